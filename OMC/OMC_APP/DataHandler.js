@@ -9,13 +9,119 @@
 
 // Expose handleDataReceived as a global function
 window.handleDataReceived = handleDataReceived;
+window.handleMetricsReceived = handleMetricsReceived;
+
+/** @global {Object} trackHistory - Logged harness fixes keyed by track log sequence number */
+var trackHistory = {};
+/** @global {number} lastReportSeq - Sequence number of the last routine report with a fix */
+var lastReportSeq = 0;
+/** @global {number} historyNext - First receiver history index the app has not synced yet */
+var historyNext = 0;
+/** @global {number} historySyncStart - performance.now() of the last history request */
+var historySyncStart = 0;
+/** @global {number} historySyncCount - Fixes received since the last history request */
+var historySyncCount = 0;
+
+/**
+ * @function decodeBinaryFrame
+ * @description Decodes a binary frame from the receiver (type, payload length, packed little endian
+ * payload; BleProtocol.h on the receiver) into an object with the same fields as the JSON frames.
+ * @param {DataView} view - The BLE characteristic value.
+ * @returns {Object|null} The decoded frame, or null if it is truncated.
+ */
+function decodeBinaryFrame(view) {
+    if (view.byteLength < 2 || view.getUint8(1) > view.byteLength - 2) {
+        return null;
+    }
+    let msgType = view.getUint8(0);
+    let len = view.getUint8(1);
+    if (msgType == pBLE_MsgProtocol) {
+        return { msgType: msgType, version: len > 0 ? view.getUint8(2) : 0 };
+    }
+    if (msgType == pBLE_MsgFoxHunt) { // MSG_FOX_HUNT: 1 while the fox hunt runs
+        return { msgType: msgType, on: len > 0 && view.getUint8(2) != 0 };
+    }
+    if (msgType == 16) { // MSG_FOX_PONG, no status block
+        if (len < 8) {
+            return null;
+        }
+        return {
+            msgType: msgType,
+            seq: view.getUint8(2),
+            rssi: view.getInt16(3, true),
+            snr: view.getInt8(5),
+            raw: view.getInt16(6, true),
+            hRssi: view.getInt8(8),
+            hSnr: view.getInt8(9)
+        };
+    }
+    if (len < 10) {
+        return null;
+    }
+    // Status block, first in every notification.
+    let flags = view.getUint8(11);
+    let dataObj = {
+        msgType: msgType,
+        rssi: view.getInt16(2, true),
+        snr: view.getInt8(4),
+        mode: view.getUint8(5),
+        rBatt: view.getUint8(6),
+        hBatt: view.getUint8(7),
+        r: view.getUint8(8),
+        g: view.getUint8(9),
+        b: view.getUint8(10),
+        rbLed: (flags & 0x01) != 0,
+        buzzer: (flags & 0x02) != 0,
+        ack: (flags & 0x04) != 0,
+        auto: (flags & 0x08) != 0,
+        loc: (flags & 0x10) != 0,
+        bcn: (flags & 0x20) != 0
+    };
+    let at = 12;
+    if (msgType == 0 && len >= 30) { // MSG_ALL_DATA
+        dataObj.lat = view.getInt32(at, true) / 1e7;
+        dataObj.lon = view.getInt32(at + 4, true) / 1e7;
+        dataObj.hour = view.getUint8(at + 8);
+        dataObj.min = view.getUint8(at + 9);
+        dataObj.sec = view.getUint8(at + 10);
+        dataObj.siv = view.getUint8(at + 11);
+        dataObj.hdop = view.getUint16(at + 12, true);
+        dataObj.alt = view.getInt16(at + 14, true);
+        dataObj.seq = view.getUint32(at + 16, true);
+    } else if (msgType == 8 && len >= 20) { // MSG_GEOFENCE_ALERT
+        dataObj.fence = view.getUint8(at);
+        dataObj.inside = view.getUint8(at + 1) != 0;
+        dataObj.lat = view.getInt32(at + 2, true) / 1e7;
+        dataObj.lon = view.getInt32(at + 6, true) / 1e7;
+    } else if (msgType == 10 && len >= 15) { // MSG_BACKFILL_DATA
+        // Same entries as the JSON frame: [lat, lon, seconds of day, siv, sequence step].
+        dataObj.seq = view.getUint32(at, true);
+        let count = view.getUint8(at + 4);
+        dataObj.fixes = [];
+        for (let i = 0, p = at + 5; i < count && p + 14 <= 2 + len; i++, p += 14) {
+            dataObj.fixes.push([view.getInt32(p, true), view.getInt32(p + 4, true),
+                view.getUint32(p + 8, true), view.getUint8(p + 12), view.getUint8(p + 13)]);
+        }
+    } else if (msgType == 11 && len >= 66) { // MSG_ENERGY
+        dataObj.boot = [];
+        dataObj.last = [];
+        for (let i = 0; i < 6; i++) {
+            dataObj.boot.push(view.getUint32(at + 4 * i, true));
+            dataObj.last.push(view.getUint32(at + 24 + 4 * i, true));
+        }
+        dataObj.avg = view.getUint32(at + 48, true);
+        dataObj.ttl = view.getUint32(at + 52, true);
+    }
+    return dataObj;
+}
 
 /**
  * @function handleDataReceived
- * @description Parses the JSON data received from the BLE device and updates UI elements.
+ * @description Parses the binary or JSON data received from the BLE device and updates UI elements.
  * 
  * The function:
- * 1. Converts the received DataView to a string.
+ * 1. Decodes binary frames with decodeBinaryFrame; JSON frames start with '{'. For JSON it
+ *    converts the received DataView to a string.
  * 2. Removes non-printable control characters.
  * 3. Trims the string.
  * 4. Attempts to parse the cleaned string as JSON.
@@ -24,35 +130,113 @@ window.handleDataReceived = handleDataReceived;
  * @param {Event} event - The BLE characteristic value changed event.
  */
 function handleDataReceived(event) {
-    // Convert BLE DataView to a UTF-8 string.
-    let decoder = new TextDecoder('utf-8');
-    let dataString = decoder.decode(event.target.value);
+    let view = event.target.value;
+    let dataObj;
+    if (view.byteLength > 0 && view.getUint8(0) != 0x7B) { // '{'
+        dataObj = decodeBinaryFrame(view);
+        if (!dataObj) {
+            console.error("Truncated binary frame from BLE");
+            return;
+        }
+        if (dataObj.msgType == pBLE_MsgProtocol) {
+            // Reply to our protocol request: commands go out binary from now on.
+            bleBinary = (dataObj.version == pBLE_ProtocolVersion);
+            console.log(`Receiver protocol version ${dataObj.version}, binary: ${bleBinary}`);
+            return;
+        }
+    } else {
+        // Convert BLE DataView to a UTF-8 string.
+        let decoder = new TextDecoder('utf-8');
+        let dataString = decoder.decode(view);
 
-    // 1) Remove null bytes or other non-printable control characters except whitespace.
-    //    This regex removes ASCII control characters (except \t, \n, \r).
-    dataString = dataString.replace(/[\x00-\x08\x0B\x0C\x0E-\x1F]+/g, "");
+        // 1) Remove null bytes or other non-printable control characters except whitespace.
+        //    This regex removes ASCII control characters (except \t, \n, \r).
+        dataString = dataString.replace(/[\x00-\x08\x0B\x0C\x0E-\x1F]+/g, "");
 
-    // 2) Trim leading and trailing whitespace.
-    dataString = dataString.trim();
-    console.log("Raw JSON from BLE:", dataString);
+        // 2) Trim leading and trailing whitespace.
+        dataString = dataString.trim();
+        console.log("Raw JSON from BLE:", dataString);
 
-    // Attempt to parse the string as JSON.
-    let dataObj;
-    try {
-        dataObj = JSON.parse(dataString);
-    } catch (error) {
-        console.error("Failed to parse JSON:", error);
-        return;
+        // Attempt to parse the string as JSON.
+        try {
+            dataObj = JSON.parse(dataString);
+        } catch (error) {
+            console.error("Failed to parse JSON:", error);
+            return;
+        }
     }
 
     // Extract the message type (msgType) from the parsed object. Default to 0.
-    let msgType = dataObj.msgType || 0; // MSG_ALL_DATA = 0, MSG_ACKNOWLEDGEMENT = 1, MSG_BUZZER = 2, MSG_LED = 3, MSG_RB_LED = 4, MSG_PWR_MODE = 5
+    let msgType = dataObj.msgType || 0; // MSG_ALL_DATA = 0, MSG_ACKNOWLEDGEMENT = 1, MSG_BUZZER = 2, MSG_LED = 3, MSG_RB_LED = 4, MSG_PWR_MODE = 5, MSG_GEOFENCE_ALERT = 8, MSG_BACKFILL_DATA = 10, MSG_ENERGY = 11
 
     // Process based on the msgType:
+    if (msgType == pBLE_MsgFoxHunt) {
+        updateFoxStatus(dataObj.on || false);
+        return;
+    }
+    if (msgType == 16) {
+        handleFoxSample(dataObj);
+        return;
+    }
+    if (msgType == 11) {
+        console.log("Received MSG_ENERGY");
+        // Charge per subsystem in uAh: LoRa TX, LoRa RX, GNSS, NeoPixel, Buzzer, MCU.
+        const names = ["LoRa TX", "LoRa RX", "GNSS", "NeoPixel", "Buzzer", "MCU"];
+        let boot = dataObj.boot || [];
+        let last = dataObj.last || [];
+        names.forEach((name, i) => {
+            console.log(`${name}: ${((boot[i] || 0) / 1000).toFixed(1)} mAh since boot, ${((last[i] || 0) / 1000).toFixed(2)} mAh since last report`);
+        });
+        let avg = dataObj.avg || 0; // Average current in uA.
+        let ttl = dataObj.ttl || 0; // Projected hours remaining.
+        updateBatteryLevel(dataObj.hBatt || 0, 1); // 1 indicates harness battery.
+        document.getElementById('hBatteryRemaining').textContent =
+            (avg > 0) ? `~${Math.floor(ttl / 24)}d ${ttl % 24}h left (${(avg / 1000).toFixed(1)} mA)` : "--";
+        return;
+    }
+    if (msgType == 10) {
+        console.log("Received MSG_BACKFILL_DATA");
+        let seq = dataObj.seq || 0;
+        let fixes = dataObj.fixes || [];
+        // The first fix is absolute (degrees * 1e7), the others are deltas from the previous fix.
+        // Entries are [lat, lon, seconds of day, siv, sequence step].
+        let latE7 = 0;
+        let lonE7 = 0;
+        fixes.forEach((fix, i) => {
+            latE7 = (i == 0) ? fix[0] : latE7 + fix[0];
+            lonE7 = (i == 0) ? fix[1] : lonE7 + fix[1];
+            seq = (i == 0) ? seq : seq + (fix[4] || 1);
+            addTrackPoint(seq, latE7 / 1e7, lonE7 / 1e7);
+        });
+        console.log(`Backfilled ${fixes.length} fixes up to sequence ${seq}`);
+        return; // The live position is not changed by old fixes.
+    }
+    if (msgType == 8) {
+        console.log("Received MSG_GEOFENCE_ALERT");
+        let fence = dataObj.fence || 0;
+        let inside = dataObj.inside || false;
+        let lat = dataObj.lat || 0.0;
+        let lon = dataObj.lon || 0.0;
+        // Show the position right away; the harness switches to live tracking on its own.
+        document.getElementById('cordValue').textContent = `Coordinates: ${lat}, ${lon}`;
+        updateTrackerLocation(lat, lon);
+        if (!inside) {
+            alert(`Your pet has left geofence ${fence}!`);
+        } else {
+            console.log(`Pet is back inside geofence ${fence}`);
+        }
+    }
     if (msgType == 5) {
         console.log("Received MSG_PWR_MODE");
-        let mode = dataObj.mode || 10; // MODE_LIVE_TRACKING = 0, MODE_POWER_SAVING = 1, MODE_EXTREME_POWER_SAVING = 2, MODE_NO_TRACKING = 10
-        return; // No UI update needed for power mode.
+        let mode = dataObj.mode || 0; // MODE_LIVE_TRACKING = 0, MODE_POWER_SAVING = 1, MODE_EXTREME_POWER_SAVING = 2, MODE_EMERGENCY_BEACON = 3
+        let automatic = dataObj.auto || false; // The harness battery policy chose the mode.
+        document.getElementById('powerModeValue').textContent = parsePowerMode(mode);
+        document.getElementById('powerModeSelect').value = mode;
+        updateBatteryLevel(dataObj.hBatt || 0, 1); // 1 indicates harness battery.
+        if (automatic) {
+            alert(`Harness battery at ${dataObj.hBatt || 0}%: switched to ${parsePowerMode(mode)}. Set "hold mode until" to override.`);
+        }
+        return;
     }
     if (msgType == 4) {
         console.log("Received MSG_RB_LED");
@@ -93,6 +277,15 @@ function handleDataReceived(event) {
         document.getElementById('cordValue').textContent = `Coordinates: ${lat}, ${lon}`;
         // Update the tracker marker on the map.
         updateTrackerLocation(lat, lon);
+        if (dataObj.seq) {
+            if (dataObj.seq < lastReportSeq) {
+                // The harness started a new track log, its numbers do not order against the old ones.
+                console.log(`Sequence went back from ${lastReportSeq} to ${dataObj.seq}, starting a new track`);
+                trackHistory = {};
+            }
+            lastReportSeq = dataObj.seq;
+            addTrackPoint(dataObj.seq, lat, lon);
+        }
         // Convert UTC time to local time and update UI.
         let localTime = convertUtcToLocalTime(hour, minute, second);
         document.getElementById('timeValue').textContent = localTime;
@@ -105,6 +298,11 @@ function handleDataReceived(event) {
         document.getElementById('hAltValue').textContent = `Harness Altitude ${alt}ft`;
     }
     
+    if (msgType == 0 || msgType == 1) {
+        // Reports and acknowledgements tell whether the harness BLE locate mode is on.
+        updateLocateStatus(dataObj.loc || false);
+    }
+
     // These values are always sent by the Receiver.
     let rbLed = dataObj.rbLed;
     let mode = dataObj.mode;
@@ -122,12 +320,61 @@ function handleDataReceived(event) {
     // Update the power mode display.
     console.log(`mode: ${mode}`);
     document.getElementById('powerModeValue').textContent = parsePowerMode(mode);
-    // Update signal bars based on the RSSI value.
-    updateSignalBars(rssi);
+    // Update signal bars based on the RSSI value. A fix from the harness BLE beacon carries the
+    // BLE RSSI, which the LoRa bars do not fit.
+    if (dataObj.bcn) {
+        document.getElementById("rssiValue").textContent = `BLE beacon ${rssi} dBm`;
+    } else {
+        updateSignalBars(rssi);
+    }
     // Log additional information (e.g., altitude, SNR, buzzer status, acknowledgement) if available.
     console.log(`Altitude: ${alt} m, SNR: ${snr}, Buzzer: ${buzzer}, ack: ${ack}`);
 }
 
+/**
+ * @function handleHarnessDataReceived
+ * @description Handles the fixes the harness notifies over its direct BLE link while locating.
+ *
+ * They are MSG_ALL_DATA binary frames with the receiver's layout, the RSSI is the one of the BLE
+ * link and there is no receiver battery in them.
+ *
+ * @param {Event} event - The BLE characteristic value changed event.
+ */
+function handleHarnessDataReceived(event) {
+    let dataObj = decodeBinaryFrame(event.target.value);
+    if (!dataObj || dataObj.msgType != 0) {
+        return;
+    }
+    let lat = dataObj.lat || 0.0;
+    let lon = dataObj.lon || 0.0;
+    document.getElementById('cordValue').textContent = `Coordinates: ${lat}, ${lon}`;
+    updateTrackerLocation(lat, lon);
+    document.getElementById('timeValue').textContent = convertUtcToLocalTime(dataObj.hour || 0, dataObj.min || 0, dataObj.sec || 0);
+    updateBatteryLevel(dataObj.hBatt || 0, 1); // 1 indicates harness battery.
+    updateSatIcon(dataObj.siv || 0);
+    document.getElementById('hdopValue').textContent = `${dataObj.hdop || 0} HDOP`;
+    updateLightIcon(dataObj.r || 0, dataObj.g || 0, dataObj.b || 0, dataObj.rbLed);
+    // Stronger is closer: the BLE RSSI is what guides the last few meters.
+    document.getElementById("rssiValue").textContent = `BLE ${dataObj.rssi} dBm`;
+}
+
+/**
+ * @function handleFoxSample
+ * @description Shows one fox hunt sample (MSG_FOX_PONG) and beeps with its signal strength.
+ *
+ * rssi and snr are smoothed by the receiver, raw is the RSSI of this answer alone, and hRssi and
+ * hSnr are how well the harness heard the ping.
+ *
+ * @param {Object} dataObj - The decoded sample.
+ */
+function handleFoxSample(dataObj) {
+    let rssi = dataObj.rssi || -999;
+    updateSignalBars(rssi);
+    document.getElementById("rssiValue").textContent = `Fox ${rssi} dBm, SNR ${dataObj.snr || 0} dB`;
+    playFoxTone(rssi);
+    console.log(`Fox ping ${dataObj.seq}: raw ${dataObj.raw} dBm, harness heard ${dataObj.hRssi} dBm / ${dataObj.hSnr} dB`);
+}
+
 /**
  * @function parsePowerMode
  * @description Parses the numeric power mode into a human-readable string.
@@ -140,11 +387,77 @@ function parsePowerMode(mode) {
         case 0: return 'Live Tracking';
         case 1: return 'Power Saving Mode';
         case 2: return 'Extreme Power Saving Mode';
+        case 3: return 'Emergency Beacon';
         case 10: return 'Error: No Tracking Mode';
         default: return 'Error: Unknown';
     }
 }
 
+/** @global {Array} metricNames - Metric names by snapshot source (0 harness, 1 receiver) and id */
+var metricNames = [
+    ["LoRa TX", "LoRa TX timeouts", "LoRa airtime (ms)", "LoRa RX", "LoRa RX errors", "Time to fix (s)",
+        "Queued events", "Max queue depth", "Wakeups", "Battery (mV)", "Free heap", "Min free heap",
+        "Power task stack", "Loop task stack", "Dropped events", "Coalesced events",
+        "Ack airtime saved (ms)", "Frame pool exhausted", "Frame arena peak (B)", "GNSS init failures",
+        "Boot to first report (ms)", "Track fixes kept (%)",
+        "Wake latency (us)", "Sleep current (uA)"],
+    ["LoRa RX", "LoRa RX errors", "LoRa TX", "RSSI (dBm)", "Backfill requests", "BLE connects",
+        "BLE writes", "BLE notifies", "Battery (mV)", "Free heap", "Min free heap", "Loop task stack",
+        "Coalesced commands", "Command airtime saved (ms)", "Frame pool exhausted",
+        "Frame arena peak (B)", "Loop wakes", "RX to BLE latency (ms)", "Dropped app commands",
+        "Command ring peak", "History chunks spilled", "History sync (fixes/s)"]
+];
+
+/** @global {Object} latestMetrics - Last decoded metrics, keyed by "harness" and "receiver" */
+var latestMetrics = {};
+
+/**
+ * @function handleMetricsReceived
+ * @description Decodes the binary metrics snapshots of the metrics characteristic.
+ *
+ * The value holds the receiver snapshot, followed by the last harness snapshot if there is one.
+ * Each snapshot is little endian: version, source, uptime in seconds (uint32), entry count, then
+ * per entry a byte type << 6 | id and a uint32 value (counter 1, gauge 2), or 5 uint16 bucket
+ * counts for a histogram (3).
+ *
+ * @param {Event} event - The BLE characteristic value changed event.
+ */
+function handleMetricsReceived(event) {
+    const view = event.target.value;
+    let offset = 0;
+    while (offset + 7 <= view.byteLength) {
+        const version = view.getUint8(offset);
+        const source = view.getUint8(offset + 1);
+        const uptime = view.getUint32(offset + 2, true);
+        const count = view.getUint8(offset + 6);
+        offset += 7;
+        if (version != 1) {
+            console.error("Unknown metrics snapshot version", version);
+            return;
+        }
+        let metrics = { uptime: uptime };
+        for (let i = 0; i < count && offset < view.byteLength; i++) {
+            const head = view.getUint8(offset++);
+            const type = head >> 6;
+            const id = head & 0x3F;
+            const name = (metricNames[source] || [])[id] || `Metric ${id}`;
+            if (type == 3) {
+                let buckets = [];
+                for (let b = 0; b < 5; b++, offset += 2) {
+                    buckets.push(view.getUint16(offset, true));
+                }
+                metrics[name] = buckets;
+            } else {
+                metrics[name] = view.getUint32(offset, true);
+                offset += 4;
+            }
+        }
+        latestMetrics[source == 0 ? "harness" : "receiver"] = metrics;
+    }
+    console.log("Received metrics");
+    console.table(latestMetrics);
+}
+
 /**
  * @function updateBatteryLevel
  * @description Updates the battery level UI element based on the battery reading.
@@ -266,6 +579,96 @@ function convertUtcToLocalTime(utcHour, utcMin, utcSec) {
     return formatter.format(utcDate);
 }
 
+/**
+ * @function addTrackPoint
+ * @description Stores a logged fix and redraws the track line in sequence order.
+ *
+ * @param {number} seq - The track log sequence number of the fix.
+ * @param {number} lat - The latitude value.
+ * @param {number} lng - The longitude value.
+ * @param {boolean} [redraw=true] - False to only store the fix (bulk sync redraws once per page).
+ */
+function addTrackPoint(seq, lat, lng, redraw = true) {
+    trackHistory[seq] = [lng, lat];
+    if (redraw) {
+        drawTrackHistory();
+    }
+}
+
+/**
+ * @function drawTrackHistory
+ * @description Redraws the track line from the stored fixes in sequence order.
+ */
+function drawTrackHistory() {
+    const coordinates = Object.keys(trackHistory)
+        .map(Number)
+        .sort((a, b) => a - b)
+        .map(key => trackHistory[key]);
+    const data = {
+        type: 'Feature',
+        geometry: { type: 'LineString', coordinates: coordinates }
+    };
+    if (map.getSource('trackHistory')) {
+        map.getSource('trackHistory').setData(data);
+    } else {
+        map.addSource('trackHistory', { type: 'geojson', data: data });
+        map.addLayer({
+            id: 'trackHistory',
+            type: 'line',
+            source: 'trackHistory',
+            paint: { 'line-color': '#FF8C00', 'line-width': 3 }
+        });
+    }
+}
+
+/**
+ * @function requestHistory
+ * @description Asks the receiver for the fixes it kept while the app was away, starting at
+ * historyNext. The receiver answers with a burst of pages on the history characteristic.
+ *
+ * @param {BluetoothRemoteGATTCharacteristic} characteristic - The history characteristic.
+ * @returns {Promise} Resolves once the request is written.
+ */
+function requestHistory(characteristic) {
+    let request = new DataView(new ArrayBuffer(4));
+    request.setUint32(0, historyNext, true);
+    historySyncStart = performance.now();
+    historySyncCount = 0;
+    return characteristic.writeValueWithoutResponse(request.buffer);
+}
+
+/**
+ * @function handleHistoryReceived
+ * @description Adds one page of the history sync to the track.
+ *
+ * A page is little endian: first history index (uint32), fix count (uint8), the next index the
+ * receiver will give out (uint32), then per fix sequence number (uint32), latitude and longitude
+ * (int32, degrees * 1e7), hour, minute, second and satellites. A page without fixes ends the sync.
+ *
+ * @param {Event} event - The BLE characteristic value changed event.
+ */
+function handleHistoryReceived(event) {
+    const view = event.target.value;
+    if (view.byteLength < 9) {
+        return;
+    }
+    let first = view.getUint32(0, true);
+    let count = view.getUint8(4);
+    if (count > 0) {
+        for (let i = 0, p = 9; i < count && p + 16 <= view.byteLength; i++, p += 16) {
+            addTrackPoint(view.getUint32(p, true), view.getInt32(p + 4, true) / 1e7, view.getInt32(p + 8, true) / 1e7, false);
+        }
+        drawTrackHistory();
+        historyNext = first + count;
+        historySyncCount += count;
+        return;
+    }
+    // Also right after a receiver restart, when its indexes started over.
+    historyNext = view.getUint32(5, true);
+    let ms = performance.now() - historySyncStart;
+    console.log(`History sync: ${historySyncCount} fixes in ${ms.toFixed(0)} ms (${(historySyncCount * 1000 / Math.max(ms, 1)).toFixed(0)} fixes/s)`);
+}
+
 /**
  * @function updateTrackerLocation
  * @description Updates the map marker for the tracker location.
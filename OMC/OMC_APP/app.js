@@ -19,6 +19,16 @@ var userLocationMarker;
 var bleDevice = null;
 /** @global {BluetoothRemoteGATTCharacteristic} commandCharacteristic - Global BLE characteristic used for sending commands */
 let commandCharacteristic;
+/** @global {boolean} bleBinary - True once the receiver confirmed the binary BLE protocol; JSON until then */
+var bleBinary = false;
+/** @global {BluetoothDevice|null} harnessDevice - The harness, connected directly over BLE while locating */
+var harnessDevice = null;
+/** @global {BluetoothRemoteGATTCharacteristic|null} harnessCharacteristic - Harness characteristic for fixes and commands */
+var harnessCharacteristic = null;
+/** @global {boolean} foxHunting - True while the receiver runs the fox hunt (its last MSG_FOX_HUNT state) */
+var foxHunting = false;
+/** @global {AudioContext} foxAudio - Audio of the fox hunt tone, created on the first start (needs a user gesture) */
+var foxAudio = null;
 /** @global {MapboxDraw} draw - Global variable to hold the Mapbox GL Draw instance */
 var draw;
 /** @global {Array} urls - Global array to hold tile URLs */
@@ -35,6 +45,24 @@ var pMapBox_URL = 'mapbox://mapbox.mapbox-terrain-dem-v1';
 var pBLE_PrimaryGUID = '4fafc201-1fb5-459e-8fcc-c5c9c331914b';
 /** @global {string} pBLE_CharacteristicGUID - BLE characteristic UUID */
 var pBLE_CharacteristicGUID = 'beb5483e-36e1-4688-b7f5-ea07361b26a8';
+/** @global {string} pBLE_MetricsGUID - BLE characteristic UUID of the binary metrics snapshot */
+var pBLE_MetricsGUID = 'beb5483f-36e1-4688-b7f5-ea07361b26a8';
+/** @global {string} pBLE_HistoryGUID - BLE characteristic UUID of the history sync */
+var pBLE_HistoryGUID = 'beb54840-36e1-4688-b7f5-ea07361b26a8';
+/** @global {number} pBLE_ProtocolVersion - Binary BLE protocol version (BleProtocol.h on the receiver) */
+var pBLE_ProtocolVersion = 1;
+/** @global {number} pBLE_MsgProtocol - Message type of the protocol request and reply (MSG_BLE_PROTOCOL) */
+var pBLE_MsgProtocol = 0x40;
+/** @global {string} pBLE_HarnessName - Name the harness advertises while locating (BLE_HARNESS_NAME) */
+var pBLE_HarnessName = 'MountainCat Harness';
+/** @global {number} pBLE_MsgLocate - Message type that starts or stops the harness locate mode (MSG_LOCATE) */
+var pBLE_MsgLocate = 13;
+/** @global {number} pLocateMinutes - Locate timeout asked for; every command to the harness restarts it */
+var pLocateMinutes = 10;
+/** @global {Array} pHarnessCommands - Message types the harness takes directly: buzzer, LED, rainbow LED, locate */
+var pHarnessCommands = [2, 3, 4, 13];
+/** @global {number} pBLE_MsgFoxHunt - Message type that starts or stops the fox hunt (MSG_FOX_HUNT) */
+var pBLE_MsgFoxHunt = 14;
 // Alternate definitions (commented out)
 // var pBLE_PrimaryGUID = '0x1234';
 // var pBLE_CharacteristicGUID = '0x4231';
@@ -171,6 +199,23 @@ document.addEventListener('DOMContentLoaded', (event) => {
                 return server.getPrimaryService(pBLE_PrimaryGUID);
             })
             .then(secondService => {
+                // The metrics characteristic is optional (older receiver firmware lacks it).
+                secondService.getCharacteristic(pBLE_MetricsGUID)
+                    .then(metrics => metrics.startNotifications())
+                    .then(metrics => {
+                        metrics.addEventListener('characteristicvaluechanged', handleMetricsReceived);
+                        return metrics.readValue();
+                    })
+                    .then(value => handleMetricsReceived({ target: { value: value } }))
+                    .catch(error => console.log('Metrics characteristic not available', error));
+                // Fixes that arrived while the app was away (optional as well).
+                secondService.getCharacteristic(pBLE_HistoryGUID)
+                    .then(history => history.startNotifications())
+                    .then(history => {
+                        history.addEventListener('characteristicvaluechanged', handleHistoryReceived);
+                        return requestHistory(history);
+                    })
+                    .catch(error => console.log('History characteristic not available', error));
                 console.log('Getting second GATT Characteristic...');
                 return secondService.getCharacteristic(pBLE_CharacteristicGUID);
             })
@@ -184,6 +229,8 @@ document.addEventListener('DOMContentLoaded', (event) => {
                 characteristic.addEventListener('characteristicvaluechanged', handleDataReceived);
                 isConnected = true;
                 updateConnectionStatus(isConnected);
+                // Ask for binary frames; older receivers ignore it and keep talking JSON.
+                return characteristic.writeValue(new Uint8Array([pBLE_MsgProtocol, 1, pBLE_ProtocolVersion]));
             })
             .catch(error => {
                 console.error('Connection failed', error);
@@ -207,6 +254,8 @@ document.addEventListener('DOMContentLoaded', (event) => {
     function onDisconnected() {
         console.log('Device disconnected');
         isConnected = false;
+        bleBinary = false; // The receiver falls back to JSON for the next connection.
+        updateFoxStatus(false); // The receiver stops the fox hunt without the phone.
         updateConnectionStatus(isConnected);
     }
 
@@ -245,20 +294,20 @@ document.addEventListener('DOMContentLoaded', (event) => {
 function rbLed() {
     var command = document.getElementById('rbLedSelect').value;
     if (command == 1) {
-        if (bleDevice && bleDevice.gatt.connected) {
+        if (bleConnected()) {
             let command = {
                 msgType: 4,
                 rbLed: true
             };
-            sendJsonCommandToBleDevice(command);
+            sendBleCommand(command);
         }
     } else {
-        if (bleDevice && bleDevice.gatt.connected) {
+        if (bleConnected()) {
             let command = {
                 msgType: 4,
                 rbLed: false
             };
-            sendJsonCommandToBleDevice(command);
+            sendBleCommand(command);
         }
     }
 }
@@ -291,7 +340,7 @@ function setLightColor() {
     };
 
     // If the BLE device is connected, send the new JSON command
-    if (bleDevice && bleDevice.gatt.connected) {
+    if (bleConnected()) {
         // Retrieve the RGB values from the mapping. If the code isn't found, default to "Off" (black).
         let color = colorMap[selectedCode] || { r: 0, g: 0, b: 0 };
 
@@ -304,7 +353,7 @@ function setLightColor() {
         };
 
         // Send the JSON command using your helper function.
-        sendJsonCommandToBleDevice(command);
+        sendBleCommand(command);
     } else {
         console.error('Bluetooth device is not connected');
     }
@@ -342,14 +391,14 @@ document.addEventListener('click', function (event) {
  * @description Sends a JSON command via BLE to turn off the light.
  */
 function turnOffLight() {
-    if (bleDevice && bleDevice.gatt.connected) {
+    if (bleConnected()) {
         let command = {
             msgType: 0,
             r: 0,
             g: 0,
             b: 0
         };
-        sendJsonCommandToBleDevice(command);
+        sendBleCommand(command);
     }
 }
 
@@ -361,20 +410,20 @@ function musicActions() {
     var selectedCode = document.getElementById('musicSelect').value;
 
     if (selectedCode == 1) {
-        if (bleDevice && bleDevice.gatt.connected) {
+        if (bleConnected()) {
             let command = {
                 msgType: 2,
                 buzzer: true,
             };
-            sendJsonCommandToBleDevice(command);
+            sendBleCommand(command);
         }
     } else {
-        if (bleDevice && bleDevice.gatt.connected) {
+        if (bleConnected()) {
             let command = {
                 msgType: 2,
                 buzzer: false,
             };
-            sendJsonCommandToBleDevice(command);
+            sendBleCommand(command);
         }
     }
 }
@@ -385,12 +434,12 @@ function musicActions() {
  * @description Sends a JSON command via BLE to deactivate the buzzer.
  */
 function turnOffBuzzer() {
-    if (bleDevice && bleDevice.gatt.connected) {
+    if (bleConnected()) {
         let command = {
             msgType: 2,
             buzzer: false,
         };
-        sendJsonCommandToBleDevice(command);
+        sendBleCommand(command);
     }
 }
 
@@ -450,9 +499,14 @@ function setPwrMode() {
         msgType: 5,
         mode: selectedMode
     };
+    // Keep this mode until the chosen time, even if the harness battery runs low.
+    let hold = holdMinutesUntil(document.getElementById('holdUntilInput').value);
+    if (hold > 0) {
+        command.hold = hold;
+    }
 
     if (bleDevice && bleDevice.gatt.connected) {
-        sendJsonCommandToBleDevice(command);
+        sendBleCommand(command);
     } else {
         console.error('Bluetooth device is not connected');
     }
@@ -460,11 +514,163 @@ function setPwrMode() {
 
 
 /**
- * @function sendJsonCommandToBleDevice
- * @description Sends a JSON command to the BLE device by encoding a command object and writing it to the BLE characteristic.
+ * @function holdMinutesUntil
+ * @description Converts a "hold mode until" time of day into minutes from now.
+ *
+ * @param {string} time - Time of day as "HH:MM", or an empty string for no hold.
+ * @returns {number} Minutes until the next occurrence of that time, 0 for no hold.
+ */
+function holdMinutesUntil(time) {
+    if (!time) {
+        return 0;
+    }
+    let [hours, minutes] = time.split(':').map(Number);
+    let now = new Date();
+    let until = new Date(now);
+    until.setHours(hours, minutes, 0, 0);
+    if (until <= now) {
+        until.setDate(until.getDate() + 1); // The time is tomorrow.
+    }
+    return Math.ceil((until - now) / 60000);
+}
+
+
+/** @global {number} pGeofenceMaxVertices - Maximum polygon vertices the harness accepts (GEOFENCE_MAX_VERTICES) */
+var pGeofenceMaxVertices = 8;
+/** @global {number} pGeofenceIdAll - Fence id that addresses every fence on the harness (GEOFENCE_ID_ALL) */
+var pGeofenceIdAll = 255;
+
+/**
+ * @function setGeofence
+ * @description Sends the first polygon drawn on the map to the harness as geofence 0.
+ *
+ * Coordinates are sent as integer degrees * 1e7. The first vertex is absolute and the others are
+ * deltas from it, which keeps a full polygon inside a single LoRa frame.
+ */
+function setGeofence() {
+    var features = draw ? draw.getAll().features : [];
+    if (features.length == 0 || features[0].geometry.type != 'Polygon') {
+        alert("Draw a polygon on the map first.");
+        return;
+    }
+
+    // Mapbox Draw closes the ring by repeating the first vertex; the harness does not need it.
+    var ring = features[0].geometry.coordinates[0].slice(0, -1);
+    if (ring.length < 3 || ring.length > pGeofenceMaxVertices) {
+        alert(`A geofence needs between 3 and ${pGeofenceMaxVertices} corners.`);
+        return;
+    }
+
+    var lat0 = Math.round(ring[0][1] * 1e7);
+    var lon0 = Math.round(ring[0][0] * 1e7);
+    let command = {
+        msgType: 7,  // MSG_GEOFENCE
+        id: 0,
+        type: 2,     // GEOFENCE_POLYGON
+        lat: lat0,
+        lon: lon0,
+        dlat: ring.slice(1).map(coord => Math.round(coord[1] * 1e7) - lat0),
+        dlon: ring.slice(1).map(coord => Math.round(coord[0] * 1e7) - lon0)
+    };
+    sendBleCommand(command);
+}
+
+/**
+ * @function clearGeofence
+ * @description Removes every geofence from the harness so it goes back to normal reporting.
+ */
+function clearGeofence() {
+    let command = {
+        msgType: 7,  // MSG_GEOFENCE
+        id: pGeofenceIdAll,
+        type: 0      // GEOFENCE_NONE
+    };
+    sendBleCommand(command);
+}
+
+/**
+ * @function encodeBinaryCommand
+ * @description Encodes a command object as a binary frame: type, payload length, then the packed
+ * little endian payload (BleProtocol.h on the receiver).
+ * @param {Object} command - The command object (e.g., {msgType: 2, buzzer: true}).
+ * @returns {Uint8Array|null} The frame, or null if the command has no binary encoding.
+ */
+function encodeBinaryCommand(command) {
+    let payload;
+    switch (command.msgType) {
+        case 2: // MSG_BUZZER
+            payload = new DataView(new ArrayBuffer(1));
+            payload.setUint8(0, command.buzzer ? 1 : 0);
+            break;
+        case 3: // MSG_LED
+            payload = new DataView(new ArrayBuffer(3));
+            payload.setUint8(0, command.r || 0);
+            payload.setUint8(1, command.g || 0);
+            payload.setUint8(2, command.b || 0);
+            break;
+        case 4: // MSG_RB_LED
+            payload = new DataView(new ArrayBuffer(1));
+            payload.setUint8(0, command.rbLed ? 1 : 0);
+            break;
+        case 5: // MSG_PWR_MODE
+            payload = new DataView(new ArrayBuffer(3));
+            payload.setUint8(0, command.mode || 0);
+            payload.setUint16(1, command.hold || 0, true);
+            break;
+        case 13: // MSG_LOCATE: on, minutes
+            payload = new DataView(new ArrayBuffer(2));
+            payload.setUint8(0, command.on ? 1 : 0);
+            payload.setUint8(1, command.min || 0);
+            break;
+        case 14: // MSG_FOX_HUNT
+            payload = new DataView(new ArrayBuffer(1));
+            payload.setUint8(0, command.on ? 1 : 0);
+            break;
+        case 7: { // MSG_GEOFENCE: id, type, count, radius, lat, lon, dlat[7], dlon[7]
+            let dlat = command.dlat || [];
+            let dlon = command.dlon || [];
+            let deltas = pGeofenceMaxVertices - 1;
+            payload = new DataView(new ArrayBuffer(15 + 8 * deltas));
+            payload.setUint8(0, command.id || 0);
+            payload.setUint8(1, command.type || 0);
+            payload.setUint8(2, 1 + Math.min(dlat.length, dlon.length, deltas));
+            payload.setUint32(3, command.rad || 0, true);
+            payload.setInt32(7, command.lat || 0, true);
+            payload.setInt32(11, command.lon || 0, true);
+            for (let i = 0; i < deltas; i++) {
+                payload.setInt32(15 + 4 * i, dlat[i] || 0, true);
+                payload.setInt32(15 + 4 * (deltas + i), dlon[i] || 0, true);
+            }
+            break;
+        }
+        default:
+            return null;
+    }
+    let frame = new Uint8Array(2 + payload.byteLength);
+    frame[0] = command.msgType;
+    frame[1] = payload.byteLength;
+    frame.set(new Uint8Array(payload.buffer), 2);
+    return frame;
+}
+
+/**
+ * @function sendBleCommand
+ * @description Sends a command object to the BLE device, as a binary frame once the receiver
+ * confirmed the binary protocol and as JSON otherwise.
  * @param {Object} command - The command object to send (e.g., {msgType: 2, buzzer: true}).
  */
-function sendJsonCommandToBleDevice(command) {
+function sendBleCommand(command) {
+    // Close to the pet, buzzer and LED go straight to the harness instead of over LoRa.
+    if (harnessConnected() && pHarnessCommands.includes(command.msgType)) {
+        harnessCharacteristic.writeValue(encodeBinaryCommand(command))
+            .then(() => {
+                console.log('Command sent to the harness:', command);
+            })
+            .catch(error => {
+                console.error('Error sending command to the harness:', error);
+            });
+        return;
+    }
     if (!bleDevice || !bleDevice.gatt.connected) {
         console.error('Bluetooth device is not connected');
         return;
@@ -474,6 +680,18 @@ function sendJsonCommandToBleDevice(command) {
         return;
     }
 
+    let frame = bleBinary ? encodeBinaryCommand(command) : null;
+    if (frame) {
+        commandCharacteristic.writeValue(frame)
+            .then(() => {
+                console.log('Binary command sent:', command);
+            })
+            .catch(error => {
+                console.error('Error sending binary command:', error);
+            });
+        return;
+    }
+
     // Convert the command object to a JSON string.
     let jsonString = JSON.stringify(command);
 
@@ -491,6 +709,139 @@ function sendJsonCommandToBleDevice(command) {
         });
 }
 
+/**
+ * @function harnessConnected
+ * @description Checks if the harness is connected directly over BLE (locate mode).
+ * @returns {boolean} True if commands can go to the harness characteristic.
+ */
+function harnessConnected() {
+    return harnessCharacteristic != null && harnessDevice != null && harnessDevice.gatt.connected;
+}
+
+/**
+ * @function bleConnected
+ * @description Checks if a command can be sent, to the receiver or straight to the harness.
+ * @returns {boolean} True if the receiver or the harness is connected.
+ */
+function bleConnected() {
+    return (bleDevice != null && bleDevice.gatt.connected) || harnessConnected();
+}
+
+/**
+ * @function startLocate
+ * @description Asks the harness over LoRa to start advertising over BLE for the close range search.
+ */
+function startLocate() {
+    sendBleCommand({ msgType: pBLE_MsgLocate, on: true, min: pLocateMinutes });
+}
+
+/**
+ * @function stopLocate
+ * @description Ends the locate mode, over the direct link if there is one and over LoRa otherwise.
+ */
+function stopLocate() {
+    sendBleCommand({ msgType: pBLE_MsgLocate, on: false });
+}
+
+/**
+ * @function connectHarness
+ * @description Connects straight to the harness once it advertises (locate mode) and the phone is
+ * close. Fixes with the BLE link RSSI arrive about every second, and buzzer and LED commands go to
+ * the harness until it disconnects. The receiver connection stays up for the long range path.
+ */
+function connectHarness() {
+    navigator.bluetooth.requestDevice({
+        filters: [{ name: pBLE_HarnessName }],
+        optionalServices: [pBLE_PrimaryGUID]
+    })
+        .then(device => {
+            harnessDevice = device;
+            device.addEventListener('gattserverdisconnected', () => {
+                console.log('Harness disconnected');
+                harnessCharacteristic = null;
+                updateLocateStatus(false);
+            });
+            return device.gatt.connect();
+        })
+        .then(server => server.getPrimaryService(pBLE_PrimaryGUID))
+        .then(service => service.getCharacteristic(pBLE_CharacteristicGUID))
+        .then(characteristic => characteristic.startNotifications())
+        .then(characteristic => {
+            characteristic.addEventListener('characteristicvaluechanged', handleHarnessDataReceived);
+            harnessCharacteristic = characteristic;
+            updateLocateStatus(true);
+            // Restarts the harness timeout from now.
+            return characteristic.writeValue(encodeBinaryCommand({ msgType: pBLE_MsgLocate, on: true, min: pLocateMinutes }));
+        })
+        .catch(error => {
+            console.error('Harness connection failed', error);
+            harnessCharacteristic = null;
+        });
+}
+
+/**
+ * @function updateLocateStatus
+ * @description Shows on the harness button whether the harness is reachable over BLE.
+ * @param {boolean} locating - True while the harness locate mode is on.
+ */
+function updateLocateStatus(locating) {
+    let button = document.getElementById('connectHarnessButton');
+    if (!button) {
+        return;
+    }
+    if (harnessConnected()) {
+        button.textContent = 'Harness Connected (BLE)';
+    } else {
+        button.textContent = locating ? 'Connect to Harness (advertising)' : 'Connect to Harness';
+    }
+}
+
+/**
+ * @function toggleFoxHunt
+ * @description Starts or stops the fox hunt: the receiver pings the harness several times a second
+ * and every answer comes back as a signal sample, for following the signal with a directional
+ * antenna when the harness has no fix.
+ */
+function toggleFoxHunt() {
+    if (!foxAudio && window.AudioContext) {
+        foxAudio = new AudioContext();
+    }
+    sendBleCommand({ msgType: pBLE_MsgFoxHunt, on: !foxHunting });
+}
+
+/**
+ * @function updateFoxStatus
+ * @description Shows the fox hunt state the receiver reported on its button.
+ * @param {boolean} on - True while the fox hunt runs.
+ */
+function updateFoxStatus(on) {
+    foxHunting = on;
+    let button = document.getElementById('foxHuntButton');
+    if (button) {
+        button.textContent = on ? 'Stop Fox Hunt' : 'Start Fox Hunt';
+    }
+}
+
+/**
+ * @function playFoxTone
+ * @description Plays a short beep per fox hunt sample, higher as the signal gets stronger.
+ * @param {number} rssi - Smoothed RSSI of the sample in dBm.
+ */
+function playFoxTone(rssi) {
+    if (!foxAudio) {
+        return;
+    }
+    // -120 dBm is the lowest pitch, -40 dBm and above the highest.
+    let level = Math.min(Math.max((rssi + 120) / 80, 0), 1);
+    let oscillator = foxAudio.createOscillator();
+    let gain = foxAudio.createGain();
+    oscillator.frequency.value = 300 + level * 1200;
+    gain.gain.value = 0.2;
+    oscillator.connect(gain).connect(foxAudio.destination);
+    oscillator.start();
+    oscillator.stop(foxAudio.currentTime + 0.08);
+}
+
 /**
  * @function sendCommandToBleDevice
  * @description Sends a simple command (as a string) to the BLE device.
@@ -1,48 +1,105 @@
 #include "batt.h"
+#include "metrics.h"
 
 /**
  * @file batt.cpp
  * @brief Implementation of battery measurement functions for the OzarkMountainCat project.
  *
- * This file implements functions for initializing the ADC for battery voltage measurement,
- * reading the battery voltage, and converting the measured voltage (in millivolts) to a percentage.
+ * This file implements the battery sampling timer, the SAADC oversampling and offset
+ * calibration, the voltage filter, and the conversion of the voltage (in millivolts) to a
+ * percentage through a LiPo discharge curve.
  */
 
+/**
+ * @brief LiPo discharge curve at light load, from 0% to 100% in steps of 10%.
+ *
+ * Kept in flash. The knee below 10% is steep, so the 0% point is the voltage at which the
+ * cell is practically empty rather than the protection cutoff.
+ */
+static const uint16_t dischargeCurveMv[] = {
+    3300, 3680, 3740, 3770, 3790, 3820, 3870, 3920, 3980, 4060, 4200
+};
+
+/**
+ * @brief Number of points in the discharge curve.
+ */
+#define BATT_CURVE_POINTS (sizeof(dischargeCurveMv) / sizeof(dischargeCurveMv[0]))
+
+/**
+ * @brief Instance used by the static timer callback.
+ */
+BattHandler *BattHandler::instance = nullptr;
+
 /**
  * @brief Initializes the battery measurement module.
  *
  * This function configures the ADC to use an internal 3.0V reference instead of the default 3.6V,
- * sets the ADC resolution to 12 bits (range 0..4095), and allows a short delay for the ADC to settle.
+ * sets the ADC resolution to 12 bits (range 0..4095) with oversampling, calibrates the offset,
+ * seeds the filter with a first sample, and starts the sample timer.
  */
 void BattHandler::begin() {
+  instance = this;
+
   // Set the analog reference voltage to 3.0V (default is 3.6V)
   analogReference(AR_INTERNAL_3_0);
 
   // Set the analog read resolution to 12 bits (can be 8, 10, 12, or 14 bits)
   analogReadResolution(12);
 
+  // Average BATT_OVERSAMPLE conversions in hardware for every analogRead()
+  analogOversampling(BATT_OVERSAMPLE);
+
   // Short delay to allow the ADC to stabilize after configuration
   delay(1);
+  analogCalibrateOffset();
+
+  // The first sample seeds the filter
+  filteredMv = readVBatt();
+  percent = mvToPercent(filteredMv);
+
+  Metrics.registerGauge(METRIC_BATT_MV);
+  Metrics.set(METRIC_BATT_MV, filteredMv);
+  sampleTimer.begin(BATT_SAMPLE_MS, onSample);
+  sampleTimer.start();
 
   Serial.println("Battery measurement initialized.");
 }
 
+/**
+ * @brief Software timer callback, takes a sample.
+ */
+void BattHandler::onSample(TimerHandle_t unused) {
+  if (instance) {
+    instance->sample();
+  }
+}
+
+/**
+ * @brief Takes a sample and updates the filtered voltage and percentage.
+ *
+ * The SAADC offset drifts with temperature, so it is calibrated again every
+ * BATT_CALIBRATE_SAMPLES samples.
+ */
+void BattHandler::sample() {
+  if (++samplesSinceCalibration >= BATT_CALIBRATE_SAMPLES) {
+    samplesSinceCalibration = 0;
+    analogCalibrateOffset();
+  }
+  float mv = readVBatt();
+  filteredMv = filteredMv + (mv - filteredMv) / BATT_FILTER_WEIGHT;
+  percent = mvToPercent(filteredMv);
+  Metrics.set(METRIC_BATT_MV, filteredMv);
+}
+
 /**
  * @brief Reads the battery voltage in millivolts.
  *
- * This function reads the raw ADC value from the battery voltage pin (PIN_VBAT)
+ * This function reads the oversampled ADC value from the battery voltage pin (PIN_VBAT)
  * and multiplies it by REAL_VBAT_MV_PER_LSB to convert it to millivolts.
  *
  * @return float The measured battery voltage in millivolts.
  */
 float BattHandler::readVBatt() {
-    // Uncomment the following debug prints to see ADC conversion details.
-    // Serial.print("MVOLTS_PER_LSB: ");
-    // Serial.println(REAL_VBAT_MV_PER_LSB);
-    // Serial.println(float(0.73242188F * 1.73));
-    // Serial.print("VBAT_Analog_Read: ");
-    // Serial.println(analogRead(PIN_VBAT));
-
     float vbat = analogRead(PIN_VBAT) * REAL_VBAT_MV_PER_LSB;
     return vbat;
 }
@@ -50,16 +107,38 @@ float BattHandler::readVBatt() {
 /**
  * @brief Converts battery voltage in millivolts to a percentage.
  *
- * This function maps the battery voltage to a percentage value.
- * - Voltages >= 4200 mV correspond to 100%.
- * - Voltages <= 3050 mV correspond to 0%.
- * - Otherwise, a linear conversion is applied.
+ * This function looks up the two discharge curve points around the voltage
+ * and interpolates linearly between them.
  *
  * @param mvolts The battery voltage in millivolts.
  * @return uint8_t The battery level as a percentage (0 to 100).
  */
 uint8_t BattHandler::mvToPercent(float mvolts) {
-    if (mvolts >= 4200) return 100;
-    else if (mvolts <= 3050) return 0;
-    else return (mvolts - 3000) / 12.0;
+    if (mvolts <= dischargeCurveMv[0]) return 0;
+    if (mvolts >= dischargeCurveMv[BATT_CURVE_POINTS - 1]) return 100;
+    uint8_t i = 1;
+    while (mvolts > dischargeCurveMv[i]) {
+        i++;
+    }
+    float low = dischargeCurveMv[i - 1];
+    float high = dischargeCurveMv[i];
+    return (i - 1) * 10 + (uint8_t)((mvolts - low) * 10 / (high - low));
+}
+
+/**
+ * @brief Gets the filtered battery voltage.
+ *
+ * @return float The battery voltage in millivolts.
+ */
+float BattHandler::getMv() {
+    return filteredMv;
+}
+
+/**
+ * @brief Gets the battery level of the filtered voltage.
+ *
+ * @return uint8_t The battery level as a percentage (0 to 100).
+ */
+uint8_t BattHandler::getPercent() {
+    return percent;
 }
@@ -3,19 +3,28 @@
  * @file batt.h
  * @brief Header file for the BattHandler class.
  *
- * This file declares the BattHandler class, which provides functions to
- * initialize battery measurement, read battery voltage, and convert the measured
- * voltage (in millivolts) to a percentage.
+ * This file declares the BattHandler class, which samples the battery voltage on its own
+ * low-rate timer and keeps a filtered voltage and the matching percentage, so readers get
+ * the cached value without touching the ADC.
  */
 
 #include "main.h"
 
+/**
+ * @brief Battery sampling configuration.
+ */
+#define BATT_SAMPLE_MS              60000   /**< Time between battery samples in milliseconds. */
+#define BATT_OVERSAMPLE             64      /**< SAADC oversampling (power of two, up to 256). */
+#define BATT_CALIBRATE_SAMPLES      60      /**< Samples between SAADC offset calibrations. */
+#define BATT_FILTER_WEIGHT          4       /**< A new sample moves the filter by 1/BATT_FILTER_WEIGHT. */
+
 /**
  * @class BattHandler
  * @brief Handles battery voltage measurement and conversion.
  *
- * The BattHandler class provides methods to initialize the ADC for battery measurement,
- * read the battery voltage in millivolts, and convert that value to a percentage.
+ * The BattHandler class samples the battery with SAADC oversampling once every BATT_SAMPLE_MS,
+ * recalibrates the SAADC offset now and then, and smooths the samples with an exponential
+ * filter. The voltage is converted to a percentage through a LiPo discharge curve.
  */
 class BattHandler {
     public:
@@ -27,15 +36,17 @@ class BattHandler {
         /**
          * @brief Initializes the battery measurement module.
          *
-         * This function sets the analog reference to 3.0V, configures the ADC resolution to 12 bits,
-         * and allows a short delay for the ADC to settle.
+         * This function sets the analog reference to 3.0V, the ADC resolution to 12 bits and the
+         * oversampling, calibrates the SAADC offset, takes the first sample and starts the
+         * sample timer.
          */
         void begin();
 
         /**
          * @brief Reads the battery voltage.
          *
-         * This function reads the raw ADC value from the battery voltage pin and converts it to millivolts.
+         * This function takes one oversampled reading from the battery voltage pin and converts
+         * it to millivolts. It bypasses the filter; use getMv() for the cached value.
          *
          * @return float The measured battery voltage in millivolts.
          */
@@ -44,15 +55,50 @@ class BattHandler {
         /**
          * @brief Converts battery voltage in millivolts to a percentage.
          *
-         * If the battery voltage is greater than or equal to 4200 mV, returns 100%.
-         * If the voltage is less than or equal to 3050 mV, returns 0%.
-         * Otherwise, returns a linear mapping from millivolts to percentage.
+         * Interpolates linearly between the points of the LiPo discharge curve table.
          *
          * @param mvolts The battery voltage in millivolts.
          * @return uint8_t The battery level as a percentage (0 to 100).
          */
         uint8_t mvToPercent(float mvolts);
 
+        /**
+         * @brief Gets the filtered battery voltage.
+         *
+         * @return float The battery voltage in millivolts.
+         */
+        float getMv();
+
+        /**
+         * @brief Gets the battery level of the filtered voltage.
+         *
+         * @return uint8_t The battery level as a percentage (0 to 100).
+         */
+        uint8_t getPercent();
+
     private:
-        // No private members declared.
+        /**
+         * @brief Takes a sample and updates the filtered voltage and percentage.
+         */
+        void sample();
+
+        /**
+         * @brief Software timer callback, takes a sample.
+         */
+        static void onSample(TimerHandle_t unused);
+
+        /** @brief Timer that triggers the samples. */
+        SoftwareTimer sampleTimer;
+
+        /** @brief Filtered battery voltage in millivolts. */
+        volatile float filteredMv = 0;
+
+        /** @brief Battery level of filteredMv in percent. */
+        volatile uint8_t percent = 0;
+
+        /** @brief Samples taken since the last offset calibration. */
+        uint8_t samplesSinceCalibration = 0;
+
+        /** @brief Instance used by the static timer callback. */
+        static BattHandler *instance;
 };
@@ -0,0 +1,154 @@
+/**
+ * @file beacon.cpp
+ * @brief Implementation of the BLE long range beacon for the OzarkMountainCat project.
+ *
+ * This file implements the payload double buffering, starting and stopping the extended
+ * advertising on the LE Coded PHY, and finding the advertising set shared with Bluefruit.
+ */
+#include "beacon.h"
+#include "bleHandler.h"
+#include "gps.h"
+#include "modepolicy.h"
+#include "logger.h"
+
+/**
+ * @brief Refreshes the payload and starts or stops the beacon as the state requires.
+ *
+ * The beacon is wanted unless the locate mode has the advertising set or the power mode saves
+ * the battery for LoRa. While it is on, only the payload buffer is swapped; the first start
+ * configures the set for the Coded PHY. A SoftDevice error is logged and the next wakeup tries
+ * again.
+ */
+void BeaconHandler::update()
+{
+#if BEACON_ENABLED
+  bool wanted = !BLE.isLocating() && receivedPacket.mode != MODE_EXTREME_POWER_SAVING &&
+                receivedPacket.mode != MODE_EMERGENCY_BEACON;
+  if (!wanted)
+  {
+    stop();
+    return;
+  }
+  BLE.begin();
+  if (!claimSet())
+  {
+    return;
+  }
+
+  uint8_t next = fill();
+  ble_gap_adv_data_t adv = {};
+  adv.adv_data.p_data = data[next];
+  adv.adv_data.len = BEACON_DATA_SIZE;
+  if (advertising)
+  {
+    // New data only, the SoftDevice keeps sending the old buffer until the next event.
+    if (sd_ble_gap_adv_set_configure(&handle, &adv, NULL) == NRF_SUCCESS)
+    {
+      active = next;
+    }
+    return;
+  }
+
+  ble_gap_adv_params_t params = {};
+  params.properties.type = BLE_GAP_ADV_TYPE_EXTENDED_NONCONNECTABLE_NONSCANNABLE_UNDIRECTED;
+  params.interval = BEACON_INTERVAL;
+  params.duration = BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED;
+  params.filter_policy = BLE_GAP_ADV_FP_ANY;
+  params.primary_phy = BLE_GAP_PHY_CODED;
+  params.secondary_phy = BLE_GAP_PHY_CODED;
+  uint32_t err = sd_ble_gap_adv_set_configure(&handle, &adv, &params);
+  if (err == NRF_SUCCESS)
+  {
+    sd_ble_gap_tx_power_set(BLE_GAP_TX_POWER_ROLE_ADV, handle, BEACON_TX_POWER);
+    err = sd_ble_gap_adv_start(handle, BLE_CONN_CFG_TAG_DEFAULT);
+  }
+  if (err != NRF_SUCCESS)
+  {
+    LOG_WARN(LOG_BEACON_FAILED, err);
+    return;
+  }
+  active = next;
+  advertising = true;
+  LOG_INFO(LOG_BEACON_ON, BEACON_INTERVAL * 5 / 8);
+#endif
+}
+
+/**
+ * @brief Stops the beacon, so the advertising set can be used for the locate mode.
+ */
+void BeaconHandler::stop()
+{
+  if (!advertising)
+  {
+    return;
+  }
+  sd_ble_gap_adv_stop(handle);
+  advertising = false;
+  LOG_INFO(LOG_BEACON_OFF);
+}
+
+/**
+ * @brief Writes the current state into the idle payload buffer.
+ *
+ * The SoftDevice keeps reading the active buffer until the next advertising event, so the
+ * new payload goes into the other one.
+ *
+ * @return Index of the buffer that was written.
+ */
+uint8_t BeaconHandler::fill()
+{
+  BeaconPayload payload = {};
+  payload.company = BEACON_COMPANY_ID;
+  payload.marker = BEACON_MARKER;
+  payload.version = BEACON_VERSION;
+  payload.lat = GPS.getLatitudeE7();
+  payload.lon = GPS.getLongitudeE7();
+  payload.seq = receivedPacket.seq;
+  payload.hour = GPS.getHour();
+  payload.min = GPS.getMinute();
+  payload.sec = GPS.getSecond();
+  payload.siv = GPS.getSIV();
+  payload.hBatt = receivedPacket.hBatt;
+  payload.mode = receivedPacket.mode;
+  payload.flags = (GPS.hasFix() ? BEACON_FLAG_FIX : 0) | (ModePolicy.isAutomatic() ? BEACON_FLAG_AUTO_MODE : 0);
+
+  // The buffer the SoftDevice is not sending from.
+  uint8_t next = active ^ 1;
+  data[next][0] = 1 + sizeof(BeaconPayload); // The AD length counts the type byte.
+  data[next][1] = BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA;
+  memcpy(&data[next][2], &payload, sizeof(BeaconPayload));
+  return next;
+}
+
+/**
+ * @brief Finds the handle of the advertising set, letting Bluefruit allocate it first.
+ *
+ * Bluefruit allocates the SoftDevice's only advertising set on its first start and keeps the
+ * handle to itself, so it has to be the one that allocates it: its advertising is started and
+ * stopped once. The handle is then read back from the SoftDevice. Stopping a set that is not
+ * advertising fails with NRF_ERROR_INVALID_STATE, while a handle that was never allocated fails
+ * with BLE_ERROR_INVALID_ADV_HANDLE.
+ *
+ * @return true once the handle is known, false (logged) if no set could be found.
+ */
+bool BeaconHandler::claimSet()
+{
+  if (handle != BLE_GAP_ADV_SET_HANDLE_NOT_SET)
+  {
+    return true;
+  }
+  Bluefruit.Advertising.start(0);
+  Bluefruit.Advertising.stop();
+  uint32_t err = BLE_ERROR_INVALID_ADV_HANDLE;
+  for (uint8_t candidate = 0; candidate < BLE_GAP_ADV_SET_COUNT_MAX; candidate++)
+  {
+    err = sd_ble_gap_adv_stop(candidate);
+    if (err == NRF_ERROR_INVALID_STATE)
+    {
+      handle = candidate;
+      return true;
+    }
+  }
+  LOG_ERROR(LOG_BEACON_FAILED, err);
+  return false;
+}
@@ -0,0 +1,109 @@
+#pragma once
+/**
+ * @file beacon.h
+ * @brief Header file for the BeaconHandler class.
+ *
+ * This file declares the BLE long range beacon: a non-connectable extended advertisement on the
+ * LE Coded PHY that carries a compact position and status payload. The receiver scans for it as
+ * a secondary link next to LoRa, without a connection and at a fraction of the LoRa TX energy.
+ */
+
+#include "main.h"
+#include <bluefruit.h>
+
+/**
+ * @brief Beacon configuration.
+ */
+#ifndef BEACON_ENABLED
+#define BEACON_ENABLED              1       /**< 0 to build without the beacon. */
+#endif
+#define BEACON_INTERVAL             3200    /**< Advertising interval in 0.625 ms units: 2 seconds. */
+#define BEACON_TX_POWER             8       /**< TX power in dBm. */
+#define BEACON_COMPANY_ID           0xFFFF  /**< Bluetooth SIG company id reserved for tests. */
+#define BEACON_MARKER               0x4D    /**< 'M', tells a MountainCat beacon from other test ids. */
+#define BEACON_VERSION              1       /**< Payload format version. */
+
+/**
+ * @brief Beacon flags.
+ */
+#define BEACON_FLAG_FIX             (1 << 0)    /**< The GNSS has a fix, lat and lon are current. */
+#define BEACON_FLAG_AUTO_MODE       (1 << 1)    /**< The battery policy chose the power mode. */
+
+/**
+ * @brief Manufacturer specific data of the beacon (23 bytes, little endian).
+ *
+ * It is sent as one AD structure (length, type 0xFF, then this) and the receiver keeps the same
+ * layout. The fix is the newest one of the GNSS, seq is the track log sequence number of the
+ * last reported fix.
+ */
+struct __attribute__((packed)) BeaconPayload {
+    uint16_t company;       /**< BEACON_COMPANY_ID. */
+    uint8_t marker;         /**< BEACON_MARKER. */
+    uint8_t version;        /**< BEACON_VERSION. */
+    int32_t lat;            /**< Latitude (degrees * 1e7). */
+    int32_t lon;            /**< Longitude (degrees * 1e7). */
+    uint32_t seq;           /**< Track log sequence number of the last reported fix. */
+    uint8_t hour;           /**< Hour (UTC) of the fix. */
+    uint8_t min;            /**< Minute. */
+    uint8_t sec;            /**< Second. */
+    uint8_t siv;            /**< Satellites in view. */
+    uint8_t hBatt;          /**< Harness battery in percent. */
+    uint8_t mode;           /**< Effective power mode. */
+    uint8_t flags;          /**< BEACON_FLAG_* bits. */
+};
+
+#define BEACON_DATA_SIZE            (2 + sizeof(BeaconPayload)) /**< AD length and type, then the payload. */
+
+/**
+ * @class BeaconHandler
+ * @brief Broadcasts the harness position on the LE Coded PHY.
+ *
+ * The Bluefruit advertising API only does legacy advertising on the 1M PHY, so the beacon uses
+ * the SoftDevice extended advertising calls directly. The SoftDevice has a single advertising
+ * set, which the beacon shares with the connectable advertising of the locate mode: the beacon
+ * is off while locating and reconfigures the set when it starts again.
+ *
+ * The power management task calls update() on every wakeup. It refreshes the payload with the
+ * new fix (the SoftDevice switches to the new buffer at the next advertising event) and starts
+ * or stops the beacon for the power mode: it is off in Extreme Power Saving and Emergency Beacon
+ * Mode to save the battery for LoRa.
+ */
+class BeaconHandler {
+public:
+    /**
+     * @brief Refreshes the payload and starts or stops the beacon as the state requires.
+     */
+    void update();
+
+    /**
+     * @brief Stops the beacon, so the advertising set can be used for the locate mode.
+     */
+    void stop();
+
+    /**
+     * @brief Checks if the beacon is on the air.
+     *
+     * @return true while advertising.
+     */
+    bool isOn() { return advertising; }
+
+private:
+    /**
+     * @brief Writes the current state into the idle payload buffer.
+     *
+     * @return Index of the buffer that was written.
+     */
+    uint8_t fill();
+
+    /**
+     * @brief Finds the handle of the advertising set, letting Bluefruit allocate it first.
+     *
+     * @return true once the handle is known.
+     */
+    bool claimSet();
+
+    uint8_t data[2][BEACON_DATA_SIZE];                  /**< Payload buffers, the SoftDevice owns the active one. */
+    uint8_t active = 0;                                 /**< Buffer given to the SoftDevice last. */
+    uint8_t handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;    /**< Advertising set handle. */
+    bool advertising = false;                           /**< Beacon on the air. */
+};
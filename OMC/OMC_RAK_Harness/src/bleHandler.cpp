@@ -1,4 +1,9 @@
 #include "bleHandler.h"
+#include "beacon.h"
+#include "gps.h"
+#include "queHandler.h"
+#include "modepolicy.h"
+#include "logger.h"
 
 /**
  * @brief Constructor for the BleHandler class.
@@ -10,18 +15,25 @@ BleHandler::BleHandler() {}
 /**
  * @brief Callback function called when a BLE connection is established.
  *
- * This function is invoked when a device connects over BLE.
+ * This function is invoked when a device connects over BLE. The link RSSI is monitored from
+ * now on, it goes out with every fix.
  *
  * @param conn_handle The connection handle of the established connection.
  */
 void connect_callback(uint16_t conn_handle) {
     Serial.println("BLE connected!");
+    BLEConnection* connection = Bluefruit.Connection(conn_handle);
+    if (connection != NULL) {
+        connection->monitorRssi();
+    }
+    LOG_INFO(LOG_BLE_CONNECTED, conn_handle);
 }
 
 /**
  * @brief Callback function called when a BLE connection is disconnected.
  *
- * This function is invoked when a BLE connection is terminated.
+ * This function is invoked when a BLE connection is terminated. The phone may only have lost
+ * the link, so advertising goes on as long as the locate mode does.
  *
  * @param conn_handle The connection handle of the disconnected connection.
  * @param reason The reason code for the disconnection.
@@ -29,6 +41,10 @@ void connect_callback(uint16_t conn_handle) {
 void disconnect_callback(uint16_t conn_handle, uint8_t reason) {
     Serial.println("BLE disconnected!");
     Serial.println(reason);
+    LOG_INFO(LOG_BLE_DISCONNECTED, reason);
+    if (BLE.isLocating()) {
+        Bluefruit.Advertising.start(0);
+    }
 }
 
 /**
@@ -36,10 +52,14 @@ void disconnect_callback(uint16_t conn_handle, uint8_t reason) {
  *
  * This function initializes the Bluefruit stack and configures the device as a BLE Peripheral.
  * It sets connection parameters, device name, TX power, and creates a BLE service with a characteristic.
- * It also configures advertising parameters so that the device advertises as "MountainCat".
+ * It also configures advertising parameters so that the device advertises as "MountainCat Harness"
+ * once startLocate() starts it.
  */
 void BleHandler::begin()
 {
+    if (started) {
+        return;
+    }
     // Initialize the Bluefruit BLE stack.
     Bluefruit.begin();
     Bluefruit.Periph.begin();
@@ -48,16 +68,16 @@ void BleHandler::begin()
     Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);
     Bluefruit.Periph.setConnectCallback(connect_callback);
     Bluefruit.Periph.setDisconnectCallback(disconnect_callback);
-    
-    // Set the device name so that the web app can filter by "MountainCat".
-    Bluefruit.setName("MountainCat");
-    
+
+    // Set the device name so that the web app can tell the harness from the receiver.
+    Bluefruit.setName(BLE_HARNESS_NAME);
+
     // Disable automatic connection LED.
     Bluefruit.autoConnLed(false);
-    
+
     // Set TX power (adjust based on your signal strength needs).
-    Bluefruit.setTxPower(8); // Options: -40, -20, -16, -12, -8, -4, 0, 2, 3, 4, 5, 6, 7, 8 
-    
+    Bluefruit.setTxPower(8); // Options: -40, -20, -16, -12, -8, -4, 0, 2, 3, 4, 5, 6, 7, 8
+
     // Configure Device Information Service.
     bledis.setModel("RAK4630");
     bledis.setManufacturer("RAKwireless");
@@ -65,46 +85,129 @@ void BleHandler::begin()
 
     // Begin the custom service for the MountainCat application.
     mountainCatService.begin();
-    
+
     // 2) Configure the characteristic:
     //    Set properties: READ (phone can read current value), WRITE (phone can send commands),
     //    NOTIFY (device can push updates to the phone).
     mountainCatChar.setProperties(CHR_PROPS_READ | CHR_PROPS_WRITE | CHR_PROPS_NOTIFY);
     // Set maximum data length for the characteristic (e.g., 247 bytes).
     mountainCatChar.setMaxLen(247); // Often 247 is safe if MTU extended.
-    
+
     // If the phone writes data, it calls onWriteCallback.
     mountainCatChar.setPermission(SECMODE_OPEN, SECMODE_OPEN);
     mountainCatChar.setWriteCallback(BleHandler::onWriteCallback);
     mountainCatChar.setUuid(MOUNTAINCAT_CHARACTERISTIC_UUID);
     mountainCatChar.begin();
-    
+
     // 3) Set up advertising:
     //    Add flags for general discoverability, include TX power, service UUID, and device name.
     Bluefruit.Advertising.addFlags(BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE);
     Bluefruit.Advertising.addTxPower();
     Bluefruit.Advertising.addService(mountainCatService);
     Bluefruit.Advertising.addName();
-    
-    // Configure advertising to restart on disconnect and set intervals.
-    Bluefruit.Advertising.restartOnDisconnect(true);
+
+    // The disconnect callback restarts advertising, and only while locating.
+    Bluefruit.Advertising.restartOnDisconnect(false);
     Bluefruit.Advertising.setInterval(160, 244); // Intervals in units of 0.625 ms.
     Bluefruit.Advertising.setFastTimeout(30);     // Fast advertising mode duration (seconds).
-    Bluefruit.Advertising.start(0);               // 0 = Do not stop advertising after n seconds.
-        
-    Serial.println("BLE initialized. Advertising as 'MountainCat'...");
+
+    started = true;
+    Serial.println("BLE initialized.");
 }
 
 /**
- * @brief Updates BLE-related tasks.
+ * @brief Ends the locate mode once its timeout ran out.
  *
- * This function is intended for periodic BLE housekeeping. For the Adafruit/Bluefruit BLE stack,
- * background processing occurs automatically, so no additional code is required here.
+ * The timeout counts from the start or from the last command of the phone, a phone that is
+ * only connected does not keep the harness awake.
  */
 void BleHandler::update()
 {
-    // Typically, Bluefruit BLE processes in the background.
-    // If additional BLE housekeeping is needed, implement it here.
+    if (locating && (millis() - activeMs) >= timeoutMs) {
+        stopLocate(LOCATE_REASON_TIMEOUT);
+    }
+}
+
+/**
+ * @brief Starts the locate mode, or extends the running one.
+ *
+ * @param reason What started it (LocateReason).
+ * @param minutes Timeout in minutes, 0 for LOCATE_DEFAULT_MINUTES.
+ */
+void BleHandler::startLocate(LocateReason reason, uint8_t minutes)
+{
+    if (minutes == 0) {
+        minutes = LOCATE_DEFAULT_MINUTES;
+    }
+    timeoutMs = (uint32_t)min(minutes, (uint8_t)LOCATE_MAX_MINUTES) * 60000;
+    activeMs = millis();
+    if (locating) {
+        return;
+    }
+    begin();
+    locating = true;
+    Beacon.stop(); // the advertising set is needed for the connectable advertising
+    Bluefruit.Advertising.start(0); // 0 = Do not stop advertising after n seconds.
+    LOG_INFO(LOG_BLE_LOCATE_START, reason, minutes);
+    Serial.println("BLE locate on, advertising as '" BLE_HARNESS_NAME "'...");
+}
+
+/**
+ * @brief Stops the locate mode, disconnects the phone and stops advertising.
+ *
+ * @param reason What stopped it (LocateReason).
+ */
+void BleHandler::stopLocate(LocateReason reason)
+{
+    if (!locating) {
+        return;
+    }
+    locating = false;
+    Bluefruit.Advertising.stop();
+    if (isConnected()) {
+        BLEConnection* connection = Bluefruit.Connection(Bluefruit.connHandle());
+        if (connection != NULL) {
+            connection->disconnect();
+        }
+    }
+    LOG_INFO(LOG_BLE_LOCATE_STOP, reason);
+    Serial.println("BLE locate off.");
+}
+
+/**
+ * @brief Notifies the current fix and the link RSSI to the connected phone.
+ *
+ * The frame is MSG_ALL_DATA in the receiver's binary BLE framing (see BleFix).
+ */
+void BleHandler::sendFix()
+{
+    if (!locating || !isConnected()) {
+        return;
+    }
+    uint8_t frame[BLE_FRAME_HEADER + sizeof(BleFix)];
+    BleFix fix = {};
+    BLEConnection* connection = Bluefruit.Connection(Bluefruit.connHandle());
+    fix.rssi = connection != NULL ? connection->getRssi() : 0;
+    fix.mode = receivedPacket.mode;
+    fix.hBatt = receivedPacket.hBatt;
+    fix.r = receivedPacket.r;
+    fix.g = receivedPacket.g;
+    fix.b = receivedPacket.b;
+    fix.flags = (receivedPacket.rbLed ? BLE_FLAG_RB_LED : 0) | (receivedPacket.buzzer ? BLE_FLAG_BUZZER : 0) |
+                (ModePolicy.isAutomatic() ? BLE_FLAG_AUTO_MODE : 0) | BLE_FLAG_LOCATE;
+    fix.lat = GPS.getLatitudeE7();
+    fix.lon = GPS.getLongitudeE7();
+    fix.hour = GPS.getHour();
+    fix.min = GPS.getMinute();
+    fix.sec = GPS.getSecond();
+    fix.siv = GPS.getSIV();
+    fix.hdop = GPS.getHDOP();
+    fix.alt = GPS.getAltitude();
+    fix.seq = receivedPacket.seq;
+    frame[0] = MSG_ALL_DATA;
+    frame[1] = sizeof(BleFix);
+    memcpy(&frame[BLE_FRAME_HEADER], &fix, sizeof(BleFix));
+    sendData(frame, sizeof(frame));
 }
 
 /**
@@ -136,8 +239,6 @@ void BleHandler::sendData(const uint8_t* data, uint16_t length)
 
     // Notify the phone with the data so that it receives a 'characteristicvaluechanged' event.
     mountainCatChar.notify(data, length);
-    Serial.print("Sent BLE data: ");
-    Serial.println();
 }
 
 /**
@@ -150,14 +251,15 @@ void BleHandler::sendData(const uint8_t* data, uint16_t length)
 bool BleHandler::isConnected()
 {
     // With the Adafruit nRF52 stack, use Bluefruit.connected() to get connection count.
-    return (Bluefruit.connected() > 0);
+    return started && (Bluefruit.connected() > 0);
 }
 
 /**
  * @brief Static callback function invoked when the BLE characteristic is written to.
  *
- * This function is called when the phone writes to the characteristic. It prints connection
- * and data information for debugging purposes.
+ * The command is published on the event bus like one that came over LoRa, without the LoRa
+ * acknowledgement (the next fix shows the new state), and the power management task is woken
+ * up to handle it. Every command restarts the locate timeout.
  *
  * @param conn_handle The connection handle of the writing device.
  * @param chr Pointer to the BLECharacteristic that was written to.
@@ -166,18 +268,53 @@ bool BleHandler::isConnected()
  */
 void BleHandler::onWriteCallback(uint16_t conn_handle, BLECharacteristic* chr, uint8_t* data, uint16_t len)
 {
-    Serial.print("BLE Write from conn_handle ");
-    Serial.println(conn_handle);
-
-    Serial.print("Data length: ");
-    Serial.println(len);
-
-    Serial.print("Data: ");
-    for (int i = 0; i < len; i++) {
-        Serial.write(data[i]);
+    if (len < BLE_FRAME_HEADER || data[1] > len - BLE_FRAME_HEADER) {
+        LOG_WARN(LOG_BLE_COMMAND_INVALID, len);
+        return;
     }
-    Serial.println();
-
-    // Here you can add code to interpret the incoming data as ASCII commands,
-    // e.g., "RED", "LIVE", "POWER_SAVE", etc.
+    const uint8_t* payload = &data[BLE_FRAME_HEADER];
+    uint8_t size = data[1];
+    Event event = {};
+    bool parsed = false;
+    switch (data[0]) {
+    case MSG_BUZZER:
+    case MSG_RB_LED:
+        if (size < 1) {
+            break;
+        }
+        event.type = data[0] == MSG_BUZZER ? EVENT_BUZZER : EVENT_RB_LED;
+        event.on = payload[0] != 0;
+        parsed = true;
+        break;
+    case MSG_LED:
+        if (size < 3) {
+            break;
+        }
+        event.type = EVENT_LED;
+        event.color.r = payload[0];
+        event.color.g = payload[1];
+        event.color.b = payload[2];
+        parsed = true;
+        break;
+    case MSG_LOCATE:
+        if (size < 2) {
+            break;
+        }
+        event.type = EVENT_LOCATE;
+        event.locate.on = payload[0] != 0;
+        event.locate.minutes = payload[1];
+        event.locate.reason = LOCATE_REASON_BLE;
+        parsed = true;
+        break;
+    default:
+        break;
+    }
+    if (!parsed) {
+        LOG_WARN(LOG_BLE_COMMAND_INVALID, len);
+        return;
+    }
+    LOG_INFO(LOG_BLE_COMMAND, data[0]);
+    BLE.activeMs = millis();
+    queHandler.publish(event);
+    xSemaphoreGive(wakeSemaphore);
 }
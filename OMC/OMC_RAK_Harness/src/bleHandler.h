@@ -0,0 +1,217 @@
+#pragma once
+/**
+ * @file bleHandler.h
+ * @brief Header file for the BleHandler class.
+ *
+ * This file declares the BleHandler class which handles the BLE close range locate mode.
+ * It sets up a BLE service with the "MountainCat Harness" name and a single characteristic,
+ * supporting read, write, and notify operations so that the phone can both send commands
+ * and receive fixes directly from the harness once it is within BLE range.
+ */
+
+#include "main.h"
+#include <bluefruit.h>
+// #include <wire.h>
+
+/**
+ * @name UUID Definitions
+ *
+ * The following macros define the 128-bit UUIDs for the BLE service and characteristic.
+ * You can define these as strings. They are the ones of the receiver, the app tells the two
+ * apart by the advertised name.
+ * @{
+ */
+#define MOUNTAINCAT_SERVICE_UUID       "4fafc201-1fb5-459e-8fcc-c5c9c331914b"    /**< UUID for the MountainCat BLE service. */
+#define MOUNTAINCAT_CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"    /**< UUID for the MountainCat BLE characteristic. */
+//#define MOUNTAINCAT_SERVICE_UUID       "0x1234"  // Alternate 16-bit UUID example.
+//#define MOUNTAINCAT_CHARACTERISTIC_UUID "0x4231" // Alternate 16-bit UUID example.
+/** @} */
+
+#define BLE_HARNESS_NAME            "MountainCat Harness"   /**< Advertised name. */
+#define BLE_FRAME_HEADER            2                       /**< Frame type and payload length. */
+
+/**
+ * @name Status flags of a BLE fix frame
+ *
+ * Same bits as the flags of the receiver's binary BLE protocol.
+ * @{
+ */
+#define BLE_FLAG_RB_LED             (1 << 0)    /**< Rainbow animation running. */
+#define BLE_FLAG_BUZZER             (1 << 1)    /**< Buzzer on. */
+#define BLE_FLAG_AUTO_MODE          (1 << 3)    /**< The battery policy chose the power mode. */
+#define BLE_FLAG_LOCATE             (1 << 4)    /**< Close range locate mode on. */
+/** @} */
+
+/**
+ * @brief What started or stopped the locate mode (log argument).
+ */
+enum LocateReason {
+    LOCATE_REASON_LORA = 0,     /**< MSG_LOCATE command over LoRa. */
+    LOCATE_REASON_BLE = 1,      /**< MSG_LOCATE command from the connected phone. */
+    LOCATE_REASON_LOW_SIV = 2,  /**< The harness lost its fix. */
+    LOCATE_REASON_TIMEOUT = 3   /**< No command from the phone within the timeout. */
+};
+
+/**
+ * @brief Fix notified to the phone while locating (30 bytes, little endian).
+ *
+ * The layout is the BleAllData frame of the receiver's binary BLE protocol, so the app decodes
+ * both with the same code. rssi is the BLE link RSSI as seen by the harness, and snr and rBatt
+ * are always 0. The frame on the characteristic is MSG_ALL_DATA, the payload length, then this.
+ */
+struct __attribute__((packed)) BleFix {
+    int16_t rssi;       /**< BLE link RSSI in dBm. */
+    int8_t snr;         /**< Unused, 0. */
+    uint8_t mode;       /**< Effective power mode. */
+    uint8_t rBatt;      /**< Unused, 0. */
+    uint8_t hBatt;      /**< Harness battery in percent. */
+    uint8_t r;          /**< LED red channel. */
+    uint8_t g;          /**< LED green channel. */
+    uint8_t b;          /**< LED blue channel. */
+    uint8_t flags;      /**< BLE_FLAG_* bits. */
+    int32_t lat;        /**< Latitude (degrees * 1e7). */
+    int32_t lon;        /**< Longitude (degrees * 1e7). */
+    uint8_t hour;       /**< Hour (UTC). */
+    uint8_t min;        /**< Minute. */
+    uint8_t sec;        /**< Second. */
+    uint8_t siv;        /**< Satellites in view. */
+    uint16_t hdop;      /**< HDOP. */
+    int16_t alt;        /**< Altitude in feet. */
+    uint32_t seq;       /**< Track log sequence number of the last reported fix. */
+};
+
+static_assert(sizeof(BleFix) == 30, "BleFix must match BleAllData of the receiver");
+
+/**
+ * @class BleHandler
+ * @brief Manages the BLE close range locate mode of the harness.
+ *
+ * LoRa stays the long range path. Once the phone is close, the harness advertises for a while
+ * so the phone can connect to it directly: while locating, the power management task wakes up
+ * every TIME_LOCATE_FIX milliseconds and notifies a fix with the link RSSI, and commands
+ * written by the phone are handled right away instead of on the next LoRa window.
+ *
+ * The BLE stack is only started with the first locate session. Every command from the phone
+ * restarts the timeout. Once it runs out, the harness disconnects, stops advertising and goes
+ * back to its normal sleep interval.
+ *
+ * Commands use the binary framing of the receiver: one byte MessageType, one byte payload
+ * length, then the payload. MSG_BUZZER and MSG_RB_LED carry one byte (0 or 1), MSG_LED
+ * three (r, g, b) and MSG_LOCATE two (on, minutes).
+ */
+class BleHandler {
+public:
+    /**
+     * @brief Constructor for BleHandler.
+     *
+     * Initializes the BleHandler object.
+     */
+    BleHandler();
+
+    /**
+     * @brief Initializes BLE functionality.
+     *
+     * Sets up the Bluefruit BLE stack, configures connection parameters, device name, TX power,
+     * and the BLE service and characteristic. Advertising is configured but only started by
+     * startLocate().
+     */
+    void begin();
+
+    /**
+     * @brief Ends the locate mode once its timeout ran out.
+     *
+     * Called by the power management task on every wakeup.
+     */
+    void update();
+
+    /**
+     * @brief Sends data over BLE.
+     *
+     * Sends a byte buffer to the connected BLE device via the MountainCat characteristic.
+     *
+     * @param data Pointer to the data buffer to send.
+     * @param length The number of bytes in the data buffer.
+     */
+    void sendData(const uint8_t* data, uint16_t length);
+
+    /**
+     * @brief Starts the locate mode, or extends the running one.
+     *
+     * @param reason What started it (LocateReason).
+     * @param minutes Timeout in minutes, 0 for LOCATE_DEFAULT_MINUTES.
+     */
+    void startLocate(LocateReason reason, uint8_t minutes);
+
+    /**
+     * @brief Stops the locate mode, disconnects the phone and stops advertising.
+     *
+     * @param reason What stopped it (LocateReason).
+     */
+    void stopLocate(LocateReason reason);
+
+    /**
+     * @brief Checks if the locate mode is on.
+     *
+     * @return true while the harness advertises or a phone is connected for locating.
+     */
+    bool isLocating() { return locating; }
+
+    /**
+     * @brief Notifies the current fix and the link RSSI to the connected phone.
+     */
+    void sendFix();
+
+    /**
+     * @brief Callback function invoked when the phone writes to the characteristic.
+     *
+     * Parses a command frame, publishes its event on the event bus and wakes the power
+     * management task so it is handled right away.
+     *
+     * @param conn_handle The connection handle of the phone.
+     * @param chr Pointer to the BLECharacteristic that received the data.
+     * @param data Pointer to the received data buffer.
+     * @param len Length of the received data in bytes.
+     */
+    static void onWriteCallback(uint16_t conn_handle, BLECharacteristic* chr, uint8_t* data, uint16_t len);
+
+private:
+    /**
+     * @brief Checks if at least one BLE device is connected.
+     *
+     * @return true if one or more devices are connected; false otherwise.
+     */
+    bool isConnected();
+
+    /**
+     * @brief Device Information Service helper.
+     *
+     * Provides information such as model and manufacturer details.
+     */
+    BLEDis bledis;
+
+    /**
+     * @brief Battery Service helper.
+     *
+     * Used for monitoring battery status over BLE.
+     */
+    BLEBas blebas;
+
+    /**
+     * @brief BLE service for the MountainCat application.
+     *
+     * Created with the defined MOUNTAINCAT_SERVICE_UUID.
+     */
+    BLEService        mountainCatService = BLEService(MOUNTAINCAT_SERVICE_UUID);
+
+    /**
+     * @brief BLE characteristic for the MountainCat application.
+     *
+     * Created with the defined MOUNTAINCAT_CHARACTERISTIC_UUID. It supports read, write, and notify operations.
+     */
+    BLECharacteristic mountainCatChar    = BLECharacteristic(MOUNTAINCAT_CHARACTERISTIC_UUID);
+
+    bool started = false;               /**< begin() has run. */
+    volatile bool locating = false;     /**< Locate mode on. */
+    volatile uint32_t activeMs = 0;     /**< millis() of the start or the last phone command. */
+    volatile uint32_t timeoutMs = 0;    /**< Locate timeout in milliseconds. */
+};
@@ -4,18 +4,22 @@
  * @brief Implementation of buzzer functionality for the OzarkMountainCat project.
  *
  * This file implements functions for initializing the buzzer hardware, playing a predefined tune,
- * and turning off the buzzer.
+ * and turning off the buzzer. The tune is played by the PWM peripheral from a RAM sequence
+ * (EasyDMA), so the CPU is not involved between notes.
  */
 
 #include "buzzer.h"
+#include "energy.h"
+#include "queHandler.h"
+#include "logger.h"
 
 /**
  * @brief Array of note frequencies for the tune.
  *
  * Contains a list of note frequencies (defined as macros like NTC5, NTCH1, etc.)
- * representing the musical notes to be played.
+ * representing the musical notes to be played. Kept const so the table stays in flash.
  */
-int tune[] = // List the frequencies according to the spectrum
+static const int16_t tune[] = // List the frequencies according to the spectrum
     {
         NTC5,
         NTC5,
@@ -137,7 +141,7 @@ int tune[] = // List the frequencies according to the spectrum
  * Contains a list of beat values (using macros such as HALF, QUARTER, WHOLE, etc.)
  * that correspond to the duration for each note in the tune array.
  */
-float durt[] = // List the beats according to the notation
+static const float durt[] = // List the beats according to the notation
     {
         HALF,
         QUARTER,
@@ -251,68 +255,161 @@ float durt[] = // List the beats according to the notation
 };
 
 /**
- * @brief Global variable to store the length of the tune.
+ * @brief Number of notes in the tune.
+ */
+static const int length = sizeof(tune) / sizeof(tune[0]);
+
+/**
+ * @brief PWM sequence played by EasyDMA.
  *
- * This variable is calculated in BuzzerHandler::begin() based on the size of the tune array.
+ * In WaveForm mode each entry is {compare ch0, ch1, ch2, countertop}, so every entry sets its
+ * own tone period. EasyDMA can only read RAM, so the flash tables are expanded here on start.
+ */
+static uint16_t sequence[BUZZER_SEQ_MAX_ENTRIES][4];
+
+/**
+ * @brief Token used to claim the PWM peripheral from the core.
  */
-int length = 0;
+#define BUZZER_PWM_TOKEN 0x425A5A52 // "BZZR"
 
 /**
  * @brief Initializes the buzzer hardware.
  *
- * Configures the buzzer pin as an output and calculates the length of the tune array.
+ * Configures the buzzer pin as an output.
  */
 void BuzzerHandler::begin()
 {
-  // Serial.end(); // (Optional: stop Serial communication if needed)
-  pinMode(PIN_BUZZER, OUTPUT);
-  // Optionally add PWM support to the buzzer pin:
-  // HwPWM0.addPin(PIN_BUZZER);
-  length = sizeof(tune) / sizeof(tune[0]); // Calculate the number of notes.
+  if (!buzzerOn)
+  {
+    pinMode(PIN_BUZZER, OUTPUT);
+    digitalWrite(PIN_BUZZER, LOW);
+  }
 }
 
 /**
- * @brief Plays the buzzer tune.
+ * @brief Expands the note tables into the PWM sequence.
+ *
+ * Each entry lasts BUZZER_SEQ_PERIODS periods of its own frequency, so a note of d seconds
+ * at f Hz takes round(d * f / BUZZER_SEQ_PERIODS) entries. Rests use a silent 500 Hz entry.
  *
- * Activates the buzzer and plays a sequence of tones defined in the tune array.
- * For each note, it plays the tone, delays based on the beat duration (adjusted by a multiplier),
- * yields control for 10 ms using vTaskDelay, and then stops the tone.
- * After the tune is played, the buzzer is turned off.
+ * @return Number of entries written.
  */
-void BuzzerHandler::on()
+uint16_t BuzzerHandler::buildSequence()
 {
-  buzzerOn = true;
-  //bool interrupted = false;
-  for (int x = 0; x < length; x++)
+  uint16_t count = 0;
+  for (int x = 0; x < length && count < BUZZER_SEQ_MAX_ENTRIES; x++)
   {
-    // Play the note at frequency specified by tune[x]
-    tone(PIN_BUZZER, tune[x]);
-    delay(500 * durt[x]);
-
-    queHandler.Que();
-    if (!buzzerOn)
+    bool rest = tune[x] <= 0;
+    uint32_t freq = rest ? 500 : tune[x];
+    uint16_t top = BUZZER_PWM_CLOCK / freq;
+    uint16_t compare = rest ? 0 : top / 2;
+    uint32_t entries = (uint32_t)(BUZZER_BEAT_MS * durt[x] * freq / 1000 / BUZZER_SEQ_PERIODS + 0.5f);
+    if (entries == 0)
+    {
+      entries = 1;
+    }
+    for (uint32_t i = 0; i < entries && count < BUZZER_SEQ_MAX_ENTRIES; i++, count++)
     {
-      noTone(PIN_BUZZER);
-      digitalWrite(PIN_BUZZER, LOW);
-      break;
+      // Bit 15 set keeps the output low outside the duty cycle (and for rests).
+      sequence[count][0] = compare | 0x8000;
+      sequence[count][1] = 0x8000;
+      sequence[count][2] = 0x8000;
+      sequence[count][3] = top;
     }
+  }
+  return count;
+}
 
-    // Stop the tone
-    noTone(PIN_BUZZER);
+/**
+ * @brief Starts playing the buzzer tune.
+ *
+ * Expands the tune into the PWM sequence and starts the PWM peripheral, then returns.
+ * The peripheral stops by itself at the end of the sequence and the STOPPED interrupt
+ * queues EVENT_BUZZER_DONE.
+ */
+void BuzzerHandler::on()
+{
+  if (buzzerOn)
+  {
+    return;
+  }
+  if (!BUZZER_PWM_HW.takeOwnership(BUZZER_PWM_TOKEN))
+  {
+    LOG_WARN(LOG_BUZZER_PWM_BUSY);
+    return;
+  }
+  uint16_t count = buildSequence();
+  buzzerOn = true;
+  Energy.set(ENERGY_BUZZER, ENERGY_UA_BUZZER);
+
+  NRF_PWM_Type *pwm = BUZZER_PWM;
+  pwm->PSEL.OUT[0] = g_ADigitalPinMap[PIN_BUZZER];
+  pwm->ENABLE = PWM_ENABLE_ENABLE_Enabled;
+  pwm->MODE = PWM_MODE_UPDOWN_Up;
+  pwm->PRESCALER = PWM_PRESCALER_PRESCALER_DIV_16; // 1 MHz
+  pwm->DECODER = (PWM_DECODER_LOAD_WaveForm << PWM_DECODER_LOAD_Pos) |
+                 (PWM_DECODER_MODE_RefreshCount << PWM_DECODER_MODE_Pos);
+  pwm->LOOP = 0;
+  pwm->SEQ[0].PTR = (uint32_t)sequence;
+  pwm->SEQ[0].CNT = count * 4;
+  pwm->SEQ[0].REFRESH = BUZZER_SEQ_PERIODS - 1;
+  pwm->SEQ[0].ENDDELAY = 0;
+  pwm->SHORTS = PWM_SHORTS_SEQEND0_STOP_Msk;
+  pwm->EVENTS_STOPPED = 0;
+  pwm->INTENSET = PWM_INTENSET_STOPPED_Msk;
+  NVIC_ClearPendingIRQ(BUZZER_PWM_IRQn);
+  NVIC_SetPriority(BUZZER_PWM_IRQn, 7);
+  NVIC_EnableIRQ(BUZZER_PWM_IRQn);
+  pwm->TASKS_SEQSTART[0] = 1;
+  LOG_INFO(LOG_BUZZER_PLAYING, length, count);
+}
+
+/**
+ * @brief Handles the PWM STOPPED interrupt.
+ *
+ * Releases the peripheral and the pin and queues EVENT_BUZZER_DONE, whether the tune
+ * finished or was stopped by off().
+ */
+void BuzzerHandler::onStopped()
+{
+  NRF_PWM_Type *pwm = BUZZER_PWM;
+  pwm->EVENTS_STOPPED = 0;
+  pwm->INTENCLR = PWM_INTENSET_STOPPED_Msk;
+  pwm->ENABLE = PWM_ENABLE_ENABLE_Disabled;
+  pwm->PSEL.OUT[0] = (uint32_t)PWM_PSEL_OUT_CONNECT_Disconnected << PWM_PSEL_OUT_CONNECT_Pos;
+  BUZZER_PWM_HW.releaseOwnership(BUZZER_PWM_TOKEN);
+  digitalWrite(PIN_BUZZER, LOW);
+  Buzzer.buzzerOn = false;
+  Energy.set(ENERGY_BUZZER, 0);
+
+  Event done = {EVENT_BUZZER_DONE};
+  queHandler.publishFromISR(done);
+}
+
+/**
+ * @brief PWM interrupt handler for the buzzer peripheral.
+ */
+extern "C" void BUZZER_PWM_IRQHandler(void)
+{
+  if (BUZZER_PWM->EVENTS_STOPPED)
+  {
+    BuzzerHandler::onStopped();
   }
-  // After the tune is finished, turn off the buzzer.
-  off();
 }
 
 /**
  * @brief Turns off the buzzer.
  *
- * Sets the buzzer pin to LOW and updates the internal state to indicate the buzzer is off.
+ * Stops a running tune (the STOPPED interrupt cleans up) or just drives the pin low.
  */
 void BuzzerHandler::off()
 {
+  if (buzzerOn)
+  {
+    BUZZER_PWM->TASKS_STOP = 1;
+    return;
+  }
   digitalWrite(PIN_BUZZER, LOW);
-  buzzerOn = false;
 }
 
 /**
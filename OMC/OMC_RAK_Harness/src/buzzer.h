@@ -68,13 +68,32 @@
 #define SIXTEENTH 0.0625 /**< Sixteenth note duration multiplier. */
 /** @} */
 
+/**
+ * @name PWM Sequencer Configuration
+ *
+ * The tune is played by a PWM peripheral in WaveForm mode. Every sequence entry plays
+ * BUZZER_SEQ_PERIODS periods of its own frequency, so note lengths are quantized to
+ * BUZZER_SEQ_PERIODS / f (32 to 122 ms over the notes used).
+ * @{
+ */
+#define BUZZER_PWM              NRF_PWM2        /**< PWM peripheral used for the buzzer (the one tone() uses). */
+#define BUZZER_PWM_HW           HwPWM2          /**< Core object used to claim BUZZER_PWM. */
+#define BUZZER_PWM_IRQn         PWM2_IRQn       /**< Interrupt of BUZZER_PWM. */
+#define BUZZER_PWM_IRQHandler   PWM2_IRQHandler /**< Interrupt handler of BUZZER_PWM. */
+#define BUZZER_PWM_CLOCK        1000000         /**< PWM clock in Hz (16 MHz / 16). */
+#define BUZZER_SEQ_PERIODS      32              /**< Tone periods per sequence entry. */
+#define BUZZER_SEQ_MAX_ENTRIES  640             /**< Sequence entries (8 bytes of RAM each). */
+#define BUZZER_BEAT_MS          500             /**< Length of a WHOLE beat in milliseconds. */
+/** @} */
+
 /**
  * @class BuzzerHandler
  * @brief Provides functions for controlling the buzzer.
  *
  * The BuzzerHandler class offers functions to initialize the buzzer hardware,
  * play a predefined tune, and turn the buzzer off. It also maintains an internal
- * state indicating whether the buzzer is currently on.
+ * state indicating whether the buzzer is currently on. Playback is asynchronous:
+ * on() returns immediately and EVENT_BUZZER_DONE is queued when the tune ends.
  */
 class BuzzerHandler
 {
@@ -87,23 +106,22 @@ public:
     /**
      * @brief Initializes the buzzer.
      *
-     * Configures the buzzer pin as an output and calculates the length of the tune array.
+     * Configures the buzzer pin as an output.
      */
     void begin();
 
     /**
-     * @brief Plays the tune on the buzzer.
+     * @brief Starts playing the tune on the buzzer.
      *
-     * Iterates through a predefined sequence of notes (stored in the global 'tune' array)
-     * and plays them with durations specified by the 'durt' array. A short vTaskDelay is used
-     * to yield control between notes. After the tune is played, the buzzer is turned off.
+     * Expands the notes in the 'tune' and 'durt' tables into a PWM sequence and hands it
+     * to the PWM peripheral. Returns immediately; the CPU is not woken between notes.
      */
     void on();
 
     /**
      * @brief Turns off the buzzer.
      *
-     * Sets the buzzer pin to LOW and updates the internal state.
+     * Stops a running tune. EVENT_BUZZER_DONE is queued once the PWM has stopped.
      */
     void off();
 
@@ -114,9 +132,23 @@ public:
      */
     bool isOn();
 
+    /**
+     * @brief Handles the PWM STOPPED interrupt.
+     *
+     * Called from the PWM interrupt handler; releases the peripheral and queues EVENT_BUZZER_DONE.
+     */
+    static void onStopped();
+
 private:
+    /**
+     * @brief Expands the note tables into the PWM sequence.
+     *
+     * @return Number of sequence entries written.
+     */
+    uint16_t buildSequence();
+
     /**
      * @brief Internal flag indicating if the buzzer is active.
      */
-    bool buzzerOn = false;
+    volatile bool buzzerOn = false;
 };
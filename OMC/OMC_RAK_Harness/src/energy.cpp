@@ -0,0 +1,171 @@
+/**
+ * @file energy.cpp
+ * @brief Implementation of the energy ledger for the OzarkMountainCat project.
+ *
+ * This file implements integrating the modelled current of each subsystem into charge, and the
+ * battery life projection sent in the energy report.
+ */
+
+#include "energy.h"
+
+/**
+ * @brief Microamp milliseconds per microamp hour.
+ */
+#define ENERGY_UAMS_PER_UAH 3600000ULL
+
+/**
+ * @brief Starts the ledger with the MCU active and everything else off.
+ */
+void EnergyHandler::begin() {
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        accounts[i] = {};
+        accounts[i].lastMs = now;
+    }
+    accounts[ENERGY_MCU].currentUa = ENERGY_UA_MCU_ACTIVE;
+    lastReportMs = now;
+}
+
+/**
+ * @brief Adds the charge used since the last update to every account.
+ *
+ * All accounts are brought up to the same time, so totals read right after are consistent.
+ *
+ * @param now Current millis().
+ */
+void EnergyHandler::settle(uint32_t now) {
+    for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        EnergyAccount &account = accounts[i];
+        uint32_t elapsed = now - account.lastMs;
+        account.chargeUaMs += (uint64_t)account.currentUa * elapsed;
+        if (account.currentUa != 0) {
+            account.onMs += elapsed;
+        }
+        account.lastMs = now;
+    }
+}
+
+/**
+ * @brief Sets the current a subsystem draws from now on.
+ *
+ * Uses the FROM_ISR critical section, which only masks the FreeRTOS interrupt priorities and
+ * works the same from a task, so the buzzer interrupt can close its account on time.
+ *
+ * @param subsystem Subsystem that changed state.
+ * @param currentUa New current in microamps, 0 when the subsystem is off.
+ */
+void EnergyHandler::set(EnergySubsystem subsystem, uint32_t currentUa) {
+    UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+    settle(millis());
+    accounts[subsystem].currentUa = currentUa;
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+/**
+ * @brief Gets the charge a subsystem used since boot.
+ *
+ * @param subsystem Subsystem.
+ * @return Charge in microamp hours.
+ */
+uint32_t EnergyHandler::getBootUah(EnergySubsystem subsystem) {
+    UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+    settle(millis());
+    uint64_t charge = accounts[subsystem].chargeUaMs;
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+    return (uint32_t)(charge / ENERGY_UAMS_PER_UAH);
+}
+
+/**
+ * @brief Gets the charge a subsystem used since the last energy report.
+ *
+ * @param subsystem Subsystem.
+ * @return Charge in microamp hours.
+ */
+uint32_t EnergyHandler::getReportUah(EnergySubsystem subsystem) {
+    UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+    settle(millis());
+    uint64_t charge = accounts[subsystem].chargeUaMs - accounts[subsystem].reportedUaMs;
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+    return (uint32_t)(charge / ENERGY_UAMS_PER_UAH);
+}
+
+/**
+ * @brief Gets the average current of the whole harness since the last energy report.
+ *
+ * Right after a report the period is too short to say anything, so the period since boot
+ * is used until the new one is a minute long.
+ *
+ * @return Average current in microamps.
+ */
+uint32_t EnergyHandler::getAverageUa() {
+    UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+    uint32_t now = millis();
+    settle(now);
+    bool sinceBoot = (now - lastReportMs) < 60000;
+    uint64_t charge = 0;
+    for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        charge += accounts[i].chargeUaMs - (sinceBoot ? 0 : accounts[i].reportedUaMs);
+    }
+    uint32_t elapsed = sinceBoot ? now : now - lastReportMs;
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+    return elapsed == 0 ? 0 : (uint32_t)(charge / elapsed);
+}
+
+/**
+ * @brief Projects the time left on the battery at the average current.
+ *
+ * @param batteryPercent Harness battery level in percent.
+ * @return Hours remaining.
+ */
+uint32_t EnergyHandler::getHoursRemaining(uint8_t batteryPercent) {
+    uint32_t averageUa = getAverageUa();
+    if (averageUa == 0) {
+        return 0;
+    }
+    uint64_t remainingUah = (uint64_t)BATTERY_CAPACITY_MAH * 1000 * batteryPercent / 100;
+    return (uint32_t)(remainingUah / averageUa);
+}
+
+/**
+ * @brief Checks if an energy report should be sent.
+ *
+ * @return true once TIME_ENERGY_REPORT has passed since the last report.
+ */
+bool EnergyHandler::reportDue() {
+    return (millis() - lastReportMs) >= TIME_ENERGY_REPORT;
+}
+
+/**
+ * @brief Starts a new "since the last report" period.
+ */
+void EnergyHandler::markReported() {
+    UBaseType_t saved = taskENTER_CRITICAL_FROM_ISR();
+    lastReportMs = millis();
+    settle(lastReportMs);
+    for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        accounts[i].reportedUaMs = accounts[i].chargeUaMs;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(saved);
+}
+
+/**
+ * @brief Gets the SX1262 TX current for an output power.
+ *
+ * Datasheet figures for the high power PA with the DC-DC regulator; powers in between use
+ * the next higher step.
+ *
+ * @param dbm Output power in dBm.
+ * @return Current in microamps.
+ */
+uint32_t EnergyHandler::txCurrentUa(int8_t dbm) {
+    if (dbm > 20) {
+        return 118000;
+    }
+    if (dbm > 17) {
+        return 84000;
+    }
+    if (dbm > 14) {
+        return 58000;
+    }
+    return 45000;
+}
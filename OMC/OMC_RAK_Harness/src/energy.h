@@ -0,0 +1,144 @@
+#pragma once
+/**
+ * @file energy.h
+ * @brief Header file for the EnergyHandler class.
+ *
+ * This file declares the EnergyHandler class which keeps an energy ledger for the harness.
+ * Every subsystem reports the current it draws whenever its state changes, and the ledger
+ * integrates current over time into charge per subsystem.
+ */
+
+#include "main.h"
+
+/**
+ * @brief Active current model in microamps.
+ *
+ * Typical datasheet figures. The sleep figures of the MCU and the LoRa RX are in power.h.
+ */
+#define ENERGY_UA_MCU_ACTIVE        3300    /**< nRF52840 running from flash at 64 MHz (DC-DC). */
+#define ENERGY_UA_GNSS_ACQUIRE      30000   /**< u-blox GNSS searching for a fix. */
+#define ENERGY_UA_GNSS_TRACK        25000   /**< u-blox GNSS tracking with a fix. */
+#define ENERGY_UA_LED_CHANNEL       20000   /**< One NeoPixel color channel at full brightness. */
+#define ENERGY_UA_BUZZER            30000   /**< Buzzer driven at 50% duty. */
+
+/**
+ * @brief Subsystems with their own account in the ledger.
+ */
+enum EnergySubsystem {
+    ENERGY_RADIO_TX = 0,    /**< LoRa transmitting. */
+    ENERGY_RADIO_RX = 1,    /**< LoRa listening. */
+    ENERGY_GNSS = 2,        /**< GNSS module powered. */
+    ENERGY_LED = 3,         /**< NeoPixels lit. */
+    ENERGY_BUZZER = 4,      /**< Buzzer playing. */
+    ENERGY_MCU = 5,         /**< MCU, active or sleeping. */
+    ENERGY_SUBSYSTEMS = 6   /**< Number of subsystems. */
+};
+
+/**
+ * @brief Ledger account of one subsystem.
+ */
+struct EnergyAccount {
+    uint32_t currentUa;     /**< Current drawn right now in microamps. */
+    uint32_t lastMs;        /**< millis() of the last update. */
+    uint32_t onMs;          /**< Time with a non zero current since boot. */
+    uint64_t chargeUaMs;    /**< Charge since boot in microamp milliseconds. */
+    uint64_t reportedUaMs;  /**< chargeUaMs at the last energy report. */
+};
+
+/**
+ * @class EnergyHandler
+ * @brief Integrates the modelled current of each subsystem into charge.
+ *
+ * The ledger does not measure anything: it relies on every subsystem calling set() when it
+ * changes state, with the current the datasheet gives for the new state. Between calls the
+ * current is constant, so the charge is current times the elapsed time.
+ */
+class EnergyHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    EnergyHandler() {}
+
+    /**
+     * @brief Starts the ledger with the MCU active and everything else off.
+     */
+    void begin();
+
+    /**
+     * @brief Sets the current a subsystem draws from now on.
+     *
+     * Safe to call from interrupt context.
+     *
+     * @param subsystem Subsystem that changed state.
+     * @param currentUa New current in microamps, 0 when the subsystem is off.
+     */
+    void set(EnergySubsystem subsystem, uint32_t currentUa);
+
+    /**
+     * @brief Gets the charge a subsystem used since boot.
+     *
+     * @param subsystem Subsystem.
+     * @return Charge in microamp hours.
+     */
+    uint32_t getBootUah(EnergySubsystem subsystem);
+
+    /**
+     * @brief Gets the charge a subsystem used since the last energy report.
+     *
+     * @param subsystem Subsystem.
+     * @return Charge in microamp hours.
+     */
+    uint32_t getReportUah(EnergySubsystem subsystem);
+
+    /**
+     * @brief Gets the average current of the whole harness since the last energy report.
+     *
+     * @return Average current in microamps.
+     */
+    uint32_t getAverageUa();
+
+    /**
+     * @brief Projects the time left on the battery at the average current.
+     *
+     * @param batteryPercent Harness battery level in percent.
+     * @return Hours remaining.
+     */
+    uint32_t getHoursRemaining(uint8_t batteryPercent);
+
+    /**
+     * @brief Checks if an energy report should be sent.
+     *
+     * @return true once TIME_ENERGY_REPORT has passed since the last report.
+     */
+    bool reportDue();
+
+    /**
+     * @brief Starts a new "since the last report" period.
+     */
+    void markReported();
+
+    /**
+     * @brief Gets the SX1262 TX current for an output power.
+     *
+     * @param dbm Output power in dBm.
+     * @return Current in microamps.
+     */
+    static uint32_t txCurrentUa(int8_t dbm);
+
+private:
+    /**
+     * @brief Adds the charge used since the last update to every account.
+     *
+     * Must be called with interrupts masked.
+     *
+     * @param now Current millis().
+     */
+    void settle(uint32_t now);
+
+    /** @brief One account per subsystem. */
+    EnergyAccount accounts[ENERGY_SUBSYSTEMS] = {};
+
+    /** @brief millis() of the last energy report. */
+    uint32_t lastReportMs = 0;
+};
@@ -0,0 +1,148 @@
+/**
+ * @file framepool.cpp
+ * @brief Implementation of the frame pool for the OzarkMountainCat project.
+ *
+ * This file implements the arena allocator of a frame and the ownership of the frames.
+ */
+
+#include "framepool.h"
+#include "logger.h"
+#include "metrics.h"
+
+/**
+ * @brief Size header in front of every block, keeps the blocks 8 byte aligned.
+ */
+#define FRAME_BLOCK_HEADER 8
+
+/**
+ * @brief Allocates from the arena.
+ *
+ * @param size Bytes needed.
+ * @return Pointer to the memory, NULL if the arena is exhausted.
+ */
+void *Frame::allocate(size_t size) {
+    size_t need = FRAME_BLOCK_HEADER + ((size + 7) & ~(size_t)7);
+    if (used + need > FRAME_JSON_ARENA) {
+        return NULL;
+    }
+    last = used;
+    used += need;
+    if (used > peak) {
+        peak = used;
+    }
+    memcpy(&arena[last], &size, sizeof(size));
+    return &arena[last + FRAME_BLOCK_HEADER];
+}
+
+/**
+ * @brief Does nothing, the arena is reset when the frame is acquired.
+ *
+ * The document destructor may run after the frame was released, so this must not touch the
+ * arena.
+ *
+ * @param ptr Memory from allocate().
+ */
+void Frame::deallocate(void *ptr) {
+}
+
+/**
+ * @brief Gets the size of a block from its header.
+ */
+size_t Frame::blockSize(void *ptr) {
+    size_t size;
+    memcpy(&size, (uint8_t *)ptr - FRAME_BLOCK_HEADER, sizeof(size));
+    return size;
+}
+
+/**
+ * @brief Grows or shrinks a block, in place if it is the last one.
+ *
+ * ArduinoJson grows the string it is reading and shrinks its slot pools once a document is
+ * complete. Both are usually the last block, so the arena rarely wastes memory on a copy.
+ *
+ * @param ptr Memory from allocate().
+ * @param size New size in bytes.
+ * @return Pointer to the memory, NULL if the arena is exhausted.
+ */
+void *Frame::reallocate(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return allocate(size);
+    }
+    uint8_t *block = (uint8_t *)ptr;
+    if (block == &arena[last + FRAME_BLOCK_HEADER]) {
+        size_t need = FRAME_BLOCK_HEADER + ((size + 7) & ~(size_t)7);
+        if (last + need > FRAME_JSON_ARENA) {
+            return NULL;
+        }
+        used = last + need;
+        if (used > peak) {
+            peak = used;
+        }
+        memcpy(&arena[last], &size, sizeof(size));
+        return ptr;
+    }
+    size_t old = blockSize(ptr);
+    void *moved = allocate(size);
+    if (moved != NULL) {
+        memcpy(moved, ptr, old < size ? old : size);
+    }
+    return moved;
+}
+
+/**
+ * @brief Empties the arena and the payload.
+ */
+void Frame::reset() {
+    used = 0;
+    last = 0;
+    len = 0;
+}
+
+/**
+ * @brief Registers the frame pool metrics.
+ */
+void FramePoolHandler::begin() {
+    Metrics.registerCounter(METRIC_FRAMES_EXHAUSTED);
+    Metrics.registerGauge(METRIC_FRAME_ARENA_PEAK);
+}
+
+/**
+ * @brief Takes a free frame.
+ *
+ * @return The frame, reset, or NULL if all frames are in use.
+ */
+Frame *FramePoolHandler::acquire() {
+    uint32_t mask = __atomic_load_n(&owned, __ATOMIC_RELAXED);
+    while (true) {
+        uint8_t i = 0;
+        while (i < FRAME_POOL_SIZE && (mask & (1UL << i))) {
+            i++;
+        }
+        if (i == FRAME_POOL_SIZE) {
+            __atomic_fetch_add(&exhausted, 1, __ATOMIC_RELAXED);
+            Metrics.add(METRIC_FRAMES_EXHAUSTED);
+            LOG_WARN(LOG_FRAMES_EXHAUSTED);
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&owned, &mask, mask | (1UL << i), false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            frames[i].reset();
+            return &frames[i];
+        }
+        // Another owner took a frame in between, mask now holds the current bits.
+    }
+}
+
+/**
+ * @brief Returns a frame to the pool.
+ *
+ * @param frame Frame from acquire(), NULL is ignored.
+ */
+void FramePoolHandler::release(Frame *frame) {
+    if (frame == NULL) {
+        return;
+    }
+    uint8_t i = frame - frames;
+    Metrics.setMax(METRIC_FRAME_ARENA_PEAK, frame->getPeak());
+    __atomic_fetch_and(&owned, ~(1UL << i), __ATOMIC_RELEASE);
+}
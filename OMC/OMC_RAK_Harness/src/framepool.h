@@ -0,0 +1,140 @@
+#pragma once
+/**
+ * @file framepool.h
+ * @brief Header file for the Frame and FramePoolHandler classes.
+ *
+ * This file declares the fixed pool of LoRa frames. Every JSON packet the harness builds or
+ * parses uses a frame from the pool: the payload bytes and the memory of the JSON document both
+ * live in the frame, so neither the task stacks nor the heap are involved and the worst case RAM
+ * use is known at link time.
+ */
+
+#include "main.h"
+
+/**
+ * @brief Frame pool configuration.
+ */
+#define FRAME_POOL_SIZE             3       /**< Frames in the pool. */
+#define FRAME_SIZE                  256     /**< Largest LoRa payload (255 bytes) plus a terminator. */
+#define FRAME_JSON_ARENA            1280    /**< JSON document memory per frame in bytes. */
+
+/**
+ * @class Frame
+ * @brief A LoRa payload buffer with the memory for its JSON document.
+ *
+ * The frame is the ArduinoJson allocator of the document built in it (JsonDocument doc(frame)).
+ * Allocation bumps through the arena and is reset when the frame is acquired, so a document
+ * must not outlive the release of its frame. Freeing is a no-op.
+ */
+class Frame : public ArduinoJson::Allocator {
+public:
+    uint8_t data[FRAME_SIZE];       /**< Payload bytes. */
+    size_t len;                     /**< Payload length in bytes. */
+
+    /**
+     * @brief Allocates from the arena.
+     *
+     * @param size Bytes needed.
+     * @return Pointer to the memory, NULL if the arena is exhausted.
+     */
+    void *allocate(size_t size) override;
+
+    /**
+     * @brief Does nothing, the arena is reset when the frame is acquired.
+     *
+     * @param ptr Memory from allocate().
+     */
+    void deallocate(void *ptr) override;
+
+    /**
+     * @brief Grows or shrinks a block, in place if it is the last one.
+     *
+     * @param ptr Memory from allocate().
+     * @param size New size in bytes.
+     * @return Pointer to the memory, NULL if the arena is exhausted.
+     */
+    void *reallocate(void *ptr, size_t size) override;
+
+    /**
+     * @brief Empties the arena and the payload.
+     */
+    void reset();
+
+    /**
+     * @brief Gets the most arena memory a document has used since boot.
+     *
+     * @return Bytes.
+     */
+    size_t getPeak() { return peak; }
+
+private:
+    /**
+     * @brief Gets the size of a block from its header.
+     */
+    static size_t blockSize(void *ptr);
+
+    /** @brief Document memory, blocks are 8 byte aligned with an 8 byte size header. */
+    alignas(8) uint8_t arena[FRAME_JSON_ARENA];
+
+    /** @brief Arena bytes in use. */
+    size_t used = 0;
+
+    /** @brief Offset of the last block, the only one that can grow in place. */
+    size_t last = 0;
+
+    /** @brief Highest arena use. */
+    size_t peak = 0;
+};
+
+/**
+ * @class FramePoolHandler
+ * @brief Fixed pool of frames with explicit ownership.
+ *
+ * acquire() hands a frame to one owner until it calls release(). Ownership is a bit per frame
+ * taken with a compare-and-swap, so the radio callbacks and the power management task can
+ * acquire frames at the same time. When the pool is empty acquire() returns NULL and the caller
+ * skips the packet.
+ */
+class FramePoolHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    FramePoolHandler() {}
+
+    /**
+     * @brief Registers the frame pool metrics.
+     */
+    void begin();
+
+    /**
+     * @brief Takes a free frame.
+     *
+     * @return The frame, reset, or NULL if all frames are in use.
+     */
+    Frame *acquire();
+
+    /**
+     * @brief Returns a frame to the pool.
+     *
+     * @param frame Frame from acquire(), NULL is ignored.
+     */
+    void release(Frame *frame);
+
+    /**
+     * @brief Gets the number of times the pool was empty.
+     *
+     * @return Failed acquire() calls since boot.
+     */
+    uint32_t getExhausted() { return exhausted; }
+
+private:
+    /** @brief The frames. */
+    Frame frames[FRAME_POOL_SIZE];
+
+    /** @brief Bit per frame, set while the frame is owned. */
+    volatile uint32_t owned = 0;
+
+    /** @brief Failed acquire() calls. */
+    volatile uint32_t exhausted = 0;
+};
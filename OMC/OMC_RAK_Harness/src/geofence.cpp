@@ -0,0 +1,258 @@
+/**
+ * @file geofence.cpp
+ * @brief Implementation of geofence evaluation for the OzarkMountainCat project.
+ *
+ * This file implements storing geofences received from the app and testing GPS fixes against
+ * them. Fixes are tested in a local planar frame around each fence so that only integer math
+ * is needed on every fix; the floating point cosine is evaluated once when a fence is stored.
+ */
+
+#include "geofence.h"
+#include "modepolicy.h"
+#include "logger.h"
+
+/**
+ * @brief Local units (degrees * 1e7 of latitude) per 100 meters.
+ *
+ * One degree of latitude is about 111320 m, so one meter is about 89.83 units.
+ */
+#define GEOFENCE_UNITS_PER_100M 8983
+
+/**
+ * @brief Computes cos(latitude) in Q15 for the local frame of a fence.
+ *
+ * @param latE7 Latitude in degrees * 1e7.
+ * @return cos(latitude) * 32768.
+ */
+static int32_t cosQ15(int32_t latE7) {
+    return (int32_t)(cos(latE7 / 10000000.0 * M_PI / 180.0) * 32768.0);
+}
+
+/**
+ * @brief Stores, replaces or clears a geofence.
+ *
+ * Circles keep their center as the local origin. Polygons use their first vertex as the origin
+ * and have every vertex converted to local x/y once, here, instead of on every fix.
+ *
+ * @param shape The geofence received from the app.
+ * @return true if the fence was accepted, false if it is malformed.
+ */
+bool GeofenceHandler::setFence(const GeofenceShape &shape) {
+    if (shape.id == GEOFENCE_ID_ALL && shape.type == GEOFENCE_NONE) {
+        clearAll();
+        LOG_INFO(LOG_GEOFENCE_CLEARED_ALL);
+        return true;
+    }
+    if (shape.id >= GEOFENCE_MAX_FENCES) {
+        LOG_WARN(LOG_GEOFENCE_BAD_ID, shape.id);
+        return false;
+    }
+    Fence &fence = fences[shape.id];
+
+    if (shape.type == GEOFENCE_NONE) {
+        fence.type = GEOFENCE_NONE;
+        LOG_INFO(LOG_GEOFENCE_CLEARED, shape.id);
+    } else if (shape.type == GEOFENCE_CIRCLE) {
+        if (shape.radius == 0) {
+            LOG_WARN(LOG_GEOFENCE_NO_RADIUS, shape.id);
+            return false;
+        }
+        int64_t radius = (int64_t)shape.radius * GEOFENCE_UNITS_PER_100M / 100;
+        fence.type = GEOFENCE_CIRCLE;
+        fence.count = 1;
+        fence.originLat = shape.lat[0];
+        fence.originLon = shape.lon[0];
+        fence.cosLat = cosQ15(fence.originLat);
+        fence.radiusSq = radius * radius;
+        LOG_INFO(LOG_GEOFENCE_CIRCLE, shape.id, shape.radius);
+    } else if (shape.type == GEOFENCE_POLYGON) {
+        if (shape.count < 3 || shape.count > GEOFENCE_MAX_VERTICES) {
+            LOG_WARN(LOG_GEOFENCE_BAD_POLYGON, shape.id, shape.count);
+            return false;
+        }
+        fence.type = GEOFENCE_POLYGON;
+        fence.count = shape.count;
+        fence.originLat = shape.lat[0];
+        fence.originLon = shape.lon[0];
+        fence.cosLat = cosQ15(fence.originLat);
+        for (uint8_t i = 0; i < fence.count; i++) {
+            fence.y[i] = shape.lat[i] - fence.originLat;
+            fence.x[i] = (int32_t)((((int64_t)shape.lon[i] - fence.originLon) * fence.cosLat) >> 15);
+        }
+        LOG_INFO(LOG_GEOFENCE_POLYGON, shape.id, fence.count);
+    } else {
+        LOG_WARN(LOG_GEOFENCE_BAD_TYPE, shape.id, shape.type);
+        return false;
+    }
+
+    if (!isArmed()) {
+        clearAll();
+    }
+    // The fence set changed, so the next fix decides the side again without raising an alert.
+    stateKnown = false;
+    return true;
+}
+
+/**
+ * @brief Removes every geofence and returns to normal reporting.
+ *
+ * If the mode was escalated by an exit, the escalation ends.
+ */
+void GeofenceHandler::clearAll() {
+    for (uint8_t i = 0; i < GEOFENCE_MAX_FENCES; i++) {
+        fences[i].type = GEOFENCE_NONE;
+    }
+    ModePolicy.setEscalated(false);
+    receivedPacket.mode = ModePolicy.getMode();
+    stateKnown = false;
+    inside = false;
+}
+
+/**
+ * @brief Checks if at least one fence is armed.
+ *
+ * @return true if one or more fences are armed.
+ */
+bool GeofenceHandler::isArmed() {
+    for (uint8_t i = 0; i < GEOFENCE_MAX_FENCES; i++) {
+        if (fences[i].type != GEOFENCE_NONE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks if the last evaluated fix was inside a fence.
+ *
+ * @return true if the last fix was inside any armed fence.
+ */
+bool GeofenceHandler::isInside() {
+    return stateKnown && inside;
+}
+
+/**
+ * @brief Tests if a point lies inside a fence.
+ *
+ * Circles compare squared distances. Polygons use the even-odd ray casting rule; the division
+ * in the usual edge intersection formula is replaced by a cross-multiplication so everything
+ * stays in 64-bit integers.
+ *
+ * @param fence The fence to test.
+ * @param latE7 Latitude in degrees * 1e7.
+ * @param lonE7 Longitude in degrees * 1e7.
+ * @return true if the point is inside.
+ */
+bool GeofenceHandler::contains(const Fence &fence, int32_t latE7, int32_t lonE7) {
+    int64_t py = (int64_t)latE7 - fence.originLat;
+    int64_t px = (((int64_t)lonE7 - fence.originLon) * fence.cosLat) >> 15;
+
+    if (fence.type == GEOFENCE_CIRCLE) {
+        return (px * px + py * py) <= fence.radiusSq;
+    }
+
+    bool in = false;
+    for (uint8_t i = 0, j = fence.count - 1; i < fence.count; j = i++) {
+        int64_t xi = fence.x[i], yi = fence.y[i];
+        int64_t xj = fence.x[j], yj = fence.y[j];
+        if ((yi > py) != (yj > py)) {
+            // Is px left of the edge at height py? (px - xi) * (yj - yi) < (py - yi) * (xj - xi),
+            // with the comparison flipped when the edge points downwards.
+            int64_t lhs = (px - xi) * (yj - yi);
+            int64_t rhs = (py - yi) * (xj - xi);
+            if ((yj > yi) ? (lhs < rhs) : (lhs > rhs)) {
+                in = !in;
+            }
+        }
+    }
+    return in;
+}
+
+/**
+ * @brief Evaluates a fix against all armed fences.
+ *
+ * @param latE7 Latitude in degrees * 1e7.
+ * @param lonE7 Longitude in degrees * 1e7.
+ * @return The transition caused by this fix.
+ */
+GeofenceTransition GeofenceHandler::evaluate(int32_t latE7, int32_t lonE7) {
+    bool nowInside = false;
+    uint8_t fenceId = lastFenceId;
+    bool armed = false;
+
+    for (uint8_t i = 0; i < GEOFENCE_MAX_FENCES; i++) {
+        if (fences[i].type == GEOFENCE_NONE) {
+            continue;
+        }
+        armed = true;
+        if (contains(fences[i], latE7, lonE7)) {
+            nowInside = true;
+            fenceId = i;
+            break;
+        }
+    }
+
+    if (!armed) {
+        return GEOFENCE_NO_CHANGE;
+    }
+
+    if (!stateKnown) {
+        // First fix against a new fence set only establishes the side.
+        stateKnown = true;
+        inside = nowInside;
+        lastFenceId = fenceId;
+        return GEOFENCE_NO_CHANGE;
+    }
+
+    if (nowInside == inside) {
+        if (nowInside) {
+            lastFenceId = fenceId;
+        }
+        return GEOFENCE_NO_CHANGE;
+    }
+
+    inside = nowInside;
+    lastFenceId = fenceId;
+
+    if (!inside) {
+        // Escape: switch to live tracking so the owner gets a position every wakeup, as far
+        // as the battery allows.
+        ModePolicy.setEscalated(true);
+        receivedPacket.mode = ModePolicy.getMode();
+        LOG_INFO(LOG_GEOFENCE_EXITED, fenceId);
+        return GEOFENCE_EXITED;
+    }
+
+    ModePolicy.setEscalated(false);
+    receivedPacket.mode = ModePolicy.getMode();
+    LOG_INFO(LOG_GEOFENCE_ENTERED, fenceId);
+    return GEOFENCE_ENTERED;
+}
+
+/**
+ * @brief Gets the id of the fence involved in the last crossing.
+ *
+ * @return Fence id.
+ */
+uint8_t GeofenceHandler::getLastFenceId() {
+    return lastFenceId;
+}
+
+/**
+ * @brief Checks if a routine position report should be sent.
+ *
+ * @return true if a routine report should be sent.
+ */
+bool GeofenceHandler::reportDue() {
+    if (!isArmed() || !isInside()) {
+        return true;
+    }
+    return (millis() - lastReport) >= TIME_GEOFENCE_INSIDE_REPORT;
+}
+
+/**
+ * @brief Records that a routine report has just been sent.
+ */
+void GeofenceHandler::markReported() {
+    lastReport = millis();
+}
@@ -0,0 +1,141 @@
+#pragma once
+/**
+ * @file geofence.h
+ * @brief Header file for the GeofenceHandler class.
+ *
+ * This file declares the GeofenceHandler class which holds the geofences pushed from the app
+ * and evaluates every GPS fix against them using integer math only.
+ */
+
+#include "main.h"
+
+/**
+ * @brief Result of evaluating a fix against the geofences.
+ */
+enum GeofenceTransition {
+    GEOFENCE_NO_CHANGE = 0, /**< Still on the same side of the fences. */
+    GEOFENCE_EXITED = 1,    /**< Left all fences since the last fix. */
+    GEOFENCE_ENTERED = 2    /**< Came back inside a fence since the last fix. */
+};
+
+/**
+ * @class GeofenceHandler
+ * @brief Evaluates GPS fixes against circle and polygon geofences.
+ *
+ * Fences are treated as safe zones: the pet is "inside" while it is inside any armed fence.
+ * Each fence is converted once to a local planar frame (degrees * 1e7, longitude scaled by
+ * cos(latitude) in Q15) so that the per-fix test is a handful of 64-bit multiplies.
+ */
+class GeofenceHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    GeofenceHandler() {}
+
+    /**
+     * @brief Stores, replaces or clears a geofence.
+     *
+     * A shape of type GEOFENCE_NONE clears the fence with the same id, or every fence
+     * when the id is GEOFENCE_ID_ALL.
+     *
+     * @param shape The geofence received from the app.
+     * @return true if the fence was accepted, false if it is malformed.
+     */
+    bool setFence(const GeofenceShape &shape);
+
+    /**
+     * @brief Removes every geofence and returns to normal reporting.
+     *
+     * If the mode was escalated by an exit, the escalation ends.
+     */
+    void clearAll();
+
+    /**
+     * @brief Checks if at least one fence is armed.
+     *
+     * @return true if one or more fences are armed.
+     */
+    bool isArmed();
+
+    /**
+     * @brief Checks if the last evaluated fix was inside a fence.
+     *
+     * @return true if the last fix was inside any armed fence.
+     */
+    bool isInside();
+
+    /**
+     * @brief Evaluates a fix against all armed fences.
+     *
+     * On a crossing the mode policy is escalated to live tracking (on exit) or the escalation
+     * ends (on re-entry); the battery floor of ModePolicyHandler applies either way.
+     *
+     * @param latE7 Latitude in degrees * 1e7.
+     * @param lonE7 Longitude in degrees * 1e7.
+     * @return The transition caused by this fix.
+     */
+    GeofenceTransition evaluate(int32_t latE7, int32_t lonE7);
+
+    /**
+     * @brief Gets the id of the fence involved in the last crossing.
+     *
+     * @return Fence id.
+     */
+    uint8_t getLastFenceId();
+
+    /**
+     * @brief Checks if a routine position report should be sent.
+     *
+     * Reports are always due when no fence is armed or the pet is outside. While inside, a report
+     * is only due once every TIME_GEOFENCE_INSIDE_REPORT milliseconds.
+     *
+     * @return true if a routine report should be sent.
+     */
+    bool reportDue();
+
+    /**
+     * @brief Records that a routine report has just been sent.
+     */
+    void markReported();
+
+private:
+    /**
+     * @brief A fence converted to the local planar frame.
+     */
+    struct Fence {
+        GeofenceType type;                  /**< Shape type (GEOFENCE_NONE if the slot is free). */
+        uint8_t count;                      /**< Number of polygon vertices. */
+        int32_t originLat;                  /**< Origin latitude of the local frame (degrees * 1e7). */
+        int32_t originLon;                  /**< Origin longitude of the local frame (degrees * 1e7). */
+        int32_t cosLat;                     /**< cos(origin latitude) in Q15. */
+        int64_t radiusSq;                   /**< Squared circle radius in local units. */
+        int32_t x[GEOFENCE_MAX_VERTICES];   /**< Polygon vertex x in local units. */
+        int32_t y[GEOFENCE_MAX_VERTICES];   /**< Polygon vertex y in local units. */
+    };
+
+    /**
+     * @brief Tests if a point lies inside a fence.
+     *
+     * @param fence The fence to test.
+     * @param latE7 Latitude in degrees * 1e7.
+     * @param lonE7 Longitude in degrees * 1e7.
+     * @return true if the point is inside.
+     */
+    static bool contains(const Fence &fence, int32_t latE7, int32_t lonE7);
+
+    /** @brief Fence slots. */
+    Fence fences[GEOFENCE_MAX_FENCES] = {};
+
+    /** @brief True once a fix has been evaluated against the current fences. */
+    bool stateKnown = false;
+
+    /** @brief Inside flag of the last evaluated fix. */
+    bool inside = false;
+
+    /** @brief Fence the pet was last seen inside (or left). */
+    uint8_t lastFenceId = 0;
+
+    /** @brief millis() of the last routine report. */
+    uint32_t lastReport = 0;
+};
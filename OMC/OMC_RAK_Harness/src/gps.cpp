@@ -1,4 +1,11 @@
 #include "gps.h"
+#include "energy.h"
+#include "metrics.h"
+
+/**
+ * @brief Upper bounds of the time to fix histogram buckets in seconds.
+ */
+static const int16_t fixTimeBounds[METRIC_BUCKETS] = {10, 30, 60, 120};
 
 /**
  * @brief Initializes the GNSS module.
@@ -10,12 +17,17 @@
  * @return true if initialization is successful, false otherwise.
  */
 bool GPSHandler::begin() {
+    ready = false;
     // Reset the GNSS module via WB_IO2 pin.
     pinMode(WB_IO2, OUTPUT);
     digitalWrite(WB_IO2, 0);
     delay(100);
     digitalWrite(WB_IO2, 1);
     delay(100);
+    powered = true;
+    poweredAt = millis();
+    Energy.set(ENERGY_GNSS, ENERGY_UA_GNSS_ACQUIRE);
+    Metrics.registerHistogram(METRIC_GPS_FIX_TIME, fixTimeBounds);
 
     // Initialize GNSS using the SparkFun library.
     if (myGNSS.begin() == false) {
@@ -57,6 +69,7 @@ bool GPSHandler::begin() {
     // }
 
     Serial.println("GNSS initialized.");
+    ready = true;
     return true;
 }
 
@@ -72,6 +85,9 @@ void GPSHandler::gpsOff() {
     delay(100);
     digitalWrite(WB_IO2, 0);
     delay(100);
+    powered = false;
+    ready = false;
+    Energy.set(ENERGY_GNSS, 0);
 }
 
 /**
@@ -82,6 +98,11 @@ void GPSHandler::gpsOff() {
  * If no fix is available, it sets the fix flag to false.
  */
 void GPSHandler::update() {
+    if (!ready) {
+        // Nothing to ask over I2C, keep the last known position.
+        fix = false;
+        return;
+    }
     // Update GNSS data using the SparkFun library.
     //Serial.println("Updating GPS data...");
     if (myGNSS.getGnssFixOk() && myGNSS.getSIV() > 4) {
@@ -89,9 +110,20 @@ void GPSHandler::update() {
     } else {
         fix = false;
     }
+    if (fix && poweredAt != 0) {
+        // First fix since power on.
+        Metrics.observe(METRIC_GPS_FIX_TIME, (millis() - poweredAt) / 1000);
+        poweredAt = 0;
+    }
+    if (powered) {
+        // Acquisition draws more than tracking, so the account follows the fix state.
+        Energy.set(ENERGY_GNSS, fix ? ENERGY_UA_GNSS_TRACK : ENERGY_UA_GNSS_ACQUIRE);
+    }
     // Convert raw latitude and longitude values.
-    lat = myGNSS.getLatitude() / 10000000.0;
-    lon = myGNSS.getLongitude() / 10000000.0;
+    latE7 = myGNSS.getLatitude();
+    lonE7 = myGNSS.getLongitude();
+    lat = latE7 / 10000000.0;
+    lon = lonE7 / 10000000.0;
     hour = myGNSS.getHour();
     min = myGNSS.getMinute();
     sec = myGNSS.getSecond();
@@ -110,6 +142,15 @@ bool GPSHandler::hasFix() {
     return fix;
 }
 
+/**
+ * @brief Checks if the GNSS module is powered and initialized.
+ *
+ * @return true once begin() succeeded, false after a failed begin() or gpsOff().
+ */
+bool GPSHandler::isReady() {
+    return ready;
+}
+
 /**
  * @brief Gets the altitude.
  *
@@ -137,6 +178,24 @@ double GPSHandler::getLongitude() {
     return lon;
 }
 
+/**
+ * @brief Gets the raw latitude.
+ *
+ * @return Latitude in degrees * 1e7.
+ */
+int32_t GPSHandler::getLatitudeE7() {
+    return latE7;
+}
+
+/**
+ * @brief Gets the raw longitude.
+ *
+ * @return Longitude in degrees * 1e7.
+ */
+int32_t GPSHandler::getLongitudeE7() {
+    return lonE7;
+}
+
 /**
  * @brief Gets the hour from the GNSS data.
  *
@@ -58,6 +58,13 @@ public:
      */
     bool hasFix();
 
+    /**
+     * @brief Checks if the GNSS module is powered and initialized.
+     *
+     * @return true once begin() succeeded, false after a failed begin() or gpsOff().
+     */
+    bool isReady();
+
     /**
      * @brief Retrieves the current latitude.
      *
@@ -72,6 +79,20 @@ public:
      */
     double getLongitude();
 
+    /**
+     * @brief Retrieves the current latitude in fixed point.
+     *
+     * @return The latitude in degrees * 1e7, as reported by the GNSS module.
+     */
+    int32_t getLatitudeE7();
+
+    /**
+     * @brief Retrieves the current longitude in fixed point.
+     *
+     * @return The longitude in degrees * 1e7, as reported by the GNSS module.
+     */
+    int32_t getLongitudeE7();
+
     /**
      * @brief Retrieves the current altitude.
      *
@@ -127,6 +148,21 @@ private:
      */
     bool fix = false;
 
+    /**
+     * @brief Flag indicating if the GNSS module is powered.
+     */
+    bool powered = false;
+
+    /**
+     * @brief Flag indicating if the last begin() succeeded and the module was not turned off since.
+     */
+    bool ready = false;
+
+    /**
+     * @brief millis() when the GNSS module was powered on, 0 once the fix time was recorded.
+     */
+    uint32_t poweredAt = 0;
+
     /**
      * @brief Latitude value.
      */
@@ -137,6 +173,16 @@ private:
      */
     double lon = 0.0;
 
+    /**
+     * @brief Raw latitude (degrees * 1e7).
+     */
+    int32_t latE7 = 0;
+
+    /**
+     * @brief Raw longitude (degrees * 1e7).
+     */
+    int32_t lonE7 = 0;
+
     /**
      * @brief Altitude value.
      */
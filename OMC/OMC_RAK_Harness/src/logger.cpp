@@ -0,0 +1,142 @@
+/**
+ * @file logger.cpp
+ * @brief Implementation of the deferred binary logger for the OzarkMountainCat project.
+ *
+ * This file implements the lock-free record ring and the drain task that sends the records to
+ * the USB serial port. tools/logdecode.py turns the records back into text.
+ */
+
+#include "logger.h"
+
+/**
+ * @brief Creates the drain task.
+ *
+ * The task runs at idle priority and sleeps until flush() or a half full ring wakes it, so it
+ * never keeps the CPU awake on its own.
+ */
+void LogHandler::begin() {
+    task = xTaskCreateStatic(drainTask, "LogDrain", LOG_TASK_STACK, this, tskIDLE_PRIORITY, taskStack, &taskBuffer);
+}
+
+/**
+ * @brief Logs a message without arguments.
+ */
+void LogHandler::write(uint8_t level, LogId id) {
+    push(level, id, 0, 0, 0, 0);
+}
+
+/**
+ * @brief Logs a message with one argument.
+ */
+void LogHandler::write(uint8_t level, LogId id, uint32_t a0) {
+    push(level, id, 1, a0, 0, 0);
+}
+
+/**
+ * @brief Logs a message with two arguments.
+ */
+void LogHandler::write(uint8_t level, LogId id, uint32_t a0, uint32_t a1) {
+    push(level, id, 2, a0, a1, 0);
+}
+
+/**
+ * @brief Logs a message with three arguments.
+ */
+void LogHandler::write(uint8_t level, LogId id, uint32_t a0, uint32_t a1, uint32_t a2) {
+    push(level, id, 3, a0, a1, a2);
+}
+
+/**
+ * @brief Reserves a slot and stores a record.
+ *
+ * The compare-and-swap compiles to LDREX/STREX on the Cortex-M4, so an interrupt that logs
+ * in between simply makes the loop retry.
+ */
+void LogHandler::push(uint8_t level, LogId id, uint8_t argc, uint32_t a0, uint32_t a1, uint32_t a2) {
+    uint32_t slot = head;
+    do {
+        if (slot - tail >= LOG_RING_SIZE) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &slot, slot + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    uint32_t index = slot & (LOG_RING_SIZE - 1);
+    LogRecord &record = ring[index];
+    record.id = id;
+    record.level = level;
+    record.argc = argc;
+    record.ms = millis();
+    record.args[0] = a0;
+    record.args[1] = a1;
+    record.args[2] = a2;
+    __atomic_store_n(&ready[index], 1, __ATOMIC_RELEASE);
+
+    if (slot - tail == LOG_RING_SIZE / 2) {
+        flush();
+    }
+}
+
+/**
+ * @brief Wakes the drain task.
+ */
+void LogHandler::flush() {
+    if (task == NULL) {
+        return;
+    }
+    if (__get_IPSR() != 0) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(task, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xTaskNotifyGive(task);
+    }
+}
+
+/**
+ * @brief Gets the number of records dropped because the ring was full.
+ *
+ * @return Dropped records since boot.
+ */
+uint32_t LogHandler::getDropped() {
+    return dropped;
+}
+
+/**
+ * @brief Sends the ready records to the USB serial port, or discards them without a host.
+ *
+ * Each record goes out as the two sync bytes, the 8 byte header and argc arguments.
+ */
+void LogHandler::drain() {
+    bool attached = Serial;
+    uint32_t lost = dropped;
+    if (attached && lost != droppedReported) {
+        write(LOG_LEVEL_WARN, LOG_DROPPED, lost - droppedReported);
+        droppedReported = lost;
+    }
+    for (;;) {
+        uint32_t index = tail & (LOG_RING_SIZE - 1);
+        if (!__atomic_load_n(&ready[index], __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (attached) {
+            const LogRecord &record = ring[index];
+            const uint8_t sync[2] = {LOG_SYNC_0, LOG_SYNC_1};
+            Serial.write(sync, sizeof(sync));
+            Serial.write((const uint8_t *)&record, 8 + 4 * record.argc);
+        }
+        ready[index] = 0;
+        tail = tail + 1;
+    }
+}
+
+/**
+ * @brief Drain task, runs drain() every time it is woken.
+ */
+void LogHandler::drainTask(void *pvParameters) {
+    LogHandler *self = (LogHandler *)pvParameters;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->drain();
+    }
+}
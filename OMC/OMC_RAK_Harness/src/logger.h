@@ -0,0 +1,172 @@
+#pragma once
+/**
+ * @file logger.h
+ * @brief Header file for the LogHandler class and the LOG_* macros.
+ *
+ * This file declares the deferred binary logger. A log call stores the message id and up to
+ * LOG_MAX_ARGS 32-bit arguments in a RAM ring; a low priority task drains the ring to the USB
+ * serial port when a host is attached. Messages below LOG_LEVEL are removed at compile time.
+ */
+
+#include "main.h"
+#include "logids.h"
+
+/**
+ * @brief Log levels.
+ */
+#define LOG_LEVEL_NONE              0   /**< No logging. */
+#define LOG_LEVEL_ERROR             1   /**< Errors only. */
+#define LOG_LEVEL_WARN              2   /**< Errors and warnings. */
+#define LOG_LEVEL_INFO              3   /**< Normal operation. */
+#define LOG_LEVEL_DEBUG             4   /**< Everything, including the hot paths. */
+
+/**
+ * @brief Compile-time log level, set with -DLOG_LEVEL=... in platformio.ini.
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL                   LOG_LEVEL_INFO
+#endif
+
+/**
+ * @brief Logger configuration.
+ */
+#define LOG_RING_SIZE               64      /**< Records in the ring (power of two). */
+#define LOG_MAX_ARGS                3       /**< Arguments per record. */
+#define LOG_SYNC_0                  0x00    /**< First sync byte in front of every record. */
+#define LOG_SYNC_1                  0xA5    /**< Second sync byte in front of every record. */
+#define LOG_TASK_STACK              256     /**< Drain task stack size in words. */
+
+/**
+ * @brief Log macros. Arguments are converted to 32-bit words.
+ */
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(id, ...)  Log.write(LOG_LEVEL_ERROR, id, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(id, ...)  do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(id, ...)   Log.write(LOG_LEVEL_WARN, id, ##__VA_ARGS__)
+#else
+#define LOG_WARN(id, ...)   do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(id, ...)   Log.write(LOG_LEVEL_INFO, id, ##__VA_ARGS__)
+#else
+#define LOG_INFO(id, ...)   do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(id, ...)  Log.write(LOG_LEVEL_DEBUG, id, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(id, ...)  do {} while (0)
+#endif
+
+/**
+ * @brief Binary log record, sent as is (little endian) after the two sync bytes.
+ *
+ * Only the first argc arguments are sent.
+ */
+struct LogRecord {
+    uint16_t id;                    /**< LogId of the message. */
+    uint8_t level;                  /**< LOG_LEVEL_* of the message. */
+    uint8_t argc;                   /**< Number of valid arguments. */
+    uint32_t ms;                    /**< millis() when the message was logged. */
+    uint32_t args[LOG_MAX_ARGS];    /**< Arguments. */
+};
+
+/**
+ * @class LogHandler
+ * @brief Deferred binary logger.
+ *
+ * Producers reserve a slot with a compare-and-swap on the head index, fill it and mark it
+ * ready, so logging is lock-free and safe from interrupts. Only the drain task moves the tail.
+ * When the ring is full the record is dropped and counted.
+ */
+class LogHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    LogHandler() {}
+
+    /**
+     * @brief Creates the drain task.
+     */
+    void begin();
+
+    /**
+     * @brief Logs a message without arguments. Use the LOG_* macros instead.
+     */
+    void write(uint8_t level, LogId id);
+
+    /**
+     * @brief Logs a message with one argument. Use the LOG_* macros instead.
+     */
+    void write(uint8_t level, LogId id, uint32_t a0);
+
+    /**
+     * @brief Logs a message with two arguments. Use the LOG_* macros instead.
+     */
+    void write(uint8_t level, LogId id, uint32_t a0, uint32_t a1);
+
+    /**
+     * @brief Logs a message with three arguments. Use the LOG_* macros instead.
+     */
+    void write(uint8_t level, LogId id, uint32_t a0, uint32_t a1, uint32_t a2);
+
+    /**
+     * @brief Wakes the drain task.
+     *
+     * Safe to call from interrupt context.
+     */
+    void flush();
+
+    /**
+     * @brief Gets the number of records dropped because the ring was full.
+     *
+     * @return Dropped records since boot.
+     */
+    uint32_t getDropped();
+
+private:
+    /**
+     * @brief Reserves a slot and stores a record.
+     */
+    void push(uint8_t level, LogId id, uint8_t argc, uint32_t a0, uint32_t a1, uint32_t a2);
+
+    /**
+     * @brief Sends the ready records to the USB serial port, or discards them without a host.
+     */
+    void drain();
+
+    /**
+     * @brief Drain task, runs drain() every time it is woken.
+     */
+    static void drainTask(void *pvParameters);
+
+    /** @brief Record storage. */
+    LogRecord ring[LOG_RING_SIZE];
+
+    /** @brief Ready flag per slot, set by the producer once the record is complete. */
+    volatile uint8_t ready[LOG_RING_SIZE] = {};
+
+    /** @brief Next slot to reserve (producers). */
+    volatile uint32_t head = 0;
+
+    /** @brief Next slot to drain (drain task only). */
+    volatile uint32_t tail = 0;
+
+    /** @brief Records dropped since boot. */
+    volatile uint32_t dropped = 0;
+
+    /** @brief Dropped count already reported by the drain task. */
+    uint32_t droppedReported = 0;
+
+    /** @brief Handle of the drain task. */
+    TaskHandle_t task = NULL;
+
+    /** @brief Drain task control block. */
+    StaticTask_t taskBuffer;
+
+    /** @brief Drain task stack. */
+    StackType_t taskStack[LOG_TASK_STACK];
+};
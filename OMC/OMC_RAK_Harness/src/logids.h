@@ -0,0 +1,96 @@
+#pragma once
+/**
+ * @file logids.h
+ * @brief Log message table for the OzarkMountainCat harness.
+ *
+ * Each entry pairs a log id with its format string. The firmware only uses the ids; the format
+ * strings never reach the binary and are read from this file by tools/logdecode.py. Append new
+ * messages at the end so ids in old captures keep their meaning. Arguments are 32-bit words,
+ * formatted with %u, %d or %x.
+ */
+
+#define LOG_MESSAGES(X) \
+    X(LOG_DROPPED,              "%u log records dropped") \
+    X(LOG_TX_DONE,              "LoRa TX done") \
+    X(LOG_TX_TIMEOUT,           "LoRa TX timeout") \
+    X(LOG_TX_SENT,              "LoRa TX %u bytes") \
+    X(LOG_RX_DONE,              "LoRa RX %u bytes, rssi %d dBm, snr %d dB") \
+    X(LOG_RX_ERROR,             "LoRa RX error, IRQ status 0x%04x (0x20 CRC, 0x40 header, 0x10 sync word)") \
+    X(LOG_RX_TIMEOUT,           "LoRa RX timeout") \
+    X(LOG_DIO_WAKE,             "LoRa wake, semaphore already given %u") \
+    X(LOG_LORA_QUE,             "Queue events for message type %u") \
+    X(LOG_QUE_EVENT,            "Processing event %u") \
+    X(LOG_QUE_RB_LED,           "Rainbow LED %u") \
+    X(LOG_QUE_BUZZER,           "Buzzer %u") \
+    X(LOG_QUE_GEOFENCE_SKIP,    "Inside geofence, skipping routine report") \
+    X(LOG_STACK_BATTERY,        "Stack high water mark after battery update: %u words") \
+    X(LOG_STACK_WAKE_REASON,    "Stack high water mark after handleWakeUpReason: %u words") \
+    X(LOG_STACK_GPS,            "Stack high water mark after activateGPS: %u words") \
+    X(LOG_STACK_FIX_LOOP,       "Stack high water mark in waitForGPSFix loop: %u words") \
+    X(LOG_STACK_FIX,            "Stack high water mark after waitForGPSFix: %u words") \
+    X(LOG_STACK_QUEUE,          "Stack high water mark after processing queued events: %u words") \
+    X(LOG_STACK_SLEEP,          "Stack high water mark after Sleep: %u words") \
+    X(LOG_STACK_SETUP,          "Stack high water mark at end of setup: %u words") \
+    X(LOG_QUE_DROPPED,          "Event %u dropped, priority %u queue full") \
+    X(LOG_QUE_COALESCED,        "Event %u replaced by a newer one") \
+    X(LOG_FRAMES_EXHAUSTED,     "Frame pool empty, packet skipped") \
+    X(LOG_FRAME_OVERFLOW,       "JSON document of message type %u did not fit its frame") \
+    X(LOG_GNSS_INIT_FAILED,     "GNSS init failed, reporting without a fix") \
+    X(LOG_BOOT_REPORT,          "First report %u ms after boot") \
+    X(LOG_BLE_LOCATE_START,     "BLE locate on, reason %u (0 LoRa, 1 BLE, 2 lost fix), %u minutes") \
+    X(LOG_BLE_LOCATE_STOP,      "BLE locate off, reason %u (0 LoRa, 1 BLE, 3 timeout)") \
+    X(LOG_BLE_CONNECTED,        "BLE phone connected, handle %u") \
+    X(LOG_BLE_DISCONNECTED,     "BLE phone disconnected, reason 0x%x") \
+    X(LOG_BLE_COMMAND,          "BLE command, message type %u") \
+    X(LOG_BLE_COMMAND_INVALID,  "BLE command of %u bytes not understood") \
+    X(LOG_BEACON_ON,            "BLE beacon on the Coded PHY, every %u ms") \
+    X(LOG_BEACON_OFF,           "BLE beacon off") \
+    X(LOG_BEACON_FAILED,        "BLE beacon not started, SoftDevice error 0x%x") \
+    X(LOG_FOX_START,            "Fox hunt ping, LoRa fox hunt profile on") \
+    X(LOG_FOX_STOP,             "No fox hunt ping for %u ms, LoRa default profile") \
+    X(LOG_ACK_HELD,             "Acknowledgement of message type %u held for the next frame") \
+    X(LOG_ACK_PIGGYBACKED,      "Acknowledgements 0x%x sent with message type %u") \
+    X(LOG_TRACK_SIMPLIFIED,     "Track page written, simplifier %u fixes in, %u kept, max error %u m") \
+    X(LOG_RX_PARSE_FAILED,      "LoRa packet could not be parsed, JSON error %u") \
+    X(LOG_LORA_READY,           "LoRa initialized, listening") \
+    X(LOG_BACKFILL_BUSY,        "Backfill: radio still busy, giving up") \
+    X(LOG_POWER_TASK_WAIT,      "Power management task waiting for a wakeup") \
+    X(LOG_WAKE,                 "Woke up on %u (0 LoRa, 1 timer)") \
+    X(LOG_GPS_WAKE,             "GPS off, waking it up for a fix") \
+    X(LOG_GPS_WAIT,             "Waiting for a GPS fix, processing the queue") \
+    X(LOG_GPS_FIX_TIMEOUT,      "No GPS fix in %u ms, reporting the last known position") \
+    X(LOG_GPS_FIX_LOCATE,       "No GPS fix, BLE locate on") \
+    X(LOG_WAKE_EVENTS,          "Processing queued events") \
+    X(LOG_GPS_OFF,              "GPS off until the next wakeup") \
+    X(LOG_SLEEP,                "Sleeping %u ms in mode %u, report every %u ms") \
+    X(LOG_SETUP_DONE,           "Setup complete") \
+    X(LOG_MODE_HOLD_EXPIRED,    "Mode policy: hold expired") \
+    X(LOG_MODE_CHANGED,         "Mode policy: mode %u -> %u at %u%% battery") \
+    X(LOG_WAKE_LATENCY,         "Wake latency %u us (wake callback to task), restore %u us") \
+    X(LOG_SLEEP_CURRENT,        "Modelled sleep current %u uA") \
+    X(LOG_TRACK_SEQ_MARK_FAILED, "Track log: failed to write sequence mark %u") \
+    X(LOG_GEOFENCE_CLEARED_ALL, "Geofence: cleared all fences") \
+    X(LOG_GEOFENCE_BAD_ID,      "Geofence: invalid fence id %u") \
+    X(LOG_GEOFENCE_CLEARED,     "Geofence: cleared fence %u") \
+    X(LOG_GEOFENCE_NO_RADIUS,   "Geofence: circle %u without radius") \
+    X(LOG_GEOFENCE_CIRCLE,      "Geofence: circle %u set, radius %u m") \
+    X(LOG_GEOFENCE_BAD_POLYGON, "Geofence: polygon %u has %u vertices, needs 3 to GEOFENCE_MAX_VERTICES") \
+    X(LOG_GEOFENCE_POLYGON,     "Geofence: polygon %u set, %u vertices") \
+    X(LOG_GEOFENCE_BAD_TYPE,    "Geofence: fence %u has unknown type %u") \
+    X(LOG_GEOFENCE_EXITED,      "Geofence: left fence %u, escalating to live tracking") \
+    X(LOG_GEOFENCE_ENTERED,     "Geofence: back inside fence %u") \
+    X(LOG_TRACK_MOUNT_FAILED,   "Track log: failed to mount internal file system") \
+    X(LOG_TRACK_READY,          "Track log initialized, next sequence %u") \
+    X(LOG_TRACK_PAGE_FAILED,    "Track log: failed to open page file %u") \
+    X(LOG_BUZZER_PWM_BUSY,      "Buzzer: PWM peripheral is in use") \
+    X(LOG_BUZZER_PLAYING,       "Buzzer: playing %u notes (%u PWM entries)")
+
+/**
+ * @brief Log message ids.
+ */
+enum LogId : uint16_t {
+#define LOG_ID_ENTRY(id, format) id,
+    LOG_MESSAGES(LOG_ID_ENTRY)
+#undef LOG_ID_ENTRY
+    LOG_ID_COUNT
+};
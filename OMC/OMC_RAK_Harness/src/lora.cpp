@@ -8,6 +8,13 @@
 
  #include "lora.h"
  #include "main.h"
+ #include "tracklog.h"
+ #include "power.h"
+ #include "energy.h"
+ #include "logger.h"
+ #include "metrics.h"
+ #include "queHandler.h"
+ #include "bleHandler.h"
 
 
  // Global variables and objects
@@ -34,7 +41,67 @@
   * @brief Singleton instance pointer for LoraHandler.
   */
  LoraHandler *LoraHandler::instance = nullptr;
+
+ /**
+  * @brief Flag set while a transmission is in progress.
+  */
+ volatile bool LoraHandler::txBusy = false;
+
+ /**
+  * @brief millis() when the current transmission started.
+  */
+ uint32_t LoraHandler::txStartMs = 0;
  
+ /**
+  * @brief Profile the modem is set up for.
+  */
+ LoraProfile LoraHandler::profile = LORA_PROFILE_DEFAULT;
+
+ /**
+  * @brief One-shot timer restarted by every fox hunt ping.
+  */
+ SoftwareTimer LoraHandler::foxTimer;
+
+ /**
+  * @brief One-shot timer that sends the pong.
+  */
+ SoftwareTimer LoraHandler::pongTimer;
+
+ /**
+  * @brief Pong waiting for pongTimer.
+  */
+ uint8_t LoraHandler::pong[FOX_PONG_SIZE];
+
+ /**
+  * @brief Mutex around txBusy, sends and profile switches.
+  */
+ SemaphoreHandle_t LoraHandler::radioMutex = NULL;
+
+ /**
+  * @brief Storage of radioMutex.
+  */
+ StaticSemaphore_t LoraHandler::radioMutexBuffer;
+
+ /**
+  * @brief Modem settings of a LoraProfile.
+  */
+ struct LoraModem
+ {
+     uint8_t spreadingFactor; /**< Spreading Factor. */
+     uint8_t bandwidth;       /**< Bandwidth (0 = 125 kHz, 1 = 250 kHz, 2 = 500 kHz). */
+     uint8_t codingRate;      /**< Coding Rate (1 = 4/5). */
+     uint8_t implicitLength;  /**< Payload length with the implicit header, 0 for the explicit header. */
+ };
+
+ /**
+  * @brief Modem settings indexed by LoraProfile (must match the receiver).
+  */
+ static const LoraModem loraProfiles[LORA_PROFILE_COUNT] = {
+     {LORA_SPREADING_FACTOR, LORA_BANDWIDTH, LORA_CODINGRATE, 0},
+     {FOX_SPREADING_FACTOR, FOX_BANDWIDTH, FOX_CODINGRATE, 0},
+     {FOX_SPREADING_FACTOR, FOX_BANDWIDTH, FOX_CODINGRATE, FOX_PONG_SIZE},
+ };
+
  /**
   * @brief Static variable for handling radio events.
   *
@@ -85,16 +152,22 @@
   * @brief Callback function called when a LoRa transmission completes successfully.
   *
   * This function is invoked by the radio when a transmission is done.
-  * It prints a message and then sets the radio back to receive mode.
+  * It prints a message and then sets the radio back to receive mode, after a pong on the
+  * explicit header fox hunt profile again.
   */
  void LoraHandler::OnTxDone(void)
  {
-     if (instance)
-     {
-         Serial.println("OnTxDone");
-         // Additional post-transmission logic can be added here.
-     }
+     LOG_DEBUG(LOG_TX_DONE);
+     Metrics.add(METRIC_LORA_AIRTIME_MS, millis() - txStartMs);
+     Energy.set(ENERGY_RADIO_TX, 0);
+     Energy.set(ENERGY_RADIO_RX, SLEEP_UA_LORA_RX);
+     // The next send may only start once the radio is back in RX mode.
+     xSemaphoreTake(radioMutex, portMAX_DELAY);
+     txBusy = false;
+     if (profile == LORA_PROFILE_FOX_PONG)
+         setProfile(LORA_PROFILE_FOX_HUNT);
      Radio.Rx(0); // Set radio to RX mode.
+     xSemaphoreGive(radioMutex);
  }
  
  /**
@@ -105,47 +178,37 @@
   */
  void LoraHandler::OnTxTimeout(void)
  {
-     if (instance)
-     {
-         Serial.println("OnTxTimeout");
-         // Handle timeout logic if necessary.
-     }
+     LOG_WARN(LOG_TX_TIMEOUT);
+     Metrics.add(METRIC_LORA_TX_TIMEOUT);
+     Metrics.add(METRIC_LORA_AIRTIME_MS, millis() - txStartMs);
+     Energy.set(ENERGY_RADIO_TX, 0);
+     Energy.set(ENERGY_RADIO_RX, SLEEP_UA_LORA_RX);
+     xSemaphoreTake(radioMutex, portMAX_DELAY);
+     txBusy = false;
+     if (profile == LORA_PROFILE_FOX_PONG)
+         setProfile(LORA_PROFILE_FOX_HUNT);
      Radio.Rx(0); // Set radio to RX mode.
+     xSemaphoreGive(radioMutex);
  }
  
  /**
   * @brief Callback function called when a LoRa reception error occurs.
   *
   * This function is invoked when an RX error is detected.
-  * It reads and prints the IRQ status, clears the error flags, and re-enters RX mode.
+  * It logs the IRQ status (the decoder names the CRC, header and sync word bits),
+  * clears the error flags, and re-enters RX mode.
   */
  void LoraHandler::OnRxError(void)
  {
-     Serial.println("OnRxError");
      // Radio.Standby(); // Optionally set radio to standby.
  
      uint16_t irqStatus = readIrqStatus();
- 
-     Serial.print("IRQ Status: 0x");
-     Serial.println(irqStatus, HEX);
+     LOG_WARN(LOG_RX_ERROR, irqStatus);
+     Metrics.add(METRIC_LORA_RX_ERROR);
  
      // Clear the IRQ status.
      clearIrqStatus(irqStatus);
  
-     // Check for common errors:
-     if (irqStatus & 0x20)
-     {
-         Serial.println(" -> CRC error detected");
-     }
-     if (irqStatus & 0x40)
-     {
-         Serial.println(" -> Header error detected (wrong length/SF/bandwidth?)");
-     }
-     if (irqStatus & 0x10)
-     {
-         Serial.println(" -> SyncWord error detected");
-     }
- 
      // Re-enter receive mode.
      Radio.Rx(0);
  }
@@ -158,7 +221,7 @@
   */
  void LoraHandler::OnRxTimeout(void)
  {
-     Serial.println("OnRxTimeout");
+     LOG_DEBUG(LOG_RX_TIMEOUT);
      // Simply re-enter RX mode to keep listening.
      Radio.Rx(0);
  }
@@ -166,14 +229,17 @@
  /**
   * @brief Serializes the current receivedPacket data into a JSON packet.
   *
-  * Depending on the message type provided, this function fills a JSON document with the appropriate fields,
-  * serializes it into a buffer, and copies it to the global RcvBuffer.
+  * Depending on the message type provided, this function fills a JSON document with the appropriate fields
+  * and serializes it into the global RcvBuffer. The document lives in a frame from the pool.
   *
   * @param msgType The message type to serialize.
   */
  void LoraHandler::SerializeJSON(MessageType msgType)
  {
-     StaticJsonDocument<200> doc;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
      if (msgType == MSG_ALL_DATA)
      {
          doc["lat"] = receivedPacket.lat;
@@ -221,25 +287,43 @@
          doc["rssi"] = receivedPacket.rssi;
          doc["snr"] = receivedPacket.snr;
      }
+     else if (msgType == MSG_GEOFENCE)
+     {
+         doc["id"] = receivedPacket.fence.id;
+         doc["type"] = receivedPacket.fence.type;
+         doc["rssi"] = receivedPacket.rssi;
+         doc["snr"] = receivedPacket.snr;
+     }
+     else if (msgType == MSG_BACKFILL)
+     {
+         doc["since"] = receivedPacket.since;
+         doc["rssi"] = receivedPacket.rssi;
+         doc["snr"] = receivedPacket.snr;
+     }
  
-     char buffer[200];
-     size_t n = serializeJson(doc, buffer, sizeof(buffer));
      memset(RcvBuffer, 0, sizeof(RcvBuffer)); // Clear the entire RcvBuffer.
-     memcpy(RcvBuffer, buffer, n);            // Copy the new JSON payload.
-     RcvBuffer[n] = '\0';                       // Null-terminate the string.
+     serializeJson(doc, RcvBuffer, sizeof(RcvBuffer) - 1); // Leaves the string null-terminated.
+     FramePool.release(frame);
  }
  
+ /**
+  * @brief Wakes the power management task for a received packet.
+  *
+  * Despite the name this runs in the LoRa RX callback, in the SX126x library's task after its
+  * DIO1 interrupt. It is called last, once the packet is parsed and its event published, so the
+  * task never wakes to an empty queue; the wake latency measured from here starts at that point.
+  */
  void DIOInterruptHandler()
  {
+   Power.markWake();
    if (uxSemaphoreGetCount(wakeSemaphore) == 0)
    {
      xSemaphoreGiveFromISR(wakeSemaphore, pdFALSE);
-     Serial.print("Lora After Give: ");
-     Serial.println(uxSemaphoreGetCount(wakeSemaphore));
+     LOG_DEBUG(LOG_DIO_WAKE, 0);
    }
    else
    {
-     Serial.println("Lora: Semaphore already given!");
+     LOG_DEBUG(LOG_DIO_WAKE, 1);
    }
  }
 
@@ -248,8 +332,8 @@
   *
   * This function is called when a LoRa packet is received (RX done).
   * It processes the payload by converting it to JSON, serializes it,
-  * re-enables RX mode, sets the packetReceived flag, prints a message,
-  * queues an event, and gives the wake semaphore.
+  * re-enables RX mode, sets the packetReceived flag, logs the reception,
+  * queues an event, and only then gives the wake semaphore.
   *
   * @param payload Pointer to the received payload buffer.
   * @param size Size of the received payload.
@@ -258,67 +342,184 @@
   */
  void LoraHandler::OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
  {
-     DIOInterruptHandler();
-     delay(10);
+     if (size == FOX_PING_SIZE && payload[0] == MSG_FOX_PING)
+     {
+         // Answered right here, the power management task sleeps on.
+         answerPing(payload[1], rssi, snr);
+         return;
+     }
      OnRxToJSON(payload, rssi, snr);
      SerializeJSON(receivedPacket.msgType);
      Radio.Rx(RX_TIMEOUT_VALUE);
      packetReceived = true;
-     Serial.println("Received Packet");
+     LOG_INFO(LOG_RX_DONE, size, rssi, snr);
+     Metrics.add(METRIC_LORA_RX);
      queEvent();
+     DIOInterruptHandler();
 }
 
  /**
-  * @brief Queues a LoRa event based on the current message type in receivedPacket.
+  * @brief Answers a fox hunt ping with a pong.
   *
-  * This function checks the global receivedPacket.msgType and then sends corresponding
-  * events into the commandQueue. It also sets the msgType in receivedPacket to MSG_WAKE_TIMER
-  * after processing.
+  * The pong is MSG_FOX_PONG, the sequence number of the ping, and the RSSI and SNR the ping
+  * arrived with, so the receiver also sees how well the harness hears it. Every ping restarts
+  * the FOX_IDLE_MS timer that switches back to the default profile.
+  *
+  * The receiver listens for exactly FOX_PONG_SIZE bytes right after its ping, so the pong leaves
+  * out the explicit header. FOX_PONG_DELAY_MS gives the receiver the time to turn around; the
+  * RX callback does not wait for it, pongTimer sends the pong from the timer daemon.
+  *
+  * @param seq Sequence number of the ping.
+  * @param rssi RSSI of the ping.
+  * @param snr SNR of the ping.
+  */
+ void LoraHandler::answerPing(uint8_t seq, int16_t rssi, int8_t snr)
+ {
+     if (profile == LORA_PROFILE_DEFAULT)
+     {
+         LOG_INFO(LOG_FOX_START);
+     }
+     foxTimer.reset();
+     pong[0] = MSG_FOX_PONG;
+     pong[1] = seq;
+     pong[2] = (uint8_t)(int8_t)constrain(rssi, (int16_t)-128, (int16_t)127);
+     pong[3] = (uint8_t)snr;
+     pongTimer.reset();
+ }
+
+ /**
+  * @brief Sends the pong prepared by answerPing().
+  *
+  * Without a LoraHandler, or with a report on air, the pong is left out and the radio only
+  * listens on the fox hunt profile.
+  *
+  * @param unused Timer handle.
+  */
+ void LoraHandler::onPongDue(TimerHandle_t unused)
+ {
+     xSemaphoreTake(radioMutex, portMAX_DELAY);
+     if (txBusy || instance == nullptr)
+     {
+         setProfile(LORA_PROFILE_FOX_HUNT);
+         Radio.Rx(0);
+     }
+     else
+     {
+         setProfile(LORA_PROFILE_FOX_PONG);
+         instance->transmit(pong, FOX_PONG_SIZE);
+     }
+     xSemaphoreGive(radioMutex);
+ }
+
+ /**
+  * @brief Goes back to the default profile once the pings stopped.
+  *
+  * A report on air finishes on the fox hunt profile first. The check and the switch hold
+  * radioMutex, so no send can start in between.
+  *
+  * @param unused Timer handle.
+  */
+ void LoraHandler::onFoxIdle(TimerHandle_t unused)
+ {
+     xSemaphoreTake(radioMutex, portMAX_DELAY);
+     if (txBusy)
+     {
+         xSemaphoreGive(radioMutex);
+         foxTimer.reset();
+         return;
+     }
+     setProfile(LORA_PROFILE_DEFAULT);
+     Radio.Rx(0);
+     xSemaphoreGive(radioMutex);
+     LOG_INFO(LOG_FOX_STOP, FOX_IDLE_MS);
+ }
+
+ /**
+  * @brief Sets up the modem for a profile.
+  *
+  * @param next Profile to switch to.
+  */
+ void LoraHandler::setProfile(LoraProfile next)
+ {
+     const LoraModem &modem = loraProfiles[next];
+     bool implicitHeader = modem.implicitLength != 0;
+     Radio.Standby();
+     Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, modem.bandwidth,
+                       modem.spreadingFactor, modem.codingRate,
+                       LORA_PREAMBLE_LENGTH, implicitHeader,
+                       true, 0, 0, LORA_IQ_INVERSION_ON, TX_TIMEOUT_VALUE);
+     Radio.SetRxConfig(MODEM_LORA, modem.bandwidth, modem.spreadingFactor,
+                       modem.codingRate, 0, LORA_PREAMBLE_LENGTH,
+                       LORA_SYMBOL_TIMEOUT, implicitHeader,
+                       modem.implicitLength, true, 0, 0, LORA_IQ_INVERSION_ON,
+                       !implicitHeader);
+     profile = next;
+ }
+
+ /**
+  * @brief Publishes the event for the message type in receivedPacket on the event bus.
+  *
+  * The event carries a copy of the payload that was just parsed, so a packet that arrives
+  * before the event is processed cannot change it. Commands from the receiver are published
+  * together with their acknowledgement. Afterwards the msgType in receivedPacket is set to
+  * MSG_WAKE_TIMER.
   */
  void LoraHandler::queEvent()
  {
+   LOG_DEBUG(LOG_LORA_QUE, receivedPacket.msgType);
+   Event event = {};
    switch (receivedPacket.msgType)
    {
    case MSG_ALL_DATA:
      // No extra event queued.
-     Serial.println("Que All Data");
      break;
    case MSG_ACKNOWLEDGEMENT:
      // No extra event queued.
-     Serial.println("Que Acknowledgement");
      break;
    case MSG_BUZZER:
-     eventType = EVENT_ACKNOWLEDGEMENT;
-     xQueueSend(commandQueue, &eventType, 0);
-     eventType = EVENT_BUZZER;
-     xQueueSend(commandQueue, &eventType, 0);
-     Serial.println("Que Buzzer");
+     event.type = EVENT_BUZZER;
+     event.on = receivedPacket.buzzer;
+     queHandler.publishCommand(event);
      break;
    case MSG_LED:
-     eventType = EVENT_ACKNOWLEDGEMENT;
-     xQueueSend(commandQueue, &eventType, 0);
-     eventType = EVENT_LED;
-     xQueueSend(commandQueue, &eventType, 0);
-     Serial.println("Que LED");
+     event.type = EVENT_LED;
+     event.color.r = receivedPacket.r;
+     event.color.g = receivedPacket.g;
+     event.color.b = receivedPacket.b;
+     queHandler.publishCommand(event);
      break;
    case MSG_RB_LED:
-     eventType = EVENT_ACKNOWLEDGEMENT;
-     xQueueSend(commandQueue, &eventType, 0);
-     eventType = EVENT_RB_LED;
-     xQueueSend(commandQueue, &eventType, 0);
-     Serial.println("Que Rainbow LED");
+     event.type = EVENT_RB_LED;
+     event.on = receivedPacket.rbLed;
+     queHandler.publishCommand(event);
      break;
    case MSG_PWR_MODE:
-     eventType = EVENT_ACKNOWLEDGEMENT;
-     xQueueSend(commandQueue, &eventType, 0);
-     eventType = EVENT_PWR_MODE;
-     xQueueSend(commandQueue, &eventType, 0);
-     Serial.println("Que Power Mode");
+     event.type = EVENT_PWR_MODE;
+     event.power.mode = receivedPacket.requestedMode;
+     event.power.hold = receivedPacket.hold;
+     queHandler.publishCommand(event);
+     break;
+   case MSG_GEOFENCE:
+     event.type = EVENT_GEOFENCE;
+     event.fence = receivedPacket.fence;
+     queHandler.publishCommand(event);
+     break;
+   case MSG_LOCATE:
+     event.type = EVENT_LOCATE;
+     event.locate.on = receivedPacket.locate;
+     event.locate.minutes = receivedPacket.locateMinutes;
+     event.locate.reason = LOCATE_REASON_LORA;
+     queHandler.publishCommand(event);
+     break;
+   case MSG_BACKFILL:
+     // The backfill frames themselves tell the receiver the request arrived.
+     event.type = EVENT_BACKFILL;
+     event.since = receivedPacket.since;
+     queHandler.publish(event);
      break;
    default:
-     eventType = EVENT_WAKE_TIMER;
-     xQueueSend(commandQueue, &eventType, 0);
-     Serial.println("Que Wakeup Timer");
+     event.type = EVENT_WAKE_TIMER;
+     queHandler.publish(event);
      break;
    }
    // Set the received packet message type to wake timer after queuing.
@@ -337,8 +538,11 @@
   */
  void LoraHandler::OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr)
  {
-     // Parse the payload using ArduinoJson.
-     StaticJsonDocument<256> doc;
+     // Parse the payload using ArduinoJson, in a frame from the pool.
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
      DeserializationError error = deserializeJson(doc, (char *)payload);
      if (!error)
      {
@@ -361,7 +565,9 @@
          }
          if (receivedPacket.msgType == MSG_PWR_MODE)
          {
-             receivedPacket.mode = doc["mode"];
+             // The effective mode is set by the mode policy when the event is processed.
+             receivedPacket.requestedMode = doc["mode"];
+             receivedPacket.hold = doc["hold"] | 0;
              receivedPacket.rssi = rssi;
              receivedPacket.snr = snr;
          }
@@ -377,6 +583,40 @@
              receivedPacket.rssi = rssi;
              receivedPacket.snr = snr;
          }
+         if (receivedPacket.msgType == MSG_GEOFENCE)
+         {
+             // Vertex 0 (or the circle center) is absolute, the others are deltas from it.
+             GeofenceShape &fence = receivedPacket.fence;
+             fence.id = doc["id"];
+             fence.type = doc["type"];
+             fence.radius = doc["rad"];
+             fence.lat[0] = doc["lat"];
+             fence.lon[0] = doc["lon"];
+             JsonArray dlat = doc["dlat"];
+             JsonArray dlon = doc["dlon"];
+             fence.count = 1;
+             for (size_t i = 0; i < dlat.size() && i < dlon.size() && fence.count < GEOFENCE_MAX_VERTICES; i++)
+             {
+                 fence.lat[fence.count] = fence.lat[0] + dlat[i].as<int32_t>();
+                 fence.lon[fence.count] = fence.lon[0] + dlon[i].as<int32_t>();
+                 fence.count++;
+             }
+             receivedPacket.rssi = rssi;
+             receivedPacket.snr = snr;
+         }
+         if (receivedPacket.msgType == MSG_LOCATE)
+         {
+             receivedPacket.locate = doc["on"];
+             receivedPacket.locateMinutes = doc["min"] | 0;
+             receivedPacket.rssi = rssi;
+             receivedPacket.snr = snr;
+         }
+         if (receivedPacket.msgType == MSG_BACKFILL)
+         {
+             receivedPacket.since = doc["since"];
+             receivedPacket.rssi = rssi;
+             receivedPacket.snr = snr;
+         }
          if (receivedPacket.msgType == MSG_ALL_DATA)
          {
              receivedPacket.lat = doc["lat"];
@@ -395,9 +635,9 @@
      }
      else
      {
-         Serial.print("JSON parse failed: ");
-         Serial.println(error.c_str());
+         LOG_WARN(LOG_RX_PARSE_FAILED, (uint32_t)error.code());
      }
+     FramePool.release(frame);
  }
  
  
@@ -412,6 +652,11 @@
  void LoraHandler::begin()
  {
      instance = this;
+     Metrics.registerCounter(METRIC_LORA_TX);
+     Metrics.registerCounter(METRIC_LORA_TX_TIMEOUT);
+     Metrics.registerCounter(METRIC_LORA_AIRTIME_MS);
+     Metrics.registerCounter(METRIC_LORA_RX);
+     Metrics.registerCounter(METRIC_LORA_RX_ERROR);
  
      // Initialize LoRa chip using RAK function.
      lora_rak4630_init();
@@ -425,24 +670,20 @@
      RadioEvents.CadDone = NULL;
  
      // Initialize the Radio with the configured events.
+     radioMutex = xSemaphoreCreateMutexStatic(&radioMutexBuffer);
      Radio.Init(&RadioEvents);
  
-     // Set frequency and TX configuration.
+     // Set frequency, then the TX and RX configuration of the default profile.
      Radio.SetChannel(RF_FREQUENCY);
-     Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, LORA_BANDWIDTH,
-                       LORA_SPREADING_FACTOR, LORA_CODINGRATE,
-                       LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON,
-                       true, 0, 0, LORA_IQ_INVERSION_ON, TX_TIMEOUT_VALUE);
-     // Set RX configuration.
-     Radio.SetRxConfig(MODEM_LORA, LORA_BANDWIDTH, LORA_SPREADING_FACTOR,
-                       LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
-                       LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
-                       0, true, 0, 0, LORA_IQ_INVERSION_ON, true);
+     setProfile(LORA_PROFILE_DEFAULT);
+     foxTimer.begin(FOX_IDLE_MS, onFoxIdle, NULL, false);
+     pongTimer.begin(FOX_PONG_DELAY_MS, onPongDue, NULL, false);
  
      loraInitialized = true;
-     Serial.println("Starting Radio.Rx");
+     ackAirtime(); // Measured once up front for coalesced commands in the RX callback.
+     Energy.set(ENERGY_RADIO_RX, SLEEP_UA_LORA_RX);
      Radio.Rx(RX_TIMEOUT_VALUE);
-     Serial.println("LoRa initialized.");
+     LOG_INFO(LOG_LORA_READY);
     //  detachInterrupt(LORA_DIO_PIN);
     //  delay(100);
     //  attachInterrupt(LORA_DIO_PIN, DIOInterruptHandler, FALLING);
@@ -483,7 +724,10 @@
  {
      if (!loraInitialized)
          return;
-     StaticJsonDocument<200> doc;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
      doc["msgType"] = MSG_ALL_DATA;
      doc["lat"] = lat;
      doc["lon"] = lon;
@@ -493,6 +737,9 @@
      doc["siv"] = siv;
      doc["hdop"] = hdop;
      doc["alt"] = alt;
+     doc["seq"] = receivedPacket.seq; // Track log sequence number for gap detection.
+     if (BLE.isLocating())
+         doc["loc"] = true; // BLE locate mode on, the app can connect to the harness.
  
      // Default values always sent.
      doc["mode"] = receivedPacket.mode;
@@ -502,15 +749,14 @@
      doc["b"] = receivedPacket.b;
      doc["hBatt"] = receivedPacket.hBatt; // Harness battery level.
  
-     char buffer[200];
-     size_t n = serializeJson(doc, buffer, sizeof(buffer));
-     sendPacket((uint8_t *)buffer, n);
+     sendFrame(frame, doc);
  }
  
  /**
   * @brief Sends a JSON packet for acknowledgement (MSG_ACKNOWLEDGEMENT) over LoRa.
   *
-  * This function serializes an acknowledgement command into JSON and sends it via LoRa.
+  * This function serializes an acknowledgement command into JSON and sends it via LoRa. It
+  * carries every held acknowledgement.
   *
   * @param ack Boolean flag for acknowledgement.
   */
@@ -518,9 +764,63 @@
  {
      if (!loraInitialized)
          return;
-     StaticJsonDocument<200> doc;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     serializeAck(ack, heldAcks, frame);
+     heldAcks = 0;
+     ackAirtimeMs = Radio.TimeOnAir(MODEM_LORA, frame->len);
+     sendPacket(frame->data, frame->len);
+     FramePool.release(frame);
+ }
+ 
+ /**
+  * @brief Gets the time on air an acknowledgement with the current state would take.
+  *
+  * @return Time on air in milliseconds.
+  */
+ uint32_t LoraHandler::ackAirtime()
+ {
+     if (!loraInitialized)
+         return 0;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return 0;
+     serializeAck(true, 0, frame);
+     ackAirtimeMs = Radio.TimeOnAir(MODEM_LORA, frame->len);
+     FramePool.release(frame);
+     return ackAirtimeMs;
+ }
+
+ /**
+  * @brief Gets the acknowledgement time on air measured last by ackAirtime() or SendJSON(bool).
+  *
+  * The acknowledgement only changes by a few digits with the state, so the last measurement is
+  * good enough for the airtime saved metric.
+  *
+  * @return Time on air in milliseconds.
+  */
+ uint32_t LoraHandler::getAckAirtime()
+ {
+     return ackAirtimeMs;
+ }
+ 
+ /**
+  * @brief Serializes an acknowledgement with the current state into a frame.
+  *
+  * @param ack Boolean flag for acknowledgement.
+  * @param acks Bitmap of the acknowledged commands (1 << MessageType).
+  * @param frame Frame that receives the payload.
+  */
+ void LoraHandler::serializeAck(bool ack, uint32_t acks, Frame *frame)
+ {
+     JsonDocument doc(frame);
      doc["msgType"] = MSG_ACKNOWLEDGEMENT;
      doc["ack"] = ack;
+     if (acks != 0)
+         doc["acks"] = acks;
+     if (BLE.isLocating())
+         doc["loc"] = true; // BLE locate mode on, the app can connect to the harness.
  
      // Default values always sent.
      doc["mode"] = receivedPacket.mode;
@@ -530,9 +830,243 @@
      doc["b"] = receivedPacket.b;
      doc["hBatt"] = receivedPacket.hBatt; // Harness battery level.
  
-     char buffer[200];
-     size_t n = serializeJson(doc, buffer, sizeof(buffer));
-     sendPacket((uint8_t *)buffer, n);
+     frame->len = serializeJson(doc, frame->data, FRAME_SIZE);
+ }
+ 
+ /**
+  * @brief Holds the acknowledgement of a handled command for the next outbound frame.
+  *
+  * The deadline counts from the first acknowledgement held, later ones go out with it.
+  *
+  * @param command Message type of the command.
+  */
+ void LoraHandler::holdAck(MessageType command)
+ {
+     if (heldAcks == 0)
+         heldMs = millis();
+     heldAcks |= (uint32_t)1 << command;
+     LOG_DEBUG(LOG_ACK_HELD, command);
+ }
+ 
+ /**
+  * @brief Sends the held acknowledgements on their own unless a report carries them in time.
+  *
+  * @param reportInMs Milliseconds until the next routine report, ACK_NO_REPORT if none is due.
+  */
+ void LoraHandler::flushAcks(uint32_t reportInMs)
+ {
+     if (heldAcks == 0)
+         return;
+     if (reportInMs != ACK_NO_REPORT && (millis() - heldMs) + reportInMs <= ACK_PIGGYBACK_MS)
+         return;
+     // The command may just have started a transmission of its own.
+     waitForTxDone(TX_TIMEOUT_VALUE);
+     SendJSON(true);
+ }
+ 
+ /**
+  * @brief Sends a geofence crossing alert (MSG_GEOFENCE_ALERT) over LoRa.
+  *
+  * This function is called as soon as a crossing is detected, ahead of any other queued event.
+  *
+  * @param fenceId Id of the fence that was crossed.
+  * @param inside True if the pet came back inside, false if it left.
+  * @param lat Latitude.
+  * @param lon Longitude.
+  */
+ void LoraHandler::SendGeofenceAlert(uint8_t fenceId, bool inside, double lat, double lon)
+ {
+     if (!loraInitialized)
+         return;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
+     doc["msgType"] = MSG_GEOFENCE_ALERT;
+     doc["fence"] = fenceId;
+     doc["inside"] = inside;
+     doc["lat"] = lat;
+     doc["lon"] = lon;
+     doc["mode"] = receivedPacket.mode;
+     doc["hBatt"] = receivedPacket.hBatt; // Harness battery level.
+ 
+     sendFrame(frame, doc);
+ }
+ 
+ /**
+  * @brief Sends logged fixes newer than a sequence number (MSG_BACKFILL_DATA) over LoRa.
+  *
+  * Each frame holds the sequence number of its first fix and an array of
+  * [lat, lon, seconds of day, siv, sequence step] entries. The first entry is absolute
+  * (degrees * 1e7), the following ones are deltas from the previous fix, which keeps four fixes
+  * well inside one frame. The sequence step is needed because the simplifier leaves holes.
+  *
+  * @param since Sequence number of the last fix the receiver has.
+  */
+ void LoraHandler::SendBackfill(uint32_t since)
+ {
+     if (!loraInitialized)
+         return;
+     TrackFix fixes[TRACKLOG_FIXES_PER_FRAME];
+     for (uint8_t frame = 0; frame < TRACKLOG_BACKFILL_FRAMES; frame++)
+     {
+         uint16_t count = TrackLog.readSince(since, fixes, TRACKLOG_FIXES_PER_FRAME);
+         if (count == 0)
+             break;
+         since = fixes[count - 1].seq;
+
+         Frame *packet = FramePool.acquire();
+         if (packet == NULL)
+             return;
+         JsonDocument doc(packet);
+         doc["msgType"] = MSG_BACKFILL_DATA;
+         doc["seq"] = fixes[0].seq;
+         JsonArray list = doc["fixes"].to<JsonArray>();
+         for (uint16_t i = 0; i < count; i++)
+         {
+             JsonArray entry = list.add<JsonArray>();
+             entry.add(i == 0 ? fixes[i].lat : fixes[i].lat - fixes[i - 1].lat);
+             entry.add(i == 0 ? fixes[i].lon : fixes[i].lon - fixes[i - 1].lon);
+             entry.add((uint32_t)fixes[i].hour * 3600 + fixes[i].min * 60 + fixes[i].sec);
+             entry.add(fixes[i].siv);
+             entry.add(i == 0 ? 0 : fixes[i].seq - fixes[i - 1].seq);
+         }
+         if (frame == TRACKLOG_BACKFILL_FRAMES - 1 && since < TrackLog.getLastSeq())
+         {
+             doc["more"] = true;
+         }
+
+         if (!waitForTxDone(TX_TIMEOUT_VALUE))
+         {
+             LOG_WARN(LOG_BACKFILL_BUSY);
+             FramePool.release(packet);
+             return;
+         }
+         sendFrame(packet, doc);
+     }
+ }
+
+ /**
+  * @brief Sends the effective power mode (MSG_PWR_MODE) over LoRa.
+  *
+  * Sent on every change of the effective mode. "auto" is true when the battery policy
+  * chose the mode rather than the app.
+  *
+  * @param mode Effective mode.
+  * @param automatic True if the battery policy overrides the requested mode.
+  */
+ void LoraHandler::SendModeChange(DeviceMode mode, bool automatic)
+ {
+     if (!loraInitialized)
+         return;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
+     doc["msgType"] = MSG_PWR_MODE;
+     doc["mode"] = mode;
+     doc["auto"] = automatic;
+     doc["hBatt"] = receivedPacket.hBatt; // Harness battery level.
+
+     sendFrame(frame, doc);
+ }
+
+ /**
+  * @brief Sends the energy ledger totals (MSG_ENERGY) over LoRa.
+  *
+  * "boot" and "last" hold the charge of each subsystem in microamp hours since boot and since
+  * the previous energy report, in EnergySubsystem order. "avg" is the average current in
+  * microamps and "ttl" the projected hours left on the battery at that current.
+  */
+ void LoraHandler::SendEnergy()
+ {
+     if (!loraInitialized)
+         return;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
+     doc["msgType"] = MSG_ENERGY;
+     JsonArray boot = doc["boot"].to<JsonArray>();
+     JsonArray last = doc["last"].to<JsonArray>();
+     for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++)
+     {
+         boot.add(Energy.getBootUah((EnergySubsystem)i));
+         last.add(Energy.getReportUah((EnergySubsystem)i));
+     }
+     doc["avg"] = Energy.getAverageUa();
+     doc["ttl"] = Energy.getHoursRemaining(receivedPacket.hBatt);
+     doc["hBatt"] = receivedPacket.hBatt; // Harness battery level.
+
+     sendFrame(frame, doc);
+ }
+
+ /**
+  * @brief Sends the runtime metrics snapshot (MSG_METRICS) over LoRa.
+  *
+  * The snapshot is binary, so it goes base64 encoded in the "m" field of the JSON frame.
+  */
+ void LoraHandler::SendMetrics()
+ {
+     if (!loraInitialized)
+         return;
+     // Static, only the power management task sends metrics.
+     static uint8_t snapshot[METRICS_SNAPSHOT_MAX];
+     static char encoded[4 * ((METRICS_SNAPSHOT_MAX + 2) / 3) + 1];
+     size_t len = Metrics.snapshot(snapshot, sizeof(snapshot));
+     if (len == 0 || MetricsHandler::toBase64(snapshot, len, encoded, sizeof(encoded)) == 0)
+         return;
+     Frame *frame = FramePool.acquire();
+     if (frame == NULL)
+         return;
+     JsonDocument doc(frame);
+     doc["msgType"] = MSG_METRICS;
+     doc["m"] = (const char *)encoded;
+
+     sendFrame(frame, doc);
+ }
+
+ /**
+  * @brief Waits until the radio has finished the current transmission.
+  *
+  * @param timeoutMs Maximum time to wait in milliseconds.
+  * @return true if the radio is idle, false on timeout.
+  */
+ bool LoraHandler::waitForTxDone(uint32_t timeoutMs)
+ {
+     uint32_t start = millis();
+     while (txBusy)
+     {
+         if ((millis() - start) >= timeoutMs)
+             return false;
+         vTaskDelay(pdMS_TO_TICKS(10));
+     }
+     return true;
+ }
+
+ /**
+  * @brief Serializes a JSON document into its frame, sends it and releases the frame.
+  *
+  * Held acknowledgements are added to the document first.
+  *
+  * @param frame Frame the document was built in, released on return.
+  * @param doc Document to send.
+  */
+ void LoraHandler::sendFrame(Frame *frame, JsonDocument &doc)
+ {
+     if (heldAcks != 0)
+     {
+         // The acknowledgements ride along and save a frame of their own.
+         Metrics.add(METRIC_AIRTIME_SAVED_MS, ackAirtime());
+         doc["acks"] = heldAcks;
+         LOG_INFO(LOG_ACK_PIGGYBACKED, heldAcks, doc["msgType"].as<uint8_t>());
+         heldAcks = 0;
+     }
+     if (doc.overflowed())
+         LOG_WARN(LOG_FRAME_OVERFLOW, doc["msgType"].as<uint8_t>());
+     frame->len = serializeJson(doc, frame->data, FRAME_SIZE);
+     sendPacket(frame->data, frame->len);
+     FramePool.release(frame);
  }
  
  /**
@@ -547,10 +1081,26 @@
  {
      if (!loraInitialized)
          return;
+     xSemaphoreTake(radioMutex, portMAX_DELAY);
+     transmit(buffer, size);
+     xSemaphoreGive(radioMutex);
+ }
+
+ /**
+  * @brief Starts a transmission, the caller holds radioMutex.
+  *
+  * @param buffer Pointer to the data buffer.
+  * @param size Size of the data to send.
+  */
+ void LoraHandler::transmit(uint8_t *buffer, uint8_t size)
+ {
+     txBusy = true;
+     Energy.set(ENERGY_RADIO_RX, 0);
+     Energy.set(ENERGY_RADIO_TX, EnergyHandler::txCurrentUa(TX_OUTPUT_POWER));
+     txStartMs = millis();
+     Metrics.add(METRIC_LORA_TX);
      Radio.Send(buffer, size);
-     Serial.print("Sent Packet: ");
-     Serial.write((char *)buffer);
-     Serial.println();
+     LOG_DEBUG(LOG_TX_SENT, size);
  }
  
  /**
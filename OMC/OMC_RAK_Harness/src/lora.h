@@ -9,6 +9,7 @@
  */
 
 #include "main.h"
+#include "framepool.h"
 
 /**
  * @brief Global receive buffer for LoRa packets.
@@ -17,6 +18,16 @@
  */
 extern uint8_t RcvBuffer[200];
 
+/**
+ * @brief LoRa modem settings, the receiver has to use the same one.
+ */
+enum LoraProfile : uint8_t {
+    LORA_PROFILE_DEFAULT = 0,   /**< LORA_SPREADING_FACTOR, long range. */
+    LORA_PROFILE_FOX_HUNT,      /**< FOX_* settings, shortest airtime for the fox hunt pings. */
+    LORA_PROFILE_FOX_PONG,      /**< FOX_* settings with the implicit header, for the pong only. */
+    LORA_PROFILE_COUNT          /**< Number of profiles. */
+};
+
 /**
  * @class LoraHandler
  * @brief Manages LoRa communications.
@@ -87,6 +98,97 @@ public:
      */
     void SendJSON(bool ack);
 
+    /**
+     * @brief Gets the time on air an acknowledgement with the current state would take.
+     *
+     * Serializes an acknowledgement from receivedPacket, so it is called from setup and the power
+     * management task only, never from the radio callbacks. The result is kept for getAckAirtime().
+     *
+     * @return Time on air in milliseconds.
+     */
+    uint32_t ackAirtime();
+
+    /**
+     * @brief Gets the acknowledgement time on air measured last by ackAirtime() or SendJSON(bool).
+     *
+     * Safe from any context, used to account for the airtime saved when commands are coalesced.
+     *
+     * @return Time on air in milliseconds.
+     */
+    uint32_t getAckAirtime();
+
+    /**
+     * @brief Holds the acknowledgement of a handled command for the next outbound frame.
+     *
+     * @param command Message type of the command.
+     */
+    void holdAck(MessageType command);
+
+    /**
+     * @brief Sends the held acknowledgements on their own unless a report carries them in time.
+     *
+     * Called before the harness sleeps. The acknowledgements keep waiting if the next routine
+     * report goes out within ACK_PIGGYBACK_MS of the first one held.
+     *
+     * @param reportInMs Milliseconds until the next routine report, ACK_NO_REPORT if none is due.
+     */
+    void flushAcks(uint32_t reportInMs);
+
+    /**
+     * @brief Sends a geofence crossing alert (MSG_GEOFENCE_ALERT) over LoRa.
+     *
+     * The alert carries the crossed fence, the new side and the current position so the app can
+     * react without waiting for the next routine report.
+     *
+     * @param fenceId Id of the fence that was crossed.
+     * @param inside True if the pet came back inside, false if it left.
+     * @param lat Latitude.
+     * @param lon Longitude.
+     */
+    void SendGeofenceAlert(uint8_t fenceId, bool inside, double lat, double lon);
+
+    /**
+     * @brief Sends logged fixes newer than a sequence number (MSG_BACKFILL_DATA) over LoRa.
+     *
+     * Up to TRACKLOG_BACKFILL_FRAMES frames of TRACKLOG_FIXES_PER_FRAME fixes are sent back to
+     * back. The last frame carries "more" if the log still holds newer fixes, so the receiver
+     * can ask for the next batch.
+     *
+     * @param since Sequence number of the last fix the receiver has.
+     */
+    void SendBackfill(uint32_t since);
+
+    /**
+     * @brief Sends the energy ledger totals (MSG_ENERGY) over LoRa.
+     *
+     * Carries the charge per subsystem since boot and since the last energy report, the
+     * average current and the projected hours left on the battery.
+     */
+    void SendEnergy();
+
+    /**
+     * @brief Sends the runtime metrics snapshot (MSG_METRICS) over LoRa.
+     *
+     * The binary snapshot is carried base64 encoded in the "m" field.
+     */
+    void SendMetrics();
+
+    /**
+     * @brief Sends the effective power mode (MSG_PWR_MODE) over LoRa.
+     *
+     * @param mode Effective mode.
+     * @param automatic True if the battery policy overrides the requested mode.
+     */
+    void SendModeChange(DeviceMode mode, bool automatic);
+
+    /**
+     * @brief Waits until the radio has finished the current transmission.
+     *
+     * @param timeoutMs Maximum time to wait in milliseconds.
+     * @return true if the radio is idle, false on timeout.
+     */
+    bool waitForTxDone(uint32_t timeoutMs);
+
     // The following functions are placeholders for other message types:
     // MSG_BUZZER, MSG_LED, MSG_RB_LED, MSG_PWR_MODE can be implemented as needed.
 
@@ -129,6 +231,33 @@ private:
      */
     void sendPacket(uint8_t *buffer, uint8_t size);
 
+    /**
+     * @brief Starts a transmission, the caller holds radioMutex.
+     *
+     * @param buffer Pointer to the data buffer.
+     * @param size Size of the data to send.
+     */
+    void transmit(uint8_t *buffer, uint8_t size);
+
+    /**
+     * @brief Serializes an acknowledgement with the current state into a frame.
+     *
+     * @param ack Boolean flag for acknowledgement.
+     * @param acks Bitmap of the acknowledged commands (1 << MessageType).
+     * @param frame Frame that receives the payload.
+     */
+    static void serializeAck(bool ack, uint32_t acks, Frame *frame);
+
+    /**
+     * @brief Serializes a JSON document into its frame, sends it and releases the frame.
+     *
+     * Held acknowledgements are added to the document first.
+     *
+     * @param frame Frame the document was built in, released on return.
+     * @param doc Document to send.
+     */
+    void sendFrame(Frame *frame, JsonDocument &doc);
+
     // Static callback functions required by the SX126x driver:
 
     /**
@@ -191,10 +320,46 @@ private:
      */
     static void OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr);
 
+    /**
+     * @brief Sets up the modem for a profile.
+     *
+     * The caller puts the radio back in RX mode or sends.
+     *
+     * @param next Profile to switch to.
+     */
+    static void setProfile(LoraProfile next);
+
+    /**
+     * @brief Answers a fox hunt ping with a pong.
+     *
+     * Runs in the RX callback, so the pong is only prepared here and sent by pongTimer
+     * FOX_PONG_DELAY_MS later. The pong goes out on LORA_PROFILE_FOX_PONG, and the TX done
+     * callback goes back to the fox hunt profile.
+     *
+     * @param seq Sequence number of the ping.
+     * @param rssi RSSI of the ping.
+     * @param snr SNR of the ping.
+     */
+    static void answerPing(uint8_t seq, int16_t rssi, int8_t snr);
+
+    /**
+     * @brief Timer callback, goes back to the default profile once the pings stopped.
+     *
+     * @param unused Timer handle.
+     */
+    static void onFoxIdle(TimerHandle_t unused);
+
+    /**
+     * @brief Timer callback, sends the pong prepared by answerPing().
+     *
+     * @param unused Timer handle.
+     */
+    static void onPongDue(TimerHandle_t unused);
+
     /**
      * @brief Queues an event based on the current message type in receivedPacket.
      *
-     * This static function examines receivedPacket.msgType and sends corresponding events into the commandQueue.
+     * This static function examines receivedPacket.msgType and publishes the corresponding events on the event bus.
      */
     static void queEvent();
 
@@ -205,8 +370,66 @@ private:
      */
     static LoraHandler* instance;
 
+    /**
+     * @brief Flag set while a transmission is in progress.
+     *
+     * Set by transmit() and cleared by the TX done and TX timeout callbacks, under radioMutex.
+     */
+    static volatile bool txBusy;
+
+    /**
+     * @brief millis() when the current transmission started, for the airtime metric.
+     */
+    static uint32_t txStartMs;
+
+    /**
+     * @brief Profile the modem is set up for.
+     */
+    static LoraProfile profile;
+
+    /**
+     * @brief One-shot timer restarted by every ping, ends the fox hunt profile.
+     */
+    static SoftwareTimer foxTimer;
+
+    /**
+     * @brief One-shot timer started by every ping, sends the pong FOX_PONG_DELAY_MS later.
+     */
+    static SoftwareTimer pongTimer;
+
+    /**
+     * @brief Pong waiting for pongTimer.
+     */
+    static uint8_t pong[FOX_PONG_SIZE];
+
+    /**
+     * @brief Serializes txBusy and every send or profile switch between the power management
+     * task, the timer daemon and the radio callbacks.
+     */
+    static SemaphoreHandle_t radioMutex;
+
+    /**
+     * @brief Storage of radioMutex.
+     */
+    static StaticSemaphore_t radioMutexBuffer;
+
     /**
      * @brief Flag indicating whether the LoRa radio has been successfully initialized.
      */
     bool loraInitialized = false;
+
+    /**
+     * @brief Bitmap of the commands whose acknowledgement is held (1 << MessageType).
+     */
+    uint32_t heldAcks = 0;
+
+    /**
+     * @brief Time on air of the last acknowledgement measured, in milliseconds.
+     */
+    volatile uint32_t ackAirtimeMs = 0;
+
+    /**
+     * @brief millis() when the first held acknowledgement was held.
+     */
+    uint32_t heldMs = 0;
 };
@@ -10,43 +10,58 @@
 #include "buzzer.h"
 #include "lora.h"
 #include "bleHandler.h"
+#include "beacon.h"
 #include "batt.h"
 #include "rgb.h"
+#include "geofence.h"
+#include "tracklog.h"
+#include "power.h"
+#include "energy.h"
+#include "modepolicy.h"
+#include "logger.h"
+#include "metrics.h"
+#include "queHandler.h"
+#include "framepool.h"
 #include <Wire.h>
 
 QueHandler queHandler;
 GPSHandler GPS;
 SemaphoreHandle_t wakeSemaphore = NULL;
+StaticSemaphore_t wakeSemaphoreBuffer;
+StaticTask_t powerTaskBuffer;
+StackType_t powerTaskStack[POWER_TASK_STACK];
 SoftwareTimer taskWakeupTimer;
 LoraHandler Lora;
 RGBHandler RGB;
 BattHandler Batt;
 BuzzerHandler Buzzer;
-QueueHandle_t commandQueue;
-EventType eventType;
+GeofenceHandler Geofence;
+TrackLogHandler TrackLog;
+PowerHandler Power;
+EnergyHandler Energy;
+ModePolicyHandler ModePolicy;
+LogHandler Log;
+MetricsHandler Metrics;
+FramePoolHandler FramePool;
 BleHandler BLE;
+BeaconHandler Beacon;
 bool wokeOnTimer = false;
-bool initSetup = false;
 int sleepTime = TIME_lIVE_TRACKING;
+uint32_t reportInterval = TIME_lIVE_TRACKING;
+uint32_t lastReportMs = 0;
+bool hadFix = false;
 
 #define TICKS(ms) pdMS_TO_TICKS(ms)
 
 /**
- * @brief Helper function to print the current stack high water mark.
+ * @brief Helper function to log the current stack high water mark.
  *
- * @param label A string label to identify where the check is performed.
+ * @param where Log id naming the place where the check is performed.
  */
-void printStackUsage(const char *label) {
-  Serial.print(label);
-  Serial.print(" - Stack High Water Mark: ");
-  Serial.println(uxTaskGetStackHighWaterMark(NULL));
+void printStackUsage(LogId where) {
+  LOG_DEBUG(where, uxTaskGetStackHighWaterMark(NULL));
 }
 
-/**
- * @brief Forward declaration for queuing an event.
- */
-void queEvent();
-
 /**
  * @brief Timer callback for waking up the device.
  *
@@ -54,86 +69,199 @@ void queEvent();
  */
 void periodicWakeup(TimerHandle_t unused) {
   wokeOnTimer = true;
+  Power.markWake();
   if (uxSemaphoreGetCount(wakeSemaphore) == 0) {
     xSemaphoreGiveFromISR(wakeSemaphore, pdFALSE);
   }
 }
 
+/**
+ * @brief Starts the BLE locate mode by itself when the harness lost its fix.
+ *
+ * A fix that does not come back after the harness had one usually means the pet is hiding
+ * under something, which is when the phone needs the close range link the most. It is not
+ * started in Emergency Beacon Mode or on a low battery, and only once per
+ * TIME_LOCATE_AUTO_COOLDOWN.
+ *
+ * @param searchMs Time spent searching for a fix during this wakeup.
+ * @return true if the locate mode was started.
+ */
+bool startLocateOnLostFix(uint32_t searchMs) {
+  static bool autoStarted = false;
+  static uint32_t autoStartMs = 0;
+  if (!hadFix || searchMs < TIME_LOCATE_AUTO_SEARCH || BLE.isLocating()) {
+    return false;
+  }
+  if (ModePolicy.getMode() == MODE_EMERGENCY_BEACON || receivedPacket.hBatt <= POLICY_BATT_EXTREME) {
+    return false;
+  }
+  if (autoStarted && (millis() - autoStartMs) < TIME_LOCATE_AUTO_COOLDOWN) {
+    return false;
+  }
+  autoStarted = true;
+  autoStartMs = millis();
+  BLE.startLocate(LOCATE_REASON_LOW_SIV, LOCATE_AUTO_MINUTES);
+  return true;
+}
+
 /**
  * @brief Waits until a valid GPS fix is acquired.
  *
  * Periodically updates the GPS, processes the command queue,
  * and delays until both a fix is present and the number of satellites (SIV) is greater than 4.
+ * The wait ends early once the BLE locate mode is on, which reports whatever the GPS has every
+ * second instead.
+ *
+ * @param timeoutMs Maximum time to wait in milliseconds, 0 to wait for as long as it takes.
  */
-void waitForGPSFix() {
+void waitForGPSFix(uint32_t timeoutMs) {
+  uint32_t start = millis();
   while (!(GPS.hasFix())) {
-    Serial.println("Waiting for GPS fix, processing queue...");
+    if (timeoutMs != 0 && (millis() - start) >= timeoutMs) {
+      LOG_WARN(LOG_GPS_FIX_TIMEOUT, timeoutMs);
+      break;
+    }
+    if (BLE.isLocating() || startLocateOnLostFix(millis() - start)) {
+      LOG_INFO(LOG_GPS_FIX_LOCATE);
+      break;
+    }
+    LOG_DEBUG(LOG_GPS_WAIT);
     GPS.update();
     queHandler.Que();
+    // The routine report waits for the fix, the acknowledgements do not.
+    Lora.flushAcks(ACK_NO_REPORT);
     vTaskDelay(TICKS(1000));
-    printStackUsage("waitForGPSFix loop");
+    printStackUsage(LOG_STACK_FIX_LOOP);
   }
-  printStackUsage("After waitForGPSFix");
+  printStackUsage(LOG_STACK_FIX);
 }
 
 /**
- * @brief Handles the wake-up reason and prints debug steps.
+ * @brief Handles the wake-up reason and logs it.
  *
  * Determines if the wake was due to a timer or a LoRa event.
  */
 void handleWakeUpReason() {
+  LOG_INFO(LOG_WAKE, wokeOnTimer ? 1 : 0);
   if (wokeOnTimer) {
-    Serial.println("Step 1:\n\nWoke up on timer");
     receivedPacket.msgType = MSG_WAKE_TIMER;
     wokeOnTimer = false;
-  } else {
-    Serial.println("Step 1:\n\nWoke up on LoRa");
   }
-  printStackUsage("After handleWakeUpReason");
+  printStackUsage(LOG_STACK_WAKE_REASON);
 }
 
 /**
- * @brief Activates the GPS based on the current mode and hardware signal.
+ * @brief Activates the GPS if it is off or was never initialized, then updates its data.
  *
- * If the mode isn’t live tracking and a specific IO pin (WB_IO2) is LOW, the GPS is started.
- * Then the GPS data is updated.
+ * A failed initialization does not hold up the wakeup: it is counted and tried again on the
+ * next one, and the report goes out with the last known position meanwhile.
  */
 void activateGPS() {
-  if (receivedPacket.mode != MODE_LIVE_TRACKING && digitalRead(WB_IO2) == LOW) {
-    Serial.println("Step 2:\n\nWaking up GPS for fix...");
-    GPS.begin();
+  if (!GPS.isReady()) {
+    LOG_DEBUG(LOG_GPS_WAKE);
+    if (!GPS.begin()) {
+      Metrics.add(METRIC_GNSS_INIT_FAILS);
+      LOG_WARN(LOG_GNSS_INIT_FAILED);
+    }
   }
-  Serial.println("Step 2:\n\nUpdating GPS data...");
   GPS.update();
-  printStackUsage("After activateGPS");
+  printStackUsage(LOG_STACK_GPS);
+}
+
+/**
+ * @brief Evaluates the current fix against the geofences.
+ *
+ * A crossing is published at the front of the high priority queue so the alert goes out
+ * before anything else processed during this wakeup. Without a fix (the GNSS did not start, the
+ * beacon timed out or the wait ended for locating) the coordinates are stale or zero, so the
+ * fences are left alone rather than raising a false alert.
+ */
+void checkGeofence() {
+  if (!GPS.hasFix()) {
+    return;
+  }
+  GeofenceTransition transition = Geofence.evaluate(GPS.getLatitudeE7(), GPS.getLongitudeE7());
+  if (transition == GEOFENCE_NO_CHANGE) {
+    return;
+  }
+  Event event = {EVENT_GEOFENCE_ALERT};
+  event.crossing.id = Geofence.getLastFenceId();
+  event.crossing.inside = (transition == GEOFENCE_ENTERED);
+  queHandler.publishFront(event);
+}
+
+/**
+ * @brief Checks if the routine report is due on this timer wakeup.
+ *
+ * Without the locate mode every timer wakeup sends one. While locating, the harness wakes up
+ * every TIME_LOCATE_FIX milliseconds, but LoRa reports keep the interval of the power mode.
+ *
+ * @return true if the routine report should be sent.
+ */
+bool routineReportDue() {
+  if (BLE.isLocating() && (millis() - lastReportMs) < reportInterval) {
+    return false;
+  }
+  lastReportMs = millis();
+  return true;
+}
+
+/**
+ * @brief Gets the time from now to the next routine report.
+ *
+ * Every wakeup restarts the wakeup timer, so without the locate mode the next report is one
+ * sleep interval away. Inside a geofence no report may be due for a long time.
+ *
+ * @return Milliseconds until the report, ACK_NO_REPORT if the next wakeup will not send one.
+ */
+uint32_t nextReportInMs() {
+  if (!Geofence.reportDue()) {
+    return ACK_NO_REPORT;
+  }
+  if (BLE.isLocating()) {
+    uint32_t elapsed = millis() - lastReportMs;
+    return elapsed < reportInterval ? reportInterval - elapsed : TIME_LOCATE_FIX;
+  }
+  return sleepTime;
 }
 
 /**
  * @brief Puts the device into sleep mode for the specified duration.
  *
- * The sleep duration is chosen based on the current operating mode.
+ * The sleep duration is chosen based on the current operating mode. The wakeup timer runs
+ * on the RTC, so with tickless idle the CPU stays asleep until it (or LoRa) fires. While the
+ * BLE locate mode is on, the device wakes up every TIME_LOCATE_FIX milliseconds instead.
  */
 void Sleep() {
   switch (receivedPacket.mode) {
+    case MODE_EMERGENCY_BEACON:
+      sleepTime = TIME_EMERGENCY_BEACON;
+      break;
     case MODE_EXTREME_POWER_SAVING:
       sleepTime = TIME_EXTREME_POWER_SAVING;
-      Serial.println("Device going to sleep: 10 minutes");
       break;
     case MODE_POWER_SAVING:
       sleepTime = TIME_POWER_SAVING;
-      Serial.println("Device going to sleep: 5 minutes");
       break;
     default:
       sleepTime = TIME_lIVE_TRACKING;
-      Serial.println("Device going to sleep: 15 seconds");
       break;
   }
-  Serial.println();
+  reportInterval = sleepTime;
+  if (BLE.isLocating()) {
+    sleepTime = TIME_LOCATE_FIX;
+  }
+  LOG_INFO(LOG_SLEEP, sleepTime, receivedPacket.mode, reportInterval);
+  // Acknowledgements the next report would bring too late go out now.
+  Lora.flushAcks(nextReportInMs());
   wokeOnTimer = false;
   taskWakeupTimer.stop();
   taskWakeupTimer.setPeriod(sleepTime);
   taskWakeupTimer.start();
-  printStackUsage("After Sleep");
+  uint32_t sleepUa = Power.getSleepCurrentUa(receivedPacket.mode);
+  Metrics.set(METRIC_SLEEP_UA, sleepUa);
+  LOG_DEBUG(LOG_SLEEP_CURRENT, sleepUa);
+  printStackUsage(LOG_STACK_SLEEP);
 }
 
 /**
@@ -143,42 +271,60 @@ void Sleep() {
  */
 void powerManagementTask(void *pvParameters) {
   for (;;) {
-    if (!initSetup) {
-      Serial.println("Power Management Task running...");
-      
-      if (xSemaphoreTake(wakeSemaphore, portMAX_DELAY) == pdTRUE) {
-        // Update battery status.
-        receivedPacket.hBatt = Batt.mvToPercent(Batt.readVBatt());
-        printStackUsage("After battery update");
+    LOG_DEBUG(LOG_POWER_TASK_WAIT);
+
+    if (xSemaphoreTake(wakeSemaphore, portMAX_DELAY) == pdTRUE) {
+      // Bring back the peripherals that were shut down for sleep.
+      Power.exitSleep();
+      Metrics.add(METRIC_WAKES);
 
-        // Step 1: Handle wake-up reason.
-        handleWakeUpReason();
+      // Update battery status (cached, the battery timer samples it).
+      receivedPacket.hBatt = Batt.getPercent();
+      RGB.setBatteryLevel(receivedPacket.hBatt);
+      // Step the power mode down (or back up) as the battery drains.
+      if (ModePolicy.evaluate(receivedPacket.hBatt)) {
+        Event event = {EVENT_MODE_CHANGE};
+        queHandler.publishFront(event);
+      }
+      printStackUsage(LOG_STACK_BATTERY);
 
-        // Step 2: Activate and update GPS.
-        activateGPS();
+      // Step 1: Handle wake-up reason.
+      handleWakeUpReason();
 
-        // Step 3: Wait for GPS fix if not already acquired.
-        if (!GPS.hasFix()) {
-          waitForGPSFix();
-        }
-        Serial.println("Step 3:\n\nGPS fix acquired, processing queued events...");
-        if (receivedPacket.msgType == MSG_WAKE_TIMER) {
-          queEvent();
-        }
-        queHandler.Que();
-        printStackUsage("After processing queued events");
+      // Step 2: Activate and update GPS.
+      activateGPS();
 
-        // Step 4: If not in live tracking, turn off GPS and then sleep.
-        Serial.println("Step 4:");
-        if (receivedPacket.mode != MODE_LIVE_TRACKING) {
-          Serial.println("\nGPS fix acquired, turning off GPS...");
-          GPS.gpsOff();
-        }
-        Sleep();
+      // Step 3: Wait for GPS fix if not already acquired (not while locating, that reports every second).
+      if (GPS.isReady() && !GPS.hasFix() && !BLE.isLocating()) {
+        // The emergency beacon cannot afford an open ended search.
+        waitForGPSFix(ModePolicy.getMode() == MODE_EMERGENCY_BEACON ? TIME_BEACON_FIX_TIMEOUT : 0);
+      }
+      if (GPS.hasFix()) {
+        hadFix = true;
+      }
+      LOG_DEBUG(LOG_WAKE_EVENTS);
+      checkGeofence();
+      if (receivedPacket.msgType == MSG_WAKE_TIMER && routineReportDue()) {
+        // The routine report can wait for room rather than being dropped.
+        Event event = {EVENT_WAKE_TIMER};
+        queHandler.publish(event, pdMS_TO_TICKS(1000));
       }
-    } else {
-      // During initial setup, just process queued events.
       queHandler.Que();
+      printStackUsage(LOG_STACK_QUEUE);
+
+      // The phone gets a fix on every wakeup while locating, until the timeout ends it.
+      BLE.sendFix();
+      BLE.update();
+      // The beacon carries the new fix from the next advertising event on.
+      Beacon.update();
+
+      // Step 4: If not in live tracking or locating, turn off GPS and then sleep.
+      if (receivedPacket.mode != MODE_LIVE_TRACKING && !BLE.isLocating()) {
+        LOG_DEBUG(LOG_GPS_OFF);
+        GPS.gpsOff();
+      }
+      Sleep();
+      Power.enterSleep();
     }
   }
 }
@@ -186,79 +332,64 @@ void powerManagementTask(void *pvParameters) {
 /**
  * @brief Setup function.
  *
- * Initializes hardware, creates semaphores and queues, sets up the software timer,
- * and creates the power management task.
+ * Brings up the radio and the LEDs right away and hands the slow GNSS initialization to the
+ * power management task, whose first wakeup is the boot itself. The tracker is reachable over
+ * LoRa within milliseconds of a reset, and the first report goes out as soon as there is a fix
+ * (or right away if the GNSS module does not answer).
  */
 void setup() {
-  initSetup = true;
+  Log.begin();
+  Metrics.begin();
+  FramePool.begin();
+  Energy.begin();
   pinMode(LED_GREEN, OUTPUT);
   pinMode(LED_BLUE, OUTPUT);
 
   Wire.begin();
-  time_t timeout = millis();
   Serial.begin(115200);
 
-  // Wait for Serial connection with blue LED indication.
-  while (!Serial) {
-    if ((millis() - timeout) < 5000) {
-      delay(100);
-      digitalWrite(LED_BLUE, HIGH);
-    } else {
-      break;
-    }
+#if BOOT_WAIT_SERIAL
+  // Debug build: wait for the serial monitor with blue LED indication.
+  uint32_t timeout = millis();
+  while (!Serial && (millis() - timeout) < BOOT_SERIAL_TIMEOUT) {
+    digitalWrite(LED_BLUE, HIGH);
+    delay(100);
   }
-  // Turn off blue LED once Serial is ready.
   digitalWrite(LED_BLUE, LOW);
+#endif
 
-  delay(2000);
-  
-  // Initialize GPS (retry until successful)
-  while (!GPS.begin()) {
-    Serial.println("Failed to initialize GPS! Trying again");
-    delay(1000);
-  }
-  delay(2000);
+  // The radio callbacks publish events and give the wake semaphore, so both come first.
+  wakeSemaphore = xSemaphoreCreateBinaryStatic(&wakeSemaphoreBuffer);
+  queHandler.begin();
 
   Lora.begin();
   RGB.begin();
   Batt.begin();
+  TrackLog.begin();
+  receivedPacket.mode = MODE_LIVE_TRACKING;
 
-  // Create wake semaphore.
-  wakeSemaphore = xSemaphoreCreateBinary();
-  if (wakeSemaphore == NULL) {
-    Serial.println("Failed to create wake semaphore!");
-    while (1);
-  }
-  Serial.println("Giving wake semaphore");
-  xSemaphoreGive(wakeSemaphore);
-
-  // Create command queue.
-  commandQueue = xQueueCreate(10, sizeof(eventType));
-  if (commandQueue == NULL) {
-    Serial.println("Failed to create command queue!");
-    while (1);
-  }
+  Metrics.registerCounter(METRIC_WAKES);
+  Metrics.registerCounter(METRIC_GNSS_INIT_FAILS);
+  Metrics.registerGauge(METRIC_BOOT_REPORT_MS);
+  Metrics.registerGauge(METRIC_WAKE_LATENCY_US);
+  Metrics.registerGauge(METRIC_SLEEP_UA);
 
-  // Create the power management task with a heap size of 2048.
-  xTaskCreate(powerManagementTask, "PowerMgmt", 2048, NULL, 1, NULL);
-  delay(1000);
+  // The wakeup timer only takes over after the first wakeup.
+  taskWakeupTimer.begin(TIME_lIVE_TRACKING, periodicWakeup);
+  taskWakeupTimer.start();
 
-  if (uxSemaphoreGetCount(wakeSemaphore) == 1) {
-    Serial.println("Taking wake semaphore");
-    xSemaphoreTake(wakeSemaphore, 10);
-  }
+  // The first wakeup is the boot: it starts the GNSS module and sends the first report.
+  wokeOnTimer = true;
+  xSemaphoreGive(wakeSemaphore);
 
-  Serial.println("Initial Setup of Power Management Task Complete");
-  initSetup = false;
-  
-  receivedPacket.mode = MODE_LIVE_TRACKING;
-  Serial.println("Setup complete.");
+  // Create the power management task on its static stack.
+  TaskHandle_t powerTask = xTaskCreateStatic(powerManagementTask, "PowerMgmt", POWER_TASK_STACK, NULL, 1,
+                                             powerTaskStack, &powerTaskBuffer);
+  Metrics.watchTask(METRIC_STACK_POWER, powerTask);
+  Metrics.watchTask(METRIC_STACK_LOOP, xTaskGetCurrentTaskHandle());
 
-  // Start the wakeup timer with an initial period of 15 seconds.
-  taskWakeupTimer.begin(15000, periodicWakeup);
-  taskWakeupTimer.start();
-  
-  printStackUsage("End of setup");
+  LOG_INFO(LOG_SETUP_DONE);
+  printStackUsage(LOG_STACK_SETUP);
 }
 
 /**
@@ -267,50 +398,3 @@ void setup() {
 void loop() {
   vTaskDelay(portMAX_DELAY);
 }
-
-/**
- * @brief Queues an event based on the current message type.
- */
-void queEvent() {
-  switch (receivedPacket.msgType) {
-    case MSG_ALL_DATA:
-      Serial.println("Que All Data");
-      break;
-    case MSG_ACKNOWLEDGEMENT:
-      Serial.println("Que Acknowledgement");
-      break;
-    case MSG_BUZZER:
-      eventType = EVENT_ACKNOWLEDGEMENT;
-      xQueueSend(commandQueue, &eventType, 0);
-      eventType = EVENT_BUZZER;
-      xQueueSend(commandQueue, &eventType, 0);
-      Serial.println("Que Buzzer");
-      break;
-    case MSG_LED:
-      eventType = EVENT_ACKNOWLEDGEMENT;
-      xQueueSend(commandQueue, &eventType, 0);
-      eventType = EVENT_LED;
-      xQueueSend(commandQueue, &eventType, 0);
-      Serial.println("Que LED");
-      break;
-    case MSG_RB_LED:
-      eventType = EVENT_ACKNOWLEDGEMENT;
-      xQueueSend(commandQueue, &eventType, 0);
-      eventType = EVENT_RB_LED;
-      xQueueSend(commandQueue, &eventType, 0);
-      Serial.println("Que Rainbow LED");
-      break;
-    case MSG_PWR_MODE:
-      eventType = EVENT_ACKNOWLEDGEMENT;
-      xQueueSend(commandQueue, &eventType, 0);
-      eventType = EVENT_PWR_MODE;
-      xQueueSend(commandQueue, &eventType, 0);
-      Serial.println("Que Power Mode");
-      break;
-    default:
-      eventType = EVENT_WAKE_TIMER;
-      xQueueSend(commandQueue, &eventType, 0);
-      Serial.println("Que Wakeup Timer");
-      break;
-  }
-}
@@ -22,7 +22,6 @@
 // #include "buzzer.h"
 // #include "gps.h"
 // #include "batt.h"
-#include "queHandler.h"
 
 
 
@@ -48,13 +47,27 @@
 #define LORA_SPREADING_FACTOR       11          /**< LoRa Spreading Factor. */
 #define LORA_CODINGRATE             4           /**< LoRa Coding Rate (1 = 4/5). */
 #define LORA_PREAMBLE_LENGTH        8           /**< LoRa preamble length. */
-#define LORA_FIX_LENGTH_PAYLOAD_ON  false       /**< LoRa fixed-length payload flag. */
 #define LORA_IQ_INVERSION_ON        false       /**< LoRa IQ inversion flag. */
 #define TX_TIMEOUT_VALUE            3000        /**< TX timeout in milliseconds. */
 #define RX_TIMEOUT_VALUE            0           /**< RX timeout in milliseconds. */
 #define LORA_SYMBOL_TIMEOUT         0	        /**< LoRa symbol timeout (in symbols). */
 #define LORA_DIO_PIN                47          /**< LoRa DIO pin number. */
 
+/**
+ * @brief Fox hunt LoRa profile (must match the receiver).
+ *
+ * The shortest airtime for the ping rate. Pings and pongs are binary and fixed length, JSON frames
+ * always start with '{'. The pong goes out with the implicit LoRa header: the receiver expects
+ * exactly FOX_PONG_SIZE bytes right after its ping, so the header is left out.
+ */
+#define FOX_SPREADING_FACTOR        7           /**< Spreading Factor. */
+#define FOX_BANDWIDTH               2           /**< Bandwidth (2 = 500 kHz). */
+#define FOX_CODINGRATE              1           /**< Coding Rate (1 = 4/5). */
+#define FOX_PING_SIZE               2           /**< MSG_FOX_PING, sequence number. */
+#define FOX_PONG_SIZE               4           /**< MSG_FOX_PONG, sequence number, ping RSSI and SNR. */
+#define FOX_PONG_DELAY_MS           2           /**< Lets the receiver open its pong window first. */
+#define FOX_IDLE_MS                 5000        /**< Back to the default profile after this long without a ping. */
+
 /**
  * @brief Battery voltage measurement parameters.
  */
@@ -62,6 +75,7 @@
 #define VBAT_MV_PER_LSB             (0.73242188F) /**< Battery mV per LSB (ADC resolution calculation). */
 #define VBAT_DIVIDER_COMP           (1.73)      /**< Compensation factor for the battery divider. */
 #define REAL_VBAT_MV_PER_LSB        (VBAT_DIVIDER_COMP * VBAT_MV_PER_LSB) /**< Adjusted mV per LSB. */
+#define BATTERY_CAPACITY_MAH        1000        /**< Harness battery capacity in mAh (match the fitted cell). */
 
 /**
  * @brief Sleep durations for different power modes.
@@ -71,6 +85,102 @@
 #define TIME_lIVE_TRACKING          ((uint32_t)15000)   /**< Live Tracking Mode: 15 seconds. */
 #define TIME_POWER_SAVING           ((uint32_t)300000)  /**< Power Saving Mode: 5 minutes. */
 #define TIME_EXTREME_POWER_SAVING   ((uint32_t)600000)  /**< Extreme Power Saving Mode: 10 minutes. */
+#define TIME_EMERGENCY_BEACON       ((uint32_t)1800000) /**< Emergency Beacon Mode: 30 minutes. */
+#define TIME_BEACON_FIX_TIMEOUT     ((uint32_t)120000)  /**< Emergency Beacon Mode: give up on a fix after 2 minutes. */
+
+/**
+ * @brief Battery aware mode policy thresholds (filtered battery level in percent).
+ *
+ * The harness steps down to the mode when the battery drops to the threshold, and steps back
+ * once the battery is POLICY_BATT_HYSTERESIS above it. The app can hold its mode for a while.
+ */
+#define POLICY_BATT_SAVING          30  /**< Step down to Power Saving Mode. */
+#define POLICY_BATT_EXTREME         15  /**< Step down to Extreme Power Saving Mode. */
+#define POLICY_BATT_BEACON          5   /**< Step down to Emergency Beacon Mode. */
+#define POLICY_BATT_HYSTERESIS      5   /**< Recovery margin above a threshold. */
+
+/**
+ * @brief Geofence configuration.
+ *
+ * Fences are pushed from the app through the receiver and evaluated on the harness on every fix.
+ * While the pet is inside a fence, routine position reports are only sent every
+ * TIME_GEOFENCE_INSIDE_REPORT milliseconds.
+ */
+#define GEOFENCE_MAX_FENCES         4                   /**< Number of geofences the harness can hold. */
+#define GEOFENCE_MAX_VERTICES       8                   /**< Maximum vertices per polygon fence (fits one LoRa frame). */
+#define GEOFENCE_ID_ALL             0xFF                /**< Fence id that addresses every fence (clear all). */
+#define TIME_GEOFENCE_INSIDE_REPORT ((uint32_t)1800000) /**< Report interval while inside a fence: 30 minutes. */
+
+/**
+ * @brief Track log configuration.
+ *
+ * Every reported fix is kept in the internal flash with a sequence number, so fixes the receiver
+ * missed can be sent again in batches of TRACKLOG_FIXES_PER_FRAME per LoRa frame.
+ */
+#define TRACKLOG_FIXES_PER_FRAME    4                   /**< Fixes per backfill LoRa frame. */
+
+/**
+ * @brief Energy accounting configuration.
+ *
+ * The energy ledger totals are sent to the receiver in their own frame, piggybacked on the
+ * routine report once every TIME_ENERGY_REPORT milliseconds.
+ */
+#define TIME_ENERGY_REPORT          ((uint32_t)1800000) /**< Energy report interval: 30 minutes. */
+
+/**
+ * @brief Runtime metrics configuration.
+ *
+ * The metrics snapshot follows the routine report once every TIME_METRICS_REPORT milliseconds.
+ */
+#define TIME_METRICS_REPORT         ((uint32_t)3600000) /**< Metrics report interval: 1 hour. */
+
+/**
+ * @brief Acknowledgement piggybacking.
+ *
+ * A handled command is not acknowledged with a frame of its own when the next routine report
+ * goes out within ACK_PIGGYBACK_MS: the acknowledgement is held, and the next frame the harness
+ * sends carries it in its "acks" field, a bitmap with one bit (1 << MessageType) per command.
+ * Held acknowledgements that would miss the deadline go out as a MSG_ACKNOWLEDGEMENT before the
+ * harness goes back to sleep.
+ */
+#define ACK_PIGGYBACK_MS            ((uint32_t)20000)   /**< Longest wait for a frame to carry an acknowledgement. */
+#define ACK_NO_REPORT               UINT32_MAX          /**< No routine report is scheduled. */
+
+/**
+ * @brief BLE close range locate configuration.
+ *
+ * For the last few meters the harness advertises over BLE, so the phone can connect directly,
+ * read a fix and the link RSSI every TIME_LOCATE_FIX milliseconds and send buzzer and LED
+ * commands without waiting for LoRa and the sleep interval. The mode starts on a MSG_LOCATE
+ * command, or by itself when a fix was lost (no fix or too few satellites in view), and stops
+ * after its timeout.
+ */
+#define TIME_LOCATE_FIX             ((uint32_t)1000)    /**< Wakeup interval while locating: 1 second. */
+#define LOCATE_DEFAULT_MINUTES      10                  /**< Timeout when the command gives none. */
+#define LOCATE_MAX_MINUTES          60                  /**< Longest timeout a command can ask for. */
+#define LOCATE_AUTO_MINUTES         5                   /**< Timeout of a session started by itself. */
+#define TIME_LOCATE_AUTO_SEARCH     ((uint32_t)60000)   /**< Search for a lost fix this long before starting: 1 minute. */
+#define TIME_LOCATE_AUTO_COOLDOWN   ((uint32_t)1800000) /**< Least time between two such sessions: 30 minutes. */
+
+/**
+ * @brief Power management task stack size in words.
+ *
+ * The task, its stack, the queues and the packet buffers are all allocated statically. The
+ * METRIC_STACK_POWER gauge shows how much of the stack is left.
+ */
+#define POWER_TASK_STACK            1536
+
+/**
+ * @brief Boot configuration.
+ *
+ * Field builds go straight from reset to tracking. Debug builds (the wiscore_rak4631_debug
+ * environment sets BOOT_WAIT_SERIAL) first wait up to BOOT_SERIAL_TIMEOUT milliseconds for the
+ * USB serial monitor.
+ */
+#ifndef BOOT_WAIT_SERIAL
+#define BOOT_WAIT_SERIAL            0       /**< 1 to wait for the serial monitor at boot. */
+#endif
+#define BOOT_SERIAL_TIMEOUT         5000    /**< Longest wait for the serial monitor in milliseconds. */
 
 /**
  * @brief External flag indicating if a packet was received.
@@ -83,7 +193,8 @@ extern bool packetReceived;
 enum DeviceMode {
     MODE_LIVE_TRACKING = 0,       /**< Live Tracking Mode. */
     MODE_POWER_SAVING = 1,        /**< Power Saving Mode. */
-    MODE_EXTREME_POWER_SAVING = 2 /**< Extreme Power Saving Mode. */
+    MODE_EXTREME_POWER_SAVING = 2,/**< Extreme Power Saving Mode. */
+    MODE_EMERGENCY_BEACON = 3     /**< Emergency Beacon Mode (battery almost empty). */
 };
 
 /**
@@ -96,20 +207,94 @@ enum MessageType {
     MSG_LED = 3,                /**< LED Message. */
     MSG_RB_LED = 4,           /**< Rainbow LED Message. */
     MSG_PWR_MODE = 5,           /**< Power Mode Message. */
-    MSG_WAKE_TIMER = 6          /**< Wake Timer Message. */
+    MSG_WAKE_TIMER = 6,         /**< Wake Timer Message. */
+    MSG_GEOFENCE = 7,           /**< Geofence definition Message. */
+    MSG_GEOFENCE_ALERT = 8,     /**< Geofence crossing alert Message. */
+    MSG_BACKFILL = 9,           /**< Backfill request Message. */
+    MSG_BACKFILL_DATA = 10,     /**< Backfill data Message. */
+    MSG_ENERGY = 11,            /**< Energy ledger Message. */
+    MSG_METRICS = 12,           /**< Runtime metrics snapshot Message. */
+    MSG_LOCATE = 13,            /**< Start or stop the BLE close range locate mode. */
+    MSG_FOX_HUNT = 14,          /**< Receiver and app only: start or stop the fox hunt. */
+    MSG_FOX_PING = 15,          /**< Fox hunt ping (binary frame). */
+    MSG_FOX_PONG = 16           /**< Fox hunt answer (binary frame). */
 };
 
 /**
- * @brief Event types for the command queue.
+ * @brief Event types for the event bus.
  */
 enum EventType {
     EVENT_LED = 0,            /**< LED event. */
-    EVENT_ACKNOWLEDGEMENT = 1,/**< Acknowledgement event. */
+    EVENT_ACKNOWLEDGEMENT = 1,/**< Unused, acknowledgements ride on the next frame (LoraHandler::flushAcks). */
     EVENT_BUZZER = 2,         /**< Buzzer event. */
     EVENT_RB_LED = 3,         /**< Rainbow LED event. */
     EVENT_PWR_MODE = 4,       /**< Power Mode change event. */
     EVENT_WAKE_TIMER = 5,     /**< Wake Timer event. */
-    EVENT_LORA_RX = 6         /**< LoRa RX event. */
+    EVENT_LORA_RX = 6,        /**< LoRa RX event. */
+    EVENT_GEOFENCE = 7,       /**< Geofence update event. */
+    EVENT_GEOFENCE_ALERT = 8, /**< Geofence crossing alert event. */
+    EVENT_BACKFILL = 9,       /**< Backfill request event. */
+    EVENT_BUZZER_DONE = 10,   /**< Buzzer tune finished or stopped. */
+    EVENT_MODE_CHANGE = 11,   /**< Effective power mode changed. */
+    EVENT_LOCATE = 12,        /**< Start or stop the BLE locate mode. */
+    EVENT_COUNT = 13          /**< Number of event types. */
+};
+
+/**
+ * @brief Event bus priorities, highest first.
+ *
+ * Each event type has a fixed priority in the dispatch table of the QueHandler.
+ */
+enum EventPriority : uint8_t {
+    PRIORITY_HIGH = 0,        /**< Acknowledgements, commands and alerts. */
+    PRIORITY_NORMAL = 1,      /**< Routine reports and backfill. */
+    PRIORITY_LOW = 2,         /**< LED changes and animations, housekeeping. */
+    PRIORITY_COUNT = 3        /**< Number of priorities. */
+};
+
+/**
+ * @brief Event bus queue depths per priority.
+ */
+#define QUE_DEPTH_HIGH              8   /**< High priority events. */
+#define QUE_DEPTH_NORMAL            4   /**< Normal priority events. */
+#define QUE_DEPTH_LOW               6   /**< Low priority events. */
+#define QUE_COALESCE_SLOTS          4   /**< Event types that keep only their newest state. */
+
+/**
+ * @brief Geofence shape types.
+ */
+enum GeofenceType {
+    GEOFENCE_NONE = 0,    /**< Empty slot, or clear the fence with this id. */
+    GEOFENCE_CIRCLE = 1,  /**< Circle around lat[0]/lon[0] with the given radius. */
+    GEOFENCE_POLYGON = 2  /**< Polygon through lat[0..count-1]/lon[0..count-1]. */
+};
+
+/**
+ * @brief Geofence definition as received over LoRa.
+ *
+ * Coordinates are stored in degrees * 1e7, the same fixed point format the GNSS module reports,
+ * so fences can be evaluated with integer math only.
+ */
+struct GeofenceShape {
+    uint8_t id;                             /**< Fence slot (0 to GEOFENCE_MAX_FENCES - 1). */
+    GeofenceType type;                      /**< Shape type. */
+    uint8_t count;                          /**< Number of valid vertices. */
+    uint32_t radius;                        /**< Circle radius in meters. */
+    int32_t lat[GEOFENCE_MAX_VERTICES];     /**< Vertex latitudes (degrees * 1e7). */
+    int32_t lon[GEOFENCE_MAX_VERTICES];     /**< Vertex longitudes (degrees * 1e7). */
+};
+
+/**
+ * @brief Compact fix as stored in the track log (16 bytes).
+ */
+struct TrackFix {
+    uint32_t seq;          /**< Sequence number (starts at 1). */
+    int32_t lat;           /**< Latitude (degrees * 1e7). */
+    int32_t lon;           /**< Longitude (degrees * 1e7). */
+    uint8_t hour;          /**< Hour (UTC). */
+    uint8_t min;           /**< Minute. */
+    uint8_t sec;           /**< Second. */
+    uint8_t siv;           /**< Satellites in view. */
 };
 
 /**
@@ -139,6 +324,47 @@ struct ReceivedPacket{
     bool ack;              /**< Acknowledgement flag. */
     uint8_t rBatt;           /**< Receiver battery level. */
     uint8_t hBatt;           /**< Harness battery level. */
+    GeofenceShape fence;     /**< Geofence received from the app. */
+    uint32_t seq;            /**< Track log sequence number of the reported fix, 0 without a fix. */
+    uint32_t since;          /**< Last sequence number the receiver has (backfill request). */
+    DeviceMode requestedMode; /**< Power mode requested from the app. */
+    uint16_t hold;           /**< Minutes to hold the requested power mode (0: no hold). */
+    bool locate;             /**< Start (true) or stop the BLE locate mode. */
+    uint8_t locateMinutes;   /**< Locate timeout in minutes (0: default). */
+};
+
+/**
+ * @brief Event on the event bus, with a copy of its payload.
+ *
+ * The payload is copied when the event is published, so a packet that arrives while the event
+ * is pending cannot change it.
+ */
+struct Event {
+    EventType type;                 /**< Event type. */
+    bool ack;                       /**< Acknowledge to the receiver once the event was handled. */
+    union {
+        struct {
+            uint8_t r;              /**< Red channel. */
+            uint8_t g;              /**< Green channel. */
+            uint8_t b;              /**< Blue channel. */
+        } color;                    /**< EVENT_LED: new color. */
+        bool on;                    /**< EVENT_RB_LED, EVENT_BUZZER: turn on or off. */
+        struct {
+            DeviceMode mode;        /**< Requested mode. */
+            uint16_t hold;          /**< Minutes to hold the requested mode (0: no hold). */
+        } power;                    /**< EVENT_PWR_MODE: mode requested from the app. */
+        GeofenceShape fence;        /**< EVENT_GEOFENCE: fence to store. */
+        struct {
+            uint8_t id;             /**< Fence that was crossed. */
+            bool inside;            /**< True if the pet came back inside. */
+        } crossing;                 /**< EVENT_GEOFENCE_ALERT: crossing to report. */
+        uint32_t since;             /**< EVENT_BACKFILL: last sequence number the receiver has. */
+        struct {
+            bool on;                /**< Start or stop. */
+            uint8_t minutes;        /**< Timeout in minutes (0: default). */
+            uint8_t reason;         /**< Where the command came from (LocateReason). */
+        } locate;                   /**< EVENT_LOCATE: locate mode requested from the app. */
+    };
 };
 
 
@@ -161,10 +387,56 @@ class LoraHandler;
 extern LoraHandler Lora;
 class RGBHandler;
 extern RGBHandler RGB;
+/**
+ * @brief Forward declaration of the GeofenceHandler class.
+ */
+class GeofenceHandler;
+extern GeofenceHandler Geofence;
+/**
+ * @brief Forward declaration of the TrackLogHandler class.
+ */
+class TrackLogHandler;
+extern TrackLogHandler TrackLog;
+/**
+ * @brief Forward declaration of the PowerHandler class.
+ */
+class PowerHandler;
+extern PowerHandler Power;
+/**
+ * @brief Forward declaration of the EnergyHandler class.
+ */
+class EnergyHandler;
+extern EnergyHandler Energy;
+/**
+ * @brief Forward declaration of the ModePolicyHandler class.
+ */
+class ModePolicyHandler;
+extern ModePolicyHandler ModePolicy;
+/**
+ * @brief Forward declaration of the LogHandler class.
+ */
+class LogHandler;
+extern LogHandler Log;
+/**
+ * @brief Forward declaration of the MetricsHandler class.
+ */
+class MetricsHandler;
+extern MetricsHandler Metrics;
+/**
+ * @brief Forward declaration of the FramePoolHandler class.
+ */
+class FramePoolHandler;
+extern FramePoolHandler FramePool;
 /**
  * @brief Forward declaration of the BleHandler class.
  */
-// class BleHandler;
+class BleHandler;
+extern BleHandler BLE;
+/**
+ * @brief Forward declaration of the BeaconHandler class.
+ */
+class BeaconHandler;
+extern BeaconHandler Beacon;
 
 /**
  * @brief Global semaphore for wake signals.
@@ -173,13 +445,6 @@ extern RGBHandler RGB;
  */
 extern SemaphoreHandle_t wakeSemaphore;
 
-/**
- * @brief Global command queue.
- *
- * This queue is used to store events that need to be processed by the system.
- */
-extern QueueHandle_t commandQueue;
-
 /**
  * @brief Global instance of the received packet.
  *
@@ -188,9 +453,7 @@ extern QueueHandle_t commandQueue;
 extern ReceivedPacket receivedPacket;
 
 /**
- * @brief Global instance of the current event type.
+ * @brief Forward declaration of the QueHandler class (event bus).
  */
-extern EventType eventType;
-
 class QueHandler;
 extern QueHandler queHandler;
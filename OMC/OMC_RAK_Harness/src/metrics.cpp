@@ -0,0 +1,217 @@
+/**
+ * @file metrics.cpp
+ * @brief Implementation of the runtime metrics registry for the OzarkMountainCat project.
+ *
+ * This file implements the registration, the updates and the binary snapshot of the metrics.
+ */
+
+#include "metrics.h"
+
+/**
+ * @brief Registers the metrics that belong to no module (heap).
+ */
+void MetricsHandler::begin() {
+    registerGauge(METRIC_HEAP_FREE);
+    registerGauge(METRIC_HEAP_MIN);
+    lastReport = millis();
+}
+
+/**
+ * @brief Registers a counter.
+ *
+ * @param id Metric id.
+ */
+void MetricsHandler::registerCounter(MetricId id) {
+    metrics[id].type = METRIC_COUNTER;
+}
+
+/**
+ * @brief Registers a gauge.
+ *
+ * @param id Metric id.
+ */
+void MetricsHandler::registerGauge(MetricId id) {
+    metrics[id].type = METRIC_GAUGE;
+}
+
+/**
+ * @brief Registers a histogram.
+ *
+ * @param id Metric id.
+ * @param bounds METRIC_BUCKETS ascending upper bounds, kept by reference.
+ */
+void MetricsHandler::registerHistogram(MetricId id, const int16_t *bounds) {
+    metrics[id].bounds = bounds;
+    metrics[id].type = METRIC_HISTOGRAM;
+}
+
+/**
+ * @brief Registers a gauge that follows the stack high water mark of a task.
+ *
+ * @param id Metric id.
+ * @param task Task to watch.
+ */
+void MetricsHandler::watchTask(MetricId id, TaskHandle_t task) {
+    metrics[id].task = task;
+    metrics[id].type = METRIC_GAUGE;
+}
+
+/**
+ * @brief Adds to a counter.
+ *
+ * @param id Metric id.
+ * @param n Amount to add.
+ */
+void MetricsHandler::add(MetricId id, uint32_t n) {
+    __atomic_fetch_add(&metrics[id].value, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sets a gauge.
+ *
+ * @param id Metric id.
+ * @param value New value.
+ */
+void MetricsHandler::set(MetricId id, uint32_t value) {
+    metrics[id].value = value;
+}
+
+/**
+ * @brief Raises a gauge to the value if it is higher (high water marks).
+ *
+ * @param id Metric id.
+ * @param value Observed value.
+ */
+void MetricsHandler::setMax(MetricId id, uint32_t value) {
+    if (value > metrics[id].value) {
+        metrics[id].value = value;
+    }
+}
+
+/**
+ * @brief Counts a value in the matching histogram bucket.
+ *
+ * The counts saturate instead of wrapping around.
+ *
+ * @param id Metric id.
+ * @param value Observed value.
+ */
+void MetricsHandler::observe(MetricId id, int32_t value) {
+    Metric &metric = metrics[id];
+    if (metric.type != METRIC_HISTOGRAM) {
+        return;
+    }
+    uint8_t bucket = 0;
+    while (bucket < METRIC_BUCKETS && value >= metric.bounds[bucket]) {
+        bucket++;
+    }
+    if (metric.buckets[bucket] != UINT16_MAX) {
+        __atomic_fetch_add(&metric.buckets[bucket], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Samples the heap and task stack gauges.
+ */
+void MetricsHandler::sample() {
+    set(METRIC_HEAP_FREE, xPortGetFreeHeapSize());
+    set(METRIC_HEAP_MIN, xPortGetMinimumEverFreeHeapSize());
+    for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+        if (metrics[i].task != NULL) {
+            metrics[i].value = uxTaskGetStackHighWaterMark(metrics[i].task);
+        }
+    }
+}
+
+/**
+ * @brief Encodes all registered metrics.
+ *
+ * @param out Output buffer.
+ * @param size Size of the output buffer.
+ * @return Snapshot length in bytes, 0 if it does not fit.
+ */
+size_t MetricsHandler::snapshot(uint8_t *out, size_t size) {
+    sample();
+    if (size < 7) {
+        return 0;
+    }
+    uint32_t uptime = millis() / 1000;
+    size_t n = 0;
+    out[n++] = METRICS_VERSION;
+    out[n++] = METRICS_SOURCE_HARNESS;
+    memcpy(&out[n], &uptime, sizeof(uptime));
+    n += sizeof(uptime);
+    size_t countAt = n++;
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+        const Metric &metric = metrics[i];
+        if (metric.type == METRIC_UNUSED) {
+            continue;
+        }
+        size_t entry = 1 + (metric.type == METRIC_HISTOGRAM ? 2 * (METRIC_BUCKETS + 1) : 4);
+        if (n + entry > size) {
+            return 0;
+        }
+        out[n++] = (metric.type << 6) | i;
+        if (metric.type == METRIC_HISTOGRAM) {
+            for (uint8_t b = 0; b <= METRIC_BUCKETS; b++) {
+                uint16_t value = metric.buckets[b];
+                memcpy(&out[n], &value, sizeof(value));
+                n += sizeof(value);
+            }
+        } else {
+            uint32_t value = metric.value;
+            memcpy(&out[n], &value, sizeof(value));
+            n += sizeof(value);
+        }
+        count++;
+    }
+    out[countAt] = count;
+    return n;
+}
+
+/**
+ * @brief Checks if the next metrics report is due.
+ *
+ * @return true once TIME_METRICS_REPORT has passed since the last report.
+ */
+bool MetricsHandler::reportDue() {
+    return (millis() - lastReport) >= TIME_METRICS_REPORT;
+}
+
+/**
+ * @brief Restarts the report interval.
+ */
+void MetricsHandler::markReported() {
+    lastReport = millis();
+}
+
+/**
+ * @brief Encodes bytes as base64 for the JSON frames.
+ *
+ * @param in Input bytes.
+ * @param len Number of input bytes.
+ * @param out Output buffer, null terminated.
+ * @param size Size of the output buffer.
+ * @return Length of the encoded text, 0 if it does not fit.
+ */
+size_t MetricsHandler::toBase64(const uint8_t *in, size_t len, char *out, size_t size) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t encoded = 4 * ((len + 2) / 3);
+    if (encoded + 1 > size) {
+        return 0;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t chunk = (uint32_t)in[i] << 16;
+        if (i + 1 < len) chunk |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) chunk |= in[i + 2];
+        out[n++] = alphabet[(chunk >> 18) & 0x3F];
+        out[n++] = alphabet[(chunk >> 12) & 0x3F];
+        out[n++] = (i + 1 < len) ? alphabet[(chunk >> 6) & 0x3F] : '=';
+        out[n++] = (i + 2 < len) ? alphabet[chunk & 0x3F] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
@@ -0,0 +1,204 @@
+#pragma once
+/**
+ * @file metrics.h
+ * @brief Header file for the MetricsHandler class.
+ *
+ * This file declares the runtime metrics registry. Modules register counters, gauges and
+ * fixed-bucket histograms with it, and the registry encodes all of them into one compact binary
+ * snapshot that is sent to the receiver once every TIME_METRICS_REPORT milliseconds.
+ */
+
+#include "main.h"
+
+/**
+ * @brief Metrics configuration.
+ */
+#define METRIC_BUCKETS              4       /**< Histogram bucket bounds (METRIC_BUCKETS + 1 buckets). */
+#define METRICS_VERSION             1       /**< Snapshot format version. */
+#define METRICS_SOURCE_HARNESS      0       /**< Snapshot source byte of the harness. */
+#define METRICS_SNAPSHOT_MAX        140     /**< Largest binary snapshot in bytes, 188 base64 characters in the LoRa frame. */
+
+/**
+ * @brief Harness metric ids.
+ *
+ * The ids are part of the snapshot format (the app keeps the same list), so new metrics are
+ * appended at the end. At most 64 ids fit in the 6 bit id field of an entry.
+ */
+enum MetricId : uint8_t {
+    METRIC_LORA_TX = 0,         /**< Counter: packets sent. */
+    METRIC_LORA_TX_TIMEOUT,     /**< Counter: transmissions that timed out. */
+    METRIC_LORA_AIRTIME_MS,     /**< Counter: time on air in milliseconds. */
+    METRIC_LORA_RX,             /**< Counter: packets received. */
+    METRIC_LORA_RX_ERROR,       /**< Counter: reception errors (CRC, header). */
+    METRIC_GPS_FIX_TIME,        /**< Histogram: seconds from GNSS power on to fix. */
+    METRIC_QUE_EVENTS,          /**< Counter: queued events processed. */
+    METRIC_QUE_DEPTH_MAX,       /**< Gauge: most events waiting in the event queues. */
+    METRIC_WAKES,               /**< Counter: wakeups of the power management task. */
+    METRIC_BATT_MV,             /**< Gauge: filtered battery voltage in millivolts. */
+    METRIC_HEAP_FREE,           /**< Gauge: free heap in bytes. */
+    METRIC_HEAP_MIN,            /**< Gauge: lowest free heap since boot in bytes. */
+    METRIC_STACK_POWER,         /**< Gauge: power management task stack high water mark in words. */
+    METRIC_STACK_LOOP,          /**< Gauge: Arduino loop task stack high water mark in words. */
+    METRIC_QUE_DROPPED,         /**< Counter: events dropped because their queue was full. */
+    METRIC_QUE_COALESCED,       /**< Counter: commands replaced by a newer one before they were handled. */
+    METRIC_AIRTIME_SAVED_MS,    /**< Counter: acknowledgement airtime saved by coalescing in milliseconds. */
+    METRIC_FRAMES_EXHAUSTED,    /**< Counter: packets skipped because the frame pool was empty. */
+    METRIC_FRAME_ARENA_PEAK,    /**< Gauge: most JSON document memory a frame has used in bytes. */
+    METRIC_GNSS_INIT_FAILS,     /**< Counter: GNSS module initializations that failed. */
+    METRIC_BOOT_REPORT_MS,      /**< Gauge: milliseconds from reset to the first routine report. */
+    METRIC_TRACK_KEPT_PCT,      /**< Gauge: percentage of the fixes the track simplifier kept. */
+    METRIC_WAKE_LATENCY_US,     /**< Gauge: microseconds from the last wake callback to the power management task. */
+    METRIC_SLEEP_UA,            /**< Gauge: modelled sleep current of the last sleep in microamps. */
+    METRIC_COUNT                /**< Number of metric ids. */
+};
+
+/**
+ * @brief Metric types, stored in the top two bits of the entry id byte.
+ */
+enum MetricType : uint8_t {
+    METRIC_UNUSED = 0,          /**< Not registered, not in the snapshot. */
+    METRIC_COUNTER = 1,         /**< Monotonic count since boot (uint32). */
+    METRIC_GAUGE = 2,           /**< Last value (uint32). */
+    METRIC_HISTOGRAM = 3        /**< Counts per bucket (METRIC_BUCKETS + 1 saturating uint16). */
+};
+
+/**
+ * @brief A registered metric.
+ */
+struct Metric {
+    MetricType type;                            /**< Type, METRIC_UNUSED until registered. */
+    volatile uint32_t value;                    /**< Counter or gauge value. */
+    const int16_t *bounds;                      /**< Upper bucket bounds of a histogram (exclusive). */
+    volatile uint16_t buckets[METRIC_BUCKETS + 1]; /**< Histogram counts, the last one is the overflow. */
+    TaskHandle_t task;                          /**< Task whose stack high water mark the gauge follows. */
+};
+
+/**
+ * @class MetricsHandler
+ * @brief Registry of counters, gauges and histograms.
+ *
+ * Counters and histograms are updated with atomic increments, so the radio callbacks may use
+ * them. Heap and task stack gauges are sampled when the snapshot is taken.
+ *
+ * Snapshot layout (little endian): version, source, uptime in seconds (uint32), entry count,
+ * then per entry one byte type << 6 | id followed by a uint32 value, or by METRIC_BUCKETS + 1
+ * uint16 bucket counts for a histogram.
+ */
+class MetricsHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    MetricsHandler() {}
+
+    /**
+     * @brief Registers the metrics that belong to no module (heap).
+     */
+    void begin();
+
+    /**
+     * @brief Registers a counter.
+     *
+     * @param id Metric id.
+     */
+    void registerCounter(MetricId id);
+
+    /**
+     * @brief Registers a gauge.
+     *
+     * @param id Metric id.
+     */
+    void registerGauge(MetricId id);
+
+    /**
+     * @brief Registers a histogram.
+     *
+     * @param id Metric id.
+     * @param bounds METRIC_BUCKETS ascending upper bounds, kept by reference.
+     */
+    void registerHistogram(MetricId id, const int16_t *bounds);
+
+    /**
+     * @brief Registers a gauge that follows the stack high water mark of a task.
+     *
+     * @param id Metric id.
+     * @param task Task to watch.
+     */
+    void watchTask(MetricId id, TaskHandle_t task);
+
+    /**
+     * @brief Adds to a counter.
+     *
+     * @param id Metric id.
+     * @param n Amount to add.
+     */
+    void add(MetricId id, uint32_t n = 1);
+
+    /**
+     * @brief Sets a gauge.
+     *
+     * @param id Metric id.
+     * @param value New value.
+     */
+    void set(MetricId id, uint32_t value);
+
+    /**
+     * @brief Raises a gauge to the value if it is higher (high water marks).
+     *
+     * @param id Metric id.
+     * @param value Observed value.
+     */
+    void setMax(MetricId id, uint32_t value);
+
+    /**
+     * @brief Counts a value in the matching histogram bucket.
+     *
+     * @param id Metric id.
+     * @param value Observed value.
+     */
+    void observe(MetricId id, int32_t value);
+
+    /**
+     * @brief Encodes all registered metrics.
+     *
+     * @param out Output buffer.
+     * @param size Size of the output buffer.
+     * @return Snapshot length in bytes, 0 if it does not fit.
+     */
+    size_t snapshot(uint8_t *out, size_t size);
+
+    /**
+     * @brief Checks if the next metrics report is due.
+     *
+     * @return true once TIME_METRICS_REPORT has passed since the last report.
+     */
+    bool reportDue();
+
+    /**
+     * @brief Restarts the report interval.
+     */
+    void markReported();
+
+    /**
+     * @brief Encodes bytes as base64 for the JSON frames.
+     *
+     * @param in Input bytes.
+     * @param len Number of input bytes.
+     * @param out Output buffer, null terminated.
+     * @param size Size of the output buffer.
+     * @return Length of the encoded text, 0 if it does not fit.
+     */
+    static size_t toBase64(const uint8_t *in, size_t len, char *out, size_t size);
+
+private:
+    /**
+     * @brief Samples the heap and task stack gauges.
+     */
+    void sample();
+
+    /** @brief Metrics indexed by MetricId. */
+    Metric metrics[METRIC_COUNT] = {};
+
+    /** @brief millis() of the last report. */
+    uint32_t lastReport = 0;
+};
@@ -0,0 +1,106 @@
+/**
+ * @file modepolicy.cpp
+ * @brief Implementation of the battery aware power mode policy for the OzarkMountainCat project.
+ *
+ * This file implements the floor level with hysteresis and the combination with the mode and
+ * hold requested from the app.
+ */
+
+#include "modepolicy.h"
+#include "logger.h"
+
+/**
+ * @brief Battery level at which each mode becomes the floor, indexed by DeviceMode.
+ */
+static const uint8_t floorThreshold[] = {
+    100,                    // MODE_LIVE_TRACKING (never stepped down to)
+    POLICY_BATT_SAVING,     // MODE_POWER_SAVING
+    POLICY_BATT_EXTREME,    // MODE_EXTREME_POWER_SAVING
+    POLICY_BATT_BEACON      // MODE_EMERGENCY_BEACON
+};
+
+/**
+ * @brief Sets the mode requested from the app.
+ *
+ * @param mode Requested mode.
+ * @param holdMinutes Minutes to keep the requested mode regardless of the battery, 0 for none.
+ */
+void ModePolicyHandler::setRequested(DeviceMode mode, uint16_t holdMinutes) {
+    requested = mode;
+    holdStart = millis();
+    holdMs = (uint32_t)holdMinutes * 60000;
+    evaluate(lastPercent);
+}
+
+/**
+ * @brief Requests live tracking for a while, e.g. after a geofence exit.
+ *
+ * @param on true to escalate, false to return to the requested mode.
+ * @return true if the effective mode changed.
+ */
+bool ModePolicyHandler::setEscalated(bool on) {
+    escalated = on;
+    return evaluate(lastPercent);
+}
+
+/**
+ * @brief Checks if a hold from the app is still running, and ends it once it expired.
+ *
+ * @return true while the requested mode is held.
+ */
+bool ModePolicyHandler::holdActive() {
+    if (holdMs != 0 && (millis() - holdStart) >= holdMs) {
+        LOG_INFO(LOG_MODE_HOLD_EXPIRED);
+        holdMs = 0;
+    }
+    return holdMs != 0;
+}
+
+/**
+ * @brief Updates the floor level from the battery and recomputes the effective mode.
+ *
+ * The floor moves one level per threshold crossed, so a deep drop goes straight to the
+ * matching level, and a recovery has to clear each threshold plus the hysteresis. An
+ * escalation is limited by the floor like the requested mode, a hold keeps either.
+ *
+ * @param batteryPercent Filtered harness battery level in percent.
+ * @return true if the effective mode changed.
+ */
+bool ModePolicyHandler::evaluate(uint8_t batteryPercent) {
+    lastPercent = batteryPercent;
+    while (floorMode < MODE_EMERGENCY_BEACON && batteryPercent <= floorThreshold[floorMode + 1]) {
+        floorMode = (DeviceMode)(floorMode + 1);
+    }
+    while (floorMode > MODE_LIVE_TRACKING && batteryPercent >= floorThreshold[floorMode] + POLICY_BATT_HYSTERESIS) {
+        floorMode = (DeviceMode)(floorMode - 1);
+    }
+
+    DeviceMode mode = escalated ? MODE_LIVE_TRACKING : requested;
+    if (!holdActive() && floorMode > requested) {
+        mode = floorMode;
+    }
+    if (mode == effective) {
+        return false;
+    }
+    LOG_INFO(LOG_MODE_CHANGED, effective, mode, batteryPercent);
+    effective = mode;
+    return true;
+}
+
+/**
+ * @brief Gets the effective mode.
+ *
+ * @return Mode the harness should run in.
+ */
+DeviceMode ModePolicyHandler::getMode() {
+    return effective;
+}
+
+/**
+ * @brief Checks if the battery policy overrides the requested mode.
+ *
+ * @return true if the effective mode is not the requested one.
+ */
+bool ModePolicyHandler::isAutomatic() {
+    return effective != requested;
+}
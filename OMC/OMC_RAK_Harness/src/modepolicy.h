@@ -0,0 +1,98 @@
+#pragma once
+/**
+ * @file modepolicy.h
+ * @brief Header file for the ModePolicyHandler class.
+ *
+ * This file declares the ModePolicyHandler class which steps the harness down to lower power
+ * modes as the battery drains, on top of the mode requested from the app.
+ */
+
+#include "main.h"
+
+/**
+ * @class ModePolicyHandler
+ * @brief Battery aware power mode escalation.
+ *
+ * The policy keeps a floor level that follows the filtered battery level: it steps down to
+ * power saving, extreme power saving and the emergency beacon as the battery drops to the
+ * POLICY_BATT_* thresholds, and only steps back up once the battery is POLICY_BATT_HYSTERESIS
+ * above a threshold again. The effective mode is the lower power of the requested mode and
+ * the floor, unless the app holds its requested mode for a while. An escalation (geofence
+ * exit) temporarily requests live tracking, still limited by the floor.
+ */
+class ModePolicyHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    ModePolicyHandler() {}
+
+    /**
+     * @brief Sets the mode requested from the app.
+     *
+     * @param mode Requested mode.
+     * @param holdMinutes Minutes to keep the requested mode regardless of the battery, 0 for none.
+     */
+    void setRequested(DeviceMode mode, uint16_t holdMinutes);
+
+    /**
+     * @brief Requests live tracking for a while, e.g. after a geofence exit.
+     *
+     * The escalation replaces the requested mode but still respects the battery floor.
+     *
+     * @param on true to escalate, false to return to the requested mode.
+     * @return true if the effective mode changed.
+     */
+    bool setEscalated(bool on);
+
+    /**
+     * @brief Updates the floor level from the battery and recomputes the effective mode.
+     *
+     * @param batteryPercent Filtered harness battery level in percent.
+     * @return true if the effective mode changed.
+     */
+    bool evaluate(uint8_t batteryPercent);
+
+    /**
+     * @brief Gets the effective mode.
+     *
+     * @return Mode the harness should run in.
+     */
+    DeviceMode getMode();
+
+    /**
+     * @brief Checks if the battery policy overrides the requested mode.
+     *
+     * @return true if the effective mode is not the requested one.
+     */
+    bool isAutomatic();
+
+private:
+    /**
+     * @brief Checks if a hold from the app is still running, and ends it once it expired.
+     *
+     * @return true while the requested mode is held.
+     */
+    bool holdActive();
+
+    /** @brief Mode requested from the app. */
+    DeviceMode requested = MODE_LIVE_TRACKING;
+
+    /** @brief True while live tracking is requested by an escalation. */
+    bool escalated = false;
+
+    /** @brief Mode the harness runs in. */
+    DeviceMode effective = MODE_LIVE_TRACKING;
+
+    /** @brief Mode the battery allows at most (MODE_LIVE_TRACKING when full). */
+    DeviceMode floorMode = MODE_LIVE_TRACKING;
+
+    /** @brief millis() when the hold started. */
+    uint32_t holdStart = 0;
+
+    /** @brief Hold duration in milliseconds, 0 when there is no hold. */
+    uint32_t holdMs = 0;
+
+    /** @brief Last battery level passed to evaluate(). */
+    uint8_t lastPercent = 100;
+};
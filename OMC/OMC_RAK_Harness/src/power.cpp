@@ -0,0 +1,128 @@
+/**
+ * @file power.cpp
+ * @brief Implementation of the sleep path for the OzarkMountainCat project.
+ *
+ * This file implements quiescing the peripherals before the power management task sleeps,
+ * restoring them on wake, and the sleep current model used for the power budget.
+ */
+
+#include "power.h"
+#include "rgb.h"
+#include "energy.h"
+#include "logger.h"
+#include "metrics.h"
+#include <Wire.h>
+
+#if !defined(configUSE_TICKLESS_IDLE) || (configUSE_TICKLESS_IDLE == 0)
+#warning "configUSE_TICKLESS_IDLE is off: the tick will keep waking the CPU while the harness sleeps"
+#endif
+
+/**
+ * @brief Puts the peripherals into their lowest power state.
+ *
+ * Serial1 (UART) is unused on the harness and is stopped. The USB Serial is only flushed;
+ * the USB stack suspends it on its own when no host is connected.
+ */
+void PowerHandler::enterSleep() {
+    if (sleeping) {
+        return;
+    }
+    // Let the log drain task run once this task blocks on the wake semaphore.
+    Log.flush();
+    Serial.flush();
+
+    // 1. UART: stop and disable the UARTE so its clock request is released.
+    NRF_UARTE0->TASKS_STOPRX = 1;
+    NRF_UARTE0->TASKS_STOPTX = 1;
+    NRF_UARTE0->ENABLE = UARTE_ENABLE_ENABLE_Disabled;
+
+    // 2. NeoPixel data line: hold it low so the pixels keep their color and ignore noise.
+    if (!RGB.isAnimating()) {
+        pinMode(PIN_RGB, OUTPUT);
+        digitalWrite(PIN_RGB, LOW);
+    }
+
+    // 3. SAADC: analogRead() enables it per conversion, make sure it is off.
+    NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled;
+
+    // 4. I2C: release the TWIM peripheral (the GPS keeps its own state).
+    Wire.end();
+
+    sleeping = true;
+    Energy.set(ENERGY_MCU, SLEEP_UA_MCU);
+}
+
+/**
+ * @brief Restores the peripherals after wake.
+ *
+ * The order is the reverse of enterSleep(): I2C first so the GPS can be read right away.
+ * The SAADC needs no restore because analogRead() enables it when used, and the NeoPixel
+ * library drives the data line again on the next show().
+ */
+void PowerHandler::exitSleep() {
+    uint32_t start = micros();
+    if (wakeMark != 0) {
+        wakeLatencyUs = start - wakeMark;
+        wakeMark = 0;
+    }
+    if (!sleeping) {
+        return;
+    }
+    Energy.set(ENERGY_MCU, ENERGY_UA_MCU_ACTIVE);
+
+    Wire.begin();
+
+    sleeping = false;
+    restoreUs = micros() - start;
+    Metrics.set(METRIC_WAKE_LATENCY_US, wakeLatencyUs);
+    LOG_DEBUG(LOG_WAKE_LATENCY, wakeLatencyUs, restoreUs);
+}
+
+/**
+ * @brief Records the time of a wake callback.
+ *
+ * Only the first callback of a sleep counts, a second one before the task runs is part of
+ * the same wakeup.
+ */
+void PowerHandler::markWake() {
+    if (wakeMark == 0) {
+        wakeMark = micros();
+    }
+}
+
+/**
+ * @brief Gets the modelled sleep current for an operating mode.
+ *
+ * Live tracking keeps the GPS on between fixes, the other modes power it down.
+ *
+ * @param mode Operating mode.
+ * @return Sleep current in microamps.
+ */
+uint32_t PowerHandler::getSleepCurrentUa(DeviceMode mode) {
+    uint32_t current = SLEEP_UA_MCU + SLEEP_UA_LORA_RX;
+    if (mode == MODE_LIVE_TRACKING) {
+        current += SLEEP_UA_GPS_ON;
+    }
+    if (RGB.isLit()) {
+        current += SLEEP_UA_NEOPIXEL_IDLE;
+    }
+    return current;
+}
+
+/**
+ * @brief Gets the time from the last wake callback to the task running.
+ *
+ * @return Wake latency in microseconds.
+ */
+uint32_t PowerHandler::getWakeLatencyUs() {
+    return wakeLatencyUs;
+}
+
+/**
+ * @brief Gets the time the last peripheral restore took.
+ *
+ * @return Restore time in microseconds.
+ */
+uint32_t PowerHandler::getRestoreUs() {
+    return restoreUs;
+}
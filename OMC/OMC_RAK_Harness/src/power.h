@@ -0,0 +1,100 @@
+#pragma once
+/**
+ * @file power.h
+ * @brief Header file for the PowerHandler class.
+ *
+ * This file declares the PowerHandler class which puts the harness peripherals into their
+ * lowest power state before the power management task blocks, and brings them back on wake.
+ * While the task is blocked, FreeRTOS tickless idle stops the tick and the CPU sleeps in
+ * System ON until the RTC based wakeup timer or the LoRa DIO interrupt fires.
+ */
+
+#include "main.h"
+
+/**
+ * @brief Sleep current model in microamps.
+ *
+ * Typical datasheet figures for the parts that stay powered while the harness sleeps.
+ * The LoRa radio stays in RX so commands from the receiver can wake the harness.
+ */
+#define SLEEP_UA_MCU                5       /**< nRF52840 System ON, RTC running, RAM retained. */
+#define SLEEP_UA_LORA_RX            4600    /**< SX1262 continuous RX (DC-DC). */
+#define SLEEP_UA_GPS_ON             25000   /**< u-blox GNSS tracking (live tracking keeps it on). */
+#define SLEEP_UA_NEOPIXEL_IDLE      600     /**< Two NeoPixels with a color latched. */
+
+/**
+ * @class PowerHandler
+ * @brief Quiesces and restores peripherals around the sleep of the power management task.
+ *
+ * Peripherals are shut down in the order UART, NeoPixel data line, SAADC, I2C and restored in
+ * the reverse order, so the GPS (I2C) is available first after wake.
+ */
+class PowerHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    PowerHandler() {}
+
+    /**
+     * @brief Puts the peripherals into their lowest power state.
+     *
+     * Called right before the power management task blocks on the wake semaphore.
+     */
+    void enterSleep();
+
+    /**
+     * @brief Restores the peripherals after wake.
+     *
+     * Called right after the power management task takes the wake semaphore. Measures the
+     * wake latency (wake callback to task) and the restore time.
+     */
+    void exitSleep();
+
+    /**
+     * @brief Records the time of a wake callback.
+     *
+     * Called where the wake semaphore is given: the wakeup timer callback (timer daemon task)
+     * and the LoRa RX callback, which the SX126x library runs in its own task after its DIO1
+     * interrupt. The library owns that interrupt, so the latency starts at the callback: it
+     * covers the hand-off to the power management task (the rest of the LoRa callback, which
+     * runs first, and the scheduler), not the interrupt entry or the wake of the CPU from
+     * System ON. Safe to call from interrupt context.
+     */
+    void markWake();
+
+    /**
+     * @brief Gets the modelled sleep current for an operating mode.
+     *
+     * @param mode Operating mode.
+     * @return Sleep current in microamps.
+     */
+    uint32_t getSleepCurrentUa(DeviceMode mode);
+
+    /**
+     * @brief Gets the time from the last wake callback to the task running.
+     *
+     * @return Wake latency in microseconds.
+     */
+    uint32_t getWakeLatencyUs();
+
+    /**
+     * @brief Gets the time the last peripheral restore took.
+     *
+     * @return Restore time in microseconds.
+     */
+    uint32_t getRestoreUs();
+
+private:
+    /** @brief micros() of the last wake callback. */
+    volatile uint32_t wakeMark = 0;
+
+    /** @brief True while the peripherals are quiesced. */
+    bool sleeping = false;
+
+    /** @brief Last measured wake latency in microseconds. */
+    uint32_t wakeLatencyUs = 0;
+
+    /** @brief Last measured restore time in microseconds. */
+    uint32_t restoreUs = 0;
+};
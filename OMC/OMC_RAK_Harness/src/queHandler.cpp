@@ -1,66 +1,400 @@
+/**
+ * @file queHandler.cpp
+ * @brief Implementation of the event bus for the OzarkMountainCat project.
+ *
+ * This file implements the event handlers, the dispatch table and the priority queues.
+ */
 #include "queHandler.h"
 #include "lora.h"
 #include "rgb.h"
 #include "buzzer.h"
 #include "gps.h"
 #include "batt.h"
+#include "geofence.h"
+#include "tracklog.h"
+#include "energy.h"
+#include "modepolicy.h"
+#include "logger.h"
+#include "metrics.h"
+#include "bleHandler.h"
+
+/**
+ * @brief Gets the message type of the command an event came from.
+ *
+ * @param type Event type.
+ * @return Message type whose bit acknowledges the command.
+ */
+static MessageType commandMessage(EventType type)
+{
+  switch (type)
+  {
+  case EVENT_LED:
+    return MSG_LED;
+  case EVENT_BUZZER:
+    return MSG_BUZZER;
+  case EVENT_RB_LED:
+    return MSG_RB_LED;
+  case EVENT_PWR_MODE:
+    return MSG_PWR_MODE;
+  case EVENT_GEOFENCE:
+    return MSG_GEOFENCE;
+  case EVENT_LOCATE:
+    return MSG_LOCATE;
+  default:
+    return MSG_ACKNOWLEDGEMENT;
+  }
+}
+
+/**
+ * @brief Sets a solid LED color.
+ */
+static void onLed(const Event &event)
+{
+  receivedPacket.r = event.color.r;
+  receivedPacket.g = event.color.g;
+  receivedPacket.b = event.color.b;
+  RGB.setColor();
+}
+
+/**
+ * @brief Starts or stops the rainbow animation.
+ */
+static void onRainbowLed(const Event &event)
+{
+  receivedPacket.rbLed = event.on;
+  LOG_DEBUG(LOG_QUE_RB_LED, event.on);
+  if (!event.on)
+  {
+    RGB.offRainbow();
+  }
+  else
+  {
+    RGB.rainbowCycle();
+  }
+}
+
+/**
+ * @brief Starts or stops the buzzer.
+ */
+static void onBuzzer(const Event &event)
+{
+  receivedPacket.buzzer = event.on;
+  LOG_DEBUG(LOG_QUE_BUZZER, event.on);
+  Buzzer.begin();
+  if (!event.on)
+  {
+    Buzzer.off();
+  }
+  else
+  {
+    Buzzer.on();
+  }
+}
+
+/**
+ * @brief Clears the buzzer state once the tune finished or was stopped.
+ */
+static void onBuzzerDone(const Event &event)
+{
+  receivedPacket.buzzer = false;
+}
+
+/**
+ * @brief Applies the power mode requested from the app.
+ */
+static void onPowerMode(const Event &event)
+{
+  // The battery policy may keep a lower power mode than the one requested.
+  ModePolicy.setRequested(event.power.mode, event.power.hold);
+  receivedPacket.mode = ModePolicy.getMode();
+  if (ModePolicy.isAutomatic())
+  {
+    Lora.waitForTxDone(TX_TIMEOUT_VALUE);
+    Lora.SendModeChange(receivedPacket.mode, true);
+  }
+}
+
+/**
+ * @brief Applies a power mode chosen by the battery policy.
+ */
+static void onModeChange(const Event &event)
+{
+  receivedPacket.mode = ModePolicy.getMode();
+  if (receivedPacket.mode == MODE_EMERGENCY_BEACON)
+  {
+    RGB.off();
+  }
+  Lora.waitForTxDone(TX_TIMEOUT_VALUE);
+  Lora.SendModeChange(receivedPacket.mode, ModePolicy.isAutomatic());
+}
+
+/**
+ * @brief Sends the routine report, and the energy and metrics reports when they are due.
+ */
+static void onWakeTimer(const Event &event)
+{
+  // Inside a geofence the routine report is only sent once in a while.
+  if (!Geofence.reportDue())
+  {
+    LOG_DEBUG(LOG_QUE_GEOFENCE_SKIP);
+    return;
+  }
+  // Routine wakeup: log the fix, then send a JSON packet with GPS and other data. A report
+  // without a fix is not logged and goes out with seq 0, so it is never backfilled.
+  receivedPacket.seq = GPS.hasFix() ? TrackLog.append(GPS.getLatitudeE7(), GPS.getLongitudeE7(), GPS.getHour(), GPS.getMinute(), GPS.getSecond(), GPS.getSIV()) : 0;
+  Lora.SendJSON(GPS.getLatitude(), GPS.getLongitude(), GPS.getHour(), GPS.getMinute(), GPS.getSecond(), GPS.getSIV(), GPS.getHDOP(), GPS.getAltitude());
+  Geofence.markReported();
+  static bool bootReported = false;
+  if (!bootReported)
+  {
+    // millis() starts at reset, so this is the boot to first report time.
+    bootReported = true;
+    Metrics.set(METRIC_BOOT_REPORT_MS, millis());
+    LOG_INFO(LOG_BOOT_REPORT, millis());
+  }
+  // Once in a while the energy ledger follows the routine report.
+  if (Energy.reportDue() && Lora.waitForTxDone(TX_TIMEOUT_VALUE))
+  {
+    Lora.SendEnergy();
+    Energy.markReported();
+  }
+  // And the runtime metrics, less often still.
+  if (Metrics.reportDue() && Lora.waitForTxDone(TX_TIMEOUT_VALUE))
+  {
+    Lora.SendMetrics();
+    Metrics.markReported();
+  }
+}
+
+/**
+ * @brief Stores a geofence received from the app.
+ */
+static void onGeofence(const Event &event)
+{
+  Geofence.setFence(event.fence);
+}
+
+/**
+ * @brief Reports a geofence crossing.
+ */
+static void onGeofenceAlert(const Event &event)
+{
+  Lora.SendGeofenceAlert(event.crossing.id, event.crossing.inside, GPS.getLatitude(), GPS.getLongitude());
+}
+
+/**
+ * @brief Sends the fixes the receiver missed.
+ */
+static void onBackfill(const Event &event)
+{
+  Lora.SendBackfill(event.since);
+}
+
+/**
+ * @brief Starts or stops the BLE close range locate mode.
+ */
+static void onLocate(const Event &event)
+{
+  if (event.locate.on)
+  {
+    BLE.startLocate((LocateReason)event.locate.reason, event.locate.minutes);
+  }
+  else
+  {
+    BLE.stopLocate((LocateReason)event.locate.reason);
+  }
+}
+
+/**
+ * @brief Dispatch table entry: priority, handler and coalescing slot of an event type.
+ */
+struct EventRoute
+{
+  EventPriority priority;                 /**< Queue the event goes to. */
+  void (*handle)(const Event &event);     /**< Handler, NULL if the event is ignored. */
+  int8_t slot;                            /**< Coalescing slot, -1 if every event is handled. */
+};
+
+/**
+ * @brief Dispatch table, indexed by EventType.
+ *
+ * Only commands that set a state get a coalescing slot. Geofences are not coalesced, each one
+ * may update a different fence.
+ */
+static const EventRoute routes[EVENT_COUNT] = {
+    {PRIORITY_LOW, onLed, 0},                // EVENT_LED
+    {PRIORITY_HIGH, NULL, -1},               // EVENT_ACKNOWLEDGEMENT, not published (LoraHandler::flushAcks)
+    {PRIORITY_HIGH, onBuzzer, 1},            // EVENT_BUZZER
+    {PRIORITY_LOW, onRainbowLed, 2},         // EVENT_RB_LED
+    {PRIORITY_HIGH, onPowerMode, 3},         // EVENT_PWR_MODE
+    {PRIORITY_NORMAL, onWakeTimer, -1},      // EVENT_WAKE_TIMER
+    {PRIORITY_NORMAL, NULL, -1},             // EVENT_LORA_RX
+    {PRIORITY_HIGH, onGeofence, -1},         // EVENT_GEOFENCE
+    {PRIORITY_HIGH, onGeofenceAlert, -1},    // EVENT_GEOFENCE_ALERT
+    {PRIORITY_NORMAL, onBackfill, -1},       // EVENT_BACKFILL
+    {PRIORITY_LOW, onBuzzerDone, -1},        // EVENT_BUZZER_DONE
+    {PRIORITY_HIGH, onModeChange, -1},       // EVENT_MODE_CHANGE
+    {PRIORITY_HIGH, onLocate, -1},           // EVENT_LOCATE
+};
+
+/**
+ * @brief Queue depth per priority.
+ */
+static const UBaseType_t queueDepth[PRIORITY_COUNT] = {QUE_DEPTH_HIGH, QUE_DEPTH_NORMAL, QUE_DEPTH_LOW};
+
+void QueHandler::begin()
+{
+  uint8_t *storage[PRIORITY_COUNT] = {storageHigh, storageNormal, storageLow};
+  for (uint8_t p = 0; p < PRIORITY_COUNT; p++)
+  {
+    queues[p] = xQueueCreateStatic(queueDepth[p], sizeof(Event), storage[p], &queueBuffers[p]);
+  }
+  Metrics.registerCounter(METRIC_QUE_EVENTS);
+  Metrics.registerGauge(METRIC_QUE_DEPTH_MAX);
+  Metrics.registerCounter(METRIC_QUE_DROPPED);
+  Metrics.registerCounter(METRIC_QUE_COALESCED);
+  Metrics.registerCounter(METRIC_AIRTIME_SAVED_MS);
+}
+
+bool QueHandler::publish(const Event &event, TickType_t wait)
+{
+  return enqueue(event, wait, false);
+}
+
+bool QueHandler::publishFront(const Event &event)
+{
+  return enqueue(event, 0, true);
+}
+
+bool QueHandler::enqueue(const Event &event, TickType_t wait, bool front)
+{
+  const EventRoute &route = routes[event.type];
+  if (route.slot >= 0)
+  {
+    // While one is pending, its queue entry will pick up the newest state when it is handled.
+    taskENTER_CRITICAL();
+    bool merged = pending[route.slot];
+    bool ackPending = merged && latest[route.slot].ack;
+    latest[route.slot] = event;
+    latest[route.slot].ack |= ackPending;
+    pending[route.slot] = true;
+    taskEXIT_CRITICAL();
+    if (merged)
+    {
+      coalesce(event, ackPending && event.ack);
+      return true;
+    }
+  }
+
+  BaseType_t queued = front ? xQueueSendToFront(queues[route.priority], &event, 0)
+                            : xQueueSend(queues[route.priority], &event, wait);
+  if (queued == pdTRUE)
+  {
+    return true;
+  }
+  if (route.slot >= 0)
+  {
+    taskENTER_CRITICAL();
+    pending[route.slot] = false;
+    taskEXIT_CRITICAL();
+  }
+  drop(event);
+  return false;
+}
+
+bool QueHandler::publishFromISR(const Event &event)
+{
+  BaseType_t woken = pdFALSE;
+  bool queued = xQueueSendFromISR(queues[routes[event.type].priority], &event, &woken) == pdTRUE;
+  if (!queued)
+  {
+    drop(event);
+  }
+  portYIELD_FROM_ISR(woken);
+  return queued;
+}
+
+bool QueHandler::publishCommand(const Event &command)
+{
+  Event acked = command;
+  acked.ack = true;
+  return publish(acked);
+}
+
+void QueHandler::coalesce(const Event &event, bool ackSaved)
+{
+  __atomic_fetch_add(&coalesced, 1, __ATOMIC_RELAXED);
+  Metrics.add(METRIC_QUE_COALESCED);
+  if (ackSaved)
+  {
+    // Runs in the publisher context, so the precomputed airtime is used.
+    Metrics.add(METRIC_AIRTIME_SAVED_MS, Lora.getAckAirtime());
+  }
+  LOG_DEBUG(LOG_QUE_COALESCED, event.type);
+}
+
+void QueHandler::drop(const Event &event)
+{
+  EventPriority priority = routes[event.type].priority;
+  __atomic_fetch_add(&dropped[priority], 1, __ATOMIC_RELAXED);
+  Metrics.add(METRIC_QUE_DROPPED);
+  LOG_WARN(LOG_QUE_DROPPED, event.type, priority);
+}
+
+uint32_t QueHandler::getDropped(EventPriority priority)
+{
+  return dropped[priority];
+}
+
+uint32_t QueHandler::getCoalesced()
+{
+  return coalesced;
+}
+
+bool QueHandler::receive(Event &event)
+{
+  for (uint8_t p = 0; p < PRIORITY_COUNT; p++)
+  {
+    if (xQueueReceive(queues[p], &event, 0) == pdTRUE)
+    {
+      return true;
+    }
+  }
+  return false;
+}
 
 void QueHandler::Que()
 {
-  // Process any queued commands in a non-blocking manner.
-  while (xQueueReceive(commandQueue, &eventType, 0) == pdTRUE)
+  UBaseType_t depth = 0;
+  for (uint8_t p = 0; p < PRIORITY_COUNT; p++)
   {
-    Serial.println("Processing queued command...");
-    switch (eventType)
+    depth += uxQueueMessagesWaiting(queues[p]);
+  }
+  Metrics.setMax(METRIC_QUE_DEPTH_MAX, depth);
+
+  // Process any queued events in a non-blocking manner, highest priority first.
+  Event event;
+  while (receive(event))
+  {
+    const EventRoute &route = routes[event.type];
+    if (route.slot >= 0)
+    {
+      // Apply the newest state published since this entry was queued.
+      taskENTER_CRITICAL();
+      event = latest[route.slot];
+      pending[route.slot] = false;
+      taskEXIT_CRITICAL();
+    }
+    LOG_INFO(LOG_QUE_EVENT, event.type);
+    Metrics.add(METRIC_QUE_EVENTS);
+    if (route.handle != NULL)
+    {
+      route.handle(event);
+    }
+    if (event.ack)
     {
-    case EVENT_ACKNOWLEDGEMENT:
-      Serial.println("Processing command: send Acknowledgement");
-      Lora.SendJSON(true);
-      break;
-    case EVENT_LED:
-      Serial.println("Processing command: Handle RGB");
-      RGB.setColor();
-      break;
-    case EVENT_RB_LED:
-      Serial.println("Processing command: Turn on Rainbow LED");
-      if (!receivedPacket.rbLed)
-      {
-        Serial.println("Turning off Rainbow LED");
-        RGB.offRainbow();
-      }
-      else
-      {
-        Serial.println("Turning on Rainbow LED");
-        RGB.rainbowCycle();
-      }
-      break;
-    case EVENT_BUZZER:
-      Serial.println("Processing command: Buzzer");
-      Buzzer.begin();
-      if (!receivedPacket.buzzer){
-        Serial.println("Buzzer off");
-        Buzzer.off();
-      } else
-      {
-        Serial.println("Buzzer on");
-        Buzzer.on();
-      }
-      break;
-    case EVENT_PWR_MODE:
-      Serial.println("Processing command: Change Power Mode");
-      // Power Mode change is handled in the main loop.
-      break;
-    case EVENT_WAKE_TIMER:
-      Serial.println("Processing command: Wake Timer Expired");
-      // Routine wakeup: send a JSON packet with GPS and other data.
-      Lora.SendJSON(GPS.getLatitude(), GPS.getLongitude(), GPS.getHour(), GPS.getMinute(), GPS.getSecond(), GPS.getSIV(), GPS.getHDOP(), GPS.getAltitude());
-      break;
-    default:
-      break;
+      // Goes out with the next frame, or on its own before the harness sleeps.
+      Lora.holdAck(commandMessage(event.type));
     }
-    Serial.println("Que has been checked");
-    Serial.printf("\n");
-    // While loop
   }
-  //vTaskDelay(10); // Delay for 1 tick (adjust as needed)
 }
@@ -1,7 +1,28 @@
 #pragma once
+/**
+ * @file queHandler.h
+ * @brief Header file for the QueHandler class (event bus).
+ *
+ * This file declares the event bus of the harness. Events carry their own payload, are queued
+ * by priority and are dispatched through a table that maps each event type to its priority,
+ * handler and coalescing slot.
+ */
 #include "main.h"
 
-
+/**
+ * @class QueHandler
+ * @brief Typed, priority aware event bus.
+ *
+ * There is one FreeRTOS queue per EventPriority. Que() always takes the next event from the
+ * highest priority queue that is not empty, so acknowledgements and commands go ahead of LED
+ * animations even if they were published later. Publishing never blocks unless asked to: when
+ * a queue is full the event is dropped, counted, logged, and the caller gets false back.
+ *
+ * Commands that set a state (LED color, rainbow, buzzer, power mode) are coalesced: while one
+ * is pending, a newer one of the same type replaces its payload instead of taking another
+ * queue entry. Only the newest state is applied and acknowledged, so a burst of colour picker
+ * writes costs one LED update and one acknowledgement.
+ */
 class QueHandler
 {
 public:
@@ -11,10 +32,125 @@ public:
     QueHandler() {}
 
     /**
-     * @brief Process any queued commands in a non-blocking manner.
+     * @brief Creates the priority queues in their static storage.
+     */
+    void begin();
+
+    /**
+     * @brief Publishes an event at the back of its priority queue.
+     *
+     * @param event Event to copy into the queue.
+     * @param wait Ticks to wait for room in the queue, 0 to drop the event right away.
+     * @return true if the event was queued, false if it was dropped.
+     */
+    bool publish(const Event &event, TickType_t wait = 0);
+
+    /**
+     * @brief Publishes an event at the front of its priority queue.
      *
-     * This function processes any queued commands in a non-blocking manner.
-     * It receives the eventType from the commandQueue and processes the command accordingly.
+     * @param event Event to copy into the queue.
+     * @return true if the event was queued, false if it was dropped.
+     */
+    bool publishFront(const Event &event);
+
+    /**
+     * @brief Publishes an event from an interrupt handler.
+     *
+     * Events that coalesce must not be published from an interrupt handler.
+     *
+     * @param event Event to copy into the queue.
+     * @return true if the event was queued, false if it was dropped.
+     */
+    bool publishFromISR(const Event &event);
+
+    /**
+     * @brief Publishes a command from the receiver that is acknowledged once handled.
+     *
+     * The acknowledgement goes out after the command was applied, so it reports the new state,
+     * and the receiver never gets an acknowledgement for a command that was dropped. It is held
+     * for the next outbound frame, see LoraHandler::holdAck().
+     *
+     * @param command Command event.
+     * @return true if the command was queued.
+     */
+    bool publishCommand(const Event &command);
+
+    /**
+     * @brief Dispatches the queued events in a non-blocking manner.
+     *
+     * Runs until all queues are empty, always taking the highest priority event first.
      */
     void Que();
-};
\ No newline at end of file
+
+    /**
+     * @brief Gets the number of events dropped because a queue was full.
+     *
+     * @param priority Queue to check.
+     * @return Dropped events since boot.
+     */
+    uint32_t getDropped(EventPriority priority);
+
+    /**
+     * @brief Gets the number of events replaced by a newer one before they were handled.
+     *
+     * @return Coalesced events since boot.
+     */
+    uint32_t getCoalesced();
+
+private:
+    /**
+     * @brief Takes the next event, highest priority first.
+     *
+     * @param event Receives the event.
+     * @return true if there was an event.
+     */
+    bool receive(Event &event);
+
+    /**
+     * @brief Queues an event, or merges it into the pending one of the same type.
+     *
+     * @param event Event to publish.
+     * @param wait Ticks to wait for room in the queue.
+     * @param front true to queue the event at the front.
+     * @return true if the event was queued or merged.
+     */
+    bool enqueue(const Event &event, TickType_t wait, bool front);
+
+    /**
+     * @brief Counts and logs an event that replaced a pending one.
+     *
+     * @param event The newer event.
+     * @param ackSaved true if both events were to be acknowledged.
+     */
+    void coalesce(const Event &event, bool ackSaved);
+
+    /**
+     * @brief Counts and logs a dropped event.
+     *
+     * @param event Event that did not fit.
+     */
+    void drop(const Event &event);
+
+    /** @brief One queue per priority. */
+    QueueHandle_t queues[PRIORITY_COUNT] = {};
+
+    /** @brief Queue control blocks. */
+    StaticQueue_t queueBuffers[PRIORITY_COUNT];
+
+    /** @brief Queue storage, one array per priority. */
+    uint8_t storageHigh[QUE_DEPTH_HIGH * sizeof(Event)];
+    uint8_t storageNormal[QUE_DEPTH_NORMAL * sizeof(Event)];
+    uint8_t storageLow[QUE_DEPTH_LOW * sizeof(Event)];
+
+    /** @brief Dropped events per priority. */
+    volatile uint32_t dropped[PRIORITY_COUNT] = {};
+
+    /** @brief Newest state of each coalescing event type. */
+    Event latest[QUE_COALESCE_SLOTS] = {};
+
+    /** @brief Coalescing slots that have an entry in their queue. */
+    bool pending[QUE_COALESCE_SLOTS] = {};
+
+    /** @brief Events replaced by a newer one. */
+    volatile uint32_t coalesced = 0;
+};
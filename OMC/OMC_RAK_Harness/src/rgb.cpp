@@ -1,19 +1,48 @@
 #include "rgb.h"
+#include "energy.h"
 
-// Helper function that maps a hue value (0-255) to an RGB color.
-// It takes the hue and the NeoPixel strip instance to use the Color() method.
-static uint32_t Wheel(uint8_t pos, Adafruit_NeoPixel &strip) {
-    pos = 255 - pos;
-    if (pos < 85) {
-        return strip.Color(255 - pos * 3, 0, pos * 3);
-    } else if (pos < 170) {
-        pos -= 85;
-        return strip.Color(0, pos * 3, 255 - pos * 3);
-    } else {
-        pos -= 170;
-        return strip.Color(pos * 3, 255 - pos * 3, 0);
-    }
-}
+/**
+ * @brief Color wheel, indexed by hue (0-255).
+ *
+ * Same mapping as the NeoPixel Wheel() example: red to green to blue and back to red.
+ * The table is const so it stays in flash.
+ */
+static const uint8_t hueTable[256][3] = {
+    {255,  0,  0}, {252,  3,  0}, {249,  6,  0}, {246,  9,  0}, {243, 12,  0}, {240, 15,  0}, {237, 18,  0}, {234, 21,  0},
+    {231, 24,  0}, {228, 27,  0}, {225, 30,  0}, {222, 33,  0}, {219, 36,  0}, {216, 39,  0}, {213, 42,  0}, {210, 45,  0},
+    {207, 48,  0}, {204, 51,  0}, {201, 54,  0}, {198, 57,  0}, {195, 60,  0}, {192, 63,  0}, {189, 66,  0}, {186, 69,  0},
+    {183, 72,  0}, {180, 75,  0}, {177, 78,  0}, {174, 81,  0}, {171, 84,  0}, {168, 87,  0}, {165, 90,  0}, {162, 93,  0},
+    {159, 96,  0}, {156, 99,  0}, {153,102,  0}, {150,105,  0}, {147,108,  0}, {144,111,  0}, {141,114,  0}, {138,117,  0},
+    {135,120,  0}, {132,123,  0}, {129,126,  0}, {126,129,  0}, {123,132,  0}, {120,135,  0}, {117,138,  0}, {114,141,  0},
+    {111,144,  0}, {108,147,  0}, {105,150,  0}, {102,153,  0}, { 99,156,  0}, { 96,159,  0}, { 93,162,  0}, { 90,165,  0},
+    { 87,168,  0}, { 84,171,  0}, { 81,174,  0}, { 78,177,  0}, { 75,180,  0}, { 72,183,  0}, { 69,186,  0}, { 66,189,  0},
+    { 63,192,  0}, { 60,195,  0}, { 57,198,  0}, { 54,201,  0}, { 51,204,  0}, { 48,207,  0}, { 45,210,  0}, { 42,213,  0},
+    { 39,216,  0}, { 36,219,  0}, { 33,222,  0}, { 30,225,  0}, { 27,228,  0}, { 24,231,  0}, { 21,234,  0}, { 18,237,  0},
+    { 15,240,  0}, { 12,243,  0}, {  9,246,  0}, {  6,249,  0}, {  3,252,  0}, {  0,255,  0}, {  0,252,  3}, {  0,249,  6},
+    {  0,246,  9}, {  0,243, 12}, {  0,240, 15}, {  0,237, 18}, {  0,234, 21}, {  0,231, 24}, {  0,228, 27}, {  0,225, 30},
+    {  0,222, 33}, {  0,219, 36}, {  0,216, 39}, {  0,213, 42}, {  0,210, 45}, {  0,207, 48}, {  0,204, 51}, {  0,201, 54},
+    {  0,198, 57}, {  0,195, 60}, {  0,192, 63}, {  0,189, 66}, {  0,186, 69}, {  0,183, 72}, {  0,180, 75}, {  0,177, 78},
+    {  0,174, 81}, {  0,171, 84}, {  0,168, 87}, {  0,165, 90}, {  0,162, 93}, {  0,159, 96}, {  0,156, 99}, {  0,153,102},
+    {  0,150,105}, {  0,147,108}, {  0,144,111}, {  0,141,114}, {  0,138,117}, {  0,135,120}, {  0,132,123}, {  0,129,126},
+    {  0,126,129}, {  0,123,132}, {  0,120,135}, {  0,117,138}, {  0,114,141}, {  0,111,144}, {  0,108,147}, {  0,105,150},
+    {  0,102,153}, {  0, 99,156}, {  0, 96,159}, {  0, 93,162}, {  0, 90,165}, {  0, 87,168}, {  0, 84,171}, {  0, 81,174},
+    {  0, 78,177}, {  0, 75,180}, {  0, 72,183}, {  0, 69,186}, {  0, 66,189}, {  0, 63,192}, {  0, 60,195}, {  0, 57,198},
+    {  0, 54,201}, {  0, 51,204}, {  0, 48,207}, {  0, 45,210}, {  0, 42,213}, {  0, 39,216}, {  0, 36,219}, {  0, 33,222},
+    {  0, 30,225}, {  0, 27,228}, {  0, 24,231}, {  0, 21,234}, {  0, 18,237}, {  0, 15,240}, {  0, 12,243}, {  0,  9,246},
+    {  0,  6,249}, {  0,  3,252}, {  0,  0,255}, {  3,  0,252}, {  6,  0,249}, {  9,  0,246}, { 12,  0,243}, { 15,  0,240},
+    { 18,  0,237}, { 21,  0,234}, { 24,  0,231}, { 27,  0,228}, { 30,  0,225}, { 33,  0,222}, { 36,  0,219}, { 39,  0,216},
+    { 42,  0,213}, { 45,  0,210}, { 48,  0,207}, { 51,  0,204}, { 54,  0,201}, { 57,  0,198}, { 60,  0,195}, { 63,  0,192},
+    { 66,  0,189}, { 69,  0,186}, { 72,  0,183}, { 75,  0,180}, { 78,  0,177}, { 81,  0,174}, { 84,  0,171}, { 87,  0,168},
+    { 90,  0,165}, { 93,  0,162}, { 96,  0,159}, { 99,  0,156}, {102,  0,153}, {105,  0,150}, {108,  0,147}, {111,  0,144},
+    {114,  0,141}, {117,  0,138}, {120,  0,135}, {123,  0,132}, {126,  0,129}, {129,  0,126}, {132,  0,123}, {135,  0,120},
+    {138,  0,117}, {141,  0,114}, {144,  0,111}, {147,  0,108}, {150,  0,105}, {153,  0,102}, {156,  0, 99}, {159,  0, 96},
+    {162,  0, 93}, {165,  0, 90}, {168,  0, 87}, {171,  0, 84}, {174,  0, 81}, {177,  0, 78}, {180,  0, 75}, {183,  0, 72},
+    {186,  0, 69}, {189,  0, 66}, {192,  0, 63}, {195,  0, 60}, {198,  0, 57}, {201,  0, 54}, {204,  0, 51}, {207,  0, 48},
+    {210,  0, 45}, {213,  0, 42}, {216,  0, 39}, {219,  0, 36}, {222,  0, 33}, {225,  0, 30}, {228,  0, 27}, {231,  0, 24},
+    {234,  0, 21}, {237,  0, 18}, {240,  0, 15}, {243,  0, 12}, {246,  0,  9}, {249,  0,  6}, {252,  0,  3}, {255,  0,  0},
+};
+
+RGBHandler *RGBHandler::instance = nullptr;
 
 /**
  * @brief Constructor for RGBHandler.
@@ -29,75 +58,252 @@ RGBHandler::RGBHandler() : strip(NUM_PIXELS, PIN_RGB, NEO_GRB + NEO_KHZ800) {
  * @brief Initializes the RGB LED.
  *
  * Calls the begin() method on the NeoPixel object and immediately updates the display
- * (which clears the LED to 'off').
+ * (which clears the LED to 'off'), then creates the (stopped) animation timer.
  */
 void RGBHandler::begin() {
+    instance = this;
     strip.begin();
     strip.show(); // Initialize all pixels to 'off'
     delay(10);
+    frameTimer.begin(framePeriod, onFrame);
     off();
     Serial.println("RGB LED initialized.");
     
 }
 
+/**
+ * @brief Software timer callback, draws one frame.
+ */
+void RGBHandler::onFrame(TimerHandle_t unused) {
+    if (instance) {
+        instance->drawFrame();
+    }
+}
+
+/**
+ * @brief Draw pended by updateTimer(), runs in the timer daemon task like onFrame().
+ */
+void RGBHandler::onDraw(void *unused, uint32_t unused2) {
+    if (instance) {
+        instance->drawFrame();
+    }
+}
+
+/**
+ * @brief Computes and shows the current frame of every LED, timer daemon task only.
+ *
+ * Every effect is a function of millis(), so frames can be skipped or slowed down
+ * without changing the speed of the animation. The LED state is copied first, the
+ * setters change it from other tasks.
+ */
+void RGBHandler::drawFrame() {
+    LedState state[NUM_PIXELS];
+    taskENTER_CRITICAL();
+    memcpy(state, leds, sizeof(state));
+    taskEXIT_CRITICAL();
+
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        const LedState &led = state[i];
+        switch (led.effect) {
+        case RGB_EFFECT_SOLID:
+            strip.setPixelColor(i, led.r, led.g, led.b);
+            break;
+        case RGB_EFFECT_RAINBOW: {
+            // One hue step every 20 ms, the speed of the old blocking loop.
+            const uint8_t *rgb = hueTable[(uint8_t)(now / 20 + led.hueOffset)];
+            strip.setPixelColor(i, rgb[0], rgb[1], rgb[2]);
+            break;
+        }
+        case RGB_EFFECT_BLINK:
+            if ((now / 500) & 1) {
+                strip.setPixelColor(i, 0, 0, 0);
+            } else {
+                strip.setPixelColor(i, led.r, led.g, led.b);
+            }
+            break;
+        case RGB_EFFECT_BREATHE: {
+            // Triangle wave 0..255..0 over about two seconds.
+            uint16_t phase = (now / 4) & 0x1FF;
+            uint16_t level = (phase < 256) ? phase : 511 - phase;
+            strip.setPixelColor(i, led.r * level / 255, led.g * level / 255, led.b * level / 255);
+            break;
+        }
+        default:
+            strip.setPixelColor(i, 0, 0, 0);
+            break;
+        }
+    }
+    strip.show();
+}
+
+/**
+ * @brief Pends a draw and starts or stops the frame timer depending on the LED effects.
+ *
+ * Solid and off LEDs are drawn once by the pended draw; the timer only runs for animated
+ * effects. Both run in the timer daemon task, in the order they were requested.
+ */
+void RGBHandler::updateTimer() {
+    bool animated = false;
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        if (leds[i].effect >= RGB_EFFECT_RAINBOW) {
+            animated = true;
+        }
+    }
+    xTimerPendFunctionCall(onDraw, NULL, 0, pdMS_TO_TICKS(10));
+    if (animated && !animating) {
+        frameTimer.setPeriod(framePeriod);
+        frameTimer.start();
+    } else if (!animated && animating) {
+        frameTimer.stop();
+    }
+    animating = animated;
+    Energy.set(ENERGY_LED, modelCurrentUa());
+}
+
+/**
+ * @brief Estimates the average current of the LEDs for the energy ledger.
+ *
+ * Each channel draws in proportion to its value. Blink and breathe are lit half of the
+ * time on average, and every color of the rainbow table adds up to one full channel.
+ *
+ * @return Current in microamps.
+ */
+uint32_t RGBHandler::modelCurrentUa() {
+    uint32_t current = 0;
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        const LedState &led = leds[i];
+        uint32_t channels = (uint32_t)led.r + led.g + led.b;
+        switch (led.effect) {
+        case RGB_EFFECT_SOLID:
+            current += channels * ENERGY_UA_LED_CHANNEL / 255;
+            break;
+        case RGB_EFFECT_RAINBOW:
+            current += ENERGY_UA_LED_CHANNEL;
+            break;
+        case RGB_EFFECT_BLINK:
+        case RGB_EFFECT_BREATHE:
+            current += channels * ENERGY_UA_LED_CHANNEL / 255 / 2;
+            break;
+        default:
+            break;
+        }
+    }
+    return current;
+}
+
+/**
+ * @brief Sets the effect of one LED.
+ *
+ * @param led LED index.
+ * @param effect Effect to run.
+ * @param r Red channel value.
+ * @param g Green channel value.
+ * @param b Blue channel value.
+ * @param hueOffset Starting point on the color wheel (rainbow only).
+ */
+void RGBHandler::setEffect(uint8_t led, RGBEffect effect, uint8_t r, uint8_t g, uint8_t b, uint8_t hueOffset) {
+    if (led >= NUM_PIXELS) {
+        return;
+    }
+    leds[led].effect = effect;
+    leds[led].r = r;
+    leds[led].g = g;
+    leds[led].b = b;
+    leds[led].hueOffset = hueOffset;
+    updateTimer();
+}
+
+/**
+ * @brief Adjusts the animation frame rate to the battery level.
+ *
+ * @param percent Harness battery level in percent.
+ */
+void RGBHandler::setBatteryLevel(uint8_t percent) {
+    uint32_t period = RGB_FRAME_MS_LOW;
+    if (percent > RGB_BATT_HIGH) {
+        period = RGB_FRAME_MS_FULL;
+    } else if (percent > RGB_BATT_LOW) {
+        period = RGB_FRAME_MS_MEDIUM;
+    }
+    if (period != framePeriod) {
+        framePeriod = period;
+        if (animating) {
+            frameTimer.setPeriod(framePeriod);
+        }
+    }
+}
+
+/**
+ * @brief Checks if the frame timer is running.
+ *
+ * @return true while at least one LED runs an animated effect.
+ */
+bool RGBHandler::isAnimating() {
+    return animating;
+}
+
+/**
+ * @brief Checks if any LED is on.
+ *
+ * @return true if at least one LED has an effect other than off.
+ */
+bool RGBHandler::isLit() {
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        if (leds[i].effect != RGB_EFFECT_OFF) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Starts the rainbow animation.
+ *
+ * Each LED gets a different starting hue for variation. The animation runs on the
+ * frame timer, so this returns right away.
+ */
 void RGBHandler::rainbowCycle() {
-    rainbowOn = true;  // Enable the rainbow effect
-    
-    // Set starting hues for each LED (different starting points for variation)
-    uint8_t hue1 = 0;
-    uint8_t hue2 = 128;
-    
-    while (rainbowOn) {
-        // Update LED 0 with its current hue
-        strip.setPixelColor(0, Wheel(hue1, strip));
-        // Update LED 1 with its current hue
-        strip.setPixelColor(1, Wheel(hue2, strip));
-        strip.show();
-        
-        // Increment the hue values for a smooth color transition
-        hue1++;
-        hue2++;
-        
-        // Process any queued events so nothing backs up
-        queHandler.Que();
-        
-        // Delay for a short time to control the transition speed (adjust as needed)
-        delay(20);
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        leds[i].effect = RGB_EFFECT_RAINBOW;
+        leds[i].hueOffset = i * (256 / NUM_PIXELS);
     }
+    updateTimer();
 }
 
 /**
  * @brief Turns off the rainbow effect.
  *
- * This function stops the rainbow cycle loop and turns off the LEDs.
+ * This function stops the rainbow animation and turns off the LEDs.
  */
 void RGBHandler::offRainbow() {
-    rainbowOn = false;  // This will break the loop in rainbowCycle()
-    off();            // Optionally, call your off() function to clear the LEDs.
+    off();
 }
 
 /**
  * @brief Sets the color of the RGB LED.
  *
- * This method sets the color of the first pixel on the NeoPixel strip to the specified RGB values.
- * It then updates the LED display with strip.show().
+ * This method sets every pixel on the NeoPixel strip to the RGB values in receivedPacket.
  *
  */
 void RGBHandler::setColor() {
-    for (int i = 0; i < strip.numPixels(); i++) {
-        strip.setPixelColor(i, strip.Color(receivedPacket.r, receivedPacket.g, receivedPacket.b));
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        leds[i].effect = RGB_EFFECT_SOLID;
+        leds[i].r = receivedPacket.r;
+        leds[i].g = receivedPacket.g;
+        leds[i].b = receivedPacket.b;
     }
-    strip.show();
+    updateTimer();
 }
 
 /**
  * @brief Turns off the RGB LED.
  *
- * Sets the color of the first pixel to off (0, 0, 0) and updates the display.
+ * Sets every pixel to off (0, 0, 0), updates the display and stops the animation timer.
  */
 void RGBHandler::off() {
-    for (int i = 0; i < strip.numPixels(); i++) {
-        strip.setPixelColor(i, strip.Color(0, 0, 0));
+    for (uint8_t i = 0; i < NUM_PIXELS; i++) {
+        leds[i].effect = RGB_EFFECT_OFF;
     }
-    strip.show();
+    updateTimer();
 }
@@ -28,12 +28,39 @@
 #define NUM_PIXELS 2
 #endif
 
+/**
+ * @brief Animation frame periods.
+ *
+ * The frame rate drops with the harness battery level. Effects are computed from millis(),
+ * so a lower frame rate only makes them less smooth, not slower.
+ */
+#define RGB_FRAME_MS_FULL       20      /**< Frame period above RGB_BATT_HIGH percent (50 fps). */
+#define RGB_FRAME_MS_MEDIUM     50      /**< Frame period above RGB_BATT_LOW percent (20 fps). */
+#define RGB_FRAME_MS_LOW        100     /**< Frame period at or below RGB_BATT_LOW percent (10 fps). */
+#define RGB_BATT_HIGH           50      /**< Battery percentage for the full frame rate. */
+#define RGB_BATT_LOW            20      /**< Battery percentage for the lowest frame rate. */
+
+/**
+ * @brief Effects that can run on each LED.
+ */
+enum RGBEffect {
+    RGB_EFFECT_OFF = 0,     /**< LED off. */
+    RGB_EFFECT_SOLID = 1,   /**< Fixed color. */
+    RGB_EFFECT_RAINBOW = 2, /**< Hue cycle through the whole color wheel. */
+    RGB_EFFECT_BLINK = 3,   /**< Color on and off once per second. */
+    RGB_EFFECT_BREATHE = 4  /**< Color fading in and out. */
+};
+
 /**
  * @class RGBHandler
  * @brief Class to control the Adafruit Flora RGB Smart NeoPixel.
  *
  * This class uses the Adafruit NeoPixel library to control an RGB LED.
  * It provides methods to initialize the LED, set its color, and turn it off.
+ * Animations are drawn by a FreeRTOS software timer, one frame per tick, so the
+ * power management task is never blocked and the CPU sleeps between frames. Only the timer
+ * daemon task draws: the setters update the LED state and pend a draw there, so two tasks
+ * never race on the pixel buffer or the NeoPixel PWM.
  */
 class RGBHandler {
 public:
@@ -55,15 +82,59 @@ public:
     /**
      * @brief Sets the color of the NeoPixel LED.
      *
-     * Sets the first (and only) pixel of the NeoPixel strip to the specified RGB color.
+     * Sets every pixel of the NeoPixel strip to the color in receivedPacket and stops
+     * any running animation.
      *
      */
     void setColor();
 
+    /**
+     * @brief Starts the rainbow animation.
+     *
+     * The LEDs start half way apart on the color wheel. Returns immediately.
+     */
     void rainbowCycle();
 
+    /**
+     * @brief Stops the rainbow animation and turns the LEDs off.
+     */
     void offRainbow();
 
+    /**
+     * @brief Sets the effect of one LED.
+     *
+     * The animation timer runs only while at least one LED has an animated effect.
+     *
+     * @param led LED index.
+     * @param effect Effect to run.
+     * @param r Red channel value.
+     * @param g Green channel value.
+     * @param b Blue channel value.
+     * @param hueOffset Starting point on the color wheel (rainbow only).
+     */
+    void setEffect(uint8_t led, RGBEffect effect, uint8_t r = 0, uint8_t g = 0, uint8_t b = 0, uint8_t hueOffset = 0);
+
+    /**
+     * @brief Adjusts the animation frame rate to the battery level.
+     *
+     * @param percent Harness battery level in percent.
+     */
+    void setBatteryLevel(uint8_t percent);
+
+    /**
+     * @brief Checks if the frame timer is running.
+     *
+     * @return true while at least one LED runs an animated effect.
+     */
+    bool isAnimating();
+
+    /**
+     * @brief Checks if any LED is on.
+     *
+     * @return true if at least one LED has an effect other than off.
+     */
+    bool isLit();
+
     /**
      * @brief Turns off the NeoPixel LED.
      *
@@ -72,7 +143,59 @@ public:
     void off();
 
 private:
+    /**
+     * @brief Effect state of one LED.
+     */
+    struct LedState {
+        RGBEffect effect;   /**< Effect running on the LED. */
+        uint8_t r;          /**< Red channel value. */
+        uint8_t g;          /**< Green channel value. */
+        uint8_t b;          /**< Blue channel value. */
+        uint8_t hueOffset;  /**< Starting point on the color wheel. */
+    };
+
+    /**
+     * @brief Software timer callback, draws one frame.
+     */
+    static void onFrame(TimerHandle_t unused);
+
+    /**
+     * @brief Draw pended by updateTimer(), runs in the timer daemon task like onFrame().
+     */
+    static void onDraw(void *unused, uint32_t unused2);
+
+    /**
+     * @brief Computes and shows the current frame of every LED, timer daemon task only.
+     */
+    void drawFrame();
+
+    /**
+     * @brief Pends a draw and starts or stops the frame timer depending on the LED effects.
+     */
+    void updateTimer();
+
+    /**
+     * @brief Estimates the average current of the LEDs for the energy ledger.
+     *
+     * @return Current in microamps.
+     */
+    uint32_t modelCurrentUa();
+
     /** @brief Instance of the Adafruit_NeoPixel library to control the LED. */
     Adafruit_NeoPixel strip;
-    bool rainbowOn;  
+
+    /** @brief Effect state per LED. */
+    LedState leds[NUM_PIXELS] = {};
+
+    /** @brief Timer that draws the animation frames. */
+    SoftwareTimer frameTimer;
+
+    /** @brief Current frame period in milliseconds. */
+    uint32_t framePeriod = RGB_FRAME_MS_FULL;
+
+    /** @brief True while the frame timer is running. */
+    bool animating = false;
+
+    /** @brief Instance used by the static timer callback. */
+    static RGBHandler *instance;
 };
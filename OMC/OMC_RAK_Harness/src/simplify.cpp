@@ -0,0 +1,166 @@
+/**
+ * @file simplify.cpp
+ * @brief Implementation of streaming track simplification for the OzarkMountainCat project.
+ *
+ * This file implements the sliding-window simplifier that sits between the GPS fixes and the
+ * track log. Distances are measured in the same local planar frame as the geofences
+ * (degrees * 1e7, longitude scaled by cos(latitude) in Q15).
+ */
+
+#include "simplify.h"
+
+/**
+ * @brief Local units (degrees * 1e7 of latitude) per 100 meters.
+ */
+#define SIMPLIFY_UNITS_PER_100M 8983
+
+/**
+ * @brief Computes cos(latitude) in Q15 for the local frame around the anchor.
+ *
+ * @param latE7 Latitude in degrees * 1e7.
+ * @return cos(latitude) * 32768.
+ */
+static int32_t cosQ15(int32_t latE7) {
+    return (int32_t)(cos(latE7 / 10000000.0 * M_PI / 180.0) * 32768.0);
+}
+
+/**
+ * @brief Sets the maximum error of a dropped fix.
+ *
+ * @param meters Tolerance in meters, 0 only drops fixes exactly on the line.
+ */
+void TrackSimplifier::setTolerance(uint16_t meters) {
+    tolerance = (int64_t)meters * SIMPLIFY_UNITS_PER_100M / 100;
+}
+
+/**
+ * @brief Checks if every window fix lies within the tolerance of the anchor to end segment.
+ *
+ * A fix that projects between the two ends is |cross| / length from the segment, so only the
+ * segment length needs a square root. A fix that projects before the anchor or past the end (the
+ * pet went out and came back) is measured to that end instead, otherwise an excursion along the
+ * line would be dropped with no error.
+ *
+ * @param end The candidate end of the line.
+ * @param error Receives the largest distance found, in local units.
+ * @return true if all window fixes are within the tolerance.
+ */
+bool TrackSimplifier::windowFits(const TrackFix &end, int64_t &error) {
+    int64_t ex = (((int64_t)end.lon - anchor.lon) * cosLat) >> 15;
+    int64_t ey = (int64_t)end.lat - anchor.lat;
+    int64_t lengthSq = ex * ex + ey * ey;
+    int64_t length = (int64_t)sqrtf((float)lengthSq);
+
+    error = 0;
+    for (uint8_t i = 0; i < windowCount; i++) {
+        int64_t px = (((int64_t)window[i].lon - anchor.lon) * cosLat) >> 15;
+        int64_t py = (int64_t)window[i].lat - anchor.lat;
+        int64_t distance;
+        int64_t dot = px * ex + py * ey;
+        if (length == 0 || dot <= 0) {
+            // Before the anchor, or the segment is a point (the pet came back to the anchor).
+            distance = (int64_t)sqrtf((float)(px * px + py * py));
+        } else if (dot >= lengthSq) {
+            // Past the end of the segment
+            int64_t dx = px - ex;
+            int64_t dy = py - ey;
+            distance = (int64_t)sqrtf((float)(dx * dx + dy * dy));
+        } else {
+            int64_t cross = px * ey - py * ex;
+            distance = (cross < 0 ? -cross : cross) / length;
+        }
+        if (distance > tolerance) {
+            return false;
+        }
+        if (distance > error) {
+            error = distance;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Makes the newest window fix the anchor and empties the window.
+ *
+ * @param out Receives the new anchor.
+ */
+void TrackSimplifier::emitLast(TrackFix &out) {
+    anchor = window[windowCount - 1];
+    cosLat = cosQ15(anchor.lat);
+    windowCount = 0;
+    if (windowError > maxError) {
+        maxError = windowError;
+    }
+    windowError = 0;
+    fixesOut++;
+    out = anchor;
+}
+
+/**
+ * @brief Feeds a fix into the simplifier.
+ *
+ * @param fix The new fix.
+ * @param out Receives the fix to keep, if any.
+ * @return true if a fix was emitted into out.
+ */
+bool TrackSimplifier::push(const TrackFix &fix, TrackFix &out) {
+    fixesIn++;
+    if (!hasAnchor) {
+        hasAnchor = true;
+        anchor = fix;
+        cosLat = cosQ15(anchor.lat);
+        fixesOut++;
+        out = fix;
+        return true;
+    }
+
+    int64_t error;
+    if (windowCount < TRACK_SIMPLIFY_WINDOW && windowFits(fix, error)) {
+        // Every fix held back so far is still explained by the line to this one.
+        windowError = error;
+        window[windowCount++] = fix;
+        return false;
+    }
+
+    // The previous fix is the last one the straight line holds for, so keep it.
+    emitLast(out);
+    window[windowCount++] = fix;
+    return true;
+}
+
+/**
+ * @brief Emits the newest held back fix, so the output ends at the current position.
+ *
+ * @param out Receives the fix to keep, if any.
+ * @return true if a fix was emitted into out.
+ */
+bool TrackSimplifier::flush(TrackFix &out) {
+    if (windowCount == 0) {
+        return false;
+    }
+    emitLast(out);
+    return true;
+}
+
+/**
+ * @brief Gets the newest fix that is held back and not yet emitted.
+ *
+ * @param out Receives the fix.
+ * @return true if a fix is held back.
+ */
+bool TrackSimplifier::pending(TrackFix &out) {
+    if (windowCount == 0) {
+        return false;
+    }
+    out = window[windowCount - 1];
+    return true;
+}
+
+/**
+ * @brief Gets the largest error of a dropped fix.
+ *
+ * @return Distance in meters.
+ */
+uint32_t TrackSimplifier::getMaxErrorM() {
+    return (uint32_t)(maxError * 100 / SIMPLIFY_UNITS_PER_100M);
+}
@@ -0,0 +1,135 @@
+#pragma once
+/**
+ * @file simplify.h
+ * @brief Header file for the TrackSimplifier class.
+ *
+ * This file declares the TrackSimplifier class which thins the stream of fixes before they are
+ * stored in the track log, so straight or stationary stretches do not use flash and backfill
+ * airtime point by point.
+ */
+
+#include "main.h"
+
+/**
+ * @brief Track simplification configuration.
+ */
+#define TRACK_SIMPLIFY_TOLERANCE_M  10  /**< Default maximum error of a dropped fix in meters. */
+#define TRACK_SIMPLIFY_WINDOW       16  /**< Maximum fixes held back before one is forced out. */
+
+/**
+ * @class TrackSimplifier
+ * @brief Streaming sliding-window line simplification.
+ *
+ * The simplifier keeps the last emitted fix (the anchor) and the fixes received since. A new fix
+ * extends the window as long as every fix in the window lies within the tolerance of the segment
+ * from the anchor to the new fix. Otherwise the previous fix is emitted and becomes the anchor.
+ * This gives the same result as Douglas-Peucker on each window, but needs only
+ * TRACK_SIMPLIFY_WINDOW fixes of memory and emits at most one fix per input.
+ */
+class TrackSimplifier {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    TrackSimplifier() {}
+
+    /**
+     * @brief Sets the maximum error of a dropped fix.
+     *
+     * @param meters Tolerance in meters, 0 only drops fixes exactly on the line.
+     */
+    void setTolerance(uint16_t meters);
+
+    /**
+     * @brief Feeds a fix into the simplifier.
+     *
+     * @param fix The new fix.
+     * @param out Receives the fix to keep, if any.
+     * @return true if a fix was emitted into out.
+     */
+    bool push(const TrackFix &fix, TrackFix &out);
+
+    /**
+     * @brief Emits the newest held back fix, so the output ends at the current position.
+     *
+     * @param out Receives the fix to keep, if any.
+     * @return true if a fix was emitted into out.
+     */
+    bool flush(TrackFix &out);
+
+    /**
+     * @brief Gets the newest fix that is held back and not yet emitted.
+     *
+     * @param out Receives the fix.
+     * @return true if a fix is held back.
+     */
+    bool pending(TrackFix &out);
+
+    /**
+     * @brief Gets the number of fixes fed in.
+     *
+     * @return Fixes passed to push().
+     */
+    uint32_t getFixesIn() { return fixesIn; }
+
+    /**
+     * @brief Gets the number of fixes kept.
+     *
+     * @return Fixes emitted by push() and flush().
+     */
+    uint32_t getFixesOut() { return fixesOut; }
+
+    /**
+     * @brief Gets the largest error of a dropped fix.
+     *
+     * @return Distance in meters.
+     */
+    uint32_t getMaxErrorM();
+
+private:
+    /**
+     * @brief Checks if every window fix lies within the tolerance of the anchor to end segment.
+     *
+     * @param end The candidate end of the line.
+     * @param error Receives the largest distance found, in local units.
+     * @return true if all window fixes are within the tolerance.
+     */
+    bool windowFits(const TrackFix &end, int64_t &error);
+
+    /**
+     * @brief Makes the newest window fix the anchor and empties the window.
+     *
+     * @param out Receives the new anchor.
+     */
+    void emitLast(TrackFix &out);
+
+    /** @brief Last emitted fix. */
+    TrackFix anchor = {};
+
+    /** @brief True once a fix has been emitted. */
+    bool hasAnchor = false;
+
+    /** @brief cos(anchor latitude) in Q15, scales longitude differences. */
+    int32_t cosLat = 32768;
+
+    /** @brief Fixes received since the anchor. */
+    TrackFix window[TRACK_SIMPLIFY_WINDOW];
+
+    /** @brief Number of fixes in window. */
+    uint8_t windowCount = 0;
+
+    /** @brief Tolerance in local units (degrees * 1e7 of latitude). */
+    int64_t tolerance = 0;
+
+    /** @brief Largest error of the fixes dropped by the current window, in local units. */
+    int64_t windowError = 0;
+
+    /** @brief Largest error of any dropped fix, in local units. */
+    int64_t maxError = 0;
+
+    /** @brief Number of fixes fed in. */
+    uint32_t fixesIn = 0;
+
+    /** @brief Number of fixes emitted. */
+    uint32_t fixesOut = 0;
+};
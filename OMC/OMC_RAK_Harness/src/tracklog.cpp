@@ -0,0 +1,293 @@
+/**
+ * @file tracklog.cpp
+ * @brief Implementation of the flash-backed track log for the OzarkMountainCat project.
+ *
+ * This file implements the page ring in the internal LittleFS partition. Each page file holds
+ * fixes in increasing sequence order, so a page is skipped by looking at its first and last fix.
+ */
+
+#include "tracklog.h"
+#include "logger.h"
+#include "metrics.h"
+
+using namespace Adafruit_LittleFS_Namespace;
+
+/**
+ * @brief Builds the path of a page file.
+ *
+ * @param page Page index.
+ * @param path Destination buffer (at least 16 bytes).
+ */
+void TrackLogHandler::pagePath(uint8_t page, char *path) {
+    snprintf(path, 16, TRACKLOG_DIR "/%u", page);
+}
+
+/**
+ * @brief Reads the first and last sequence numbers of a page file.
+ *
+ * @param page Page index.
+ * @param firstSeq Receives the sequence number of the first fix.
+ * @param lastSeq Receives the sequence number of the last fix.
+ * @return true if the page file exists and holds at least one fix.
+ */
+bool TrackLogHandler::pageInfo(uint8_t page, uint32_t &firstSeq, uint32_t &lastSeq) {
+    char path[16];
+    pagePath(page, path);
+    File file(InternalFS);
+    if (!file.open(path, FILE_O_READ)) {
+        return false;
+    }
+    TrackFix first;
+    TrackFix last;
+    uint16_t count = file.size() / sizeof(TrackFix);
+    bool ok = count > 0 && file.read(&first, sizeof(first)) == sizeof(first);
+    if (ok) {
+        file.seek((count - 1) * sizeof(TrackFix));
+        ok = file.read(&last, sizeof(last)) == sizeof(last);
+    }
+    file.close();
+    if (ok) {
+        firstSeq = first.seq;
+        lastSeq = last.seq;
+    }
+    return ok;
+}
+
+/**
+ * @brief Reads the sequence mark file.
+ *
+ * @return First sequence number not handed out before the reboot, 0 without a mark.
+ */
+uint32_t TrackLogHandler::readSeqMark() {
+    uint32_t mark = 0;
+    File file(InternalFS);
+    if (file.open(TRACKLOG_SEQ_FILE, FILE_O_READ)) {
+        if (file.read(&mark, sizeof(mark)) != sizeof(mark)) {
+            mark = 0;
+        }
+        file.close();
+    }
+    return mark;
+}
+
+/**
+ * @brief Reserves the next TRACKLOG_SEQ_BLOCK sequence numbers in the sequence mark file.
+ *
+ * The file is written before any number of the block is handed out, once per boot and once
+ * every TRACKLOG_SEQ_BLOCK reports, so it adds little flash wear to the page writes.
+ */
+void TrackLogHandler::reserveSeq() {
+    seqLimit = nextSeq + TRACKLOG_SEQ_BLOCK;
+    if (InternalFS.exists(TRACKLOG_SEQ_FILE)) {
+        InternalFS.remove(TRACKLOG_SEQ_FILE);
+    }
+    File file(InternalFS);
+    bool ok = file.open(TRACKLOG_SEQ_FILE, FILE_O_WRITE);
+    if (ok) {
+        ok = file.write((const uint8_t *)&seqLimit, sizeof(seqLimit)) == sizeof(seqLimit);
+        file.close();
+    }
+    if (!ok) {
+        LOG_WARN(LOG_TRACK_SEQ_MARK_FAILED, seqLimit);
+    }
+}
+
+/**
+ * @brief Mounts the internal file system and recovers the ring position.
+ *
+ * The page holding the newest fix is found from the last sequence number of every page file,
+ * and logging continues on the page after it. A partially flushed page stays valid as it is.
+ * Numbering continues at the sequence mark, which is past every number handed out before.
+ *
+ * @return true if the file system is mounted.
+ */
+bool TrackLogHandler::begin() {
+    if (!InternalFS.begin()) {
+        LOG_ERROR(LOG_TRACK_MOUNT_FAILED);
+        return false;
+    }
+    if (!InternalFS.exists(TRACKLOG_DIR)) {
+        InternalFS.mkdir(TRACKLOG_DIR);
+    }
+    mounted = true;
+    simplifier.setTolerance(TRACK_SIMPLIFY_TOLERANCE_M);
+    Metrics.registerGauge(METRIC_TRACK_KEPT_PCT);
+
+    uint32_t lastSeq = 0;
+    uint8_t lastPage = TRACKLOG_PAGES - 1;
+    for (uint8_t page = 0; page < TRACKLOG_PAGES; page++) {
+        uint32_t firstSeq;
+        uint32_t pageLastSeq;
+        if (pageInfo(page, firstSeq, pageLastSeq) && pageLastSeq > lastSeq) {
+            lastSeq = pageLastSeq;
+            lastPage = page;
+        }
+    }
+
+    pageFill = 0;
+    currentPage = (lastPage + 1) % TRACKLOG_PAGES;
+    nextSeq = lastSeq + 1;
+    uint32_t mark = readSeqMark();
+    if (mark == 0 && lastSeq != 0) {
+        // A log without a mark (older firmware): fixes that were only buffered in RAM may have
+        // been reported with these numbers. Each kept fix of the RAM page stands for up to
+        // TRACK_SIMPLIFY_WINDOW + 1 reported ones, and the simplifier may have held back a full
+        // window after the last kept fix.
+        nextSeq += TRACKLOG_FIXES_PER_PAGE * (TRACK_SIMPLIFY_WINDOW + 1) + TRACK_SIMPLIFY_WINDOW;
+    }
+    if (mark > nextSeq) {
+        nextSeq = mark;
+    }
+    reserveSeq();
+
+    LOG_INFO(LOG_TRACK_READY, nextSeq);
+    return true;
+}
+
+/**
+ * @brief Writes the RAM page to its page file.
+ *
+ * The old file is removed first because the LittleFS write mode appends.
+ *
+ * @return true if the whole page was written.
+ */
+bool TrackLogHandler::writePage() {
+    if (!mounted || pageFill == 0) {
+        return false;
+    }
+    char path[16];
+    pagePath(currentPage, path);
+    if (InternalFS.exists(path)) {
+        InternalFS.remove(path);
+    }
+    File file(InternalFS);
+    if (!file.open(path, FILE_O_WRITE)) {
+        LOG_WARN(LOG_TRACK_PAGE_FAILED, currentPage);
+        return false;
+    }
+    size_t bytes = pageFill * sizeof(TrackFix);
+    bool ok = file.write((const uint8_t *)pageBuffer, bytes) == bytes;
+    file.close();
+    return ok;
+}
+
+/**
+ * @brief Adds a fix kept by the simplifier to the RAM page.
+ *
+ * @param fix The fix to store.
+ */
+void TrackLogHandler::store(const TrackFix &fix) {
+    pageBuffer[pageFill++] = fix;
+    if (pageFill == TRACKLOG_FIXES_PER_PAGE) {
+        writePage();
+        currentPage = (currentPage + 1) % TRACKLOG_PAGES;
+        pageFill = 0;
+        uint32_t in = simplifier.getFixesIn();
+        Metrics.set(METRIC_TRACK_KEPT_PCT, in == 0 ? 0 : simplifier.getFixesOut() * 100 / in);
+        LOG_INFO(LOG_TRACK_SIMPLIFIED, in, simplifier.getFixesOut(), simplifier.getMaxErrorM());
+    }
+}
+
+/**
+ * @brief Adds a fix to the log.
+ *
+ * @param lat Latitude in degrees * 1e7.
+ * @param lon Longitude in degrees * 1e7.
+ * @param hour Hour (UTC).
+ * @param min Minute.
+ * @param sec Second.
+ * @param siv Satellites in view.
+ * @return The sequence number given to the fix.
+ */
+uint32_t TrackLogHandler::append(int32_t lat, int32_t lon, uint8_t hour, uint8_t min, uint8_t sec, uint8_t siv) {
+    if (mounted && nextSeq >= seqLimit) {
+        reserveSeq();
+    }
+    TrackFix fix;
+    fix.seq = nextSeq++;
+    fix.lat = lat;
+    fix.lon = lon;
+    fix.hour = hour;
+    fix.min = min;
+    fix.sec = sec;
+    fix.siv = siv;
+
+    TrackFix kept;
+    if (simplifier.push(fix, kept)) {
+        store(kept);
+    }
+    return fix.seq;
+}
+
+/**
+ * @brief Writes the partially filled page to flash.
+ */
+void TrackLogHandler::flush() {
+    TrackFix kept;
+    if (simplifier.flush(kept)) {
+        store(kept);
+    }
+    writePage();
+}
+
+/**
+ * @brief Reads the oldest fixes newer than a sequence number.
+ *
+ * Flash pages are visited from the oldest to the newest, followed by the RAM page and the fix
+ * held back by the simplifier. The page after the newest written one is the oldest; while it is
+ * being refilled its file is skipped.
+ *
+ * @param since Sequence number of the last fix the receiver has.
+ * @param out Destination array.
+ * @param max Size of the destination array.
+ * @return Number of fixes copied, in sequence order.
+ */
+uint16_t TrackLogHandler::readSince(uint32_t since, TrackFix *out, uint16_t max) {
+    uint16_t n = 0;
+
+    for (uint8_t i = 0; i < TRACKLOG_PAGES && mounted && n < max; i++) {
+        uint8_t page = (currentPage + i) % TRACKLOG_PAGES;
+        if (page == currentPage && pageFill > 0) {
+            // Either a flush of the RAM page or data from the last lap that is being replaced.
+            continue;
+        }
+        uint32_t firstSeq;
+        uint32_t lastSeq;
+        if (!pageInfo(page, firstSeq, lastSeq) || lastSeq <= since) {
+            continue;
+        }
+        char path[16];
+        pagePath(page, path);
+        File file(InternalFS);
+        if (!file.open(path, FILE_O_READ)) {
+            continue;
+        }
+        while (n < max && file.read(&out[n], sizeof(TrackFix)) == sizeof(TrackFix)) {
+            if (out[n].seq > since) {
+                n++;
+            }
+        }
+        file.close();
+    }
+
+    for (uint16_t i = 0; i < pageFill && n < max; i++) {
+        if (pageBuffer[i].seq > since) {
+            out[n++] = pageBuffer[i];
+        }
+    }
+
+    TrackFix held;
+    if (n < max && simplifier.pending(held) && held.seq > since) {
+        out[n++] = held;
+    }
+    return n;
+}
+
+/**
+ * @brief Gets the sequence number of the newest fix.
+ *
+ * @return Newest sequence number, 0 if the log is empty.
+ */
+uint32_t TrackLogHandler::getLastSeq() {
+    return nextSeq - 1;
+}
@@ -0,0 +1,168 @@
+#pragma once
+/**
+ * @file tracklog.h
+ * @brief Header file for the TrackLogHandler class.
+ *
+ * This file declares the TrackLogHandler class which keeps a ring buffer of compact fixes in the
+ * nRF52840 internal flash, so fixes reported while the receiver is out of range can be sent again
+ * once the link returns.
+ */
+
+#include "main.h"
+#include "simplify.h"
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+
+/**
+ * @brief Track log geometry.
+ *
+ * The log is TRACKLOG_PAGES files of one flash page each in the internal LittleFS partition.
+ * Fixes are collected in RAM and written one full page at a time, so every page costs a single
+ * erase/program cycle. LittleFS spreads the page files over its blocks for wear levelling.
+ * The internal partition is 28 kB, so four pages leave room for the file system metadata.
+ */
+#define TRACKLOG_PAGE_SIZE          4096    /**< nRF52840 flash page size in bytes. */
+#define TRACKLOG_PAGES              4       /**< Number of pages in the ring. */
+#define TRACKLOG_FIXES_PER_PAGE     (TRACKLOG_PAGE_SIZE / sizeof(TrackFix)) /**< Fixes per page. */
+#define TRACKLOG_BACKFILL_FRAMES    8       /**< Maximum LoRa frames sent per backfill request. */
+#define TRACKLOG_DIR                "/track" /**< Directory holding the page files. */
+#define TRACKLOG_SEQ_FILE           TRACKLOG_DIR "/seq" /**< Sequence mark file. */
+#define TRACKLOG_SEQ_BLOCK          256     /**< Sequence numbers reserved per mark file write. */
+
+/**
+ * @class TrackLogHandler
+ * @brief Flash-backed ring buffer of reported fixes.
+ *
+ * Every fix that is reported gets a sequence number. The sequence number travels with the report
+ * so the receiver can detect gaps and ask for "fixes since sequence N". Fixes pass through a
+ * TrackSimplifier first, so the log only keeps the fixes needed to redraw the track within the
+ * simplifier tolerance and sequence numbers in the log have holes.
+ */
+class TrackLogHandler {
+public:
+    /**
+     * @brief Default constructor.
+     */
+    TrackLogHandler() {}
+
+    /**
+     * @brief Mounts the internal file system and recovers the ring position.
+     *
+     * Sequence numbers are handed out in blocks of TRACKLOG_SEQ_BLOCK, and the end of the current
+     * block is kept in the sequence mark file. After a reboot numbering continues at the mark, so
+     * a number reported before is never given out again, even if no page was written yet.
+     *
+     * @return true if the file system is mounted.
+     */
+    bool begin();
+
+    /**
+     * @brief Adds a fix to the log.
+     *
+     * The fix goes through the simplifier. A kept fix is buffered in RAM and the page is written
+     * to flash once it is full.
+     *
+     * @param lat Latitude in degrees * 1e7.
+     * @param lon Longitude in degrees * 1e7.
+     * @param hour Hour (UTC).
+     * @param min Minute.
+     * @param sec Second.
+     * @param siv Satellites in view.
+     * @return The sequence number given to the fix.
+     */
+    uint32_t append(int32_t lat, int32_t lon, uint8_t hour, uint8_t min, uint8_t sec, uint8_t siv);
+
+    /**
+     * @brief Writes the partially filled page to flash.
+     *
+     * The fix held back by the simplifier is kept first. Only needed before a planned power loss;
+     * normal operation writes full pages.
+     */
+    void flush();
+
+    /**
+     * @brief Reads the oldest fixes newer than a sequence number.
+     *
+     * The newest fix held back by the simplifier is included, so a backfill always ends at the
+     * last known position.
+     *
+     * @param since Sequence number of the last fix the receiver has.
+     * @param out Destination array.
+     * @param max Size of the destination array.
+     * @return Number of fixes copied, in sequence order.
+     */
+    uint16_t readSince(uint32_t since, TrackFix *out, uint16_t max);
+
+    /**
+     * @brief Gets the sequence number of the newest fix.
+     *
+     * @return Newest sequence number, 0 if the log is empty.
+     */
+    uint32_t getLastSeq();
+
+private:
+    /**
+     * @brief Writes the RAM page to its page file.
+     *
+     * @return true if the whole page was written.
+     */
+    bool writePage();
+
+    /**
+     * @brief Adds a fix kept by the simplifier to the RAM page.
+     *
+     * @param fix The fix to store.
+     */
+    void store(const TrackFix &fix);
+
+    /**
+     * @brief Reads the first and last sequence numbers of a page file.
+     *
+     * @param page Page index.
+     * @param firstSeq Receives the sequence number of the first fix.
+     * @param lastSeq Receives the sequence number of the last fix.
+     * @return true if the page file exists and holds at least one fix.
+     */
+    bool pageInfo(uint8_t page, uint32_t &firstSeq, uint32_t &lastSeq);
+
+    /**
+     * @brief Reads the sequence mark file.
+     *
+     * @return First sequence number not handed out before the reboot, 0 without a mark.
+     */
+    uint32_t readSeqMark();
+
+    /**
+     * @brief Reserves the next TRACKLOG_SEQ_BLOCK sequence numbers in the sequence mark file.
+     */
+    void reserveSeq();
+
+    /**
+     * @brief Builds the path of a page file.
+     *
+     * @param page Page index.
+     * @param path Destination buffer (at least 16 bytes).
+     */
+    static void pagePath(uint8_t page, char *path);
+
+    /** @brief Drops fixes that add less than the tolerance to the track. */
+    TrackSimplifier simplifier;
+
+    /** @brief Fixes of the page being filled. */
+    TrackFix pageBuffer[TRACKLOG_FIXES_PER_PAGE];
+
+    /** @brief Number of fixes in pageBuffer. */
+    uint16_t pageFill = 0;
+
+    /** @brief Page index pageBuffer will be written to. */
+    uint8_t currentPage = 0;
+
+    /** @brief Sequence number for the next fix (sequence numbers start at 1). */
+    uint32_t nextSeq = 1;
+
+    /** @brief First sequence number not covered by the sequence mark file. */
+    uint32_t seqLimit = 0;
+
+    /** @brief True once the file system is mounted. */
+    bool mounted = false;
+};
@@ -0,0 +1,19 @@
+#pragma once
+/**
+ * @file Arduino.h
+ * @brief Host stand-in for the Arduino core, for the native test environment.
+ *
+ * Only what the hardware independent modules use. The tests provide millis() themselves, so
+ * they can script the clock.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+/**
+ * @brief Milliseconds since boot, defined by each test.
+ */
+unsigned long millis();
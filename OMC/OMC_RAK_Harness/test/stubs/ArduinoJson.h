@@ -0,0 +1,5 @@
+#pragma once
+/**
+ * @file ArduinoJson.h
+ * @brief Empty host stand-in, the tested modules do not build JSON documents.
+ */
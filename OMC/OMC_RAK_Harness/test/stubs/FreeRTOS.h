@@ -0,0 +1,18 @@
+#pragma once
+/**
+ * @file FreeRTOS.h
+ * @brief Host stand-in for the FreeRTOS types and critical sections used by the tested modules.
+ *
+ * The tests run single threaded, so the critical sections are empty.
+ */
+
+#include <stdint.h>
+
+typedef uint32_t UBaseType_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+#define taskENTER_CRITICAL_FROM_ISR() 0
+#define taskEXIT_CRITICAL_FROM_ISR(saved) (void)(saved)
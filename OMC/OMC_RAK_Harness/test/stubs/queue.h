@@ -0,0 +1,5 @@
+#pragma once
+/**
+ * @file queue.h
+ * @brief Empty host stand-in, main.h only needs the FreeRTOS.h and Arduino.h ones.
+ */
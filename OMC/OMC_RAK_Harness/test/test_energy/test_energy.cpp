@@ -0,0 +1,146 @@
+/**
+ * @file test_energy.cpp
+ * @brief Host test of the energy ledger over a scripted day.
+ *
+ * The harness runs a day in power saving mode against a scripted clock: every five minutes it
+ * wakes for 25 s with the GNSS searching for 20 s, one LoRa transmission of 1 s and 2 s of
+ * listening, then sleeps. The expected charges are worked out by hand from the script.
+ *
+ *     pio test -e native
+ */
+
+#include <unity.h>
+#include "energy.h"
+
+/** @brief Scripted clock returned by millis(). */
+static uint32_t clockMs = 0;
+
+unsigned long millis() {
+    return clockMs;
+}
+
+/** @brief Current of the MCU while asleep in the script, in microamps. */
+#define SCRIPT_UA_MCU_SLEEP 5
+
+/** @brief Current of the LoRa radio while listening in the script, in microamps. */
+#define SCRIPT_UA_LORA_RX 4600
+
+/** @brief Output power of the scripted transmissions in dBm. */
+#define SCRIPT_TX_DBM 22
+
+/** @brief Wakeups in the scripted day, one every five minutes. */
+#define SCRIPT_WAKES 288
+
+/**
+ * @brief Runs one five minute power saving cycle.
+ *
+ * @param energy Ledger under test.
+ */
+static void runWake(EnergyHandler &energy) {
+    energy.set(ENERGY_MCU, ENERGY_UA_MCU_ACTIVE);
+    energy.set(ENERGY_GNSS, ENERGY_UA_GNSS_ACQUIRE);
+    clockMs += 20000;
+    energy.set(ENERGY_GNSS, 0);
+    energy.set(ENERGY_RADIO_TX, EnergyHandler::txCurrentUa(SCRIPT_TX_DBM));
+    clockMs += 1000;
+    energy.set(ENERGY_RADIO_TX, 0);
+    energy.set(ENERGY_RADIO_RX, SCRIPT_UA_LORA_RX);
+    clockMs += 2000;
+    energy.set(ENERGY_RADIO_RX, 0);
+    clockMs += 2000;
+    energy.set(ENERGY_MCU, SCRIPT_UA_MCU_SLEEP);
+    clockMs += 275000;
+}
+
+/**
+ * @brief Starts a ledger at boot and runs the scripted day on it.
+ *
+ * @param energy Ledger under test.
+ */
+static void runDay(EnergyHandler &energy) {
+    clockMs = 0;
+    energy.begin();
+    for (uint16_t i = 0; i < SCRIPT_WAKES; i++) {
+        runWake(energy);
+    }
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+/**
+ * @brief Every subsystem account holds the charge of the script.
+ */
+void test_day_per_subsystem(void) {
+    EnergyHandler energy;
+    runDay(energy);
+    TEST_ASSERT_EQUAL_UINT32(86400000, clockMs);
+    // 288 x 20 s x 30 mA
+    TEST_ASSERT_EQUAL_UINT32(48000, energy.getBootUah(ENERGY_GNSS));
+    // 288 x 1 s x 118 mA
+    TEST_ASSERT_EQUAL_UINT32(9440, energy.getBootUah(ENERGY_RADIO_TX));
+    // 288 x 2 s x 4.6 mA
+    TEST_ASSERT_EQUAL_UINT32(736, energy.getBootUah(ENERGY_RADIO_RX));
+    // 288 x (25 s x 3.3 mA + 275 s x 5 uA)
+    TEST_ASSERT_EQUAL_UINT32(6710, energy.getBootUah(ENERGY_MCU));
+    TEST_ASSERT_EQUAL_UINT32(0, energy.getBootUah(ENERGY_LED));
+    TEST_ASSERT_EQUAL_UINT32(0, energy.getBootUah(ENERGY_BUZZER));
+    // Nothing was reported yet, so the report period is the whole day.
+    TEST_ASSERT_EQUAL_UINT32(48000, energy.getReportUah(ENERGY_GNSS));
+}
+
+/**
+ * @brief The average current and the time to empty follow the whole day.
+ */
+void test_day_projection(void) {
+    EnergyHandler energy;
+    runDay(energy);
+    // 233589600000 uAms over 86400000 ms
+    TEST_ASSERT_EQUAL_UINT32(2703, energy.getAverageUa());
+    // Half of BATTERY_CAPACITY_MAH at 2703 uA
+    TEST_ASSERT_EQUAL_UINT32(BATTERY_CAPACITY_MAH * 1000 / 2 / 2703, energy.getHoursRemaining(50));
+    TEST_ASSERT_EQUAL_UINT32(0, energy.getHoursRemaining(0));
+}
+
+/**
+ * @brief A report starts a new period, the boot totals keep counting.
+ */
+void test_report_period(void) {
+    EnergyHandler energy;
+    runDay(energy);
+    TEST_ASSERT_TRUE(energy.reportDue());
+    energy.markReported();
+    TEST_ASSERT_FALSE(energy.reportDue());
+
+    // Within the first minute the average still covers the time since boot.
+    clockMs += 30000;
+    TEST_ASSERT_EQUAL_UINT32(2702, energy.getAverageUa());
+
+    // One hour asleep: only the MCU sleep current is in the new period.
+    clockMs += 3570000;
+    TEST_ASSERT_EQUAL_UINT32(5, energy.getReportUah(ENERGY_MCU));
+    TEST_ASSERT_EQUAL_UINT32(0, energy.getReportUah(ENERGY_GNSS));
+    TEST_ASSERT_EQUAL_UINT32(6715, energy.getBootUah(ENERGY_MCU));
+    TEST_ASSERT_EQUAL_UINT32(SCRIPT_UA_MCU_SLEEP, energy.getAverageUa());
+    TEST_ASSERT_EQUAL_UINT32(BATTERY_CAPACITY_MAH * 1000 / 2 / SCRIPT_UA_MCU_SLEEP, energy.getHoursRemaining(50));
+}
+
+/**
+ * @brief The TX current steps of the SX1262 power amplifier.
+ */
+void test_tx_current(void) {
+    TEST_ASSERT_EQUAL_UINT32(118000, EnergyHandler::txCurrentUa(22));
+    TEST_ASSERT_EQUAL_UINT32(84000, EnergyHandler::txCurrentUa(20));
+    TEST_ASSERT_EQUAL_UINT32(58000, EnergyHandler::txCurrentUa(17));
+    TEST_ASSERT_EQUAL_UINT32(45000, EnergyHandler::txCurrentUa(14));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_day_per_subsystem);
+    RUN_TEST(test_day_projection);
+    RUN_TEST(test_report_period);
+    RUN_TEST(test_tx_current);
+    return UNITY_END();
+}
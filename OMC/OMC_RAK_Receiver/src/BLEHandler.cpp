@@ -1,11 +1,30 @@
 #include "BLEHandler.h"
+#include "MetricsHandler.h"
+#include "FramePoolHandler.h"
+#include "CommandHandler.h"
+#include "HistoryHandler.h"
+#include "LogHandler.h"
+
+// Connection parameters per BleProfile
+struct BleProfileParams {
+    uint16_t interval;      // 1.25 ms units
+    uint16_t latency;       // connection events the receiver may skip
+    uint16_t timeout;       // supervision timeout, 10 ms units
+    uint8_t phy;
+};
+
+static const BleProfileParams profiles[BLE_PROFILE_COUNT] = {
+    {120, 3, 400, BLE_GAP_PHY_1MBPS},  // BLE_PROFILE_TRACKING: 150 ms, a phone write waits 600 ms at most
+    {12, 0, 200, BLE_GAP_PHY_1MBPS},   // BLE_PROFILE_LOCATING: 15 ms
+    {6, 0, 200, BLE_GAP_PHY_2MBPS},    // BLE_PROFILE_BULK_SYNC: 7.5 ms
+};
 
 // Constructor - nothing special needed here
 BleHandler::BleHandler() {}
-bool bleReceived = false;
 
 void connect_callback(uint16_t conn_handle) {
     Serial.println("BLE connected!");
+    Metrics.add(METRIC_BLE_CONNECTS);
      // Get the reference to current connection
      // The below code is necessary to get past the 20 byte MTU limit. This is the only way the code will work. 
      // Metods like "Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);"" don't work unless you have the below code.
@@ -14,25 +33,32 @@ void connect_callback(uint16_t conn_handle) {
     char central_name[32] = { 0 };
     connection->getPeerName(central_name, sizeof(central_name));
 
-    Serial.println("Request to change MTU size to 200 bytes");
-    connection->requestMtuExchange(203);                              // Change MTU SIZE
+    // Largest MTU and long data packets, the profile sets the interval and PHY. The requests
+    // complete in the background, the callback does not wait for them.
+    Serial.println("Request to change MTU size to 247 bytes");
+    connection->requestMtuExchange(247);                              // Change MTU SIZE
+    connection->requestDataLengthUpdate();
+    // The app usually writes right after connecting
+    BLE.markActive();
 
     Serial.print("Connected to ");
     Serial.println(central_name);
-
-    // delay a bit for all the request to complete
-    delay(1000);
   }
 void disconnect_callback(uint16_t conn_handle, uint8_t reason) {
     Serial.println("BLE disconnected!");
+    // The next app may be an older one that only reads JSON
+    BLE.setBinary(false);
+    BLE.resetProfile();
     Serial.println(reason);
 }
 
 // Initialize BLE
 void BleHandler::begin()
 {
-    // Initialize the Bluefruit stack
+    // Initialize the Bluefruit stack. The connection config is only read by begin(): 247 byte
+    // MTU and 8 queued notifications for the history sync bursts.
     Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);
+    Bluefruit.configPrphConn(247, 200, 8, 4);
     Bluefruit.begin();
     Bluefruit.Periph.setConnectCallback(connect_callback);
     Bluefruit.Periph.setDisconnectCallback(disconnect_callback);
@@ -57,9 +83,25 @@ void BleHandler::begin()
     mountainCatChar.setPermission(SECMODE_OPEN, SECMODE_OPEN);
     mountainCatChar.setWriteCallback(BleHandler::onWriteCallback);
     mountainCatChar.setUuid(MOUNTAINCAT_CHARACTERISTIC_UUID);
-    mountainCatChar.setFixedLen(200);
+    // Variable length, a binary frame is a few dozen bytes
+    mountainCatChar.setMaxLen(200);
     mountainCatChar.begin();
-    //mountainCatChar.setMaxLen(247);
+
+    // Metrics snapshot (binary): receiver first, then the last one from the harness
+    metricsChar.setProperties(CHR_PROPS_READ | CHR_PROPS_NOTIFY);
+    metricsChar.setPermission(SECMODE_OPEN, SECMODE_NO_ACCESS);
+    metricsChar.setMaxLen(BLE_METRICS_MAX);
+    metricsChar.begin();
+
+    // History sync: the app writes the first index it is missing, pages come back as notifications
+    historyChar.setProperties(CHR_PROPS_WRITE | CHR_PROPS_WRITE_WO_RESP | CHR_PROPS_NOTIFY);
+    historyChar.setPermission(SECMODE_OPEN, SECMODE_OPEN);
+    historyChar.setWriteCallback(BleHandler::onHistoryWrite);
+    historyChar.setMaxLen(HISTORY_PAGE_MAX);
+    historyChar.begin();
+    Metrics.registerCounter(METRIC_BLE_CONNECTS);
+    Metrics.registerCounter(METRIC_BLE_WRITES);
+    Metrics.registerCounter(METRIC_BLE_NOTIFIES);
 
     // 3) Set up advertising
     Bluefruit.Advertising.addFlags(BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE);
@@ -71,117 +113,113 @@ void BleHandler::begin()
     
     // Start advertising
     Bluefruit.Advertising.restartOnDisconnect(true);
-    Bluefruit.Advertising.setInterval(32, 64); // in unit of 0.625 ms
-    Bluefruit.Advertising.setFastTimeout(30);	 // number of seconds in fast mode
+    Bluefruit.Advertising.setInterval(BLE_ADV_FAST_INTERVAL, BLE_ADV_SLOW_INTERVAL); // in unit of 0.625 ms
+    Bluefruit.Advertising.setFastTimeout(BLE_ADV_FAST_TIMEOUT);	 // number of seconds in fast mode
     Bluefruit.Advertising.start(0);				 // 0 = Don't stop advertising after n seconds
-    Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);
-    Bluefruit.configPrphConn(247, 200, 4, 4);    
     Serial.println("BLE initialized. Advertising as 'MountainCat'...");
 }
 
 void BleHandler::update()
 {
-    //This is a placeholder for the future
+    if (profile == BLE_PROFILE_LOCATING && millis() - lastActiveMs >= BLE_IDLE_MS) {
+        setProfile(BLE_PROFILE_TRACKING);
+    }
+}
+
+void BleHandler::setProfile(BleProfile next)
+{
+    if (next == profile || !isConnected()) {
+        return;
+    }
+    BLEConnection* connection = Bluefruit.Connection(Bluefruit.connHandle());
+    if (connection == NULL) {
+        return;
+    }
+    const BleProfileParams &params = profiles[next];
+    connection->requestPHY(params.phy);
+    connection->requestConnectionParameter(params.interval, params.latency, params.timeout);
+    profile = next;
+    LOG_INFO(LOG_BLE_PROFILE, next, params.interval, params.latency);
+}
+
+void BleHandler::markActive()
+{
+    lastActiveMs = millis();
+    // A history sync keeps its profile until it is done
+    if (profile != BLE_PROFILE_BULK_SYNC) {
+        setProfile(BLE_PROFILE_LOCATING);
+    }
 }
 
-void BleHandler::sendData(const uint8_t* data, uint16_t length)
+bool BleHandler::sendData(const uint8_t* data, uint16_t length)
 {
     if (!isConnected()) {
         Serial.println("BLE not connected, skipping sendData.");
-        return;
+        return false;
     }
     if (length > mountainCatChar.getMaxLen()) {
         length = mountainCatChar.getMaxLen();
         Serial.println("Warning: Data truncated to characteristic max length.");
     }
-    mountainCatChar.notify(data, length);
+    bool sent = mountainCatChar.notify(data, length);
+    Metrics.add(METRIC_BLE_NOTIFIES);
     Serial.print("Sent BLE data: ");
+    return sent;
 }
 
-// Check if at least one device is connected
-bool BleHandler::isConnected()
+bool BleHandler::sendHistory(const uint8_t* data, uint16_t length)
 {
-    return (Bluefruit.connected() > 0);
+    return isConnected() && historyChar.notify(data, length);
 }
 
-void BleHandler::OnRxToJSON(uint8_t *payload, uint16_t len)
+uint16_t BleHandler::getPayloadSize()
 {
-    // Now parse with ArduinoJson
-    char jsonBuffer[len + 1];
-    memcpy(jsonBuffer, payload, len);
-    jsonBuffer[len] = '\0';  // Null terminate the string
-
-    StaticJsonDocument<256> doc;
-    DeserializationError error = deserializeJson(doc, jsonBuffer);
-    if (!error)
-    {
-        // Extract fields
-        receivedPacket.msgType = doc["msgType"];
-        delay(10);
-        if (receivedPacket.msgType == MSG_LED)
-        {
-            receivedPacket.r = doc["r"];
-            receivedPacket.g = doc["g"];
-            receivedPacket.b = doc["b"];
-        }
-        if (receivedPacket.msgType == MSG_RB_LED)
-        {
-            receivedPacket.rbLed = doc["rbLed"]; // rainbow led
-        }
-        if (receivedPacket.msgType == MSG_PWR_MODE)
-        {
-            receivedPacket.mode = doc["mode"];
-        }
-        if (receivedPacket.msgType == MSG_BUZZER)
-        {
-            receivedPacket.buzzer = doc["buzzer"];
-        }
-        if (receivedPacket.msgType == MSG_ACKNOWLEDGEMENT)
-        {
-            receivedPacket.ack = doc["ack"];
-        }
-        if (receivedPacket.msgType == MSG_ALL_DATA)
-        {
-            receivedPacket.lat = doc["lat"];
-            receivedPacket.lon = doc["lon"];
-            receivedPacket.hour = doc["hour"];
-            receivedPacket.min = doc["min"];
-            receivedPacket.sec = doc["sec"];
-            receivedPacket.siv = doc["siv"];
-            receivedPacket.hdop = doc["hdop"];
-            receivedPacket.alt = doc["alt"];
-        };
-    }
-    else
-    {
-        Serial.print("JSON parse failed: ");
-        Serial.println(error.c_str());
+    BLEConnection* connection = Bluefruit.Connection(Bluefruit.connHandle());
+    return connection != NULL ? connection->getMtu() - 3 : 20;
+}
+
+void BleHandler::updateMetrics(const uint8_t* data, uint16_t length)
+{
+    // Keep the value current for reads, and push it to a subscribed phone
+    metricsChar.write(data, length);
+    if (isConnected()) {
+        metricsChar.notify(data, length);
     }
 }
 
+// Check if at least one device is connected
+bool BleHandler::isConnected()
+{
+    return (Bluefruit.connected() > 0);
+}
+
 // Static callback if the phone writes to our characteristic
 void BleHandler::onWriteCallback(uint16_t conn_handle, BLECharacteristic* chr, uint8_t* data, uint16_t len)
 {
-    Serial.print("BLE Write from conn_handle ");
-    Serial.println(conn_handle);
-
-    Serial.print("Data length: ");
-    Serial.println(len);
+    Metrics.add(METRIC_BLE_WRITES);
+    BLE.markActive();
+    // The first byte tells JSON ('{') from a binary frame and its message type
+    LOG_DEBUG(LOG_BLE_WRITE, len, conn_handle, len > 0 ? data[0] : 0);
+    // Parsed and sent by the command task, in order
+    Commands.push(data, len);
+}
 
-    Serial.print("Data: ");
-    for (int i = 0; i < len; i++) {
-        Serial.write(data[i]);
+void BleHandler::onHistoryWrite(uint16_t conn_handle, BLECharacteristic* chr, uint8_t* data, uint16_t len)
+{
+    if (len >= sizeof(uint32_t)) {
+        uint32_t from;
+        memcpy(&from, data, sizeof(from));
+        History.request(from);
     }
-    Serial.println();
-    OnRxToJSON(data, len);
-    bleReceived = true;
 }
 
 
 void BleHandler::SerializeJSON(MessageType msgType, uint8_t* data)
 {
-
-    StaticJsonDocument<200> doc;
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL)
+        return;
+    JsonDocument doc(frame);
     if (msgType == MSG_ALL_DATA)
     {
         doc["lat"] = receivedPacket.lat;
@@ -216,10 +254,8 @@ void BleHandler::SerializeJSON(MessageType msgType, uint8_t* data)
         doc["mode"] = receivedPacket.mode;
     }
 
-    char buffer[200];
-    size_t n = serializeJson(doc, buffer, sizeof(buffer));
-    memset(data, 0, sizeof(data)); // Wipes entire buffer
-    memcpy(data, buffer, n);            // Copy new payload
-    data[n] = '\0';                     // Null-terminate the new data
+    // data is the 200 byte characteristic value, serializeJson null-terminates it
+    serializeJson(doc, data, 200);
+    FramePool.release(frame);
 }
 
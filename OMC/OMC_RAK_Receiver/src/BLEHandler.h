@@ -6,6 +6,25 @@
 // You can define your 128-bit UUIDs as strings:
 #define MOUNTAINCAT_SERVICE_UUID       "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
 #define MOUNTAINCAT_CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"
+#define MOUNTAINCAT_METRICS_UUID        "beb5483f-36e1-4688-b7f5-ea07361b26a8"
+#define MOUNTAINCAT_HISTORY_UUID        "beb54840-36e1-4688-b7f5-ea07361b26a8"
+
+#define BLE_ADV_FAST_INTERVAL       32      // 20 ms for the first BLE_ADV_FAST_TIMEOUT seconds (0.625 ms units)
+#define BLE_ADV_SLOW_INTERVAL       244     // 152.5 ms after that
+#define BLE_ADV_FAST_TIMEOUT        30      // seconds
+#define BLE_IDLE_MS                 30000   // no app write for this long: back to the tracking profile
+#define BLE_METRICS_MAX             244     // metrics characteristic, one notification of a 247 byte MTU
+
+// Connection parameter profiles (table in BLEHandler.cpp). The receiver picks one from activity:
+// locating on connect and on every app write, bulk sync while a history sync runs, and tracking
+// once the app has been idle for BLE_IDLE_MS. Slave latency only delays what the phone sends, so
+// live fixes are notified right away in every profile.
+enum BleProfile : uint8_t {
+    BLE_PROFILE_TRACKING = 0,   // long interval with slave latency, lowest current while idle
+    BLE_PROFILE_LOCATING,       // short interval, low command and notification latency
+    BLE_PROFILE_BULK_SYNC,      // shortest interval on the 2M PHY for the history burst
+    BLE_PROFILE_COUNT           // none, not connected
+};
 
 // This class sets up a BLE service with the "MountainCat" name and a single characteristic.
 // It supports read, write, and notify so the phone can receive data (LoRa packets) and send commands.
@@ -13,13 +32,31 @@ class BleHandler {
 public:
     BleHandler();
     void begin();
+    // Falls back to the tracking profile once the app is idle, from the housekeeping
     void update();
+    // Requests the connection parameters of a profile, if it is not the active one
+    void setProfile(BleProfile profile);
+    // App activity: locating profile and restart the idle time
+    void markActive();
+    // Forgets the active profile, the next connection starts without one
+    void resetProfile() { profile = BLE_PROFILE_COUNT; }
     
 
     // Call this to send data to the phone. 'data' is your buffer, 'length' is how many bytes.
-    void sendData(const uint8_t* data, uint16_t length);
+    // False if no phone got it.
+    bool sendData(const uint8_t* data, uint16_t length);
+    // One page of the history sync (HistoryHandler), waits for a free notification buffer
+    bool sendHistory(const uint8_t* data, uint16_t length);
+    // Largest notification payload of the connection (MTU - 3)
+    uint16_t getPayloadSize();
+    // Notifications in the binary framing (BleProtocol.h) instead of JSON, for this connection
+    void setBinary(bool on) { binary = on; }
+    bool isBinary() { return binary; }
+    // Sets the binary metrics snapshot served on the metrics characteristic (read and notify)
+    void updateMetrics(const uint8_t* data, uint16_t length);
     // Callback when the phone writes to our characteristic
     static void onWriteCallback(uint16_t conn_handle, BLECharacteristic* chr, uint8_t* data, uint16_t len);
+    static void onHistoryWrite(uint16_t conn_handle, BLECharacteristic* chr, uint8_t* data, uint16_t len);
 
 private:
     // A helper to see if at least one device is connected over BLE
@@ -27,10 +64,14 @@ private:
     BLEDis bledis; // DIS (Device Information Service) helper class instance
     BLEBas blebas; // BAS (Battery Service) helper class instance
     void SerializeJSON(MessageType msgType, uint8_t* data);
-    static void OnRxToJSON(uint8_t *payload, uint16_t len);
     // Our BLE service and characteristic
     BLEService        mountainCatService = BLEService(MOUNTAINCAT_SERVICE_UUID);
     BLECharacteristic mountainCatChar    = BLECharacteristic(MOUNTAINCAT_CHARACTERISTIC_UUID);
-    
-    
+    BLECharacteristic metricsChar        = BLECharacteristic(MOUNTAINCAT_METRICS_UUID);
+    BLECharacteristic historyChar        = BLECharacteristic(MOUNTAINCAT_HISTORY_UUID);
+    volatile bool binary = false; // JSON until the app asks for MSG_BLE_PROTOCOL
+    volatile BleProfile profile = BLE_PROFILE_COUNT;
+    volatile uint32_t lastActiveMs = 0;
 };
+
+extern BleHandler BLE;
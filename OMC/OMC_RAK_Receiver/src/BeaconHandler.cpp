@@ -0,0 +1,97 @@
+#include "BeaconHandler.h"
+#include "BLEHandler.h"
+#include "LoraHandler.h"
+#include "LogHandler.h"
+
+void BeaconHandler::begin() {
+#if BEACON_ENABLED
+    Bluefruit.Scanner.setRxCallback(onReport);
+    ble_gap_scan_params_t params = {};
+    params.extended = 1;
+    params.scan_phys = BLE_GAP_PHY_CODED;
+    params.interval = BEACON_SCAN_INTERVAL;
+    params.window = BEACON_SCAN_WINDOW;
+    params.timeout = BLE_GAP_SCAN_TIMEOUT_UNLIMITED;
+    params.filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL;
+    uint32_t err = sd_ble_gap_scan_start(&params, &reportData);
+    if (err != NRF_SUCCESS) {
+        LOG_WARN(LOG_BEACON_SCAN_FAILED, err);
+    }
+#endif
+}
+
+// Finds our manufacturer data among the AD structures of a report
+bool BeaconHandler::parse(const ble_data_t &data, BeaconPayload &payload) {
+    for (uint16_t i = 0; i + 1 < data.len && data.p_data[i] != 0; i += data.p_data[i] + 1) {
+        uint8_t len = data.p_data[i];
+        if (data.p_data[i + 1] != BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA || len - 1 < (int)sizeof(payload) ||
+            i + 1 + len > data.len) {
+            continue;
+        }
+        memcpy(&payload, &data.p_data[i + 2], sizeof(payload));
+        return payload.company == BEACON_COMPANY_ID && payload.marker == BEACON_MARKER &&
+               payload.version == BEACON_VERSION;
+    }
+    return false;
+}
+
+// Bluefruit callback task, on every advertising report of the scan
+void BeaconHandler::onReport(ble_gap_evt_adv_report_t *report) {
+    BeaconPayload payload;
+    if (parse(report->data, payload)) {
+        taskENTER_CRITICAL();
+        Beacon.pending = payload;
+        Beacon.pendingRssi = report->rssi;
+        Beacon.received = true;
+        taskEXIT_CRITICAL();
+        notifyLoop(LOOP_EVENT_BEACON);
+    }
+    // The SoftDevice pauses the scan on every report until it gets a buffer back
+    sd_ble_gap_scan_start(NULL, &Beacon.reportData);
+}
+
+void BeaconHandler::forward() {
+    if (!received) {
+        return;
+    }
+    // The LoRa callback task runs above this one and fills receivedPacket without blocking, so a
+    // copy taken in a critical section is never half updated
+    taskENTER_CRITICAL();
+    BeaconPayload payload = pending;
+    int8_t rssi = pendingRssi;
+    received = false;
+    packet = receivedPacket;
+    taskEXIT_CRITICAL();
+
+    // Only a fix the app did not get over LoRa, the harness advertises the same one until its next wakeup
+    if (!(payload.flags & BEACON_FLAG_FIX) ||
+        (payload.hour == packet.hour && payload.min == packet.min && payload.sec == packet.sec) ||
+        (payload.hour == lastHour && payload.min == lastMin && payload.sec == lastSec)) {
+        return;
+    }
+    lastHour = payload.hour;
+    lastMin = payload.min;
+    lastSec = payload.sec;
+    // The fields the beacon does not carry keep their LoRa values
+    packet.msgType = MSG_ALL_DATA;
+    packet.lat = payload.lat / 1e7;
+    packet.lon = payload.lon / 1e7;
+    packet.hour = payload.hour;
+    packet.min = payload.min;
+    packet.sec = payload.sec;
+    packet.siv = payload.siv;
+    packet.hBatt = payload.hBatt;
+    packet.mode = (DeviceMode)payload.mode;
+    packet.autoMode = payload.flags & BEACON_FLAG_AUTO_MODE;
+    packet.rssi = rssi;
+    packet.snr = 0;
+    packet.seq = 0; // not a track log entry
+    packet.beacon = true;
+    packet.ack = false;
+    uint16_t len = LoraHandler::Serialize(MSG_ALL_DATA, packet, encodeBuffer, sizeof(encodeBuffer));
+    if (len == 0) {
+        return;
+    }
+    BLE.sendData(encodeBuffer, len);
+    LOG_DEBUG(LOG_BEACON_FORWARDED, rssi);
+}
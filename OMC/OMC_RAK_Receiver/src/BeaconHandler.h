@@ -0,0 +1,64 @@
+#pragma once
+
+#include "main.h"
+#include "LoraHandler.h"
+#include <bluefruit.h>
+
+#ifndef BEACON_ENABLED
+#define BEACON_ENABLED          1       // 0: no beacon scan
+#endif
+#define BEACON_COMPANY_ID       0xFFFF  // must match the harness
+#define BEACON_MARKER           0x4D    // 'M'
+#define BEACON_VERSION          1
+#define BEACON_SCAN_INTERVAL    1600    // 1 s (0.625 ms units)
+#define BEACON_SCAN_WINDOW      320     // 200 ms of it, one Coded PHY advertising event is a few ms
+
+// Beacon flags (must match the harness)
+#define BEACON_FLAG_FIX         (1 << 0)
+#define BEACON_FLAG_AUTO_MODE   (1 << 1)
+
+// Manufacturer data of the harness beacon, after the AD length and type (must match the harness)
+struct __attribute__((packed)) BeaconPayload {
+    uint16_t company;
+    uint8_t marker;
+    uint8_t version;
+    int32_t lat;        // degrees * 1e7
+    int32_t lon;
+    uint32_t seq;       // track log sequence number of the last reported fix
+    uint8_t hour, min, sec;
+    uint8_t siv;
+    uint8_t hBatt;
+    uint8_t mode;       // DeviceMode
+    uint8_t flags;      // BEACON_FLAG_*
+};
+
+// Secondary link to the harness: its BLE beacon, a non-connectable extended advertisement on the
+// LE Coded PHY. The Bluefruit scanner only scans legacy advertising on the 1M PHY, so the scan is
+// started with the SoftDevice call and only the report callback goes through Bluefruit. The
+// callback keeps the newest beacon and wakes the loop task, which forwards it to the app as an
+// ALL_DATA notification when it has a fix LoRa did not deliver. Forwarded beacons carry "bcn"
+// (JSON) or BLE_FLAG_BEACON, the BLE RSSI and seq 0, so the app does not log them in the track.
+// The beacon is encoded from a copy of the LoRa state into a buffer of its own, so it neither
+// waits for nor changes receivedPacket and RcvBuffer.
+class BeaconHandler {
+    public:
+        BeaconHandler() {}
+        void begin();
+        // Forwards the newest beacon to the app, loop task only
+        void forward();
+
+    private:
+        static void onReport(ble_gap_evt_adv_report_t *report);
+        static bool parse(const ble_data_t &data, BeaconPayload &payload);
+
+        uint8_t scanBuffer[BLE_GAP_SCAN_BUFFER_EXTENDED_MIN];
+        ble_data_t reportData = {scanBuffer, sizeof(scanBuffer)};
+        BeaconPayload pending = {};
+        int8_t pendingRssi = 0;
+        volatile bool received = false;
+        ReceivedPacket packet;                      // LoRa state with the beacon fields, loop task only
+        uint8_t encodeBuffer[sizeof(RcvBuffer)];
+        uint8_t lastHour = 0xFF, lastMin, lastSec;  // time of the last forwarded fix
+};
+
+extern BeaconHandler Beacon;
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "main.h"
+
+// Binary framing of the MountainCat characteristic, both ways: one byte type (MessageType), one
+// byte payload length, then the payload as one of the packed little endian structs below.
+// Coordinates are degrees * 1e7, and geofences and backfilled fixes keep the LoRa frame layout
+// (first vertex or fix absolute, the others deltas).
+//
+// JSON compatibility: a write that starts with '{' is parsed as JSON, and notifications stay JSON
+// until the app sends MSG_BLE_PROTOCOL with our version. The receiver answers with the same frame
+// and uses binary notifications until the phone disconnects, so older apps keep working.
+#define BLE_PROTOCOL_VERSION    1
+#define BLE_FRAME_HEADER        2       // type and payload length
+#define BLE_FRAME_MAX           200     // characteristic length
+
+// BleStatus flags
+#define BLE_FLAG_RB_LED         (1 << 0)
+#define BLE_FLAG_BUZZER         (1 << 1)
+#define BLE_FLAG_ACK            (1 << 2)    // the harness frame acknowledged commands
+#define BLE_FLAG_AUTO_MODE      (1 << 3)    // harness battery policy chose the power mode
+#define BLE_FLAG_LOCATE         (1 << 4)    // harness BLE locate mode is on
+#define BLE_FLAG_BEACON         (1 << 5)    // fix from the harness BLE beacon (BleAllData)
+
+// Link and harness state, first in every notification except MSG_FOX_HUNT and MSG_FOX_PONG
+struct __attribute__((packed)) BleStatus {
+    int16_t rssi;
+    int8_t snr;
+    uint8_t mode;       // DeviceMode
+    uint8_t rBatt;      // receiver battery percent
+    uint8_t hBatt;      // harness battery percent
+    uint8_t r, g, b;
+    uint8_t flags;      // BLE_FLAG_*
+};
+
+// Notifications (receiver to app). MSG_ACKNOWLEDGEMENT, MSG_BUZZER, MSG_LED, MSG_RB_LED and
+// MSG_PWR_MODE carry a BleStatus only.
+struct __attribute__((packed)) BleAllData {
+    BleStatus status;
+    int32_t lat;
+    int32_t lon;
+    uint8_t hour, min, sec;
+    uint8_t siv;
+    uint16_t hdop;
+    int16_t alt;        // feet
+    uint32_t seq;
+};
+
+struct __attribute__((packed)) BleGeofenceAlert {
+    BleStatus status;
+    uint8_t fence;
+    uint8_t inside;
+    int32_t lat;
+    int32_t lon;
+};
+
+struct __attribute__((packed)) BleBackfillFix {
+    int32_t lat;        // absolute for the first fix, delta from the previous one after that
+    int32_t lon;
+    uint32_t secOfDay;
+    uint8_t siv;
+    uint8_t seqStep;    // 0 for the first fix
+};
+
+// Only the first count fixes are sent
+struct __attribute__((packed)) BleBackfill {
+    BleStatus status;
+    uint32_t seq;       // sequence number of the first fix
+    uint8_t count;
+    BleBackfillFix fixes[TRACKLOG_FIXES_PER_FRAME];
+};
+
+struct __attribute__((packed)) BleEnergy {
+    BleStatus status;
+    uint32_t boot[ENERGY_SUBSYSTEMS];   // uAh
+    uint32_t last[ENERGY_SUBSYSTEMS];   // uAh
+    uint32_t avg;                       // uA
+    uint32_t ttl;                       // hours
+};
+
+// One per fox hunt pong, without a BleStatus to stay short at the ping rate. MSG_FOX_HUNT
+// notifications carry one byte, 1 while the fox hunt runs.
+struct __attribute__((packed)) BleFoxSample {
+    uint8_t seq;
+    int16_t rssi;       // smoothed
+    int8_t snr;         // smoothed
+    int16_t raw;        // this pong
+    int8_t harnessRssi; // the ping as the harness heard it
+    int8_t harnessSnr;
+};
+
+// Commands (app to receiver). MSG_BUZZER, MSG_RB_LED and MSG_FOX_HUNT carry one byte, 0 or 1.
+struct __attribute__((packed)) BleLedCommand {
+    uint8_t r, g, b;
+};
+
+struct __attribute__((packed)) BlePowerCommand {
+    uint8_t mode;
+    uint16_t hold;      // minutes, 0: no hold
+};
+
+// The harness notifies the same BleAllData frames when the app connects to it directly
+struct __attribute__((packed)) BleLocateCommand {
+    uint8_t on;
+    uint8_t minutes;    // 0: harness default
+};
+
+struct __attribute__((packed)) BleGeofenceCommand {
+    uint8_t id;
+    uint8_t type;       // GeofenceType
+    uint8_t count;      // vertices, including the first one
+    uint32_t radius;    // meters
+    int32_t lat;
+    int32_t lon;
+    int32_t dlat[GEOFENCE_MAX_VERTICES - 1];
+    int32_t dlon[GEOFENCE_MAX_VERTICES - 1];
+};
+
+static_assert(BLE_FRAME_HEADER + sizeof(BleEnergy) <= BLE_FRAME_MAX, "energy frame too long");
+static_assert(BLE_FRAME_HEADER + sizeof(BleBackfill) <= BLE_FRAME_MAX, "backfill frame too long");
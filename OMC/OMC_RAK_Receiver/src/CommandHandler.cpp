@@ -0,0 +1,271 @@
+#include "CommandHandler.h"
+#include "LoraHandler.h"
+#include "LogHandler.h"
+#include "MetricsHandler.h"
+#include "FramePoolHandler.h"
+#include "BLEHandler.h"
+#include "BleProtocol.h"
+#include "FoxHuntHandler.h"
+
+void CommandHandler::begin() {
+    Metrics.registerCounter(METRIC_CMD_DROPPED);
+    Metrics.registerGauge(METRIC_CMD_RING_MAX);
+    // Same priority as the loop task, the radio work is short
+    task = xTaskCreateStatic(commandTask, "Commands", CMD_TASK_STACK, this, 1, taskStack, &taskBuffer);
+}
+
+bool CommandHandler::push(const uint8_t *data, uint16_t len) {
+    if (len > CMD_PAYLOAD_MAX) {
+        len = CMD_PAYLOAD_MAX;
+    }
+    // Reserve a slot, a concurrent writer makes the compare-and-swap retry
+    uint32_t slot = head;
+    do {
+        if (slot - tail >= CMD_RING_SIZE) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            Metrics.add(METRIC_CMD_DROPPED);
+            LOG_WARN(LOG_CMD_DROPPED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &slot, slot + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    uint32_t index = slot & (CMD_RING_SIZE - 1);
+    CommandSlot &entry = ring[index];
+    memcpy(entry.data, data, len);
+    entry.len = len;
+    __atomic_store_n(&ready[index], 1, __ATOMIC_RELEASE);
+    Metrics.setMax(METRIC_CMD_RING_MAX, slot + 1 - tail);
+    notify(CMD_EVENT_WRITE);
+    return true;
+}
+
+void CommandHandler::notify(uint32_t events) {
+    if (task != NULL) {
+        xTaskNotify(task, events, eSetBits);
+    }
+}
+
+// Parses one app write, JSON from older apps or a binary frame. Vertex 0 of a geofence is
+// absolute, the rest are deltas from it (same layout as the LoRa frame).
+bool CommandHandler::parse(const uint8_t *data, uint16_t len, Command &command) {
+    if (len > 0 && data[0] == '{') {
+        return parseJson(data, len, command);
+    }
+    return parseBinary(data, len, command);
+}
+
+bool CommandHandler::parseJson(const uint8_t *data, uint16_t len, Command &command) {
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL) {
+        return false;
+    }
+    JsonDocument doc(frame);
+    DeserializationError error = deserializeJson(doc, data, len);
+    if (error) {
+        LOG_WARN(LOG_CMD_PARSE_FAILED, (uint32_t)error.code());
+        FramePool.release(frame);
+        return false;
+    }
+    command.msgType = doc["msgType"];
+    switch (command.msgType) {
+        case MSG_LED:
+            command.r = doc["r"];
+            command.g = doc["g"];
+            command.b = doc["b"];
+            break;
+        case MSG_RB_LED:
+            command.rbLed = doc["rbLed"]; // rainbow led
+            break;
+        case MSG_BUZZER:
+            command.buzzer = doc["buzzer"];
+            break;
+        case MSG_PWR_MODE:
+            command.mode = doc["mode"];
+            command.hold = doc["hold"] | 0; // "hold mode until" from the app, in minutes
+            break;
+        case MSG_LOCATE:
+            command.locate = doc["on"];
+            command.minutes = doc["min"] | 0;
+            break;
+        case MSG_FOX_HUNT:
+            command.fox = doc["on"];
+            break;
+        case MSG_GEOFENCE: {
+            GeofenceShape &fence = command.fence;
+            fence.id = doc["id"];
+            fence.type = doc["type"];
+            fence.radius = doc["rad"];
+            fence.lat[0] = doc["lat"];
+            fence.lon[0] = doc["lon"];
+            JsonArray dlat = doc["dlat"];
+            JsonArray dlon = doc["dlon"];
+            fence.count = 1;
+            for (size_t i = 0; i < dlat.size() && i < dlon.size() && fence.count < GEOFENCE_MAX_VERTICES; i++) {
+                fence.lat[fence.count] = fence.lat[0] + dlat[i].as<int32_t>();
+                fence.lon[fence.count] = fence.lon[0] + dlon[i].as<int32_t>();
+                fence.count++;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    FramePool.release(frame);
+    return true;
+}
+
+bool CommandHandler::parseBinary(const uint8_t *data, uint16_t len, Command &command) {
+    if (len < BLE_FRAME_HEADER || data[1] > len - BLE_FRAME_HEADER) {
+        LOG_WARN(LOG_CMD_PARSE_FAILED, (uint32_t)len);
+        return false;
+    }
+    command.msgType = (MessageType)data[0];
+    const uint8_t *payload = &data[BLE_FRAME_HEADER];
+    uint8_t size = data[1];
+    // Short payloads are rejected, longer ones may come from a newer app that appended fields
+    switch (command.msgType) {
+        case MSG_LED: {
+            BleLedCommand led;
+            if (size < sizeof(led)) {
+                break;
+            }
+            memcpy(&led, payload, sizeof(led));
+            command.r = led.r;
+            command.g = led.g;
+            command.b = led.b;
+            return true;
+        }
+        case MSG_RB_LED:
+        case MSG_BUZZER:
+            if (size < 1) {
+                break;
+            }
+            command.rbLed = payload[0] != 0;
+            command.buzzer = payload[0] != 0;
+            return true;
+        case MSG_PWR_MODE: {
+            BlePowerCommand power;
+            if (size < sizeof(power)) {
+                break;
+            }
+            memcpy(&power, payload, sizeof(power));
+            command.mode = (DeviceMode)power.mode;
+            command.hold = power.hold;
+            return true;
+        }
+        case MSG_LOCATE: {
+            BleLocateCommand locate;
+            if (size < sizeof(locate)) {
+                break;
+            }
+            memcpy(&locate, payload, sizeof(locate));
+            command.locate = locate.on != 0;
+            command.minutes = locate.minutes;
+            return true;
+        }
+        case MSG_GEOFENCE: {
+            BleGeofenceCommand shape;
+            if (size < sizeof(shape)) {
+                break;
+            }
+            memcpy(&shape, payload, sizeof(shape));
+            GeofenceShape &fence = command.fence;
+            fence.id = shape.id;
+            fence.type = (GeofenceType)shape.type;
+            fence.radius = shape.radius;
+            fence.lat[0] = shape.lat;
+            fence.lon[0] = shape.lon;
+            fence.count = shape.count == 0 ? 1 : min(shape.count, (uint8_t)GEOFENCE_MAX_VERTICES);
+            for (uint8_t i = 1; i < fence.count; i++) {
+                fence.lat[i] = shape.lat + shape.dlat[i - 1];
+                fence.lon[i] = shape.lon + shape.dlon[i - 1];
+            }
+            return true;
+        }
+        case MSG_FOX_HUNT:
+            if (size < 1) {
+                break;
+            }
+            command.fox = payload[0] != 0;
+            return true;
+        case MSG_BLE_PROTOCOL:
+            if (size < 1) {
+                break;
+            }
+            command.version = payload[0];
+            return true;
+        default:
+            break;
+    }
+    LOG_WARN(LOG_CMD_PARSE_FAILED, (uint32_t)len);
+    return false;
+}
+
+void CommandHandler::handle(const Command &command) {
+    LOG_INFO(LOG_BLE_COMMAND, command.msgType);
+    switch (command.msgType) {
+        case MSG_LED:
+        case MSG_RB_LED:
+        case MSG_BUZZER:
+        case MSG_PWR_MODE:
+        case MSG_LOCATE:
+            // Sent once the radio is free, a newer one replaces it until then
+            loraHandler.queueCommand(command);
+            break;
+        case MSG_GEOFENCE:
+            // Each fence may be a different one, so they all go out in order
+            loraHandler.waitForTxDone(TX_TIMEOUT_VALUE);
+            loraHandler.sendGeofence(command.fence);
+            break;
+        case MSG_FOX_HUNT:
+            if (command.fox)
+                Fox.start();
+            else
+                Fox.stop();
+            break;
+        case MSG_BLE_PROTOCOL: {
+            // Binary notifications only if the app speaks our version, the reply tells it which
+            // one we speak either way
+            BLE.setBinary(command.version == BLE_PROTOCOL_VERSION);
+            uint8_t reply[BLE_FRAME_HEADER + 1] = {MSG_BLE_PROTOCOL, 1, BLE_PROTOCOL_VERSION};
+            BLE.sendData(reply, sizeof(reply));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void CommandHandler::drain() {
+    for (;;) {
+        uint32_t index = tail & (CMD_RING_SIZE - 1);
+        if (!__atomic_load_n(&ready[index], __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        Command command = {};
+        const CommandSlot &entry = ring[index];
+        bool parsed = parse(entry.data, entry.len, command);
+        ready[index] = 0;
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        if (parsed) {
+            handle(command);
+        }
+    }
+}
+
+void CommandHandler::commandTask(void *pvParameters) {
+    CommandHandler *self = (CommandHandler *)pvParameters;
+    for (;;) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+        self->drain();
+        if (events & CMD_EVENT_FOX_PING) {
+            Fox.ping();
+        }
+        if (loraHandler.backfillDue() && loraHandler.waitForTxDone(TX_TIMEOUT_VALUE)) {
+            // A report arrived after a gap: ask the harness for the fixes in between
+            loraHandler.SendJSON(MSG_BACKFILL);
+        }
+        loraHandler.sendPendingCommands();
+    }
+}
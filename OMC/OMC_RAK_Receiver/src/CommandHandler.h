@@ -0,0 +1,71 @@
+#pragma once
+
+#include "main.h"
+
+#define CMD_RING_SIZE       8       // app writes between the BLE callback and the command task (power of two)
+#define CMD_PAYLOAD_MAX     200     // largest app write, the characteristic is 200 bytes
+#define CMD_TASK_STACK      512     // command task stack in words
+
+// Command task notification bits
+#define CMD_EVENT_WRITE         (1UL << 0)  // app write in the ring
+#define CMD_EVENT_RADIO_FREE    (1UL << 1)  // TX done or timed out, the next pending command can go
+#define CMD_EVENT_BACKFILL      (1UL << 2)  // gap in the harness sequence numbers
+#define CMD_EVENT_FOX_PING      (1UL << 3)  // fox hunt ping due
+
+// An app command, parsed from one write. Each one carries its own payload, nothing is read from
+// or written to receivedPacket.
+struct Command {
+    MessageType msgType;
+    uint8_t r, g, b;
+    bool rbLed;
+    bool buzzer;
+    DeviceMode mode;
+    uint16_t hold;
+    GeofenceShape fence;
+    uint8_t version; // MSG_BLE_PROTOCOL
+    bool locate; // MSG_LOCATE: start or stop
+    uint8_t minutes; // MSG_LOCATE: timeout, 0 for the harness default
+    bool fox; // MSG_FOX_HUNT: start or stop
+};
+
+// One app write, copied as is
+struct CommandSlot {
+    uint16_t len;
+    uint8_t data[CMD_PAYLOAD_MAX];
+};
+
+// App commands: the BLE write callback only copies the write into a lock-free ring (same scheme
+// as the log ring, a compare-and-swap reserves the slot and a ready flag publishes it), and the
+// command task parses the writes in order and schedules them on LoRa. The command task is the
+// only one that transmits, so commands, geofences and backfill requests never race for the
+// radio. A write that finds the ring full is dropped and counted.
+class CommandHandler {
+    public:
+        CommandHandler() {}
+        void begin();
+        // Copies one app write into the ring, false if the ring is full
+        bool push(const uint8_t *data, uint16_t len);
+        // Wakes the command task with CMD_EVENT_* bits, from task context
+        void notify(uint32_t events);
+        uint32_t getDropped() { return dropped; }
+        // Parses and acts on the writes in the ring, in order, command task only
+        void drain();
+
+    private:
+        static bool parse(const uint8_t *data, uint16_t len, Command &command);
+        static bool parseJson(const uint8_t *data, uint16_t len, Command &command);
+        static bool parseBinary(const uint8_t *data, uint16_t len, Command &command);
+        void handle(const Command &command);
+        static void commandTask(void *pvParameters);
+
+        CommandSlot ring[CMD_RING_SIZE];
+        volatile uint8_t ready[CMD_RING_SIZE] = {}; // set by the producer once the write is copied
+        volatile uint32_t head = 0; // next slot to reserve
+        volatile uint32_t tail = 0; // next slot to parse, command task only
+        volatile uint32_t dropped = 0;
+        TaskHandle_t task = NULL;
+        StaticTask_t taskBuffer;
+        StackType_t taskStack[CMD_TASK_STACK];
+};
+
+extern CommandHandler Commands;
@@ -0,0 +1,125 @@
+#include "FoxHuntHandler.h"
+#include "BLEHandler.h"
+#include "BleProtocol.h"
+#include "CommandHandler.h"
+#include "LoraHandler.h"
+#include "LogHandler.h"
+
+void FoxHuntHandler::begin() {
+    pingTimer.begin(FOX_PING_INTERVAL_MS, onPingTimer);
+}
+
+void FoxHuntHandler::onPingTimer(TimerHandle_t unused) {
+    Commands.notify(CMD_EVENT_FOX_PING);
+}
+
+void FoxHuntHandler::start() {
+    if (on) {
+        notifyApp();
+        return;
+    }
+    answered = false;
+    seq = 0;
+    startMs = millis();
+    on = true;
+    loraHandler.setProfile(LORA_PROFILE_FOX_HUNT);
+    pingTimer.start();
+    LOG_INFO(LOG_FOX_START);
+    notifyApp();
+    ping();
+}
+
+void FoxHuntHandler::stop() {
+    if (!on) {
+        notifyApp();
+        return;
+    }
+    on = false;
+    pingTimer.stop();
+    loraHandler.setProfile(LORA_PROFILE_DEFAULT);
+    LOG_INFO(LOG_FOX_STOP);
+    notifyApp();
+}
+
+void FoxHuntHandler::ping() {
+    if (!on) {
+        return;
+    }
+    uint32_t now = millis();
+    if (Bluefruit.connected() == 0 || now - startMs >= FOX_MAX_MINUTES * 60000UL) {
+        stop(); // nobody to show the samples to, or forgotten
+        return;
+    }
+    if (answered && now - lastPongMs >= FOX_IDLE_MS) {
+        // Out of reach on the fox hunt profile, or the harness already went back to the default one
+        answered = false;
+        LOG_INFO(LOG_FOX_LOST, seq);
+    }
+    // A busy radio skips this ping, the next one is an interval away
+    if (loraHandler.sendPing(seq, !answered)) {
+        seq++;
+    }
+}
+
+// Radio callback task
+void FoxHuntHandler::onPong(const uint8_t *frame, int16_t rssi, int8_t snr) {
+    if (!on) {
+        return;
+    }
+    if (!answered) {
+        rssiAvg = rssi;
+        snrAvg = snr;
+        answered = true;
+    } else {
+        rssiAvg += (rssi - rssiAvg) * FOX_SMOOTHING;
+        snrAvg += (snr - snrAvg) * FOX_SMOOTHING;
+    }
+    lastPongMs = millis();
+    if (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= FOX_SAMPLE_RING) {
+        return; // the loop task is behind, the next pong is close behind too
+    }
+    FoxSample &sample = samples[head & (FOX_SAMPLE_RING - 1)];
+    sample.seq = frame[1];
+    sample.rssi = (int16_t)lroundf(rssiAvg);
+    sample.snr = (int8_t)lroundf(snrAvg);
+    sample.raw = rssi;
+    sample.harnessRssi = (int8_t)frame[2];
+    sample.harnessSnr = (int8_t)frame[3];
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    notifyLoop(LOOP_EVENT_FOX);
+}
+
+// One MSG_FOX_PONG notification per sample, each encoded into a buffer of its own
+void FoxHuntHandler::forward() {
+    while (tail != __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        const FoxSample &sample = samples[tail & (FOX_SAMPLE_RING - 1)];
+        if (BLE.isBinary()) {
+            uint8_t frame[BLE_FRAME_HEADER + sizeof(BleFoxSample)] = {MSG_FOX_PONG, sizeof(BleFoxSample)};
+            BleFoxSample fox = {sample.seq, sample.rssi, sample.snr, sample.raw, sample.harnessRssi, sample.harnessSnr};
+            memcpy(&frame[BLE_FRAME_HEADER], &fox, sizeof(fox));
+            __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+            BLE.sendData(frame, sizeof(frame));
+        } else {
+            // rssi and snr are smoothed, hRssi and hSnr are the ping as the harness heard it
+            char json[112];
+            int len = snprintf(json, sizeof(json),
+                               "{\"msgType\":%u,\"seq\":%u,\"rssi\":%d,\"snr\":%d,\"raw\":%d,\"hRssi\":%d,\"hSnr\":%d}",
+                               MSG_FOX_PONG, sample.seq, sample.rssi, sample.snr, sample.raw, sample.harnessRssi,
+                               sample.harnessSnr);
+            __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+            BLE.sendData((const uint8_t *)json, len);
+        }
+    }
+}
+
+// MSG_FOX_HUNT with the new state, so the app shows it even if a stop came from here
+void FoxHuntHandler::notifyApp() {
+    if (BLE.isBinary()) {
+        uint8_t frame[BLE_FRAME_HEADER + 1] = {MSG_FOX_HUNT, 1, on};
+        BLE.sendData(frame, sizeof(frame));
+    } else {
+        char json[32];
+        int len = snprintf(json, sizeof(json), "{\"msgType\":%u,\"on\":%s}", MSG_FOX_HUNT, on ? "true" : "false");
+        BLE.sendData((const uint8_t *)json, len);
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "main.h"
+
+#define FOX_PING_INTERVAL_MS    250     // 4 pings a second
+#define FOX_SMOOTHING           0.3f    // weight of a new pong in the smoothed RSSI and SNR
+#define FOX_MAX_MINUTES         30      // the fox hunt stops by itself after this long
+#define FOX_SAMPLE_RING         4       // pongs between the radio callback and the loop task (power of two)
+
+// Fox hunt: RSSI direction finding when the harness has no fix. The receiver pings the harness
+// at FOX_PING_INTERVAL_MS and the harness answers every ping with a pong. Each pong goes to the
+// app as a MSG_FOX_PONG sample with the smoothed RSSI and SNR, so the user can sweep a
+// directional antenna and follow the signal.
+//
+// The radio callback only smooths a pong and puts the sample in a single producer ring, the loop
+// task encodes each one into its own buffer and notifies the app, so a pong never touches
+// RcvBuffer or receivedPacket. A sample that finds the ring full is dropped, the next one is a
+// ping interval behind.
+//
+// Both ends use the fox hunt LoRa profile meanwhile. Until a pong comes back the pings go out on
+// the default profile: a ping there tells the harness to switch over, and it answers on the fox
+// hunt profile. Pongs leave out the LoRa header, the receiver listens for exactly one in a short
+// implicit header window after each ping (LORA_PROFILE_FOX_PONG). The harness goes back to the default profile FOX_IDLE_MS after the last ping, and
+// so does the receiver's ping profile when no pong came for that long. The fox hunt ends on a
+// stop from the app, when the phone disconnects, or after FOX_MAX_MINUTES.
+class FoxHuntHandler {
+    public:
+        FoxHuntHandler() {}
+        void begin();
+        // Command task only
+        void start();
+        void stop();
+        // Sends the next ping, command task on CMD_EVENT_FOX_PING
+        void ping();
+        // From the radio RX callback
+        void onPong(const uint8_t *frame, int16_t rssi, int8_t snr);
+        // Sends the samples in the ring to the app, loop task only
+        void forward();
+        bool isOn() { return on; }
+
+    private:
+        void notifyApp();
+        static void onPingTimer(TimerHandle_t unused);
+
+        SoftwareTimer pingTimer;
+        volatile bool on = false;
+        volatile bool answered = false; // the harness is on the fox hunt profile
+        uint8_t seq = 0;
+        uint32_t startMs = 0;
+        volatile uint32_t lastPongMs = 0;
+        float rssiAvg = 0;
+        float snrAvg = 0;
+        FoxSample samples[FOX_SAMPLE_RING];
+        volatile uint32_t head = 0; // next slot to fill, radio callback only
+        volatile uint32_t tail = 0; // next slot to send, loop task only
+};
+
+extern FoxHuntHandler Fox;
@@ -0,0 +1,82 @@
+#include "FramePoolHandler.h"
+#include "LogHandler.h"
+#include "MetricsHandler.h"
+
+#define FRAME_BLOCK_HEADER 8 // size of a block, keeps the blocks 8 byte aligned
+
+void *Frame::allocate(size_t size) {
+    size_t need = FRAME_BLOCK_HEADER + ((size + 7) & ~(size_t)7);
+    if (used + need > FRAME_JSON_ARENA) {
+        return NULL;
+    }
+    last = used;
+    used += need;
+    if (used > peak) {
+        peak = used;
+    }
+    memcpy(&arena[last], &size, sizeof(size));
+    return &arena[last + FRAME_BLOCK_HEADER];
+}
+
+// ArduinoJson grows the string it is reading and shrinks its slot pools once a document is
+// complete; both are usually the last block, so a copy is rarely needed
+void *Frame::reallocate(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return allocate(size);
+    }
+    if ((uint8_t *)ptr == &arena[last + FRAME_BLOCK_HEADER]) {
+        size_t need = FRAME_BLOCK_HEADER + ((size + 7) & ~(size_t)7);
+        if (last + need > FRAME_JSON_ARENA) {
+            return NULL;
+        }
+        used = last + need;
+        if (used > peak) {
+            peak = used;
+        }
+        memcpy(&arena[last], &size, sizeof(size));
+        return ptr;
+    }
+    size_t old;
+    memcpy(&old, (uint8_t *)ptr - FRAME_BLOCK_HEADER, sizeof(old));
+    void *moved = allocate(size);
+    if (moved != NULL) {
+        memcpy(moved, ptr, old < size ? old : size);
+    }
+    return moved;
+}
+
+void FramePoolHandler::begin() {
+    Metrics.registerCounter(METRIC_FRAMES_EXHAUSTED);
+    Metrics.registerGauge(METRIC_FRAME_ARENA_PEAK);
+}
+
+Frame *FramePoolHandler::acquire() {
+    uint32_t mask = __atomic_load_n(&owned, __ATOMIC_RELAXED);
+    while (true) {
+        uint8_t i = 0;
+        while (i < FRAME_POOL_SIZE && (mask & (1UL << i))) {
+            i++;
+        }
+        if (i == FRAME_POOL_SIZE) {
+            __atomic_fetch_add(&exhausted, 1, __ATOMIC_RELAXED);
+            Metrics.add(METRIC_FRAMES_EXHAUSTED);
+            LOG_WARN(LOG_FRAMES_EXHAUSTED);
+            return NULL;
+        }
+        // On failure mask is reloaded with the current bits and the search starts over
+        if (__atomic_compare_exchange_n(&owned, &mask, mask | (1UL << i), false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            frames[i].reset();
+            return &frames[i];
+        }
+    }
+}
+
+void FramePoolHandler::release(Frame *frame) {
+    if (frame == NULL) {
+        return;
+    }
+    uint8_t i = frame - frames;
+    Metrics.setMax(METRIC_FRAME_ARENA_PEAK, frame->getPeak());
+    __atomic_fetch_and(&owned, ~(1UL << i), __ATOMIC_RELEASE);
+}
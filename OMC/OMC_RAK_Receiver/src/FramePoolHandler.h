@@ -0,0 +1,48 @@
+#pragma once
+
+#include "main.h"
+
+#define FRAME_POOL_SIZE     3       // frames in the pool
+#define FRAME_SIZE          256     // largest LoRa payload (255 bytes) plus a terminator
+#define FRAME_JSON_ARENA    1280    // JSON document memory per frame in bytes
+
+// A packet buffer with the memory of its JSON document: JsonDocument doc(frame) allocates from
+// the frame's arena instead of the heap. The arena is reset when the frame is acquired, so the
+// document must not outlive the release of its frame; freeing is a no-op.
+class Frame : public ArduinoJson::Allocator {
+    public:
+        uint8_t data[FRAME_SIZE];
+        size_t len;
+
+        void *allocate(size_t size) override;
+        void deallocate(void *ptr) override {}
+        void *reallocate(void *ptr, size_t size) override; // in place for the last block
+        void reset() { used = 0; last = 0; len = 0; }
+        size_t getPeak() { return peak; }
+
+    private:
+        alignas(8) uint8_t arena[FRAME_JSON_ARENA]; // 8 byte aligned blocks with a size header
+        size_t used = 0;
+        size_t last = 0; // offset of the last block, the only one that can grow in place
+        size_t peak = 0;
+};
+
+// Fixed pool of frames with explicit ownership: acquire() hands a frame to one owner until it
+// calls release(). The owned bits are taken with a compare-and-swap, so the loop, the radio
+// callbacks and the BLE callbacks can all use the pool. An empty pool returns NULL and the
+// caller skips the packet, so the worst case RAM is known at link time.
+class FramePoolHandler {
+    public:
+        FramePoolHandler() {}
+        void begin();
+        Frame *acquire();
+        void release(Frame *frame);
+        uint32_t getExhausted() { return exhausted; }
+
+    private:
+        Frame frames[FRAME_POOL_SIZE];
+        volatile uint32_t owned = 0;
+        volatile uint32_t exhausted = 0;
+};
+
+extern FramePoolHandler FramePool;
@@ -0,0 +1,174 @@
+#include "HistoryHandler.h"
+#include "BLEHandler.h"
+#include "LogHandler.h"
+#include "MetricsHandler.h"
+
+using namespace Adafruit_LittleFS_Namespace;
+
+static void chunkPath(uint32_t chunk, char *path) {
+    snprintf(path, 16, HISTORY_DIR "/%lu", (unsigned long)(chunk % HISTORY_CHUNKS));
+}
+
+void HistoryHandler::begin() {
+    Metrics.registerCounter(METRIC_HISTORY_SPILLS);
+    Metrics.registerGauge(METRIC_HISTORY_SYNC_FPS);
+#if HISTORY_FLASH_SPILL
+    // Indexes restart with the receiver, chunks of an earlier run are of no use
+    mounted = InternalFS.begin();
+    if (mounted) {
+        InternalFS.rmdir_r(HISTORY_DIR);
+        InternalFS.mkdir(HISTORY_DIR);
+    }
+#endif
+}
+
+void HistoryHandler::record(const TrackFix &fix, bool delivered) {
+    if (next >= HISTORY_RAM_FIXES && next % HISTORY_CHUNK_FIXES == 0) {
+        // The next HISTORY_CHUNK_FIXES fixes overwrite this chunk
+        spill((next - HISTORY_RAM_FIXES) / HISTORY_CHUNK_FIXES);
+    }
+    ring[next & (HISTORY_RAM_FIXES - 1)] = fix;
+    next++;
+    // Got to the app live, and the app is not missing anything older
+    if (delivered && synced == next - 1) {
+        synced = next;
+    }
+}
+
+void HistoryHandler::spill(uint32_t chunk) {
+#if HISTORY_FLASH_SPILL
+    if (!mounted || (chunk + 1) * HISTORY_CHUNK_FIXES <= synced) {
+        return; // the app has it already
+    }
+    char path[16];
+    chunkPath(chunk, path);
+    if (InternalFS.exists(path)) {
+        InternalFS.remove(path); // the write mode appends
+    }
+    File file(InternalFS);
+    bool ok = file.open(path, FILE_O_WRITE);
+    if (ok) {
+        // A chunk is contiguous in the ring, HISTORY_RAM_FIXES is a multiple of the chunk size
+        const uint8_t *data = (const uint8_t *)&ring[(chunk * HISTORY_CHUNK_FIXES) & (HISTORY_RAM_FIXES - 1)];
+        size_t bytes = HISTORY_CHUNK_FIXES * sizeof(TrackFix);
+        ok = file.write(data, bytes) == bytes;
+        file.close();
+    }
+    if (!ok) {
+        // The chunks in flash no longer reach the RAM ring
+        spilled = false;
+        LOG_WARN(LOG_HISTORY_SPILL_FAILED, chunk);
+        return;
+    }
+    if (!spilled || chunk != lastChunk + 1) {
+        firstChunk = chunk;
+    }
+    lastChunk = chunk;
+    spilled = true;
+    if (lastChunk - firstChunk >= HISTORY_CHUNKS) {
+        firstChunk = lastChunk - HISTORY_CHUNKS + 1;
+    }
+    Metrics.add(METRIC_HISTORY_SPILLS);
+#endif
+}
+
+uint32_t HistoryHandler::oldest() {
+    uint32_t ramFrom = next > HISTORY_RAM_FIXES ? next - HISTORY_RAM_FIXES : 0;
+    // Flash only counts if the last chunk written is the one the ring is overwriting now
+    if (spilled && lastChunk * HISTORY_CHUNK_FIXES <= ramFrom && ramFrom <= (lastChunk + 1) * HISTORY_CHUNK_FIXES) {
+        return firstChunk * HISTORY_CHUNK_FIXES;
+    }
+    return ramFrom;
+}
+
+// Reads up to max fixes starting at index from, without crossing a flash chunk
+uint8_t HistoryHandler::readPage(uint32_t from, uint8_t max, TrackFix *fixes) {
+    uint32_t count = min((uint32_t)max, next - from);
+    uint32_t ramFrom = next > HISTORY_RAM_FIXES ? next - HISTORY_RAM_FIXES : 0;
+    if (from >= ramFrom) {
+        for (uint32_t i = 0; i < count; i++) {
+            fixes[i] = ring[(from + i) & (HISTORY_RAM_FIXES - 1)];
+        }
+        return count;
+    }
+#if HISTORY_FLASH_SPILL
+    count = min(count, (uint32_t)(HISTORY_CHUNK_FIXES - from % HISTORY_CHUNK_FIXES));
+    char path[16];
+    chunkPath(from / HISTORY_CHUNK_FIXES, path);
+    File file(InternalFS);
+    if (!file.open(path, FILE_O_READ)) {
+        return 0;
+    }
+    file.seek((from % HISTORY_CHUNK_FIXES) * sizeof(TrackFix));
+    int bytes = file.read(fixes, count * sizeof(TrackFix));
+    file.close();
+    return bytes > 0 ? bytes / sizeof(TrackFix) : 0;
+#else
+    return 0;
+#endif
+}
+
+void HistoryHandler::request(uint32_t from) {
+    requestedFrom = from;
+    requested = true;
+    notifyLoop(LOOP_EVENT_HISTORY);
+}
+
+void HistoryHandler::sync() {
+    if (!requested) {
+        return;
+    }
+    requested = false;
+    uint32_t from = requestedFrom;
+    if (from > next) {
+        from = 0; // the receiver restarted since the app last synced
+    } else if (from > synced) {
+        synced = from;
+    }
+    from = max(from, oldest());
+
+    // As many fixes per notification as the MTU allows, sent back to back
+    TrackFix fixes[(HISTORY_PAGE_MAX - HISTORY_PAGE_HEADER) / sizeof(TrackFix)];
+    uint8_t page[HISTORY_PAGE_MAX];
+    uint8_t perPage = (min(BLE.getPayloadSize(), (uint16_t)HISTORY_PAGE_MAX) - HISTORY_PAGE_HEADER) / sizeof(TrackFix);
+    if (perPage == 0) {
+        LOG_WARN(LOG_HISTORY_ABORTED, 0); // MTU exchange not done
+        return;
+    }
+    BLE.setProfile(BLE_PROFILE_BULK_SYNC);
+    uint32_t startMs = millis();
+    uint32_t sent = 0;
+    for (;;) {
+        uint8_t count = 0;
+        if (from < next) {
+            count = readPage(from, perPage, fixes);
+            if (count == 0) {
+                // Chunk file missing, go on with what is in RAM
+                from = max(from + 1, next > HISTORY_RAM_FIXES ? next - HISTORY_RAM_FIXES : 0);
+                continue;
+            }
+        }
+        memcpy(&page[0], &from, sizeof(from));
+        page[4] = count;
+        memcpy(&page[5], &next, sizeof(next));
+        memcpy(&page[HISTORY_PAGE_HEADER], fixes, count * sizeof(TrackFix));
+        if (!BLE.sendHistory(page, HISTORY_PAGE_HEADER + count * sizeof(TrackFix))) {
+            LOG_WARN(LOG_HISTORY_ABORTED, sent);
+            BLE.setProfile(BLE_PROFILE_LOCATING);
+            return;
+        }
+        if (count == 0) {
+            break;
+        }
+        from += count;
+        sent += count;
+    }
+    synced = next;
+    BLE.setProfile(BLE_PROFILE_LOCATING);
+    BLE.markActive(); // idle time starts now
+
+    uint32_t elapsedMs = millis() - startMs;
+    uint32_t perSecond = elapsedMs > 0 ? sent * 1000 / elapsedMs : sent;
+    Metrics.set(METRIC_HISTORY_SYNC_FPS, perSecond);
+    LOG_INFO(LOG_HISTORY_SYNCED, sent, elapsedMs, perSecond);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "main.h"
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+
+#define HISTORY_RAM_FIXES       256     // fixes kept in RAM (power of two, multiple of HISTORY_CHUNK_FIXES)
+#ifndef HISTORY_FLASH_SPILL
+#define HISTORY_FLASH_SPILL     1       // 0: RAM only
+#endif
+#define HISTORY_CHUNK_FIXES     64      // fixes per flash chunk file (1 kB)
+#define HISTORY_CHUNKS          16      // chunk files in the flash ring
+#define HISTORY_DIR             "/history"
+#define HISTORY_PAGE_HEADER     9       // first index (uint32), count (uint8), next index (uint32)
+#define HISTORY_PAGE_MAX        244     // page of a 247 byte MTU
+
+// Recent fixes for an app that was not connected when they arrived. Every fix from a routine
+// report or a backfill frame gets a history index. The newest HISTORY_RAM_FIXES are in a RAM
+// ring. With HISTORY_FLASH_SPILL, older ones the app has not synced yet are written to the
+// internal file system one chunk at a time before the ring overwrites them, so flash is only
+// written while the phone is away. The history starts over when the receiver restarts.
+//
+// Sync: the app writes the first index it is missing (uint32) to the history characteristic,
+// and the loop task answers with a burst of pages as notifications. Each page is the first index,
+// the fix count and the next index to be given out, then count TrackFix (16 bytes each). A page
+// with no fixes ends the transfer.
+class HistoryHandler {
+    public:
+        HistoryHandler() {}
+        void begin();
+        // Adds a fix, delivered if it also went to the phone as a live notification
+        void record(const TrackFix &fix, bool delivered);
+        // From the BLE write callback: the app has every fix before index from
+        void request(uint32_t from);
+        // Sends the requested fixes, loop task only
+        void sync();
+
+    private:
+        uint32_t oldest();
+        uint8_t readPage(uint32_t from, uint8_t max, TrackFix *fixes);
+        void spill(uint32_t chunk);
+
+        TrackFix ring[HISTORY_RAM_FIXES];
+        uint32_t next = 0;          // index of the next fix
+        uint32_t synced = 0;        // the app has every fix before this index
+        volatile uint32_t requestedFrom = 0;
+        volatile bool requested = false;
+        bool mounted = false;
+        bool spilled = false;       // firstChunk..lastChunk are in flash
+        uint32_t firstChunk = 0;
+        uint32_t lastChunk = 0;
+};
+
+extern HistoryHandler History;
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "main.h"
+#include "LogIds.h"
+
+// Log levels, messages above LOG_LEVEL are compiled out (-DLOG_LEVEL=... in platformio.ini)
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE       64      // records in the ring (power of two)
+#define LOG_MAX_ARGS        3       // arguments per record
+#define LOG_SYNC_0          0x00    // sync bytes in front of every record
+#define LOG_SYNC_1          0xA5
+#define LOG_TASK_STACK      256     // drain task stack in words
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(id, ...)  Log.write(LOG_LEVEL_ERROR, id, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(id, ...)  do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(id, ...)   Log.write(LOG_LEVEL_WARN, id, ##__VA_ARGS__)
+#else
+#define LOG_WARN(id, ...)   do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(id, ...)   Log.write(LOG_LEVEL_INFO, id, ##__VA_ARGS__)
+#else
+#define LOG_INFO(id, ...)   do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(id, ...)  Log.write(LOG_LEVEL_DEBUG, id, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(id, ...)  do {} while (0)
+#endif
+
+// Binary record, sent as is (little endian) after the sync bytes, with only argc arguments
+struct LogRecord {
+    uint16_t id;
+    uint8_t level;
+    uint8_t argc;
+    uint32_t ms;
+    uint32_t args[LOG_MAX_ARGS];
+};
+
+// Deferred binary logger: producers reserve a slot with a compare-and-swap on head (lock-free,
+// safe from interrupts), an idle priority task drains the ring to USB when a host is attached
+class LogHandler {
+    public:
+        LogHandler() {}
+        void begin();
+        void write(uint8_t level, LogId id);
+        void write(uint8_t level, LogId id, uint32_t a0);
+        void write(uint8_t level, LogId id, uint32_t a0, uint32_t a1);
+        void write(uint8_t level, LogId id, uint32_t a0, uint32_t a1, uint32_t a2);
+        void flush(); // wakes the drain task, safe from interrupts
+        uint32_t getDropped() { return dropped; }
+
+    private:
+        void push(uint8_t level, LogId id, uint8_t argc, uint32_t a0, uint32_t a1, uint32_t a2);
+        void drain();
+        static void drainTask(void *pvParameters);
+
+        LogRecord ring[LOG_RING_SIZE];
+        volatile uint8_t ready[LOG_RING_SIZE] = {}; // set by the producer once the record is complete
+        volatile uint32_t head = 0; // next slot to reserve
+        volatile uint32_t tail = 0; // next slot to drain, drain task only
+        volatile uint32_t dropped = 0;
+        uint32_t droppedReported = 0;
+        TaskHandle_t task = NULL;
+        StaticTask_t taskBuffer;
+        StackType_t taskStack[LOG_TASK_STACK];
+};
+
+extern LogHandler Log;
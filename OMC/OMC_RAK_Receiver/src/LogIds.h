@@ -0,0 +1,41 @@
+#pragma once
+
+// Log message table: id and format string. Only the ids go into the firmware, the format strings
+// are read from this file by tools/logdecode.py. Append new messages at the end so old captures
+// still decode. Arguments are 32-bit words, formatted with %u, %d or %x.
+#define LOG_MESSAGES(X) \
+    X(LOG_DROPPED,          "%u log records dropped") \
+    X(LOG_TX_DONE,          "LoRa TX done") \
+    X(LOG_TX_TIMEOUT,       "LoRa TX timeout") \
+    X(LOG_TX_SENT,          "LoRa TX %u bytes") \
+    X(LOG_RX_DONE,          "LoRa RX %u bytes, rssi %d dBm, snr %d dB") \
+    X(LOG_RX_ERROR,         "LoRa RX error, IRQ status 0x%04x (0x20 CRC, 0x40 header, 0x10 sync word)") \
+    X(LOG_RX_TIMEOUT,       "LoRa RX timeout") \
+    X(LOG_BACKFILL_GAP,     "Missed %u fixes, requesting backfill") \
+    X(LOG_ALIVE,            "Looping, battery %u%%") \
+    X(LOG_BLE_COMMAND,      "BLE command, message type %u") \
+    X(LOG_CMD_COALESCED,    "Command %u replaced by a newer one") \
+    X(LOG_FRAMES_EXHAUSTED, "Frame pool empty, packet skipped") \
+    X(LOG_FRAME_OVERFLOW,   "JSON document of message type %u did not fit its frame") \
+    X(LOG_CMD_DROPPED,      "App command dropped, command ring full") \
+    X(LOG_CMD_PARSE_FAILED, "App command could not be parsed, JSON error or frame length %u") \
+    X(LOG_HISTORY_SYNCED,   "History sync: %u fixes in %u ms, %u fixes/s") \
+    X(LOG_HISTORY_ABORTED,  "History sync stopped after %u fixes, notify failed") \
+    X(LOG_HISTORY_SPILL_FAILED, "History chunk %u could not be written to flash") \
+    X(LOG_BLE_PROFILE,      "BLE profile %u: interval %u x 1.25 ms, slave latency %u") \
+    X(LOG_BEACON_SCAN_FAILED, "Beacon scan not started, SoftDevice error 0x%x") \
+    X(LOG_BEACON_FORWARDED, "Harness beacon fix forwarded, BLE RSSI %d") \
+    X(LOG_FOX_START,        "Fox hunt on") \
+    X(LOG_FOX_STOP,         "Fox hunt off") \
+    X(LOG_FOX_LOST,         "Fox hunt: no pong, ping %u goes out on the default profile") \
+    X(LOG_ACKS,             "Harness acknowledged commands 0x%x with message type %u") \
+    X(LOG_RX_PARSE_FAILED,  "LoRa packet could not be parsed, JSON error %u") \
+    X(LOG_BLE_WRITE,        "App write of %u bytes from connection %u, first byte 0x%x") \
+    X(LOG_SEQ_RESTART,      "Harness sequence went back from %u to %u, treating it as a restart")
+
+enum LogId : uint16_t {
+#define LOG_ID_ENTRY(id, format) id,
+    LOG_MESSAGES(LOG_ID_ENTRY)
+#undef LOG_ID_ENTRY
+    LOG_ID_COUNT
+};
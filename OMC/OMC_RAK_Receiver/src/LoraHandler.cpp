@@ -1,12 +1,45 @@
 #include "LoraHandler.h"
+#include "LogHandler.h"
+#include "MetricsHandler.h"
+#include "FramePoolHandler.h"
+#include "BLEHandler.h"
+#include "BleProtocol.h"
+#include "FoxHuntHandler.h"
 
 // extern QueueHandle_t eventQueue;
 // extern SemaphoreHandle_t wakeSemaphore;
 
 uint8_t RcvBuffer[200]; // Define the actual buffer
+uint16_t RcvLength = 0;
 bool packetReceived = false;
 ReceivedPacket receivedPacket = {};
 LoraHandler *LoraHandler::instance = nullptr;
+uint32_t LoraHandler::lastSeq = 0;
+uint32_t LoraHandler::backfillSince = 0;
+volatile bool LoraHandler::backfillRequested = false;
+volatile bool LoraHandler::txBusy = false;
+uint32_t LoraHandler::txStartMs = 0;
+volatile uint32_t LoraHandler::rxAtMs = 0;
+LoraProfile LoraHandler::radioProfile = LORA_PROFILE_DEFAULT;
+volatile LoraProfile LoraHandler::listenProfile = LORA_PROFILE_DEFAULT;
+volatile bool LoraHandler::pongDue = false;
+
+struct LoraModem {
+    uint8_t spreadingFactor;
+    uint8_t bandwidth;
+    uint8_t codingRate;
+    uint8_t implicitLength; // payload length with the implicit header, 0: explicit header
+};
+
+// Indexed by LoraProfile (must match the harness)
+static const LoraModem loraProfiles[LORA_PROFILE_COUNT] = {
+    {LORA_SPREADING_FACTOR, LORA_BANDWIDTH, LORA_CODINGRATE, 0},
+    {FOX_SPREADING_FACTOR, FOX_BANDWIDTH, FOX_CODINGRATE, 0},
+    {FOX_SPREADING_FACTOR, FOX_BANDWIDTH, FOX_CODINGRATE, FOX_PONG_SIZE},
+};
+
+// Upper bounds of the RSSI histogram buckets (dBm)
+static const int16_t rssiBounds[METRIC_BUCKETS] = {-120, -110, -100, -90};
 static RadioEvents_t RadioEvents;
 
 #define SX126X_GET_IRQ_STATUS 0x15
@@ -38,8 +71,20 @@ void LoraHandler::OnTxDone(void)
 {
     if (instance)
     {
-        Serial.println("OnTxDone");
-        Radio.Rx(0);
+        LOG_DEBUG(LOG_TX_DONE);
+        txBusy = false;
+        if (pongDue)
+        {
+            // Only the pong can come now, it has no header
+            pongDue = false;
+            applyProfile(LORA_PROFILE_FOX_PONG);
+            Radio.Rx(FOX_PONG_WINDOW_MS);
+        }
+        else
+        {
+            listen();
+        }
+        Commands.notify(CMD_EVENT_RADIO_FREE);
         // Add logic if you want to repeat sends or handle post-send events
     }
 }
@@ -48,146 +93,292 @@ void LoraHandler::OnTxTimeout(void)
 {
     if (instance)
     {
-        Serial.println("OnTxTimeout");
-        Radio.Rx(0);
+        LOG_WARN(LOG_TX_TIMEOUT);
+        txBusy = false;
+        pongDue = false;
+        listen();
+        Commands.notify(CMD_EVENT_RADIO_FREE);
         // Handle timeout if necessary
     }
 }
 
 void LoraHandler::OnRxError(void)
 {
-    Serial.println("OnRxError");
     // Radio.Standby();
 
+    // The decoder names the common bits (0x20 CRC, 0x40 header, 0x10 sync word error)
     uint16_t irqStatus = readIrqStatus();
-
-    Serial.print("IRQ Status: 0x");
-    Serial.println(irqStatus, HEX);
+    LOG_WARN(LOG_RX_ERROR, irqStatus);
+    Metrics.add(METRIC_LORA_RX_ERROR);
 
     // Clear the IRQ status so it's not misread next time
     clearIrqStatus(irqStatus);
 
-    // The SX126x datasheet (and RAK driver) define bits like:
-    //   0x20 = CRC error
-    //   0x40 = Header error
-    //   0x10 = SyncWord error
-    //   etc.
-    // Let's check a couple of common ones:
-
-    if (irqStatus & 0x20)
-    {
-        Serial.println(" -> CRC error detected");
-    }
-    if (irqStatus & 0x40)
-    {
-        Serial.println(" -> Header error detected (wrong length/SF/bandwidth?)");
-    }
-    if (irqStatus & 0x10)
-    {
-        Serial.println(" -> SyncWord error detected");
-    }
-
     // Re-enter receive mode
-    Radio.Rx(0);
+    listen();
 }
 
 void LoraHandler::OnRxTimeout(void)
 {
-    Serial.println("OnRxTimeout");
-    // Just put radio back in RX mode to keep listening
+    LOG_DEBUG(LOG_RX_TIMEOUT);
+    // Just put radio back in RX mode to keep listening, the pong window ends here without a pong
+    listen();
+}
+
+// Back to RX on the listen profile, which always has the explicit header
+void LoraHandler::listen()
+{
+    if (radioProfile != listenProfile)
+        applyProfile(listenProfile);
     Radio.Rx(0);
 }
 
-void LoraHandler::SerializeJSON(MessageType msgType)
+uint16_t LoraHandler::SerializeJSON(MessageType msgType, const ReceivedPacket &packet, uint8_t *buffer, size_t size)
 {
-    StaticJsonDocument<200> doc;
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL)
+        return 0;
+    JsonDocument doc(frame);
     if (msgType == MSG_ALL_DATA)
     {
         doc["msgType"] = MSG_ALL_DATA;
-        doc["mode"] = receivedPacket.mode;
-        doc["lat"] = receivedPacket.lat;
-        doc["lon"] = receivedPacket.lon;
-        doc["hour"] = receivedPacket.hour;
-        doc["min"] = receivedPacket.min;
-        doc["sec"] = receivedPacket.sec;
-        doc["siv"] = receivedPacket.siv;
-        doc["hdop"] = receivedPacket.hdop;
-        doc["alt"] = receivedPacket.alt;
-        doc["rssi"] = receivedPacket.rssi;
-        doc["snr"] = receivedPacket.snr;
-        doc["r"] = receivedPacket.r;
-        doc["g"] = receivedPacket.g;    
-        doc["b"] = receivedPacket.b;
-        doc["rBatt"] = receivedPacket.rBatt; // Receiver battery
-        doc["hBatt"] = receivedPacket.hBatt; // Harness battery
+        doc["mode"] = packet.mode;
+        doc["lat"] = packet.lat;
+        doc["lon"] = packet.lon;
+        doc["hour"] = packet.hour;
+        doc["min"] = packet.min;
+        doc["sec"] = packet.sec;
+        doc["siv"] = packet.siv;
+        doc["hdop"] = packet.hdop;
+        doc["alt"] = packet.alt;
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+        doc["r"] = packet.r;
+        doc["g"] = packet.g;    
+        doc["b"] = packet.b;
+        doc["rBatt"] = packet.rBatt; // Receiver battery
+        doc["hBatt"] = packet.hBatt; // Harness battery
+        doc["seq"] = packet.seq; // Track log sequence number
+        doc["loc"] = packet.locating; // harness BLE locate mode
+        if (packet.ack)
+            doc["ack"] = true; // the report carried acknowledgements
+        if (packet.beacon)
+            doc["bcn"] = true; // from the harness BLE beacon, rssi is the BLE one
     }
     else if (msgType == MSG_ACKNOWLEDGEMENT)
     {
         doc["msgType"] = MSG_ACKNOWLEDGEMENT;
-        doc["mode"] = receivedPacket.mode;
-        doc["ack"] = receivedPacket.ack;
-        doc["rssi"] = receivedPacket.rssi;
-        doc["snr"] = receivedPacket.snr;
-        doc["r"] = receivedPacket.r;
-        doc["g"] = receivedPacket.g;    
-        doc["b"] = receivedPacket.b;
-        doc["rBatt"] = receivedPacket.rBatt; // Receiver battery
-        doc["hBatt"] = receivedPacket.hBatt; // Harness battery
+        doc["mode"] = packet.mode;
+        doc["ack"] = packet.ack;
+        doc["loc"] = packet.locating; // harness BLE locate mode
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+        doc["r"] = packet.r;
+        doc["g"] = packet.g;    
+        doc["b"] = packet.b;
+        doc["rBatt"] = packet.rBatt; // Receiver battery
+        doc["hBatt"] = packet.hBatt; // Harness battery
     }
     else if (msgType == MSG_BUZZER)
     {
         doc["msgType"] = MSG_BUZZER;
-        doc["mode"] = receivedPacket.mode;
-        doc["buzzer"] = receivedPacket.buzzer;
-        doc["rssi"] = receivedPacket.rssi;
-        doc["snr"] = receivedPacket.snr;
-        doc["r"] = receivedPacket.r;
-        doc["g"] = receivedPacket.g;    
-        doc["b"] = receivedPacket.b;
-        doc["rBatt"] = receivedPacket.rBatt; // Receiver battery
-        doc["hBatt"] = receivedPacket.hBatt; // Harness battery
+        doc["mode"] = packet.mode;
+        doc["buzzer"] = packet.buzzer;
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+        doc["r"] = packet.r;
+        doc["g"] = packet.g;    
+        doc["b"] = packet.b;
+        doc["rBatt"] = packet.rBatt; // Receiver battery
+        doc["hBatt"] = packet.hBatt; // Harness battery
     }
     else if (msgType == MSG_LED)
     {
         doc["msgType"] = MSG_LED;
-        doc["mode"] = receivedPacket.mode;
-        doc["r"] = receivedPacket.r;
-        doc["g"] = receivedPacket.g;
-        doc["b"] = receivedPacket.b;
-        doc["rssi"] = receivedPacket.rssi;
-        doc["snr"] = receivedPacket.snr;
+        doc["mode"] = packet.mode;
+        doc["r"] = packet.r;
+        doc["g"] = packet.g;
+        doc["b"] = packet.b;
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
     }
     else if (msgType == MSG_RB_LED)
     {
         doc["msgType"] = MSG_RB_LED;
-        doc["mode"] = receivedPacket.mode;
-        doc["rbLed"] = receivedPacket.rbLed; // rainbow led
-        doc["rssi"] = receivedPacket.rssi;
-        doc["snr"] = receivedPacket.snr;
-        doc["r"] = receivedPacket.r;
-        doc["g"] = receivedPacket.g;    
-        doc["b"] = receivedPacket.b;
-        doc["rBatt"] = receivedPacket.rBatt; // Receiver battery
-        doc["hBatt"] = receivedPacket.hBatt; // Harness battery
+        doc["mode"] = packet.mode;
+        doc["rbLed"] = packet.rbLed; // rainbow led
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+        doc["r"] = packet.r;
+        doc["g"] = packet.g;    
+        doc["b"] = packet.b;
+        doc["rBatt"] = packet.rBatt; // Receiver battery
+        doc["hBatt"] = packet.hBatt; // Harness battery
     }
     else if (msgType == MSG_PWR_MODE)
     {
         doc["msgType"] = MSG_PWR_MODE;
-        doc["mode"] = receivedPacket.mode;
-        doc["rssi"] = receivedPacket.rssi;
-        doc["snr"] = receivedPacket.snr;
-        doc["r"] = receivedPacket.r;
-        doc["g"] = receivedPacket.g;    
-        doc["b"] = receivedPacket.b;
-        doc["rBatt"] = receivedPacket.rBatt; // Receiver battery
-        doc["hBatt"] = receivedPacket.hBatt; // Harness battery
+        doc["mode"] = packet.mode;
+        doc["auto"] = packet.autoMode; // harness battery policy chose the mode
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+        doc["r"] = packet.r;
+        doc["g"] = packet.g;    
+        doc["b"] = packet.b;
+        doc["rBatt"] = packet.rBatt; // Receiver battery
+        doc["hBatt"] = packet.hBatt; // Harness battery
+    }
+    else if (msgType == MSG_GEOFENCE_ALERT)
+    {
+        doc["msgType"] = MSG_GEOFENCE_ALERT;
+        doc["mode"] = packet.mode;
+        doc["fence"] = packet.fenceId;
+        doc["inside"] = packet.inside;
+        doc["lat"] = packet.lat;
+        doc["lon"] = packet.lon;
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+        doc["rBatt"] = packet.rBatt; // Receiver battery
+        doc["hBatt"] = packet.hBatt; // Harness battery
+    }
+    else if (msgType == MSG_BACKFILL_DATA)
+    {
+        // Same layout as the LoRa frame: first fix absolute, the others deltas from the previous one
+        doc["msgType"] = MSG_BACKFILL_DATA;
+        doc["seq"] = packet.fixes[0].seq;
+        JsonArray list = doc["fixes"].to<JsonArray>();
+        for (uint8_t i = 0; i < packet.fixCount; i++)
+        {
+            const TrackFix &fix = packet.fixes[i];
+            JsonArray entry = list.add<JsonArray>();
+            entry.add(i == 0 ? fix.lat : fix.lat - packet.fixes[i - 1].lat);
+            entry.add(i == 0 ? fix.lon : fix.lon - packet.fixes[i - 1].lon);
+            entry.add((uint32_t)fix.hour * 3600 + fix.min * 60 + fix.sec);
+            entry.add(fix.siv);
+            entry.add(i == 0 ? 0 : fix.seq - packet.fixes[i - 1].seq);
+        }
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
+    }
+    else if (msgType == MSG_ENERGY)
+    {
+        doc["msgType"] = MSG_ENERGY;
+        JsonArray boot = doc["boot"].to<JsonArray>();
+        JsonArray last = doc["last"].to<JsonArray>();
+        for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++)
+        {
+            boot.add(packet.energyBoot[i]);
+            last.add(packet.energyLast[i]);
+        }
+        doc["avg"] = packet.energyAvg;
+        doc["ttl"] = packet.energyTtl;
+        doc["hBatt"] = packet.hBatt; // Harness battery
+        doc["rssi"] = packet.rssi;
+        doc["snr"] = packet.snr;
     }
 
-    char buffer[200];
-    size_t n = serializeJson(doc, buffer, sizeof(buffer));
-    memset(RcvBuffer, 0, sizeof(RcvBuffer)); // Wipes entire buffer
-    memcpy(RcvBuffer, buffer, n);            // Copy new payload
-    RcvBuffer[n] = '\0';                     // Null-terminate the new data
+    memset(buffer, 0, size); // Wipes entire buffer
+    uint16_t len = serializeJson(doc, buffer, size - 1); // leaves it null-terminated
+    FramePool.release(frame);
+    return len;
+}
+
+static int32_t toE7(double degrees)
+{
+    return (int32_t)lround(degrees * 1e7);
+}
+
+uint16_t LoraHandler::SerializeBinary(MessageType msgType, const ReceivedPacket &packet, uint8_t *buffer, size_t size)
+{
+    BleStatus status = {};
+    status.rssi = packet.rssi;
+    status.snr = packet.snr;
+    status.mode = packet.mode;
+    status.rBatt = (uint8_t)lroundf(packet.rBatt);
+    status.hBatt = (uint8_t)lroundf(packet.hBatt);
+    status.r = packet.r;
+    status.g = packet.g;
+    status.b = packet.b;
+    status.flags = (packet.rbLed ? BLE_FLAG_RB_LED : 0) | (packet.buzzer ? BLE_FLAG_BUZZER : 0) |
+                   (packet.ack ? BLE_FLAG_ACK : 0) | (packet.autoMode ? BLE_FLAG_AUTO_MODE : 0) |
+                   (packet.locating ? BLE_FLAG_LOCATE : 0) |
+                   (packet.beacon && msgType == MSG_ALL_DATA ? BLE_FLAG_BEACON : 0);
+
+    uint8_t *payload = &buffer[BLE_FRAME_HEADER];
+    size_t len = sizeof(status);
+    if (msgType == MSG_ALL_DATA)
+    {
+        BleAllData data = {};
+        data.status = status;
+        data.lat = toE7(packet.lat);
+        data.lon = toE7(packet.lon);
+        data.hour = packet.hour;
+        data.min = packet.min;
+        data.sec = packet.sec;
+        data.siv = packet.siv;
+        data.hdop = packet.hdop;
+        data.alt = (int16_t)lround(packet.alt);
+        data.seq = packet.seq;
+        len = sizeof(data);
+        memcpy(payload, &data, len);
+    }
+    else if (msgType == MSG_GEOFENCE_ALERT)
+    {
+        BleGeofenceAlert alert = {};
+        alert.status = status;
+        alert.fence = packet.fenceId;
+        alert.inside = packet.inside;
+        alert.lat = toE7(packet.lat);
+        alert.lon = toE7(packet.lon);
+        len = sizeof(alert);
+        memcpy(payload, &alert, len);
+    }
+    else if (msgType == MSG_BACKFILL_DATA)
+    {
+        // Same layout as the LoRa frame: first fix absolute, the others deltas from the previous one
+        BleBackfill backfill = {};
+        backfill.status = status;
+        backfill.seq = packet.fixes[0].seq;
+        backfill.count = packet.fixCount;
+        for (uint8_t i = 0; i < packet.fixCount; i++)
+        {
+            const TrackFix &fix = packet.fixes[i];
+            BleBackfillFix &entry = backfill.fixes[i];
+            entry.lat = i == 0 ? fix.lat : fix.lat - packet.fixes[i - 1].lat;
+            entry.lon = i == 0 ? fix.lon : fix.lon - packet.fixes[i - 1].lon;
+            entry.secOfDay = (uint32_t)fix.hour * 3600 + fix.min * 60 + fix.sec;
+            entry.siv = fix.siv;
+            entry.seqStep = i == 0 ? 0 : fix.seq - packet.fixes[i - 1].seq;
+        }
+        len = offsetof(BleBackfill, fixes) + backfill.count * sizeof(BleBackfillFix);
+        memcpy(payload, &backfill, len);
+    }
+    else if (msgType == MSG_ENERGY)
+    {
+        BleEnergy energy = {};
+        energy.status = status;
+        memcpy(energy.boot, packet.energyBoot, sizeof(energy.boot));
+        memcpy(energy.last, packet.energyLast, sizeof(energy.last));
+        energy.avg = packet.energyAvg;
+        energy.ttl = packet.energyTtl;
+        len = sizeof(energy);
+        memcpy(payload, &energy, len);
+    }
+    else
+    {
+        memcpy(payload, &status, len);
+    }
+
+    buffer[0] = msgType;
+    buffer[1] = len;
+    return BLE_FRAME_HEADER + len;
+}
+
+uint16_t LoraHandler::Serialize(MessageType msgType, const ReceivedPacket &packet, uint8_t *buffer, size_t size)
+{
+    if (BLE.isBinary())
+        return SerializeBinary(msgType, packet, buffer, size);
+    return SerializeJSON(msgType, packet, buffer, size);
 }
 
 void LoraHandler::OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
@@ -197,24 +388,74 @@ void LoraHandler::OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t
     // xSemaphoreGiveFromISR(wakeSemaphore, &xHigherPriorityTaskWoken);
     // portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
     // delay(10);
-    OnRxToJSON(payload, rssi, snr);
-    SerializeJSON(receivedPacket.msgType);
+    rxAtMs = millis();
+    if (radioProfile == LORA_PROFILE_FOX_PONG)
+    {
+        // Binary and at the ping rate, it skips the JSON parser and the RX log
+        if (payload[0] == MSG_FOX_PONG)
+            Fox.onPong(payload, rssi, snr);
+        listen();
+        return;
+    }
+    // A packet that did not parse leaves receivedPacket as it was, the app must not get it again
+    bool parsed = OnRxToJSON(payload, rssi, snr);
+    // Encoded for the app once, in the protocol it asked for
+    RcvLength = parsed ? Serialize(receivedPacket.msgType, receivedPacket, RcvBuffer, sizeof(RcvBuffer)) : 0;
     Radio.Rx(RX_TIMEOUT_VALUE);
-    packetReceived = true;
-    Serial.println("Received Packet");
+    LOG_INFO(LOG_RX_DONE, size, rssi, snr);
+    Metrics.add(METRIC_LORA_RX);
+    Metrics.observe(METRIC_LORA_RSSI, rssi);
+    if (RcvLength != 0)
+    {
+        packetReceived = true;
+        notifyLoop(LOOP_EVENT_LORA_RX);
+    }
+    if (backfillRequested)
+        Commands.notify(CMD_EVENT_BACKFILL);
+}
+
+// Compares a reported sequence number with the last one seen and asks for the missing fixes.
+// A lower number means the receiver or the harness restarted, so tracking starts over.
+void LoraHandler::checkSequence(uint32_t seq)
+{
+    if (seq == 0)
+        return; // harness without a track log, or a report without a fix
+    if (seq < lastSeq)
+    {
+        // The harness numbers fixes across reboots, so this is a new log (erased flash or another
+        // harness). Sequence ordering starts over here, a backfill of the old numbers is dropped.
+        LOG_WARN(LOG_SEQ_RESTART, lastSeq, seq);
+        backfillRequested = false;
+        backfillSince = 0;
+    }
+    else if (lastSeq != 0 && seq > lastSeq + 1)
+    {
+        LOG_INFO(LOG_BACKFILL_GAP, seq - lastSeq - 1);
+        Metrics.add(METRIC_BACKFILL_REQUESTS);
+        backfillSince = lastSeq;
+        backfillRequested = true;
+    }
+    lastSeq = seq;
 }
 
-void LoraHandler::OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr)
+bool LoraHandler::OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr)
 {
-    // Now parse with ArduinoJson
-    StaticJsonDocument<256> doc;
+    // Now parse with ArduinoJson, in a frame from the pool
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL)
+        return false;
+    JsonDocument doc(frame);
     DeserializationError error = deserializeJson(doc, (char *)payload);
     if (!error)
     {
         // Extract fields
         receivedPacket.msgType = doc["msgType"];
         receivedPacket.mode = doc["mode"];
-        delay(10);
+        // Any harness frame can carry held acknowledgements, one bit per command MessageType
+        uint32_t acks = doc["acks"] | 0;
+        receivedPacket.ack = acks != 0;
+        if (acks != 0)
+            LOG_INFO(LOG_ACKS, acks, receivedPacket.msgType);
         if (receivedPacket.msgType == MSG_LED)
         {
             receivedPacket.r = doc["r"];
@@ -231,7 +472,10 @@ void LoraHandler::OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr)
         }
         if (receivedPacket.msgType == MSG_PWR_MODE)
         {
+            // Sent by the harness whenever its effective mode changes
             receivedPacket.mode = doc["mode"];
+            receivedPacket.autoMode = doc["auto"] | false;
+            receivedPacket.hBatt = doc["hBatt"]; // Harness battery
             receivedPacket.rssi = rssi;
             receivedPacket.snr = snr;
         }
@@ -244,6 +488,73 @@ void LoraHandler::OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr)
         if (receivedPacket.msgType == MSG_ACKNOWLEDGEMENT)
         {
             receivedPacket.ack = doc["ack"];
+            receivedPacket.locating = doc["loc"] | false;
+            receivedPacket.rssi = rssi;
+            receivedPacket.snr = snr;
+        }
+        if (receivedPacket.msgType == MSG_GEOFENCE_ALERT)
+        {
+            receivedPacket.fenceId = doc["fence"];
+            receivedPacket.inside = doc["inside"];
+            receivedPacket.lat = doc["lat"];
+            receivedPacket.lon = doc["lon"];
+            receivedPacket.hBatt = doc["hBatt"]; // Harness battery
+            receivedPacket.rssi = rssi;
+            receivedPacket.snr = snr;
+        }
+        if (receivedPacket.msgType == MSG_BACKFILL_DATA)
+        {
+            uint32_t seq = doc["seq"];
+            JsonArray list = doc["fixes"];
+            receivedPacket.fixCount = 0;
+            for (size_t i = 0; i < list.size() && receivedPacket.fixCount < TRACKLOG_FIXES_PER_FRAME; i++)
+            {
+                JsonArray entry = list[i];
+                TrackFix &fix = receivedPacket.fixes[receivedPacket.fixCount];
+                fix.seq = seq;
+                fix.lat = entry[0].as<int32_t>();
+                fix.lon = entry[1].as<int32_t>();
+                if (receivedPacket.fixCount > 0)
+                {
+                    // Entries after the first are deltas, including the sequence step
+                    const TrackFix &prev = receivedPacket.fixes[receivedPacket.fixCount - 1];
+                    fix.seq = prev.seq + entry[4].as<uint32_t>();
+                    fix.lat += prev.lat;
+                    fix.lon += prev.lon;
+                }
+                uint32_t hms = entry[2].as<uint32_t>();
+                fix.hour = hms / 3600;
+                fix.min = (hms / 60) % 60;
+                fix.sec = hms % 60;
+                fix.siv = entry[3].as<uint8_t>();
+                receivedPacket.fixCount++;
+            }
+            receivedPacket.more = doc["more"] | false;
+            if (receivedPacket.more && receivedPacket.fixCount > 0)
+            {
+                // Ask for the next batch
+                backfillSince = receivedPacket.fixes[receivedPacket.fixCount - 1].seq;
+                backfillRequested = true;
+            }
+            receivedPacket.rssi = rssi;
+            receivedPacket.snr = snr;
+        }
+        if (receivedPacket.msgType == MSG_METRICS)
+        {
+            Metrics.setRemote(doc["m"].as<const char *>()); // served on the metrics characteristic
+        }
+        if (receivedPacket.msgType == MSG_ENERGY)
+        {
+            JsonArray boot = doc["boot"];
+            JsonArray last = doc["last"];
+            for (uint8_t i = 0; i < ENERGY_SUBSYSTEMS; i++)
+            {
+                receivedPacket.energyBoot[i] = boot[i].as<uint32_t>();
+                receivedPacket.energyLast[i] = last[i].as<uint32_t>();
+            }
+            receivedPacket.energyAvg = doc["avg"];
+            receivedPacket.energyTtl = doc["ttl"];
+            receivedPacket.hBatt = doc["hBatt"]; // Harness battery
             receivedPacket.rssi = rssi;
             receivedPacket.snr = snr;
         }
@@ -261,18 +572,30 @@ void LoraHandler::OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr)
             receivedPacket.snr = snr;
             receivedPacket.rBatt = receivedPacket.rBatt; // Receiver battery
             receivedPacket.hBatt = doc["hBatt"]; // Harness battery
+            receivedPacket.seq = doc["seq"] | 0;
+            receivedPacket.locating = doc["loc"] | false;
+            receivedPacket.beacon = false;
+            checkSequence(receivedPacket.seq);
         };
     }
     else
     {
-        Serial.print("JSON parse failed: ");
-        Serial.println(error.c_str());
+        LOG_WARN(LOG_RX_PARSE_FAILED, (uint32_t)error.code());
     }
+    FramePool.release(frame);
+    return !error;
 }
 
 void LoraHandler::begin()
 {
     instance = this;
+    Metrics.registerCounter(METRIC_LORA_RX);
+    Metrics.registerCounter(METRIC_LORA_RX_ERROR);
+    Metrics.registerCounter(METRIC_LORA_TX);
+    Metrics.registerHistogram(METRIC_LORA_RSSI, rssiBounds);
+    Metrics.registerCounter(METRIC_BACKFILL_REQUESTS);
+    Metrics.registerCounter(METRIC_CMD_COALESCED);
+    Metrics.registerCounter(METRIC_AIRTIME_SAVED_MS);
 
     // Initialize LoRa chip using RAK function
     lora_rak4630_init();
@@ -290,14 +613,7 @@ void LoraHandler::begin()
 
     // Set frequency and other parameters
     Radio.SetChannel(RF_FREQUENCY);
-    Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, LORA_BANDWIDTH,
-                      LORA_SPREADING_FACTOR, LORA_CODINGRATE,
-                      LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON,
-                      true, 0, 0, LORA_IQ_INVERSION_ON, TX_TIMEOUT_VALUE);
-    Radio.SetRxConfig(MODEM_LORA, LORA_BANDWIDTH, LORA_SPREADING_FACTOR,
-                      LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
-                      LORA_SYMBOL_TIMEOUT, LORA_FIX_LENGTH_PAYLOAD_ON,
-                      0, true, 0, 0, LORA_IQ_INVERSION_ON, true);
+    applyProfile(LORA_PROFILE_DEFAULT);
 
     loraInitialized = true;
     Serial.println("Starting Radio.Rx");
@@ -319,7 +635,10 @@ void LoraHandler::SendJSON(double lat, double lon, uint8_t hour,
 {
     if (!loraInitialized)
         return;
-    StaticJsonDocument<200> doc;
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL)
+        return;
+    JsonDocument doc(frame);
     doc["msgType"] = MSG_ALL_DATA;
     doc["lat"] = lat;
     doc["lon"] = lon;
@@ -338,9 +657,7 @@ void LoraHandler::SendJSON(double lat, double lon, uint8_t hour,
     doc["b"] = receivedPacket.b;
     doc["hBatt"] = receivedPacket.hBatt; // Harness battery
 
-    char buffer[200];
-    size_t n = serializeJson(doc, buffer, sizeof(buffer));
-    sendPacket((uint8_t *)buffer, n);
+    sendFrame(frame, doc);
 }
 
 // MSG_ACKNOWLEDGEMENT = 1
@@ -348,45 +665,238 @@ void LoraHandler::SendJSON(MessageType msgType)
 {
     if (!loraInitialized)
         return;
-    StaticJsonDocument<200> doc;
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL)
+        return;
+    JsonDocument doc(frame);
+    switch (msgType)
+    {
+        case MSG_ACKNOWLEDGEMENT:
+            doc["msgType"] = MSG_ACKNOWLEDGEMENT;
+            doc["ack"] = receivedPacket.ack;
+            break;
+        case MSG_BACKFILL:
+            doc["msgType"] = MSG_BACKFILL;
+            doc["since"] = backfillSince;
+            backfillRequested = false;
+            break;
+        default:
+            break;
+    }
+    sendFrame(frame, doc);
+}
+
+// MSG_GEOFENCE = 7
+void LoraHandler::sendGeofence(const GeofenceShape &fence)
+{
+    if (!loraInitialized)
+        return;
+    Frame *frame = FramePool.acquire();
+    if (frame == NULL)
+        return;
+    JsonDocument doc(frame);
+    // Deltas from vertex 0 keep a full polygon inside one LoRa frame
+    doc["msgType"] = MSG_GEOFENCE;
+    doc["id"] = fence.id;
+    doc["type"] = fence.type;
+    if (fence.type != GEOFENCE_NONE)
+    {
+        doc["lat"] = fence.lat[0];
+        doc["lon"] = fence.lon[0];
+    }
+    if (fence.type == GEOFENCE_CIRCLE)
+    {
+        doc["rad"] = fence.radius;
+    }
+    else if (fence.type == GEOFENCE_POLYGON)
+    {
+        JsonArray dlat = doc["dlat"].to<JsonArray>();
+        JsonArray dlon = doc["dlon"].to<JsonArray>();
+        for (uint8_t i = 1; i < fence.count; i++)
+        {
+            dlat.add(fence.lat[i] - fence.lat[0]);
+            dlon.add(fence.lon[i] - fence.lon[0]);
+        }
+    }
+    sendFrame(frame, doc);
+}
+
+// MSG_BUZZER, MSG_LED, MSG_RB_LED and MSG_PWR_MODE, from the pending state
+void LoraHandler::serializeCommand(MessageType msgType, Frame *frame)
+{
+    JsonDocument doc(frame);
+    doc["msgType"] = msgType;
     switch (msgType)
     {
         case MSG_BUZZER:
-            doc["msgType"] = MSG_BUZZER;
-            doc["buzzer"] = receivedPacket.buzzer;
+            doc["buzzer"] = pending.buzzer;
             break;
         case MSG_LED:
-            doc["msgType"] = MSG_LED;
-            doc["r"] = receivedPacket.r;
-            doc["g"] = receivedPacket.g;
-            doc["b"] = receivedPacket.b;
+            doc["r"] = pending.r;
+            doc["g"] = pending.g;
+            doc["b"] = pending.b;
             break;
         case MSG_RB_LED:
-            doc["msgType"] = MSG_RB_LED;
-            doc["rbLed"] = receivedPacket.rbLed; // rainbow led
+            doc["rbLed"] = pending.rbLed; // rainbow led
             break;
         case MSG_PWR_MODE:
-            doc["msgType"] = MSG_PWR_MODE;
-            doc["mode"] = receivedPacket.mode;
+            doc["mode"] = pending.mode;
+            if (pending.hold != 0)
+                doc["hold"] = pending.hold;
             break;
-        case MSG_ACKNOWLEDGEMENT:
-            doc["msgType"] = MSG_ACKNOWLEDGEMENT;
-            doc["ack"] = receivedPacket.ack;
+        case MSG_LOCATE:
+            doc["on"] = pending.locate;
+            if (pending.minutes != 0)
+                doc["min"] = pending.minutes;
+            break;
+        default:
             break;
     }
-    char buffer[200];
-    size_t n = serializeJson(doc, buffer, sizeof(buffer));
-    sendPacket((uint8_t *)buffer, n);
+    frame->len = serializeJson(doc, frame->data, FRAME_SIZE);
+}
+
+void LoraHandler::queueCommand(const Command &command)
+{
+    MessageType msgType = command.msgType;
+    uint16_t bit = 1 << msgType;
+    if (pending.mask & bit)
+    {
+        // The pending command never goes on air, count what it would have cost
+        Frame *frame = FramePool.acquire();
+        if (frame != NULL)
+        {
+            serializeCommand(msgType, frame);
+            Metrics.add(METRIC_AIRTIME_SAVED_MS, Radio.TimeOnAir(MODEM_LORA, frame->len));
+            FramePool.release(frame);
+        }
+        Metrics.add(METRIC_CMD_COALESCED);
+        LOG_DEBUG(LOG_CMD_COALESCED, msgType);
+    }
+    switch (msgType)
+    {
+        case MSG_BUZZER:
+            pending.buzzer = command.buzzer;
+            break;
+        case MSG_LED:
+            pending.r = command.r;
+            pending.g = command.g;
+            pending.b = command.b;
+            break;
+        case MSG_RB_LED:
+            pending.rbLed = command.rbLed;
+            break;
+        case MSG_PWR_MODE:
+            pending.mode = command.mode;
+            pending.hold = command.hold;
+            break;
+        case MSG_LOCATE:
+            pending.locate = command.locate;
+            pending.minutes = command.minutes;
+            break;
+        default:
+            return;
+    }
+    pending.mask |= bit;
+}
+
+void LoraHandler::sendPendingCommands()
+{
+    // Power mode and buzzer first, the LED can wait for the next free slot
+    static const MessageType order[] = {MSG_PWR_MODE, MSG_LOCATE, MSG_BUZZER, MSG_RB_LED, MSG_LED};
+    if (!loraInitialized || pending.mask == 0)
+        return;
+    if (txBusy && (millis() - txStartMs) < TX_TIMEOUT_VALUE)
+        return;
+    for (MessageType msgType : order)
+    {
+        if (pending.mask & (1 << msgType))
+        {
+            Frame *frame = FramePool.acquire();
+            if (frame == NULL)
+                return; // try again on the next pass
+            serializeCommand(msgType, frame);
+            pending.mask &= ~(1 << msgType);
+            sendPacket(frame->data, frame->len);
+            FramePool.release(frame);
+            return;
+        }
+    }
+}
+
+// Sets up the modem for a profile, the caller puts the radio back in RX or sends
+void LoraHandler::applyProfile(LoraProfile profile)
+{
+    const LoraModem &modem = loraProfiles[profile];
+    bool implicitHeader = modem.implicitLength != 0;
+    Radio.Standby();
+    Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, modem.bandwidth,
+                      modem.spreadingFactor, modem.codingRate,
+                      LORA_PREAMBLE_LENGTH, implicitHeader,
+                      true, 0, 0, LORA_IQ_INVERSION_ON, TX_TIMEOUT_VALUE);
+    Radio.SetRxConfig(MODEM_LORA, modem.bandwidth, modem.spreadingFactor,
+                      modem.codingRate, 0, LORA_PREAMBLE_LENGTH,
+                      LORA_SYMBOL_TIMEOUT, implicitHeader,
+                      modem.implicitLength, true, 0, 0, LORA_IQ_INVERSION_ON,
+                      !implicitHeader); // single RX, so the pong window can time out
+    radioProfile = profile;
+}
+
+void LoraHandler::setProfile(LoraProfile profile)
+{
+    listenProfile = profile;
+    if (!loraInitialized || txBusy || radioProfile == profile)
+        return; // the TX done callback switches over
+    applyProfile(profile);
+    Radio.Rx(0);
+}
+
+bool LoraHandler::sendPing(uint8_t seq, bool onDefault)
+{
+    if (!loraInitialized || (txBusy && (millis() - txStartMs) < TX_TIMEOUT_VALUE))
+        return false;
+    // The TX done callback opens the pong window
+    LoraProfile profile = onDefault ? LORA_PROFILE_DEFAULT : listenProfile;
+    if (radioProfile != profile)
+        applyProfile(profile);
+    uint8_t ping[FOX_PING_SIZE] = {MSG_FOX_PING, seq};
+    pongDue = true;
+    sendPacket(ping, FOX_PING_SIZE);
+    return true;
+}
+
+bool LoraHandler::waitForTxDone(uint32_t timeoutMs)
+{
+    uint32_t start = millis();
+    while (txBusy && (millis() - txStartMs) < TX_TIMEOUT_VALUE)
+    {
+        if ((millis() - start) >= timeoutMs)
+            return false;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
+
+// Serializes the document into its frame, sends it and releases the frame
+void LoraHandler::sendFrame(Frame *frame, const JsonDocument &doc)
+{
+    if (doc.overflowed())
+        LOG_WARN(LOG_FRAME_OVERFLOW, doc["msgType"].as<uint8_t>());
+    frame->len = serializeJson(doc, frame->data, FRAME_SIZE);
+    sendPacket(frame->data, frame->len);
+    FramePool.release(frame);
 }
 
 void LoraHandler::sendPacket(uint8_t *buffer, uint8_t size)
 {
     if (!loraInitialized)
         return;
+    if (radioProfile == LORA_PROFILE_FOX_PONG)
+        applyProfile(listenProfile); // gives up the pong window, the harness cannot read implicit frames
+    txBusy = true;
+    txStartMs = millis();
     Radio.Send(buffer, size);
-    Serial.print("Sent Packet: ");
-    Serial.write((char *)buffer);
-    Serial.println();
+    Metrics.add(METRIC_LORA_TX);
+    LOG_DEBUG(LOG_TX_SENT, size);
 }
 
 uint8_t *LoraHandler::GetRxPacket(void)
@@ -1,8 +1,19 @@
 #pragma once
 
 #include "main.h"
+#include "FramePoolHandler.h"
+#include "CommandHandler.h"
+
+// LoRa modem settings (table in LoraHandler.cpp), both ends have to use the same one
+enum LoraProfile : uint8_t {
+    LORA_PROFILE_DEFAULT = 0,   // LORA_SPREADING_FACTOR, long range
+    LORA_PROFILE_FOX_HUNT,      // FOX_*, shortest airtime for the fox hunt pings
+    LORA_PROFILE_FOX_PONG,      // FOX_* with the implicit header, only in the window after a ping
+    LORA_PROFILE_COUNT
+};
 
 extern uint8_t RcvBuffer[200]; // Declare it as extern
+extern uint16_t RcvLength; // bytes of RcvBuffer to notify
 
 class LoraHandler {
 public:
@@ -15,7 +26,13 @@ public:
                     uint8_t hour, uint8_t min, uint8_t sec, 
                     uint8_t siv, uint16_t hdop, double alt);
 
-    static void SerializeJSON(MessageType msgType);
+    // Encodes a packet for the app into buffer, returns the length (0 if the frame pool was empty).
+    // Each caller owns its buffer: RcvBuffer is the LoRa RX one.
+    static uint16_t SerializeJSON(MessageType msgType, const ReceivedPacket &packet, uint8_t *buffer, size_t size);
+    // Same content as SerializeJSON in the binary BLE framing (BleProtocol.h)
+    static uint16_t SerializeBinary(MessageType msgType, const ReceivedPacket &packet, uint8_t *buffer, size_t size);
+    // In the protocol the app asked for
+    static uint16_t Serialize(MessageType msgType, const ReceivedPacket &packet, uint8_t *buffer, size_t size);
     // MSG_ACKNOWLEDGEMENT = 1
     void SendJSON(MessageType msgType);
     void SendJSON(MessageType msgType, uint8_t r, uint8_t g, uint8_t b);
@@ -34,9 +51,28 @@ public:
     bool shouldBuzzerBeOn() { return false; }
     //void OnRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr);
     uint8_t* GetRxPacket();
+    // True when a gap in the harness sequence numbers needs a MSG_BACKFILL request
+    bool backfillDue() { return backfillRequested; }
+    // millis() of the last RX done, for the RX to BLE latency
+    uint32_t getRxAt() { return rxAtMs; }
+    // Commands that set a state (LED, rainbow, buzzer, power mode, locate) are last writer wins: the
+    // newest value is kept until the radio is free, so a burst of colour picker writes goes
+    // out as one packet and gets one acknowledgement
+    void queueCommand(const Command &command);
+    void sendPendingCommands();
+    void sendGeofence(const GeofenceShape &fence);
+    // Waits for the packet on air, false if it is still busy after timeoutMs
+    bool waitForTxDone(uint32_t timeoutMs);
+    // Profile to listen and send on, applied now or once the packet on air is done
+    void setProfile(LoraProfile profile);
+    // Sends a fox hunt ping, on the default profile if the harness has to be switched over first.
+    // False if the radio is busy.
+    bool sendPing(uint8_t seq, bool onDefault);
 
 private:
     void sendPacket(uint8_t *buffer, uint8_t size);
+    void sendFrame(Frame *frame, const JsonDocument &doc);
+    void serializeCommand(MessageType msgType, Frame *frame);
 
     // Static callbacks required by SX126x driver
     static void OnTxDone(void);
@@ -47,10 +83,42 @@ private:
     static void Recieve(void);
     static uint16_t readIrqStatus(void);
     static void clearIrqStatus(uint16_t irqStatus);
-    static void OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr);
+    // False if the packet did not parse or the frame pool was empty, receivedPacket is unchanged then
+    static bool OnRxToJSON(uint8_t *payload, int16_t rssi, int8_t snr);
+    static void checkSequence(uint32_t seq);
+    static void applyProfile(LoraProfile profile);
+    static void listen();
 
     // Associate callbacks with this instance
     static LoraHandler* instance;
 
+    // Track log sequence tracking for gap backfill
+    static uint32_t lastSeq;
+    static uint32_t backfillSince;
+    static volatile bool backfillRequested;
+
+    // Newest state of the coalescing commands, copied from the app command when it is queued
+    struct PendingCommands {
+        uint16_t mask;          // bit per MessageType waiting to be sent
+        uint8_t r, g, b;
+        bool rbLed;
+        bool buzzer;
+        DeviceMode mode;
+        uint16_t hold;
+        bool locate;
+        uint8_t minutes;
+    };
+    PendingCommands pending = {};
+
+    // Set while a packet is on air, cleared by the TX done and TX timeout callbacks
+    static volatile bool txBusy;
+    static uint32_t txStartMs;
+    static volatile uint32_t rxAtMs;
+    static LoraProfile radioProfile;            // the modem is set up for this one
+    static volatile LoraProfile listenProfile;  // and goes back to this one after a TX
+    static volatile bool pongDue;               // a ping is on air, the pong window follows it
+
     bool loraInitialized = false;
 };
+
+extern LoraHandler loraHandler;
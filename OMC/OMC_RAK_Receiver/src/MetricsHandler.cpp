@@ -0,0 +1,127 @@
+#include "MetricsHandler.h"
+
+void MetricsHandler::begin() {
+    registerGauge(METRIC_HEAP_FREE);
+    registerGauge(METRIC_HEAP_MIN);
+}
+
+void MetricsHandler::registerHistogram(MetricId id, const int16_t *bounds) {
+    metrics[id].bounds = bounds;
+    metrics[id].type = METRIC_HISTOGRAM;
+}
+
+void MetricsHandler::watchTask(MetricId id, TaskHandle_t task) {
+    metrics[id].task = task;
+    metrics[id].type = METRIC_GAUGE;
+}
+
+void MetricsHandler::add(MetricId id, uint32_t n) {
+    __atomic_fetch_add(&metrics[id].value, n, __ATOMIC_RELAXED);
+}
+
+void MetricsHandler::observe(MetricId id, int32_t value) {
+    Metric &metric = metrics[id];
+    if (metric.type != METRIC_HISTOGRAM) {
+        return;
+    }
+    uint8_t bucket = 0;
+    while (bucket < METRIC_BUCKETS && value >= metric.bounds[bucket]) {
+        bucket++;
+    }
+    // Saturate instead of wrapping around
+    if (metric.buckets[bucket] != UINT16_MAX) {
+        __atomic_fetch_add(&metric.buckets[bucket], 1, __ATOMIC_RELAXED);
+    }
+}
+
+void MetricsHandler::sample() {
+    set(METRIC_HEAP_FREE, xPortGetFreeHeapSize());
+    set(METRIC_HEAP_MIN, xPortGetMinimumEverFreeHeapSize());
+    for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+        if (metrics[i].task != NULL) {
+            metrics[i].value = uxTaskGetStackHighWaterMark(metrics[i].task);
+        }
+    }
+}
+
+size_t MetricsHandler::snapshot(uint8_t *out, size_t size) {
+    sample();
+    if (size < 7) {
+        return 0;
+    }
+    uint32_t uptime = millis() / 1000;
+    size_t n = 0;
+    out[n++] = METRICS_VERSION;
+    out[n++] = METRICS_SOURCE_RECEIVER;
+    memcpy(&out[n], &uptime, sizeof(uptime));
+    n += sizeof(uptime);
+    size_t countAt = n++;
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+        const Metric &metric = metrics[i];
+        if (metric.type == METRIC_UNUSED) {
+            continue;
+        }
+        size_t entry = 1 + (metric.type == METRIC_HISTOGRAM ? 2 * (METRIC_BUCKETS + 1) : 4);
+        if (n + entry > size) {
+            return 0;
+        }
+        out[n++] = (metric.type << 6) | i;
+        if (metric.type == METRIC_HISTOGRAM) {
+            for (uint8_t b = 0; b <= METRIC_BUCKETS; b++) {
+                uint16_t value = metric.buckets[b];
+                memcpy(&out[n], &value, sizeof(value));
+                n += sizeof(value);
+            }
+        } else {
+            uint32_t value = metric.value;
+            memcpy(&out[n], &value, sizeof(value));
+            n += sizeof(value);
+        }
+        count++;
+    }
+    out[countAt] = count;
+    return n;
+}
+
+size_t MetricsHandler::snapshotRemote(uint8_t *out, size_t size) {
+    if (remoteLen == 0 || remoteLen > size) {
+        return 0;
+    }
+    memcpy(out, remote, remoteLen);
+    return remoteLen;
+}
+
+void MetricsHandler::setRemote(const char *base64) {
+    if (base64 == nullptr) {
+        return;
+    }
+    remoteLen = fromBase64(base64, remote, sizeof(remote));
+}
+
+size_t MetricsHandler::fromBase64(const char *in, uint8_t *out, size_t size) {
+    uint32_t chunk = 0;
+    uint8_t bits = 0;
+    size_t n = 0;
+    for (; *in != '\0' && *in != '='; in++) {
+        char c = *in;
+        uint8_t value;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '+') value = 62;
+        else if (c == '/') value = 63;
+        else return 0;
+        chunk = (chunk << 6) | value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n >= size) {
+                return 0;
+            }
+            out[n++] = (chunk >> bits) & 0xFF;
+        }
+    }
+    return n;
+}
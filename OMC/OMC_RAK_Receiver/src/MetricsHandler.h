@@ -0,0 +1,84 @@
+#pragma once
+
+#include "main.h"
+
+#define METRIC_BUCKETS              4       // histogram bucket bounds (METRIC_BUCKETS + 1 buckets)
+#define METRICS_VERSION             1       // snapshot format version
+#define METRICS_SOURCE_RECEIVER     1       // snapshot source byte of the receiver (harness: 0)
+#define METRICS_SNAPSHOT_MAX        160     // largest snapshot of one device in bytes
+
+// Receiver metric ids, part of the snapshot format (the app keeps the same list): append only
+enum MetricId : uint8_t {
+    METRIC_LORA_RX = 0,         // counter: packets received
+    METRIC_LORA_RX_ERROR,       // counter: reception errors (CRC, header)
+    METRIC_LORA_TX,             // counter: commands sent to the harness
+    METRIC_LORA_RSSI,           // histogram: RSSI of the received packets in dBm
+    METRIC_BACKFILL_REQUESTS,   // counter: gaps in the harness sequence numbers
+    METRIC_BLE_CONNECTS,        // counter: phone connections
+    METRIC_BLE_WRITES,          // counter: commands written by the phone
+    METRIC_BLE_NOTIFIES,        // counter: packets notified to the phone
+    METRIC_BATT_MV,             // gauge: filtered battery voltage in millivolts
+    METRIC_HEAP_FREE,           // gauge: free heap in bytes
+    METRIC_HEAP_MIN,            // gauge: lowest free heap since boot in bytes
+    METRIC_STACK_LOOP,          // gauge: loop task stack high water mark in words
+    METRIC_CMD_COALESCED,       // counter: commands replaced by a newer one before they were sent
+    METRIC_AIRTIME_SAVED_MS,    // counter: command airtime saved by coalescing in milliseconds
+    METRIC_FRAMES_EXHAUSTED,    // counter: packets skipped because the frame pool was empty
+    METRIC_FRAME_ARENA_PEAK,    // gauge: most JSON document memory a frame has used in bytes
+    METRIC_LOOP_WAKES,          // counter: times the loop task woke up
+    METRIC_RX_TO_BLE_MS,        // histogram: milliseconds from LoRa RX done to the BLE notify
+    METRIC_CMD_DROPPED,         // counter: app writes dropped because the command ring was full
+    METRIC_CMD_RING_MAX,        // gauge: most app writes waiting in the command ring
+    METRIC_HISTORY_SPILLS,      // counter: history chunks written to flash while the phone was away
+    METRIC_HISTORY_SYNC_FPS,    // gauge: fixes per second of the last history sync
+    METRIC_COUNT
+};
+
+// Stored in the top two bits of the entry id byte
+enum MetricType : uint8_t {
+    METRIC_UNUSED = 0,
+    METRIC_COUNTER = 1,         // uint32 count since boot
+    METRIC_GAUGE = 2,           // uint32 last value
+    METRIC_HISTOGRAM = 3        // METRIC_BUCKETS + 1 saturating uint16 counts
+};
+
+struct Metric {
+    MetricType type;
+    volatile uint32_t value;
+    const int16_t *bounds;      // upper bucket bounds (exclusive) of a histogram
+    volatile uint16_t buckets[METRIC_BUCKETS + 1];
+    TaskHandle_t task;          // task whose stack high water mark the gauge follows
+};
+
+// Registry of counters, gauges and histograms. The snapshot is little endian: version, source,
+// uptime in seconds (uint32), entry count, then per entry type << 6 | id and a uint32 value or
+// the histogram counts. The last snapshot of the harness (MSG_METRICS) is kept to be served
+// with ours on the metrics characteristic.
+class MetricsHandler {
+    public:
+        MetricsHandler() {}
+        void begin();
+        void registerCounter(MetricId id) { metrics[id].type = METRIC_COUNTER; }
+        void registerGauge(MetricId id) { metrics[id].type = METRIC_GAUGE; }
+        void registerHistogram(MetricId id, const int16_t *bounds);
+        void watchTask(MetricId id, TaskHandle_t task);
+        void add(MetricId id, uint32_t n = 1); // safe from the radio callbacks
+        void set(MetricId id, uint32_t value) { metrics[id].value = value; }
+        void setMax(MetricId id, uint32_t value) { if (value > metrics[id].value) metrics[id].value = value; }
+        void observe(MetricId id, int32_t value);
+        size_t snapshot(uint8_t *out, size_t size);
+        // Copies the last snapshot of the harness, 0 if there is none yet or it does not fit
+        size_t snapshotRemote(uint8_t *out, size_t size);
+        // Stores the base64 "m" field of a MSG_METRICS frame
+        void setRemote(const char *base64);
+
+    private:
+        void sample();
+        static size_t fromBase64(const char *in, uint8_t *out, size_t size);
+
+        Metric metrics[METRIC_COUNT] = {};
+        uint8_t remote[METRICS_SNAPSHOT_MAX];
+        size_t remoteLen = 0;
+};
+
+extern MetricsHandler Metrics;
@@ -1,29 +1,72 @@
 #include "batt.h"
+#include "MetricsHandler.h"
+
+// LiPo discharge curve at light load, 0% to 100% in steps of 10% (in flash)
+static const uint16_t dischargeCurveMv[] = {
+    3300, 3680, 3740, 3770, 3790, 3820, 3870, 3920, 3980, 4060, 4200
+};
+#define BATT_CURVE_POINTS (sizeof(dischargeCurveMv) / sizeof(dischargeCurveMv[0]))
+
+BattHandler *BattHandler::instance = nullptr;
 
 void BattHandler::begin() {
+  instance = this;
+
   // Set the analog reference to 3.0V (default = 3.6V)
   analogReference(AR_INTERNAL_3_0);
 
   // Set the resolution to 12-bit (0..4095)
   analogReadResolution(12); // Can be 8, 10, 12 or 14
 
+  // Average in hardware for every analogRead()
+  analogOversampling(BATT_OVERSAMPLE);
+
    // Let the ADC settle
    delay(1);
+   analogCalibrateOffset();
+
+  // The first sample seeds the filter
+  filteredMv = readVBatt();
+  percent = mvToPercent(filteredMv);
+  Metrics.registerGauge(METRIC_BATT_MV);
+  Metrics.set(METRIC_BATT_MV, filteredMv);
+
+  sampleTimer.begin(BATT_SAMPLE_MS, onSample);
+  sampleTimer.start();
 }
 
-float BattHandler::readVBatt() {
-    // Serial.print("MVOLTS_PER_LSB: ");
-    // Serial.println(REAL_VBAT_MV_PER_LSB);
-    // Serial.println(float(0.73242188F * 1.73));
-    // Serial.print("VBAT_Analog_Read: ");
-    // Serial.println(analogRead(PIN_VBAT));
+void BattHandler::onSample(TimerHandle_t unused) {
+  if (instance) {
+    instance->sample();
+  }
+}
+
+void BattHandler::sample() {
+  // The SAADC offset drifts with temperature, calibrate again now and then
+  if (++samplesSinceCalibration >= BATT_CALIBRATE_SAMPLES) {
+    samplesSinceCalibration = 0;
+    analogCalibrateOffset();
+  }
+  float mv = readVBatt();
+  filteredMv = filteredMv + (mv - filteredMv) / BATT_FILTER_WEIGHT;
+  percent = mvToPercent(filteredMv);
+  Metrics.set(METRIC_BATT_MV, filteredMv);
+}
 
+float BattHandler::readVBatt() {
     float vbat = analogRead(PIN_VBAT) * REAL_VBAT_MV_PER_LSB;
     return vbat;
 }
 
+// Linear interpolation between the two curve points around the voltage
 uint8_t BattHandler::mvToPercent(float mvolts) {
-    if (mvolts >= 4200) return 100;
-    else if (mvolts <= 3050) return 0;
-    else return (mvolts - 3000) / 12.0;
-}
\ No newline at end of file
+    if (mvolts <= dischargeCurveMv[0]) return 0;
+    if (mvolts >= dischargeCurveMv[BATT_CURVE_POINTS - 1]) return 100;
+    uint8_t i = 1;
+    while (mvolts > dischargeCurveMv[i]) {
+        i++;
+    }
+    float low = dischargeCurveMv[i - 1];
+    float high = dischargeCurveMv[i];
+    return (i - 1) * 10 + (uint8_t)((mvolts - low) * 10 / (high - low));
+}
@@ -2,14 +2,28 @@
 
 #include "main.h"
 
+#define BATT_SAMPLE_MS              60000   // time between battery samples
+#define BATT_OVERSAMPLE             64      // SAADC oversampling (power of two, up to 256)
+#define BATT_CALIBRATE_SAMPLES      60      // samples between SAADC offset calibrations
+#define BATT_FILTER_WEIGHT          4       // a new sample moves the filter by 1/BATT_FILTER_WEIGHT
+
+// Samples the battery on its own timer; readers get the filtered, cached value
 class BattHandler {
     public:
         BattHandler() {}
         void begin();
         float readVBatt();
         uint8_t mvToPercent(float mvolts);
+        float getMv() { return filteredMv; }
+        uint8_t getPercent() { return percent; }
 
     private:
-        
+        void sample();
+        static void onSample(TimerHandle_t unused);
 
-};
\ No newline at end of file
+        SoftwareTimer sampleTimer;
+        volatile float filteredMv = 0;
+        volatile uint8_t percent = 0;
+        uint8_t samplesSinceCalibration = 0;
+        static BattHandler *instance;
+};
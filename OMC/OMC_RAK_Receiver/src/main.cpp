@@ -7,25 +7,59 @@
 #include "BuzzerHandler.h"
 #include "PowerManager.h"
 #include "batt.h"
+#include "LogHandler.h"
+#include "MetricsHandler.h"
+#include "FramePoolHandler.h"
+#include "CommandHandler.h"
+#include "HistoryHandler.h"
+#include "BeaconHandler.h"
+#include "FoxHuntHandler.h"
 
 // Global objects
 BleHandler BLE;
 LoraHandler loraHandler;
 BattHandler Batt;
+LogHandler Log;
+MetricsHandler Metrics;
+FramePoolHandler FramePool;
+CommandHandler Commands;
+HistoryHandler History;
+BeaconHandler Beacon;
+FoxHuntHandler Fox;
 // RgbLed rgbLed(NEOPIXEL_PIN, 1);
 // GnssHandler gnssHandler;
 // BuzzerHandler buzzer(BUZZER_PIN);
 // PowerManager powerManager;
 
-uint32_t previousMillis = 0;
+// Upper bounds of the RX to BLE latency histogram buckets (ms)
+static const int16_t rxToBleBounds[METRIC_BUCKETS] = {5, 20, 50, 200};
 
-QueueHandle_t eventQueue = NULL;
+static TaskHandle_t loopTask = NULL;
+static SoftwareTimer housekeepingTimer;
+
+void notifyLoop(uint32_t events) {
+    if (loopTask != NULL) {
+        xTaskNotify(loopTask, events, eSetBits);
+    }
+}
+
+static void onHousekeeping(TimerHandle_t unused) {
+    notifyLoop(LOOP_EVENT_HOUSEKEEPING);
+}
 
 // Track last broadcast time
 static unsigned long lastBroadcast = 0;
 
 void setup() {
     Serial.begin(115200);
+    Log.begin();
+    Metrics.begin();
+    FramePool.begin();
+    Metrics.watchTask(METRIC_STACK_LOOP, xTaskGetCurrentTaskHandle());
+    Metrics.registerCounter(METRIC_LOOP_WAKES);
+    Metrics.registerHistogram(METRIC_RX_TO_BLE_MS, rxToBleBounds);
+    // Before the radio and BLE start, their callbacks notify it
+    loopTask = xTaskGetCurrentTaskHandle();
 
     pinMode(LED_GREEN, OUTPUT);
     time_t serialTimeout = millis();
@@ -40,22 +74,21 @@ void setup() {
         }
     }
 
-    eventQueue = xQueueCreate(10, sizeof(EventType));
-    if (eventQueue == NULL) {
-        Serial.println("Failed to create event queue!");
-    } else {
-        Serial.println("Event queue created successfully.");
-    }
-
     receivedPacket.mode = MODE_LIVE_TRACKING;
     
     // rgbLed.begin();
     // gnssHandler.begin();
     // buzzer.begin();
     // bleHandler.begin();
+    History.begin();
     loraHandler.begin();
+    Commands.begin();
+    Fox.begin();
     BLE.begin();
+    Beacon.begin();
     Batt.begin();
+    housekeepingTimer.begin(LOOP_HOUSEKEEPING_MS, onHousekeeping);
+    housekeepingTimer.start();
 
     // powerManager.begin(MODE_LIVE_TRACKING);
     // rgbLed.setColor(0, 0, 255); // Blue for startup
@@ -94,42 +127,79 @@ void setup() {
 //     }
 // }
 
+// Keeps the reported or backfilled fixes for an app that reconnects later
+static void recordHistory(bool delivered) {
+    if (receivedPacket.msgType == MSG_ALL_DATA) {
+        TrackFix fix = {receivedPacket.seq, (int32_t)lround(receivedPacket.lat * 1e7), (int32_t)lround(receivedPacket.lon * 1e7),
+                        receivedPacket.hour, receivedPacket.min, receivedPacket.sec, receivedPacket.siv};
+        History.record(fix, delivered);
+    } else if (receivedPacket.msgType == MSG_BACKFILL_DATA) {
+        for (uint8_t i = 0; i < receivedPacket.fixCount; i++) {
+            History.record(receivedPacket.fixes[i], delivered);
+        }
+    }
+}
+
+// Refreshes the metrics characteristic with our snapshot and the last one of the harness. If
+// both do not fit one notification they go out one after the other, the app keeps each by its
+// source byte (a read then returns the harness one).
+void publishMetrics() {
+    uint8_t snapshot[2 * METRICS_SNAPSHOT_MAX];
+    size_t n = Metrics.snapshot(snapshot, sizeof(snapshot));
+    if (n == 0) {
+        return;
+    }
+    size_t remote = Metrics.snapshotRemote(&snapshot[n], sizeof(snapshot) - n);
+    if (n + remote <= BLE_METRICS_MAX) {
+        BLE.updateMetrics(snapshot, n + remote);
+    } else {
+        BLE.updateMetrics(snapshot, n);
+        BLE.updateMetrics(&snapshot[n], remote);
+    }
+}
+
 void loop(){
-    receivedPacket.rBatt = Batt.mvToPercent(Batt.readVBatt());
+    // Blocks until a callback or the housekeeping timer has work, the CPU sleeps meanwhile
+    uint32_t events = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+    Metrics.add(METRIC_LOOP_WAKES);
+
+    receivedPacket.rBatt = Batt.getPercent(); // cached, sampled on the battery timer
     if (packetReceived){
-        char buffer[200];
-        memcpy(buffer, RcvBuffer, sizeof(RcvBuffer));
-        Serial.write(buffer);
-        Serial.println();
-        BLE.sendData(RcvBuffer, sizeof(RcvBuffer));
+        if (receivedPacket.msgType == MSG_METRICS) {
+            // Binary, goes out on its own characteristic instead of the JSON one
+            publishMetrics();
+        } else {
+            if (!BLE.isBinary()) {
+                Serial.write(RcvBuffer, RcvLength);
+                Serial.println();
+            }
+            bool delivered = BLE.sendData(RcvBuffer, RcvLength);
+            Metrics.observe(METRIC_RX_TO_BLE_MS, millis() - loraHandler.getRxAt());
+            recordHistory(delivered);
+        }
         packetReceived = false;
     }
-    if ((millis() - previousMillis ) >= 10000)
+    if (events & LOOP_EVENT_HISTORY)
     {
-        
-        previousMillis = millis();
-        Serial.println("Looping");
-
+        History.sync();
     }
-    if (bleReceived){
-        Serial.println("Received packet from BLE");
-        switch (receivedPacket.msgType){
-            case MSG_LED:
-                loraHandler.SendJSON(MSG_LED);
-                break;
-            case MSG_RB_LED:
-               loraHandler.SendJSON(MSG_RB_LED);
-                break;
-            case MSG_BUZZER:
-                loraHandler.SendJSON(MSG_BUZZER);
-                break;
-            case MSG_PWR_MODE:
-                loraHandler.SendJSON(MSG_PWR_MODE);
-                break;
-            default:
-                break;
-        }
-        bleReceived = false;
+    if (events & LOOP_EVENT_BEACON)
+    {
+        Beacon.forward();
+    }
+    if (events & LOOP_EVENT_FOX)
+    {
+        Fox.forward();
+    }
+    if (events & LOOP_EVENT_HOUSEKEEPING)
+    {
+        LOG_DEBUG(LOG_ALIVE, receivedPacket.rBatt);
+        Log.flush();
+        publishMetrics();
+        BLE.update();
+        // Covers a TX that never reported done, the command task then treats it as timed out
+        Commands.notify(CMD_EVENT_RADIO_FREE);
     }
 }
 
@@ -20,28 +20,62 @@
 #define LORA_SPREADING_FACTOR       11
 #define LORA_CODINGRATE             4           // 1=4/5
 #define LORA_PREAMBLE_LENGTH        8
-#define LORA_FIX_LENGTH_PAYLOAD_ON  false
 #define LORA_IQ_INVERSION_ON        false
 #define TX_TIMEOUT_VALUE            3000
 #define RX_TIMEOUT_VALUE            0
 #define LORA_SYMBOL_TIMEOUT         0	// Symbols
 
+// Fox hunt LoRa profile (must match the harness): shortest airtime for the ping rate. Pings and
+// pongs are binary and fixed length, JSON frames always start with '{'. Pongs use the implicit
+// header: only a FOX_PONG_SIZE pong can follow a ping, so the receiver listens for one that way
+// for FOX_PONG_WINDOW_MS after each ping.
+#define FOX_SPREADING_FACTOR        7
+#define FOX_BANDWIDTH               2           // 500 kHz
+#define FOX_CODINGRATE              1           // 4/5
+#define FOX_PING_SIZE               2           // MSG_FOX_PING, sequence number
+#define FOX_PONG_SIZE               4           // MSG_FOX_PONG, sequence number, ping RSSI and SNR at the harness
+#define FOX_PONG_WINDOW_MS          30          // implicit header RX after a ping, then back to the explicit one
+#define FOX_IDLE_MS                 5000        // the harness goes back to the default profile without pings
+
 // Battery Definitions
 #define PIN_VBAT                    WB_A0
 #define VBAT_MV_PER_LSB             (0.73242188F) // 3.0V ADC range and 12 - bit ADC resolution = 3000mV / 4096
 #define VBAT_DIVIDER_COMP           (1.73)      // Compensation factor for the VBAT divider, depend on the board  
 #define REAL_VBAT_MV_PER_LSB        (VBAT_DIVIDER_COMP * VBAT_MV_PER_LSB)
 
+// Geofence Definitions (must match the harness)
+#define GEOFENCE_MAX_VERTICES       8
+#define GEOFENCE_ID_ALL             0xFF
+
+// Track log Definitions (must match the harness)
+#define TRACKLOG_FIXES_PER_FRAME    4
+
+// Energy ledger Definitions (must match the harness)
+#define ENERGY_SUBSYSTEMS           6 // LoRa TX, LoRa RX, GNSS, NeoPixel, Buzzer, MCU
+
 //flags
 extern bool packetReceived;
-extern bool bleReceived;
+
+// Loop task notification bits: the radio and timer callbacks set them, and the loop task
+// blocks until one is set so the nRF52 sleeps in between. App commands have their own task
+// (CommandHandler).
+#define LOOP_EVENT_LORA_RX          (1UL << 0)  // packet in RcvBuffer
+#define LOOP_EVENT_HOUSEKEEPING     (1UL << 1)  // alive log, log flush and metrics refresh
+#define LOOP_EVENT_HISTORY          (1UL << 2)  // the app asked for the fixes it missed
+#define LOOP_EVENT_BEACON           (1UL << 3)  // harness BLE beacon received
+#define LOOP_EVENT_FOX              (1UL << 4)  // fox hunt samples in the ring
+#define LOOP_HOUSEKEEPING_MS        10000
+
+// Wakes the loop task, from task context only (the radio and timer callbacks both are)
+void notifyLoop(uint32_t events);
 
 // If using I2C for GNSS, RAK4631 defaults: SDA & SCL are on Wire
 // Mode enumerations
 enum DeviceMode {
     MODE_LIVE_TRACKING = 0,
     MODE_POWER_SAVING = 1,
-    MODE_EXTREME_POWER_SAVING = 2
+    MODE_EXTREME_POWER_SAVING = 2,
+    MODE_EMERGENCY_BEACON = 3 // harness battery almost empty
 };
 
 enum MessageType {
@@ -50,7 +84,18 @@ enum MessageType {
     MSG_BUZZER = 2,
     MSG_LED = 3,
     MSG_RB_LED = 4, // rainbow led
-    MSG_PWR_MODE = 5
+    MSG_PWR_MODE = 5,
+    MSG_GEOFENCE = 7,
+    MSG_GEOFENCE_ALERT = 8,
+    MSG_BACKFILL = 9,
+    MSG_BACKFILL_DATA = 10,
+    MSG_ENERGY = 11,
+    MSG_METRICS = 12, // harness runtime metrics snapshot
+    MSG_LOCATE = 13, // start or stop the harness BLE locate mode
+    MSG_FOX_HUNT = 14, // app and receiver only: start or stop the fox hunt, and its state
+    MSG_FOX_PING = 15, // fox hunt ping (binary LoRa frame)
+    MSG_FOX_PONG = 16, // fox hunt answer (binary LoRa frame), one sample to the app per pong
+    MSG_BLE_PROTOCOL = 0x40 // app and receiver only (BleProtocol.h), payload: version
 };
 
 enum EventType {
@@ -63,6 +108,43 @@ enum EventType {
     EVENT_LORA_RX = 6
 };
 
+enum GeofenceType {
+    GEOFENCE_NONE = 0,
+    GEOFENCE_CIRCLE = 1,
+    GEOFENCE_POLYGON = 2
+};
+
+// Coordinates are degrees * 1e7. Vertex 0 is the circle center or the first polygon vertex.
+struct GeofenceShape {
+    uint8_t id;
+    GeofenceType type;
+    uint8_t count;
+    uint32_t radius; // meters
+    int32_t lat[GEOFENCE_MAX_VERTICES];
+    int32_t lon[GEOFENCE_MAX_VERTICES];
+};
+
+// One logged fix from the harness track log. Coordinates are degrees * 1e7.
+struct TrackFix {
+    uint32_t seq;
+    int32_t lat;
+    int32_t lon;
+    uint8_t hour;
+    uint8_t min;
+    uint8_t sec;
+    uint8_t siv;
+};
+
+// One fox hunt pong
+struct FoxSample {
+    uint8_t seq; // ping it answers
+    int16_t rssi; // smoothed (dBm)
+    int8_t snr; // smoothed (dB)
+    int16_t raw; // RSSI of this pong
+    int8_t harnessRssi; // the ping as the harness heard it
+    int8_t harnessSnr;
+};
+
 struct ReceivedPacket{
     MessageType msgType;
     double lat;
@@ -85,7 +167,21 @@ struct ReceivedPacket{
     bool ack;
     float rBatt; //Receiver battery
     float hBatt; //Harness battery
-    
+    GeofenceShape fence; // geofence from the app
+    uint8_t fenceId; // crossed fence (geofence alert)
+    bool inside; // inside flag of the crossed fence (geofence alert)
+    uint32_t seq; // track log sequence number of the reported fix
+    TrackFix fixes[TRACKLOG_FIXES_PER_FRAME]; // backfilled fixes
+    uint8_t fixCount; // number of valid entries in fixes
+    bool more; // harness has more fixes after this backfill frame
+    uint32_t energyBoot[ENERGY_SUBSYSTEMS]; // harness charge per subsystem since boot (uAh)
+    uint32_t energyLast[ENERGY_SUBSYSTEMS]; // harness charge per subsystem since the last energy report (uAh)
+    uint32_t energyAvg; // harness average current (uA)
+    uint32_t energyTtl; // projected hours left on the harness battery
+    uint16_t hold; // minutes the harness keeps the requested power mode (0: no hold)
+    bool autoMode; // harness battery policy chose the power mode
+    bool locating; // harness BLE locate mode is on, the app can connect to it
+    bool beacon; // the fix came from the harness BLE beacon, not LoRa
 };
 
 // Declare a global instance of the struct
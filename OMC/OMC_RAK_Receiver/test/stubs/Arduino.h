@@ -0,0 +1,16 @@
+#pragma once
+
+// Host stand-in for the Arduino core, only what the tested modules use. The tests define
+// millis() themselves.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+unsigned long millis();
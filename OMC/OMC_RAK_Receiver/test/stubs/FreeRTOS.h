@@ -0,0 +1,33 @@
+#pragma once
+
+// Host stand-in for FreeRTOS. There are no tasks on the host: xTaskCreateStatic() returns NULL,
+// so notifications go nowhere and the tests call the task work (drain() and the like) themselves.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+typedef void *TaskHandle_t;
+typedef void *TimerHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef struct { uint8_t d[100]; } StaticTask_t;
+typedef void (*TaskFunction_t)(void *);
+
+enum eNotifyAction { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite };
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  1
+#define portMAX_DELAY           0xffffffffUL
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+inline TaskHandle_t xTaskCreateStatic(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, StackType_t *, StaticTask_t *) { return NULL; }
+inline BaseType_t xTaskNotify(TaskHandle_t, uint32_t, eNotifyAction) { return pdPASS; }
+inline BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t *value, TickType_t) { *value = 0; return pdTRUE; }
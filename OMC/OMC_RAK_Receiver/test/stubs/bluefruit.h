@@ -0,0 +1,11 @@
+#pragma once
+
+// Host stand-in for the Bluefruit types the handler headers hold as members
+
+#include <Arduino.h>
+
+class BLEService { public: BLEService(const char *) {} };
+class BLECharacteristic { public: BLECharacteristic(const char *) {} };
+class BLEDis {};
+class BLEBas {};
+class SoftwareTimer {};
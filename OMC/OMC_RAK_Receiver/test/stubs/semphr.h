@@ -0,0 +1,3 @@
+#pragma once
+
+// Empty host stand-in, main.h includes it but the tested modules use nothing from it
@@ -0,0 +1,202 @@
+// Host stress test of the app command ring (CommandHandler push() and drain()).
+//
+// Producer threads stand in for the BLE write callbacks and push binary LED and geofence writes
+// of varying length while a consumer thread stands in for the command task and drains the ring.
+// Every write carries its producer and its number, so the handlers below can check that each
+// producer's writes arrive once, in order and intact. The LoRa, fox hunt, BLE, log and metrics
+// collaborators are stubbed here.
+//
+//     pio test -e native
+
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "CommandHandler.h"
+#include "LoraHandler.h"
+#include "LogHandler.h"
+#include "MetricsHandler.h"
+#include "FramePoolHandler.h"
+#include "BLEHandler.h"
+#include "BleProtocol.h"
+#include "FoxHuntHandler.h"
+
+#define PRODUCERS           2
+#define WRITES_PER_PRODUCER 200000
+#define LED_PADDING_MAX     7       // LED writes get up to this many bytes appended, like a newer app
+
+static CommandHandler *commands; // a fresh ring for every test
+LoraHandler loraHandler;
+FoxHuntHandler Fox;
+BleHandler BLE;
+LogHandler Log;
+MetricsHandler Metrics;
+FramePoolHandler FramePool;
+
+// Written by the consumer thread only
+static uint32_t expected[PRODUCERS]; // next write number per producer
+static uint32_t handled;
+static uint32_t errors;
+
+unsigned long millis() {
+    return 0;
+}
+
+// Checks the number of a write against the next one of its producer
+static void arrived(uint8_t producer, uint32_t n) {
+    if (producer >= PRODUCERS || n != expected[producer]) {
+        errors++;
+        return;
+    }
+    expected[producer]++;
+    handled++;
+}
+
+// LED writes carry the producer in r and the low 16 bits of the write number in g and b
+void LoraHandler::queueCommand(const Command &command) {
+    if (command.msgType != MSG_LED || command.r >= PRODUCERS) {
+        errors++;
+        return;
+    }
+    uint32_t n = expected[command.r];
+    if (((n >> 8) & 0xFF) != command.g || (n & 0xFF) != command.b) {
+        errors++;
+        return;
+    }
+    arrived(command.r, n);
+}
+
+// Geofence writes carry the producer in the id and the write number in every other field
+void LoraHandler::sendGeofence(const GeofenceShape &fence) {
+    uint32_t n = fence.radius;
+    bool intact = fence.type == GEOFENCE_POLYGON && fence.count == 1 + n % GEOFENCE_MAX_VERTICES &&
+                  fence.lat[0] == (int32_t)n && fence.lon[0] == -(int32_t)n;
+    for (uint8_t i = 1; intact && i < fence.count; i++) {
+        intact = fence.lat[i] == (int32_t)(n + i) && fence.lon[i] == -(int32_t)(n + i);
+    }
+    if (!intact) {
+        errors++;
+        return;
+    }
+    arrived(fence.id, n);
+}
+
+volatile bool LoraHandler::backfillRequested = false;
+bool LoraHandler::waitForTxDone(uint32_t timeoutMs) { return true; }
+void LoraHandler::sendPendingCommands() {}
+void LoraHandler::SendJSON(MessageType msgType) {}
+void FoxHuntHandler::start() {}
+void FoxHuntHandler::stop() {}
+void FoxHuntHandler::ping() {}
+BleHandler::BleHandler() {}
+bool BleHandler::sendData(const uint8_t *data, uint16_t length) { return true; }
+void LogHandler::write(uint8_t level, LogId id) {}
+void LogHandler::write(uint8_t level, LogId id, uint32_t a0) {}
+void LogHandler::write(uint8_t level, LogId id, uint32_t a0, uint32_t a1) {}
+void LogHandler::write(uint8_t level, LogId id, uint32_t a0, uint32_t a1, uint32_t a2) {}
+void MetricsHandler::add(MetricId id, uint32_t n) {}
+
+// Encodes write n of a producer: even ones are LED frames padded to varying lengths, odd ones
+// are geofences with up to GEOFENCE_MAX_VERTICES vertices. Returns the length.
+static uint16_t encode(uint8_t producer, uint32_t n, uint8_t *out) {
+    if (n % 2 == 0) {
+        BleLedCommand led = {producer, (uint8_t)(n >> 8), (uint8_t)n};
+        uint8_t padding = n / 2 % (LED_PADDING_MAX + 1);
+        out[0] = MSG_LED;
+        out[1] = sizeof(led) + padding;
+        memcpy(&out[BLE_FRAME_HEADER], &led, sizeof(led));
+        memset(&out[BLE_FRAME_HEADER + sizeof(led)], 0xEE, padding);
+        return BLE_FRAME_HEADER + sizeof(led) + padding;
+    }
+    BleGeofenceCommand shape = {};
+    shape.id = producer;
+    shape.type = GEOFENCE_POLYGON;
+    shape.count = 1 + n % GEOFENCE_MAX_VERTICES;
+    shape.radius = n;
+    shape.lat = n;
+    shape.lon = -(int32_t)n;
+    for (uint8_t i = 1; i < GEOFENCE_MAX_VERTICES; i++) {
+        shape.dlat[i - 1] = i;
+        shape.dlon[i - 1] = -i;
+    }
+    out[0] = MSG_GEOFENCE;
+    out[1] = sizeof(shape);
+    memcpy(&out[BLE_FRAME_HEADER], &shape, sizeof(shape));
+    return BLE_FRAME_HEADER + sizeof(shape);
+}
+
+void setUp(void) {
+    commands = new CommandHandler();
+    memset(expected, 0, sizeof(expected));
+    handled = 0;
+    errors = 0;
+}
+
+void tearDown(void) {
+    delete commands;
+}
+
+// A write that finds the ring full is dropped and counted, the ones before it are kept in order
+void test_full_ring_drops(void) {
+    uint8_t buffer[CMD_PAYLOAD_MAX];
+    for (uint32_t n = 0; n < CMD_RING_SIZE + 3; n++) {
+        bool kept = commands->push(buffer, encode(0, n, buffer));
+        TEST_ASSERT_EQUAL_UINT8(n < CMD_RING_SIZE, kept);
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, commands->getDropped());
+    commands->drain();
+    TEST_ASSERT_EQUAL_UINT32(CMD_RING_SIZE, handled);
+    TEST_ASSERT_EQUAL_UINT32(0, errors);
+
+    // The ring is free again, the next write is the one after the kept ones
+    TEST_ASSERT_TRUE(commands->push(buffer, encode(0, CMD_RING_SIZE, buffer)));
+    commands->drain();
+    TEST_ASSERT_EQUAL_UINT32(CMD_RING_SIZE + 1, handled);
+    TEST_ASSERT_EQUAL_UINT32(0, errors);
+}
+
+// Concurrent producers against the draining command task: nothing lost, doubled, reordered or
+// torn. A producer retries while the ring is full.
+void test_concurrent_producers(void) {
+    std::thread producers[PRODUCERS];
+    for (uint8_t p = 0; p < PRODUCERS; p++) {
+        producers[p] = std::thread([p]() {
+            uint8_t buffer[CMD_PAYLOAD_MAX];
+            for (uint32_t n = 0; n < WRITES_PER_PRODUCER; n++) {
+                uint16_t len = encode(p, n, buffer);
+                while (!commands->push(buffer, len)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    // A torn write may not parse and reach no handler, so the consumer runs until the producers
+    // are done rather than until every write arrived
+    std::atomic<bool> done(false);
+    std::thread consumer([&done]() {
+        while (!done) {
+            commands->drain();
+            // The command task blocks here until the next notification, on one core the producers
+            // have to get the CPU back
+            std::this_thread::yield();
+        }
+        commands->drain();
+    });
+    for (uint8_t p = 0; p < PRODUCERS; p++) {
+        producers[p].join();
+    }
+    done = true;
+    consumer.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, errors);
+    TEST_ASSERT_EQUAL_UINT32(PRODUCERS * WRITES_PER_PRODUCER, handled);
+    for (uint8_t p = 0; p < PRODUCERS; p++) {
+        TEST_ASSERT_EQUAL_UINT32(WRITES_PER_PRODUCER, expected[p]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_full_ring_drops);
+    RUN_TEST(test_concurrent_producers);
+    return UNITY_END();
+}
@@ -20,20 +20,12 @@ bool wokeOnTimer = false;
 
 void periodicWakeup(TimerHandle_t unused)
 {
-  // In an ISR context, indicate wake-up due to timer.
-  Serial.print("periodicWakeup before give: ");
-  Serial.println(uxSemaphoreGetCount(wakeSemaphore));
+  // In an ISR context, indicate wake-up due to timer (no Serial here, it runs in the timer task).
   wokeOnTimer = true;
 
   if (uxSemaphoreGetCount(wakeSemaphore) == 0)
   {
     xSemaphoreGiveFromISR(wakeSemaphore, pdFALSE);
-    Serial.print("periodicWakeup After Give: ");
-    Serial.println(uxSemaphoreGetCount(wakeSemaphore));
-  }
-  else
-  {
-    Serial.println("periodicWakeup: Semaphore already given!");
   }
 }
 
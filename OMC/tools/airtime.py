@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Compare the LoRa time on air and energy of the explicit and implicit header.
+
+The modem settings come from the #defines of the harness (main.h for the
+profiles, power.h for the RX current), the TX current follows
+EnergyHandler::txCurrentUa(). Every frame class is shown with both headers;
+only the fox hunt pong uses the implicit one (LORA_PROFILE_FOX_PONG), the
+receiver cannot tell when any other frame will arrive.
+
+    python3 airtime.py ../OMC_RAK_Harness/src
+    python3 airtime.py ../OMC_RAK_Harness/src --report-bytes 180
+"""
+
+import argparse
+import math
+import os
+import re
+
+DEFINE = re.compile(r"^#define\s+(\w+)\s+\(?(?:\(\w+\))?\s*(-?\d+)", re.MULTILINE)
+BANDWIDTH_HZ = {0: 125000, 1: 250000, 2: 500000}
+
+
+def load_defines(src, *names):
+    """Returns the integer #defines of the given headers."""
+    values = {}
+    for name in names:
+        with open(os.path.join(src, name), encoding="utf-8") as f:
+            values.update((key, int(value)) for key, value in DEFINE.findall(f.read()))
+    return values
+
+
+def tx_current_ua(dbm):
+    """Same steps as EnergyHandler::txCurrentUa()."""
+    if dbm > 20:
+        return 118000
+    if dbm > 17:
+        return 84000
+    if dbm > 14:
+        return 58000
+    return 45000
+
+
+def time_on_air_ms(size, sf, bw, cr, preamble, implicit, crc=True):
+    """SX126x time on air (Semtech AN1200.13) of a size byte payload."""
+    symbol_ms = (1 << sf) * 1000.0 / BANDWIDTH_HZ[bw]
+    # The driver turns the low data rate optimization on for symbols of 16 ms and more.
+    de = 1 if symbol_ms >= 16 else 0
+    bits = 8 * size - 4 * sf + 28 + (16 if crc else 0) - (20 if implicit else 0)
+    symbols = 8 + max(math.ceil(bits / (4.0 * (sf - 2 * de))) * (cr + 4), 0)
+    return (preamble + 4.25 + symbols) * symbol_ms
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("src", help="harness source directory (main.h, power.h)")
+    parser.add_argument("--report-bytes", type=int, default=170, help="JSON routine report size")
+    parser.add_argument("--ping-ms", type=int, default=250, help="fox hunt ping interval")
+    args = parser.parse_args()
+
+    d = load_defines(args.src, "main.h", "power.h")
+    default = (d["LORA_SPREADING_FACTOR"], d["LORA_BANDWIDTH"], d["LORA_CODINGRATE"])
+    fox = (d["FOX_SPREADING_FACTOR"], d["FOX_BANDWIDTH"], d["FOX_CODINGRATE"])
+    preamble = d["LORA_PREAMBLE_LENGTH"]
+    tx_ua = tx_current_ua(d["TX_OUTPUT_POWER"])
+    rx_ua = d["SLEEP_UA_LORA_RX"]
+
+    frames = [
+        # name, bytes, modem, implicit header in use
+        ("routine report", args.report_bytes, default, False),
+        ("fox hunt ping", d["FOX_PING_SIZE"], fox, False),
+        ("fox hunt pong", d["FOX_PONG_SIZE"], fox, True),
+    ]
+    print("%-16s %5s %-10s %10s %10s %6s %s" % ("frame", "bytes", "SF/BW/CR", "explicit", "implicit", "saved", "header"))
+    for name, size, (sf, bw, cr), implicit in frames:
+        explicit_ms = time_on_air_ms(size, sf, bw, cr, preamble, False)
+        implicit_ms = time_on_air_ms(size, sf, bw, cr, preamble, True)
+        print("%-16s %5d %-10s %8.2fms %8.2fms %5.1f%% %s" % (
+            name, size, "%d/%dk/4:%d" % (sf, BANDWIDTH_HZ[bw] // 1000, cr + 4), explicit_ms, implicit_ms,
+            100.0 * (explicit_ms - implicit_ms) / explicit_ms, "implicit" if implicit else "explicit"))
+
+    # One pong per ping: the harness sends it, the receiver listens for it.
+    sf, bw, cr = fox
+    explicit_ms = time_on_air_ms(d["FOX_PONG_SIZE"], sf, bw, cr, preamble, False)
+    implicit_ms = time_on_air_ms(d["FOX_PONG_SIZE"], sf, bw, cr, preamble, True)
+    pongs = 3600000 / args.ping_ms
+    print()
+    print("Fox hunt, %d pongs an hour:" % pongs)
+    for side, current_ua in (("harness TX", tx_ua), ("receiver RX", rx_ua)):
+        explicit_mah = pongs * explicit_ms * current_ua / 3.6e9
+        implicit_mah = pongs * implicit_ms * current_ua / 3.6e9
+        print("  %-12s %6.2f mAh explicit, %6.2f mAh implicit, %5.2f mAh saved" % (
+            side, explicit_mah, implicit_mah, explicit_mah - implicit_mah))
+    print("  channel      %6.1f s explicit, %6.1f s implicit on air" % (
+        pongs * explicit_ms / 1000, pongs * implicit_ms / 1000))
+
+
+if __name__ == "__main__":
+    main()
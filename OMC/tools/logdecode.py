@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Decode the binary log records of the OzarkMountainCat harness and receiver.
+
+The firmware sends each record as the sync bytes 0x00 0xA5, an 8 byte header
+(uint16 id, uint8 level, uint8 argc, uint32 millis) and argc uint32 arguments,
+all little endian. The format strings live in the firmware's log id table
+(logids.h on the harness, LogIds.h on the receiver); ids are their order there.
+Anything between records (Serial.print output) is passed through as text.
+
+    python3 logdecode.py ../OMC_RAK_Harness/src/logids.h COM8
+    python3 logdecode.py ../OMC_RAK_Receiver/src/LogIds.h capture.bin
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\x00\xa5"
+HEADER = struct.Struct("<HBBI")
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+ENTRY = re.compile(r'X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+CONVERSION = re.compile(r"%(%|[-0-9]*[udxX])")
+
+
+def load_messages(path):
+    """Returns the (name, format) pairs of the log id table, indexed by id."""
+    with open(path, encoding="utf-8") as f:
+        return ENTRY.findall(f.read())
+
+
+def format_message(fmt, args):
+    """Applies the 32-bit arguments to a printf style format."""
+    values = iter(args)
+
+    def convert(match):
+        spec = match.group(1)
+        if spec == "%":
+            return "%"
+        value = next(values, 0)
+        if spec.endswith("d"):
+            value = struct.unpack("<i", struct.pack("<I", value))[0]
+            spec = spec[:-1] + "d"
+        return ("%" + spec) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(read, messages, out):
+    """Reads chunks until read() returns nothing and writes one line per record."""
+    buffer = b""
+    while True:
+        chunk = read()
+        if not chunk:
+            break
+        buffer += chunk
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                # Keep a trailing 0x00, it may be the first sync byte.
+                keep = 1 if buffer.endswith(b"\x00") else 0
+                text, buffer = buffer[:len(buffer) - keep], buffer[len(buffer) - keep:]
+                out.write(text.decode("utf-8", "replace"))
+                break
+            if start:
+                out.write(buffer[:start].decode("utf-8", "replace"))
+                buffer = buffer[start:]
+            if len(buffer) < len(SYNC) + HEADER.size:
+                break
+            log_id, level, argc, ms = HEADER.unpack_from(buffer, len(SYNC))
+            if argc > 3 or level not in LEVELS:
+                # Not a record after all, resync after the false sync bytes.
+                out.write(buffer[:len(SYNC)].decode("utf-8", "replace"))
+                buffer = buffer[len(SYNC):]
+                continue
+            end = len(SYNC) + HEADER.size + 4 * argc
+            if len(buffer) < end:
+                break
+            args = struct.unpack_from("<%dI" % argc, buffer, len(SYNC) + HEADER.size)
+            buffer = buffer[end:]
+            if log_id < len(messages):
+                name, fmt = messages[log_id]
+                text = format_message(fmt, args)
+            else:
+                name, text = "LOG_%d" % log_id, " ".join("0x%08x" % a for a in args)
+            out.write("[%10.3f] %s %s: %s\n" % (ms / 1000.0, LEVELS[level], name, text))
+        out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("ids", help="log id table of the firmware (logids.h / LogIds.h)")
+    parser.add_argument("source", help="serial port, or a file with a raw capture")
+    parser.add_argument("--baud", type=int, default=115200, help="serial baud rate")
+    args = parser.parse_args()
+
+    messages = load_messages(args.ids)
+    if os.path.isfile(args.source):
+        capture = open(args.source, "rb")
+        read = lambda: capture.read(256)
+    else:
+        import serial  # pyserial, only needed for live ports
+        port = serial.Serial(args.source, args.baud, timeout=None)
+        read = lambda: port.read(max(1, port.in_waiting))
+    try:
+        decode(read, messages, sys.stdout)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
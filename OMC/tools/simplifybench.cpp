@@ -0,0 +1,164 @@
+/*
+ * Feeds recorded tracks through the harness TrackSimplifier and reports how much of each track
+ * the track log keeps and how far the dropped fixes are from the kept line.
+ *
+ * The tracks are GPX files (every trkpt) or CSV files with one "lat,lon" pair in degrees per
+ * line. The error is measured again here in double precision, as the distance of every dropped
+ * fix to the segment between the two kept fixes around it, so it checks the integer math of the
+ * simplifier. A built-in out-and-back track (0 m -> 300 m -> 30 m north) runs first: every fix of
+ * it lies on one line, so only a segment distance keeps the turn.
+ *
+ *     g++ -std=gnu++17 -O2 -I../OMC_RAK_Harness/src -I../OMC_RAK_Harness/test/stubs \
+ *         -o simplifybench simplifybench.cpp ../OMC_RAK_Harness/src/simplify.cpp
+ *     ./simplifybench walk.gpx yard.csv
+ *     ./simplifybench -t 5 walk.gpx
+ */
+
+#include "simplify.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+unsigned long millis() {
+    return 0;
+}
+
+static const double EARTH_RADIUS_M = 6371008.8;
+
+struct Point {
+    double lat;
+    double lon;
+};
+
+// Every trkpt of a GPX file, or every "lat,lon" line of anything else
+static std::vector<Point> readTrack(const char *path) {
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    std::string s = text.str();
+    std::vector<Point> track;
+
+    std::string name(path);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".gpx") == 0) {
+        for (size_t at = s.find("<trkpt"); at != std::string::npos; at = s.find("<trkpt", at + 1)) {
+            size_t end = s.find('>', at);
+            size_t lat = s.find("lat=\"", at);
+            size_t lon = s.find("lon=\"", at);
+            if (end == std::string::npos || lat > end || lon > end) {
+                continue;
+            }
+            track.push_back({atof(s.c_str() + lat + 5), atof(s.c_str() + lon + 5)});
+        }
+        return track;
+    }
+    std::istringstream lines(s);
+    std::string line;
+    while (std::getline(lines, line)) {
+        Point p;
+        if (sscanf(line.c_str(), "%lf,%lf", &p.lat, &p.lon) == 2) {
+            track.push_back(p);
+        }
+    }
+    return track;
+}
+
+// Distance in meters of p to the segment from a to b (to a itself if they are the same point),
+// in a local plane around a
+static double segmentDistanceM(const Point &p, const Point &a, const Point &b) {
+    double k = EARTH_RADIUS_M * M_PI / 180.0;
+    double c = cos(a.lat * M_PI / 180.0);
+    double px = (p.lon - a.lon) * c * k, py = (p.lat - a.lat) * k;
+    double bx = (b.lon - a.lon) * c * k, by = (b.lat - a.lat) * k;
+    double lengthSq = bx * bx + by * by;
+    double t = lengthSq == 0 ? 0 : std::min(1.0, std::max(0.0, (px * bx + py * by) / lengthSq));
+    return hypot(px - t * bx, py - t * by);
+}
+
+// Walks 300 m north in 10 m steps and comes back to 30 m
+static std::vector<Point> outAndBack() {
+    const double start = 36.5, stepDeg = 10.0 / (EARTH_RADIUS_M * M_PI / 180.0);
+    std::vector<Point> track;
+    for (int m = 0; m <= 300; m += 10) {
+        track.push_back({start + m / 10 * stepDeg, -93.2});
+    }
+    for (int m = 290; m >= 30; m -= 10) {
+        track.push_back({start + m / 10 * stepDeg, -93.2});
+    }
+    return track;
+}
+
+struct Result {
+    uint32_t in = 0;
+    uint32_t kept = 0;
+    uint32_t reportedErrorM = 0;
+    double measuredErrorM = 0;
+};
+
+static Result run(const std::vector<Point> &track, uint16_t toleranceM) {
+    TrackSimplifier simplifier;
+    simplifier.setTolerance(toleranceM);
+    std::vector<uint32_t> kept; // sequence numbers of the kept fixes, as the track log stores them
+    for (uint32_t i = 0; i < track.size(); i++) {
+        TrackFix fix = {};
+        fix.seq = i;
+        fix.lat = (int32_t)lround(track[i].lat * 1e7);
+        fix.lon = (int32_t)lround(track[i].lon * 1e7);
+        TrackFix out;
+        if (simplifier.push(fix, out)) {
+            kept.push_back(out.seq);
+        }
+    }
+    TrackFix out;
+    if (simplifier.flush(out)) {
+        kept.push_back(out.seq);
+    }
+
+    Result result;
+    result.in = simplifier.getFixesIn();
+    result.kept = simplifier.getFixesOut();
+    result.reportedErrorM = simplifier.getMaxErrorM();
+    for (size_t k = 1; k < kept.size(); k++) {
+        for (uint32_t i = kept[k - 1] + 1; i < kept[k]; i++) {
+            result.measuredErrorM = std::max(result.measuredErrorM, segmentDistanceM(track[i], track[kept[k - 1]], track[kept[k]]));
+        }
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    uint16_t toleranceM = TRACK_SIMPLIFY_TOLERANCE_M;
+    int first = 1;
+    if (argc > 2 && std::string(argv[1]) == "-t") {
+        toleranceM = (uint16_t)atoi(argv[2]);
+        first = 3;
+    }
+
+    printf("tolerance %u m, window %u fixes\n", toleranceM, TRACK_SIMPLIFY_WINDOW);
+    printf("%-24s %8s %8s %7s %10s %10s\n", "track", "fixes", "kept", "ratio", "error", "measured");
+    Result total;
+    for (int i = first - 1; i < argc; i++) {
+        const char *name = i < first ? "(out and back)" : argv[i];
+        std::vector<Point> track = i < first ? outAndBack() : readTrack(argv[i]);
+        if (track.empty()) {
+            fprintf(stderr, "%s: no fixes\n", name);
+            continue;
+        }
+        Result r = run(track, toleranceM);
+        printf("%-24s %8u %8u %6.1fx %8u m %8.1f m\n", name, r.in, r.kept, (double)r.in / r.kept,
+               r.reportedErrorM, r.measuredErrorM);
+        total.in += r.in;
+        total.kept += r.kept;
+        total.reportedErrorM = std::max(total.reportedErrorM, r.reportedErrorM);
+        total.measuredErrorM = std::max(total.measuredErrorM, r.measuredErrorM);
+    }
+    if (total.kept == 0) {
+        return 1;
+    }
+    printf("%-24s %8u %8u %6.1fx %8u m %8.1f m\n", "all", total.in, total.kept, (double)total.in / total.kept,
+           total.reportedErrorM, total.measuredErrorM);
+    // The window limit can force a fix out early, never late, so the bound holds on every track.
+    return total.measuredErrorM <= toleranceM + 1 ? 0 : 1;
+}